@@ -0,0 +1,142 @@
+#include "dcc_rx_hal.h"
+
+#if defined(ARDUINO_ARCH_RP2040)
+
+#include <Arduino.h>
+#include "hardware/pio.h"
+#include "hardware/dma.h"
+#include "hardware/gpio.h"
+#include "hardware/clocks.h"
+
+// The state machine runs at 1MHz, one cycle per µs.
+static const uint32_t DCC_RX_SM_HZ = 1000000;
+// Sample point after the rising edge in µs, between the longest "1" half-bit
+// (64µs) and the shortest "0" half-bit (90µs) a decoder has to accept.
+static const uint DCC_RX_SAMPLE_US = 77;
+// Start value of the delay loop: after the 1-cycle `set`, `jmp x--` runs x + 1 times with 3 cycles each.
+static const uint DCC_RX_DELAY_LOOPS = (DCC_RX_SAMPLE_US - 1) / 3 - 1;
+static_assert(DCC_RX_DELAY_LOOPS <= 31, "delay loop count must fit into a set instruction");
+static const uint DCC_RX_TRANSFER_COUNT = 0xFFFFFFFF;
+
+static PIO rx_pio;
+static uint rx_sm;
+static int rx_dma_channel = -1;
+static uint32_t read_count;       // Bytes taken out of the ring
+static uint32_t overrun_count;
+// The DMA wraps its write address at the ring size, which requires the alignment.
+static volatile uint8_t rx_ring[HAL_DCC_RX_RING_SIZE] __attribute__((aligned(HAL_DCC_RX_RING_SIZE)));
+
+static_assert((HAL_DCC_RX_RING_SIZE & (HAL_DCC_RX_RING_SIZE - 1)) == 0, "HAL_DCC_RX_RING_SIZE must be a power of 2");
+
+// Program, in pioasm notation:
+//
+//   .wrap_target
+//       wait 0 pin 0
+//       wait 1 pin 0          ; rising edge, a bit starts
+//       set x, DELAY_LOOPS
+//   delay:
+//       jmp x-- delay [2]
+//       in pins, 1            ; 1: the half-bit is still running, a DCC "0"
+//   .wrap
+//
+// The bits are inverted in hal_dcc_rx_read(). Autopush delivers every 8 bits.
+static uint16_t rx_program_instructions[5];
+
+static bool claim_state_machine(PIO pio, const pio_program_t* program, uint* offset) {
+    if (!pio_can_add_program(pio, program)) {
+        return false;
+    }
+    int sm = pio_claim_unused_sm(pio, false);
+    if (sm < 0) {
+        return false;
+    }
+    rx_pio = pio;
+    rx_sm = sm;
+    *offset = pio_add_program(pio, program);
+    return true;
+}
+
+static void start_dma() {
+    dma_channel_config config = dma_channel_get_default_config(rx_dma_channel);
+    channel_config_set_transfer_data_size(&config, DMA_SIZE_8);
+    channel_config_set_read_increment(&config, false);
+    channel_config_set_write_increment(&config, true);
+    channel_config_set_ring(&config, true, __builtin_ctz(HAL_DCC_RX_RING_SIZE));
+    channel_config_set_dreq(&config, pio_get_dreq(rx_pio, rx_sm, false));
+    // With left shifts the 8 bits are the low byte of the FIFO word, a byte read pops the word.
+    dma_channel_configure(rx_dma_channel, &config, rx_ring, (const volatile uint8_t*)&rx_pio->rxf[rx_sm],
+                          DCC_RX_TRANSFER_COUNT, true);
+    read_count = 0;
+}
+
+bool hal_dcc_rx_init(uint8_t pin) {
+    if (rx_dma_channel >= 0) {
+        return false; // Only one receiver
+    }
+
+    rx_program_instructions[0] = pio_encode_wait_pin(false, 0);
+    rx_program_instructions[1] = pio_encode_wait_pin(true, 0);
+    rx_program_instructions[2] = pio_encode_set(pio_x, DCC_RX_DELAY_LOOPS);
+    rx_program_instructions[3] = pio_encode_jmp_x_dec(3) | pio_encode_delay(2);
+    rx_program_instructions[4] = pio_encode_in(pio_pins, 1);
+    pio_program_t program = {};
+    program.instructions = rx_program_instructions;
+    program.length = 5;
+    program.origin = -1;
+
+    uint offset;
+    if (!claim_state_machine(pio0, &program, &offset) && !claim_state_machine(pio1, &program, &offset)) {
+        return false;
+    }
+    rx_dma_channel = dma_claim_unused_channel(false);
+    if (rx_dma_channel < 0) {
+        return false;
+    }
+
+    // The state machine only reads the pin, it stays a plain input with pull-up.
+    gpio_init(pin);
+    gpio_set_dir(pin, false);
+    gpio_pull_up(pin);
+
+    pio_sm_config config = pio_get_default_sm_config();
+    sm_config_set_wrap(&config, offset, offset + 4);
+    sm_config_set_in_pins(&config, pin);
+    sm_config_set_in_shift(&config, false, true, 8);
+    sm_config_set_fifo_join(&config, PIO_FIFO_JOIN_RX);
+    sm_config_set_clkdiv(&config, (float)clock_get_hz(clk_sys) / DCC_RX_SM_HZ);
+    pio_sm_init(rx_pio, rx_sm, offset, &config);
+
+    start_dma();
+    pio_sm_set_enabled(rx_pio, rx_sm, true);
+    return true;
+}
+
+int hal_dcc_rx_read(uint8_t* buffer, int max_bytes) {
+    if (rx_dma_channel < 0) {
+        return 0;
+    }
+    uint32_t written = DCC_RX_TRANSFER_COUNT - dma_hw->ch[rx_dma_channel].transfer_count;
+    if (written - read_count > HAL_DCC_RX_RING_SIZE) {
+        // The oldest bytes have been overwritten, continue with the ones still in the ring.
+        overrun_count += written - read_count - HAL_DCC_RX_RING_SIZE;
+        read_count = written - HAL_DCC_RX_RING_SIZE;
+    }
+
+    int count = 0;
+    while (read_count != written && count < max_bytes) {
+        buffer[count++] = ~rx_ring[read_count & (HAL_DCC_RX_RING_SIZE - 1)];
+        read_count++;
+    }
+
+    // The transfer count lasts for months of DCC traffic; restart the ring when it has run out.
+    if (read_count == written && !dma_channel_is_busy(rx_dma_channel)) {
+        start_dma();
+    }
+    return count;
+}
+
+uint32_t hal_dcc_rx_get_overrun_count() {
+    return overrun_count;
+}
+
+#endif // ARDUINO_ARCH_RP2040
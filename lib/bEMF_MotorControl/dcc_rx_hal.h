@@ -0,0 +1,58 @@
+/**
+ * @file dcc_rx_hal.h
+ * @brief Hardware Abstraction Layer (HAL) for DCC bit reception by a PIO state machine.
+ *
+ * A PIO state machine classifies every DCC bit by its half-bit time: it waits
+ * for the rising edge that starts a bit and samples the input 77µs later. A
+ * "1" half-bit (58µs) has ended by then, a "0" half-bit (at least 90µs) has
+ * not. Both halves of a bit are equally long, so the polarity of the track
+ * connection does not matter. The state machine shifts the bits into bytes,
+ * and a DMA channel moves the bytes into a RAM ring buffer.
+ *
+ * The CPU gets no interrupt per edge or bit; it collects the bytes with
+ * `hal_dcc_rx_read()` and assembles the packets in software (see
+ * DccPacketDecoder). Bytes not read within `HAL_DCC_RX_RING_SIZE` bytes of
+ * DCC traffic (about 240ms) are overwritten and counted as overruns.
+ */
+#ifndef DCC_RX_HAL_H
+#define DCC_RX_HAL_H
+
+#include <cstdint>
+
+/**
+ * @brief Size of the receive ring buffer in bytes (8 DCC bits each).
+ *
+ * Must be a power of 2, the DMA wraps the write address at this size.
+ */
+#ifndef HAL_DCC_RX_RING_SIZE
+#define HAL_DCC_RX_RING_SIZE 256
+#endif
+
+/**
+ * @brief Starts DCC reception on `pin`.
+ *
+ * Claims a state machine and instruction memory on one of the PIO blocks and
+ * a DMA channel. The pin is configured as input with pull-up.
+ *
+ * @return False if no state machine, instruction memory or DMA channel is free.
+ */
+bool hal_dcc_rx_init(uint8_t pin);
+
+/**
+ * @brief Copies the received bits into `buffer`, never blocks.
+ *
+ * Every byte holds 8 DCC bits in the order of reception, the first one in the
+ * most significant bit.
+ *
+ * @param buffer Destination of the bytes.
+ * @param max_bytes Capacity of `buffer`.
+ * @return The number of bytes copied, 0 if nothing new was received.
+ */
+int hal_dcc_rx_read(uint8_t* buffer, int max_bytes);
+
+/**
+ * @brief Returns the number of bytes lost because `hal_dcc_rx_read()` was called too late.
+ */
+uint32_t hal_dcc_rx_get_overrun_count();
+
+#endif // DCC_RX_HAL_H
@@ -1,170 +1,473 @@
 /**
- * @file motor_control_hal_rp2040.cpp
- * @brief RP2040-specific implementation for the motor control HAL.
+ * @file motor_control_hal.cpp
+ * @brief Platform independent part of the motor control HAL.
  *
- * This file provides the concrete implementation of the functions defined in
- * motor_control_hal.h for the Raspberry Pi RP2040 microcontroller. It uses
- * the Pico-SDK's hardware peripherals (PWM, ADC, DMA) for efficient,
- * non-blocking motor control and BEMF measurement.
+ * The RP2040 has a single ADC with 4 external inputs, so all motor instances
+ * share it on a time-sliced schedule. Two chained DMA channels ("ping" and
+ * "pong") fill alternating buffer halves, so the ADC runs without gaps. Each
+ * time a half is complete the DMA ISR publishes it, re-arms the finished
+ * channel for the next instance and switches the ADC inputs to the instance
+ * whose half is now being filled. The reduction of the samples runs later in
+ * `hal_motor_service()`.
+ *
+ * This file holds all of that bookkeeping: the instance pool and its pin
+ * checks, the round-robin successor table, the window generations, the half
+ * hand-over of the DMA ISR, the overrun detection and the reduction. It has no
+ * register access of its own and is built for the board and for the native
+ * simulation alike; the peripherals are driven through `motor_control_hw.h`
+ * (`motor_control_hw_rp2040.cpp` on the board).
+ *
+ * Acquisition only runs while at least one instance has an armed measurement
+ * window (`hal_motor_arm_bemf()`). Only armed instances take part in the
+ * time-sliced schedule, and a half is only delivered if its instance was
+ * armed for the whole half. Without armed instances, ADC, DMA and the PWM
+ * wrap interrupt are stopped.
+ *
+ * Current sense instances have no PWM slice. Their round-robin mask selects a
+ * single input, and `hal_motor_service()` splits their halves into blocks of
+ * `HAL_CURRENT_SENSE_BLOCK` samples.
  */
 
 #include "motor_control_hal.h"
+#include "motor_control_hw.h"
 
-#if defined(ARDUINO_ARCH_RP2040)
-
-#include <Arduino.h>
-#include "hardware/pwm.h"
-#include "hardware/dma.h"
-#include "hardware/adc.h"
-#include "hardware/irq.h"
-
-//== Hardware PWM & BEMF Measurement Parameters ==
-
-// PWM frequency for the motor driver, 25kHz is high enough to be inaudible.
-const uint PWM_FREQUENCY_HZ = 25000;
-// PWM counter wrap value, calculated from the 125MHz system clock.
-// Formula: (SystemClock / PWM_Frequency) - 1. This value determines the PWM resolution.
-static uint16_t PWM_WRAP_VALUE = (125000000 / PWM_FREQUENCY_HZ) - 1;
-// Delay after the PWM cycle before triggering ADC, allows the motor coils' magnetic field to collapse.
-const uint BEMF_MEASUREMENT_DELAY_US = 10;
-// Ring buffer size for ADC samples. Must be a power of 2 for DMA efficiency.
-const uint BEMF_RING_BUFFER_SIZE = 64;
-
-//== Static Globals for Hardware Control ==
-static uint dma_channel;     // DMA channel for ADC->memory transfers
-static uint motor_pwm_slice; // The RP2040 PWM slice driving the motor
-// Volatile is required as this buffer is written by DMA and read by the CPU in an ISR.
-static volatile uint16_t bemf_ring_buffer[BEMF_RING_BUFFER_SIZE];
-static hal_bemf_update_callback_t bemf_callback = nullptr;
-static uint8_t g_pwm_a_pin; // Motor PWM A pin
-static uint8_t g_pwm_b_pin; // Motor PWM B pin
-
-// Forward Declarations
-static void dma_irq_handler();
-static int64_t delayed_adc_trigger_callback(alarm_id_t id, void *user_data);
-static void on_pwm_wrap();
-
-// DMA ISR: triggered when the BEMF ring buffer is full.
-// This is the core of the measurement, processing raw ADC data and passing it to the controller.
-static void dma_irq_handler() {
-    // Clear the DMA interrupt flag for our channel using a bitmask.
-    dma_hw->ints0 = 1u << dma_channel;
+#include <cstdlib>
+
+int hal_bemf_reduce(const volatile uint16_t* samples, int count) {
+    int avg_a, avg_b;
+    return hal_bemf_reduce_terminals(samples, count, &avg_a, &avg_b);
+}
 
+int hal_bemf_reduce_terminals(const volatile uint16_t* samples, int count, int* avg_a, int* avg_b) {
     uint32_t sum_A = 0, sum_B = 0;
-    // De-interleave and sum the ADC samples for each motor terminal (B, A, B, A, ...).
-    for (uint i = 0; i < BEMF_RING_BUFFER_SIZE; i += 2) {
-        sum_B += bemf_ring_buffer[i];
-        sum_A += bemf_ring_buffer[i + 1];
+    // De-interleave and sum the ADC samples for each motor terminal. The block starts with
+    // terminal B (B, A, B, A, ...), i.e. one sample into a half, see hal_motor_service().
+    for (int i = 0; i < count; i += 2) {
+        sum_B += samples[i];
+        sum_A += samples[i + 1];
     }
+    *avg_a = sum_A / (count / 2);
+    *avg_b = sum_B / (count / 2);
     // Calculate the average differential BEMF.
-    int measured_bemf = abs((int)(sum_A / (BEMF_RING_BUFFER_SIZE / 2)) - (int)(sum_B / (BEMF_RING_BUFFER_SIZE / 2)));
+    return abs(*avg_a - *avg_b);
+}
+
+int hal_current_reduce(const volatile uint16_t* samples, int count, int block, int* values) {
+    int value_count = 0;
+    for (int start = 0; start + block <= count; start += block) {
+        // The very first sample may have been converted on the inputs of the previous instance.
+        int first = start == 0 ? 1 : start;
+        uint32_t sum = 0;
+        for (int i = first; i < start + block; i++) {
+            sum += samples[i];
+        }
+        values[value_count++] = sum / (start + block - first);
+    }
+    return value_count;
+}
+
+static_assert(HAL_BEMF_HALF_SAMPLES % HAL_CURRENT_SENSE_BLOCK == 0 && HAL_CURRENT_SENSE_BLOCK >= 2,
+              "HAL_CURRENT_SENSE_BLOCK must divide the buffer half");
+
+//== Motor Instances ==
+
+struct hal_motor {
+    bool in_use;
+    bool sense_only;                     // Current sense instance without a PWM slice
+    uint8_t pwm_a_pin;
+    uint8_t pwm_b_pin;
+    uint8_t pwm_slice;                   // The RP2040 PWM slice driving this motor
+    uint32_t adc_rrobin_mask;            // ADC round-robin mask selecting both BEMF inputs (or the shunt input)
+    uint8_t adc_first_input;             // Input converted first in every half: BEMF A (or the shunt input)
+    uint8_t adc_second_input;            // Input converted after it: BEMF B (or the shunt input)
+    hal_bemf_update_callback_t callback;
+    void* context;
+    volatile bool armed;                 // Measurement window open, instance takes part in the schedule
+    volatile uint32_t generation;        // Incremented on every arm, tags the halves of one window
+    uint16_t last_avg_a;                 // Terminal averages of the last delivered measurement
+    uint16_t last_avg_b;
+};
+
+static hal_motor_t motors[HAL_MOTOR_MAX_INSTANCES];
+// Ping-pong sample buffers, two halves per instance.
+// Volatile is required as these buffers are written by DMA and read by the CPU.
+static volatile uint16_t bemf_buffers[HAL_MOTOR_MAX_INSTANCES][2][HAL_BEMF_HALF_SAMPLES];
+// Armed round-robin successor of every instance, precomputed to keep the DMA ISR short.
+static volatile int next_instance[HAL_MOTOR_MAX_INSTANCES];
+static int armed_count = 0;
+
+//== State of the shared Hardware ==
+static bool hal_initialized = false;
+static int sync_instance = -1;           // Instance whose PWM wrap starts the ADC, -1 while stopped
+static volatile int chan_owner[2];       // Instance each channel is currently writing for
+static volatile uint32_t chan_generation[2]; // Window generation of that instance when the channel was armed
+static hal_bemf_trigger_mode_t trigger_mode = HAL_BEMF_TRIGGER_HARDWARE;
+
+//== State published by the DMA ISR, consumed by hal_motor_service() ==
+static volatile uint32_t half_ready_mask = 0;  // Bit h set: half h is complete and not yet processed
+static volatile int half_owner[2];             // Instance the completed half belongs to
+static volatile uint32_t half_generation[2];   // Window generation the completed half was sampled in
+static volatile uint32_t half_done_at[2];      // Value of `halves_completed` when the half completed
+static volatile uint32_t halves_completed = 0; // Total number of completed halves
+static uint32_t overrun_count = 0;
+
+// Same as pwm_gpio_to_slice_num() of the Pico-SDK: two GPIOs per slice, 8 slices.
+static uint8_t hal_pwm_slice_of(uint8_t pin) {
+    return (pin >> 1) & 7;
+}
+
+static bool hal_is_adc_pin(uint8_t pin) {
+    return pin >= HAL_ADC_FIRST_GPIO && pin < HAL_ADC_FIRST_GPIO + HAL_ADC_INPUT_COUNT;
+}
+
+// Rebuilds the round-robin successor table after an instance was armed or disarmed.
+// Every instance points to the next armed one, so a running channel can always be handed on.
+static void hal_update_schedule() {
+    for (int index = 0; index < HAL_MOTOR_MAX_INSTANCES; index++) {
+        int next = -1;
+        for (int i = 1; i <= HAL_MOTOR_MAX_INSTANCES && next < 0; i++) {
+            int candidate = (index + i) % HAL_MOTOR_MAX_INSTANCES;
+            if (motors[candidate].armed) {
+                next = candidate;
+            }
+        }
+        next_instance[index] = next;
+    }
+}
+
+// The chained channel has already taken over, so this only publishes the finished
+// half and re-arms its channel.
+void hal_motor_half_complete(int half) {
+    half_owner[half] = chan_owner[half];
+    half_generation[half] = chan_generation[half];
+    half_done_at[half] = ++halves_completed;
+    half_ready_mask |= 1u << half;
+
+    // Re-arm the finished channel for the instance following the one that is sampling now.
+    int running = chan_owner[half ^ 1];
+    int next = next_instance[running];
+    chan_owner[half] = next;
+    chan_generation[half] = motors[next].generation;
+    // Point the ADC at the inputs of the instance whose half is being filled now, input A on
+    // the even positions. The first sample after a hand-over may still stem from the previous
+    // inputs; hal_motor_service() drops it. If this interrupt came later than one conversion,
+    // the round robin still continues in phase.
+    hal_motor_t* motor = &motors[running];
+    int written = hal_hw_samples_written(half ^ 1);
+    hal_hw_rearm(half, bemf_buffers[next][half], motor->adc_rrobin_mask,
+                 written % 2 == 0 ? motor->adc_first_input : motor->adc_second_input);
+}
 
-    if (bemf_callback) {
-        bemf_callback(measured_bemf);
+// Sets up the shared peripherals on the first instance.
+static void hal_init_shared() {
+    hal_hw_init_shared(trigger_mode);
+    hal_initialized = true;
+}
+
+// Restarts all motor slices together with the trigger slice.
+static void hal_sync_trigger_phase() {
+    uint32_t slice_mask = 1u << HAL_BEMF_TRIGGER_PWM_SLICE;
+    for (int i = 0; i < HAL_MOTOR_MAX_INSTANCES; i++) {
+        if (motors[i].in_use && !motors[i].sense_only) {
+            slice_mask |= 1u << motors[i].pwm_slice;
+        }
     }
-    // Restart DMA transfer to refill the buffer for the next cycle.
-    dma_channel_set_write_addr(dma_channel, bemf_ring_buffer, true);
+    hal_hw_sync_trigger_phase(slice_mask);
 }
 
-// One-shot hardware timer callback to trigger the ADC conversion.
-// This is called after the BEMF_MEASUREMENT_DELAY_US to ensure a stable reading.
-static int64_t delayed_adc_trigger_callback(alarm_id_t id, void *user_data) {
-    // Start a single ADC conversion sequence that will run until the DMA buffer is full.
-    adc_run(true);
-    return 0; // Returning 0 prevents the timer from rescheduling.
+// Starts the acquisition pipeline for the first armed instance.
+// Must be called with interrupts disabled.
+static void hal_start_acquisition(int index) {
+    hal_motor_t* motor = &motors[index];
+    for (int half = 0; half < 2; half++) {
+        chan_owner[half] = index;
+        chan_generation[half] = motor->generation;
+    }
+    sync_instance = index;
+    hal_hw_start(bemf_buffers[index][0], bemf_buffers[index][1], motor->adc_rrobin_mask, motor->adc_first_input,
+                 motor->pwm_slice);
 }
 
-// PWM Wrap ISR: synchronizes ADC measurement with the PWM cycle.
-// This is triggered at the end of each PWM cycle.
-static void on_pwm_wrap() {
-    pwm_clear_irq(motor_pwm_slice);
-    // Schedule the ADC trigger to run after the specified delay.
-    add_alarm_in_us(BEMF_MEASUREMENT_DELAY_US, delayed_adc_trigger_callback, NULL, true);
+// Stops ADC, DMA and the PWM wrap interrupt after the last window was disarmed.
+// Must be called with interrupts disabled.
+static void hal_stop_acquisition() {
+    hal_hw_stop(motors[sync_instance].pwm_slice);
+    sync_instance = -1;
+    // Halves that completed before the stop belong to closed windows.
+    half_ready_mask = 0;
 }
 
 //== Public HAL Function Implementations ==
 
-void hal_motor_init(uint8_t pwm_a_pin, uint8_t pwm_b_pin, uint8_t bemf_a_pin, uint8_t bemf_b_pin, hal_bemf_update_callback_t callback) {
-    g_pwm_a_pin = pwm_a_pin;
-    g_pwm_b_pin = pwm_b_pin;
-    bemf_callback = callback;
-
-    // --- ADC and DMA Setup ---
-    adc_init();
-    adc_gpio_init(bemf_b_pin);
-    adc_gpio_init(bemf_a_pin);
-    // Configure ADC for round-robin sampling. The bitmask `(1u << N)` selects ADC channel N.
-    // Arduino pins A0-A3 map to ADC0-3 (GPIO 26-29), so `pin - 26` converts GPIO to ADC channel.
-    adc_set_round_robin((1u << (bemf_b_pin - 26)) | (1u << (bemf_a_pin - 26)));
-    adc_select_input(bemf_b_pin - 26);
-    // Configure the ADC FIFO to generate a DMA request (DREQ) for every sample.
-    adc_fifo_setup(true, true, 1, false, false);
-
-    dma_channel = dma_claim_unused_channel(true);
-    dma_channel_config dma_config = dma_channel_get_default_config(dma_channel);
-    channel_config_set_transfer_data_size(&dma_config, DMA_SIZE_16); // 16-bit ADC samples
-    channel_config_set_read_increment(&dma_config, false);           // Read from same ADC FIFO address
-    channel_config_set_write_increment(&dma_config, true);           // Write to sequential buffer addresses
-    channel_config_set_dreq(&dma_config, DREQ_ADC);                  // Trigger DMA from ADC
-    // Configure a ring buffer write address. The '6' is log2(BEMF_RING_BUFFER_SIZE), i.e., log2(64).
-    channel_config_set_ring(&dma_config, true, 6);
-
-    // Apply the DMA config: read from ADC FIFO, write to our ring buffer.
-    dma_channel_configure(dma_channel, &dma_config, bemf_ring_buffer, &adc_hw->fifo, BEMF_RING_BUFFER_SIZE, false);
-    // Set up the DMA interrupt handler.
-    dma_channel_set_irq0_enabled(dma_channel, true);
-    irq_set_exclusive_handler(DMA_IRQ_0, dma_irq_handler);
-    irq_set_enabled(DMA_IRQ_0, true);
-
-    // --- PWM Setup for Motor Control ---
-    gpio_set_function(g_pwm_a_pin, GPIO_FUNC_PWM);
-    gpio_set_function(g_pwm_b_pin, GPIO_FUNC_PWM);
+hal_motor_t* hal_motor_init(uint8_t pwm_a_pin, uint8_t pwm_b_pin, uint8_t bemf_a_pin, uint8_t bemf_b_pin,
+                            hal_bemf_update_callback_t callback, void* context) {
     // Both PWM pins must be on the same slice.
-    motor_pwm_slice = pwm_gpio_to_slice_num(g_pwm_a_pin);
+    uint8_t slice = hal_pwm_slice_of(pwm_a_pin);
+    if (hal_pwm_slice_of(pwm_b_pin) != slice) {
+        return nullptr;
+    }
+    // Both BEMF pins must be ADC inputs (Arduino pins A0-A3 map to ADC0-3).
+    if (!hal_is_adc_pin(bemf_a_pin) || !hal_is_adc_pin(bemf_b_pin)) {
+        return nullptr;
+    }
+    if (slice == HAL_BEMF_TRIGGER_PWM_SLICE && trigger_mode == HAL_BEMF_TRIGGER_HARDWARE && hal_initialized) {
+        return nullptr; // Slice is reserved for the running ADC trigger
+    }
+
+    int index = -1;
+    for (int i = 0; i < HAL_MOTOR_MAX_INSTANCES; i++) {
+        if (motors[i].in_use) {
+            if (!motors[i].sense_only && motors[i].pwm_slice == slice) {
+                return nullptr; // Slice already driven by another instance
+            }
+        } else if (index < 0) {
+            index = i;
+        }
+    }
+    if (index < 0) {
+        return nullptr; // Instance pool exhausted
+    }
+    // A slice set up elsewhere, e.g. by hal_servo_init(), would lose its configuration.
+    if (hal_hw_pwm_slice_running(slice)) {
+        return nullptr;
+    }
 
-    pwm_config motor_pwm_conf = pwm_get_default_config();
-    pwm_config_set_wrap(&motor_pwm_conf, PWM_WRAP_VALUE);
-    pwm_init(motor_pwm_slice, &motor_pwm_conf, true);
+    if (slice == HAL_BEMF_TRIGGER_PWM_SLICE && trigger_mode == HAL_BEMF_TRIGGER_HARDWARE) {
+        // The first motor takes the trigger slice, the ADC start falls back to the alarm.
+        trigger_mode = HAL_BEMF_TRIGGER_ALARM;
+    }
+    if (!hal_initialized) {
+        hal_init_shared();
+    }
+
+    hal_motor_t* motor = &motors[index];
+    motor->sense_only = false;
+    motor->pwm_a_pin = pwm_a_pin;
+    motor->pwm_b_pin = pwm_b_pin;
+    motor->pwm_slice = slice;
+    motor->callback = callback;
+    motor->context = context;
+    // Round robin over both BEMF inputs. The bitmask `(1u << N)` selects ADC channel N.
+    motor->adc_rrobin_mask = (1u << (bemf_b_pin - HAL_ADC_FIRST_GPIO)) | (1u << (bemf_a_pin - HAL_ADC_FIRST_GPIO));
+    motor->adc_first_input = bemf_a_pin - HAL_ADC_FIRST_GPIO;
+    motor->adc_second_input = bemf_b_pin - HAL_ADC_FIRST_GPIO;
+    // The ADC inputs may be shared with other instances, the time slicing keeps the samples apart.
+    hal_hw_init_motor(slice, pwm_a_pin, pwm_b_pin, bemf_a_pin, bemf_b_pin);
 
-    // --- PWM Interrupt for Synchronization ---
-    pwm_clear_irq(motor_pwm_slice);
-    // Enable the interrupt that fires when the PWM counter wraps.
-    pwm_set_irq_enabled(motor_pwm_slice, true);
-    irq_set_exclusive_handler(PWM_IRQ_WRAP, on_pwm_wrap);
-    irq_set_enabled(PWM_IRQ_WRAP, true);
+    // The instance only joins the schedule once its first measurement window is armed.
+    motor->armed = false;
+    motor->in_use = true;
 
-    // Start the DMA, which will now wait for the first ADC trigger.
-    dma_channel_set_write_addr(dma_channel, bemf_ring_buffer, true);
+    if (trigger_mode == HAL_BEMF_TRIGGER_HARDWARE) {
+        hal_sync_trigger_phase();
+    }
+    return motor;
 }
 
-void hal_motor_set_pwm(int duty_cycle, bool forward) {
-    // Map the 8-bit duty cycle (0-255) to the PWM counter's range.
-    uint16_t level = map(duty_cycle, 0, 255, 0, PWM_WRAP_VALUE);
+hal_motor_t* hal_current_sense_init(uint8_t sense_pin, hal_bemf_update_callback_t callback, void* context) {
+    if (!hal_is_adc_pin(sense_pin)) {
+        return nullptr;
+    }
+    // The alarm mode is paced by the wrap interrupt of the first armed instance's slice.
+    if (trigger_mode != HAL_BEMF_TRIGGER_HARDWARE) {
+        return nullptr;
+    }
+
+    int index = -1;
+    for (int i = 0; i < HAL_MOTOR_MAX_INSTANCES && index < 0; i++) {
+        if (!motors[i].in_use) {
+            index = i;
+        }
+    }
+    if (index < 0) {
+        return nullptr; // Instance pool exhausted
+    }
+
+    if (!hal_initialized) {
+        hal_init_shared();
+    }
+
+    hal_motor_t* motor = &motors[index];
+    motor->sense_only = true;
+    motor->callback = callback;
+    motor->context = context;
+    motor->adc_rrobin_mask = 1u << (sense_pin - HAL_ADC_FIRST_GPIO);
+    motor->adc_first_input = sense_pin - HAL_ADC_FIRST_GPIO;
+    motor->adc_second_input = motor->adc_first_input;
+    hal_hw_init_sense(sense_pin);
+    motor->armed = false;
+    motor->in_use = true;
+
+    // Starts the trigger slice if this is the first instance.
+    hal_sync_trigger_phase();
+    return motor;
+}
+
+void hal_motor_arm_bemf(hal_motor_t* motor) {
+    if (motor == nullptr || motor->armed) {
+        return;
+    }
+    uint32_t irq_state = hal_hw_disable_interrupts();
+    // A new generation invalidates every half that was sampled before this window.
+    motor->generation++;
+    motor->armed = true;
+    armed_count++;
+    hal_update_schedule();
+    if (armed_count == 1) {
+        hal_start_acquisition(motor - motors);
+    }
+    hal_hw_restore_interrupts(irq_state);
+}
+
+void hal_motor_disarm_bemf(hal_motor_t* motor) {
+    if (motor == nullptr || !motor->armed) {
+        return;
+    }
+    uint32_t irq_state = hal_hw_disable_interrupts();
+    motor->armed = false;
+    armed_count--;
+    if (armed_count == 0) {
+        hal_stop_acquisition();
+    }
+    hal_update_schedule();
+    hal_hw_restore_interrupts(irq_state);
+}
+
+void hal_bemf_set_trigger_mode(hal_bemf_trigger_mode_t mode) {
+    if (!hal_initialized) {
+        trigger_mode = mode;
+    }
+}
 
+hal_bemf_trigger_mode_t hal_bemf_get_trigger_mode() {
+    return trigger_mode;
+}
+
+// True if the channel of `half` has written into the samples of the half that completed
+// as number `done_at` for `owner`. The channel restarts once the other half completes; it
+// overwrites the samples if it was re-armed for the same instance, and in any case once
+// it has completed again.
+static bool hal_half_overwritten(int owner, uint32_t done_at, int rearmed_for) {
+    uint32_t completed_since = halves_completed - done_at;
+    return completed_since >= 2 || (completed_since == 1 && rearmed_for == owner);
+}
+
+void hal_motor_service() {
+    hal_hw_update_irq_rate();
+
+    for (int half = 0; half < 2; half++) {
+        if (!(half_ready_mask & (1u << half))) {
+            continue;
+        }
+
+        uint32_t irq_state = hal_hw_disable_interrupts();
+        half_ready_mask &= ~(1u << half);
+        int owner = half_owner[half];
+        uint32_t done_at = half_done_at[half];
+        uint32_t generation = half_generation[half];
+        // Instance the channel was re-armed for when this half completed.
+        int rearmed_for = chan_owner[half];
+        hal_hw_restore_interrupts(irq_state);
+
+        // Samples that are already being overwritten are not reduced at all.
+        if (hal_half_overwritten(owner, done_at, rearmed_for)) {
+            overrun_count++;
+            continue;
+        }
+
+        hal_motor_t* motor = &motors[owner];
+        int avg_a = 0, avg_b = 0, measured_bemf = 0;
+        int currents[HAL_BEMF_HALF_SAMPLES / HAL_CURRENT_SENSE_BLOCK];
+        int current_count = 0;
+        if (motor->sense_only) {
+            current_count = hal_current_reduce(bemf_buffers[owner][half], HAL_BEMF_HALF_SAMPLES,
+                                               HAL_CURRENT_SENSE_BLOCK, currents);
+        } else {
+            // The half holds A, B, A, B, ... The first sample (input A) may still have been
+            // converted on the inputs of the previous owner of the channel and is dropped;
+            // the B/A pairs follow it, the last B is left over.
+            measured_bemf = hal_bemf_reduce_terminals(bemf_buffers[owner][half] + 1, HAL_BEMF_HALF_SAMPLES - 2,
+                                                      &avg_a, &avg_b);
+        }
+        // The other half may have completed during the reduction, restarting the channel.
+        if (hal_half_overwritten(owner, done_at, rearmed_for)) {
+            overrun_count++;
+            continue;
+        }
+
+        // Only halves sampled completely inside the current window of an armed instance count.
+        if (!motor->armed || motor->generation != generation) {
+            continue;
+        }
+        if (motor->sense_only) {
+            // The callback may close the window, e.g. when it cuts the coil; the rest is dropped then.
+            for (int i = 0; i < current_count && motor->armed && motor->generation == generation; i++) {
+                motor->last_avg_a = currents[i];
+                motor->last_avg_b = 0;
+                if (motor->callback) {
+                    motor->callback(motor->context, currents[i]);
+                }
+            }
+            continue;
+        }
+        motor->last_avg_a = avg_a;
+        motor->last_avg_b = avg_b;
+        if (motor->callback) {
+            motor->callback(motor->context, measured_bemf);
+        }
+    }
+}
+
+uint32_t hal_motor_get_overrun_count() {
+    return overrun_count;
+}
+
+void hal_motor_set_pwm(hal_motor_t* motor, int duty_cycle, bool forward) {
+    if (motor == nullptr || motor->sense_only) {
+        return;
+    }
     if (forward) {
         // For forward, PWM is applied to pin A and pin B is held low.
-        pwm_set_gpio_level(g_pwm_a_pin, level);
-        pwm_set_gpio_level(g_pwm_b_pin, 0);
+        hal_hw_set_pwm(motor->pwm_a_pin, duty_cycle);
+        hal_hw_set_pwm(motor->pwm_b_pin, 0);
     } else {
         // For reverse, pin A is held low and PWM is applied to pin B.
-        pwm_set_gpio_level(g_pwm_a_pin, 0);
-        pwm_set_gpio_level(g_pwm_b_pin, level);
+        hal_hw_set_pwm(motor->pwm_a_pin, 0);
+        hal_hw_set_pwm(motor->pwm_b_pin, duty_cycle);
     }
 }
 
-int hal_motor_get_bemf_buffer(volatile uint16_t** buffer, int* last_write_pos) {
-    *buffer = bemf_ring_buffer;
+void hal_motor_get_last_terminals(hal_motor_t* motor, int* avg_a, int* avg_b) {
+    *avg_a = motor->last_avg_a;
+    *avg_b = motor->last_avg_b;
+}
 
-    // Get the current write address from the DMA controller.
-    uintptr_t current_write_addr = (uintptr_t)dma_hw->ch[dma_channel].write_addr;
-    // Calculate the offset from the beginning of the buffer.
-    uintptr_t buffer_start_addr = (uintptr_t)bemf_ring_buffer;
-    int byte_offset = current_write_addr - buffer_start_addr;
+int hal_motor_get_bemf_buffer(hal_motor_t* motor, volatile uint16_t** buffer, int* last_write_pos) {
+    int index = motor - motors;
+    *buffer = &bemf_buffers[index][0][0];
+    *last_write_pos = 0;
 
-    // Convert the byte offset to a sample index.
-    *last_write_pos = byte_offset / sizeof(uint16_t);
+    for (int half = 0; half < 2; half++) {
+        volatile uint16_t* write_address = hal_hw_write_address(half);
+        if (chan_owner[half] == index && write_address != nullptr) {
+            // Offset of the DMA write address from the beginning of the buffer, in samples.
+            *last_write_pos = write_address - *buffer;
+        }
+    }
 
-    return BEMF_RING_BUFFER_SIZE;
+    return 2 * HAL_BEMF_HALF_SAMPLES;
 }
 
-#endif // ARDUINO_ARCH_RP2040
+void hal_motor_reset() {
+    for (int i = 0; i < HAL_MOTOR_MAX_INSTANCES; i++) {
+        motors[i] = hal_motor_t();
+    }
+    hal_update_schedule();
+    armed_count = 0;
+    hal_initialized = false;
+    sync_instance = -1;
+    trigger_mode = HAL_BEMF_TRIGGER_HARDWARE;
+    half_ready_mask = 0;
+    halves_completed = 0;
+    overrun_count = 0;
+}
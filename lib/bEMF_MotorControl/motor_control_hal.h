@@ -5,43 +5,204 @@
  * This file defines a platform-agnostic interface for hardware-accelerated
  * PWM motor control and BEMF (Back-EMF) measurement. The implementation for
  * a specific microcontroller must be provided separately.
+ *
+ * The HAL is handle-based: every motor is represented by its own
+ * `hal_motor_t` instance, which owns a PWM slice, a slot in the ADC
+ * round-robin schedule and a private DMA sample buffer. Several motors can
+ * therefore be driven and measured at the same time.
+ *
+ * Sampling runs without gaps into double-buffered (ping-pong) DMA halves. The
+ * interrupt only publishes which half is complete; the reduction to a
+ * differential BEMF value happens in `hal_motor_service()`, which must be
+ * called regularly from the main loop.
+ *
+ * By default each ADC conversion is started by hardware: a spare PWM slice
+ * runs phase-shifted by the measurement delay and its wrap paces a DMA
+ * channel that starts the conversion, so no CPU work is needed per PWM
+ * cycle. The previous timer-alarm path is available as a fallback.
+ *
+ * Samples are only taken for instances with an armed measurement window
+ * (`hal_motor_arm_bemf()`). While no window is armed, the acquisition
+ * pipeline is completely stopped.
+ *
+ * A current sense instance (`hal_current_sense_init()`) has no PWM slice and
+ * samples a single ADC input, e.g. the shunt of a coil driver. It takes part
+ * in the same schedule and delivers a current value every
+ * `HAL_CURRENT_SENSE_BLOCK` samples instead of one BEMF value per half.
  */
 #ifndef MOTOR_CONTROL_HAL_H
 #define MOTOR_CONTROL_HAL_H
 
 #include <cstdint>
 
+/**
+ * @brief Maximum number of motor instances the HAL can manage.
+ *
+ * Each instance needs a PWM slice of its own, so the RP2040 limit is 8.
+ * Can be lowered with a build flag to save RAM.
+ */
+#ifndef HAL_MOTOR_MAX_INSTANCES
+#define HAL_MOTOR_MAX_INSTANCES 8
+#endif
+
+/**
+ * @brief PWM slice used to pace the hardware-triggered ADC conversions.
+ *
+ * This slice must not be used by any motor; its GPIOs are not touched. On
+ * the Seeed XIAO RP2040 slice 7 (GPIO 14/15) is not routed to a pin.
+ */
+#ifndef HAL_BEMF_TRIGGER_PWM_SLICE
+#define HAL_BEMF_TRIGGER_PWM_SLICE 7
+#endif
+
+/**
+ * @brief Samples averaged into one value of a current sense instance.
+ *
+ * At the 25kHz sample rate the default yields a value every 320µs. Must
+ * divide the 64 samples of a buffer half.
+ */
+#ifndef HAL_CURRENT_SENSE_BLOCK
+#define HAL_CURRENT_SENSE_BLOCK 8
+#endif
+
+/**
+ * @brief How the ADC conversions are started after each PWM cycle.
+ */
+typedef enum {
+    HAL_BEMF_TRIGGER_HARDWARE, ///< Phase-shifted PWM slice paces a DMA write to the ADC (no CPU work)
+    HAL_BEMF_TRIGGER_ALARM     ///< PWM wrap IRQ schedules a timer alarm that starts the ADC (fallback)
+} hal_bemf_trigger_mode_t;
+
+/**
+ * @brief Opaque handle for a single motor instance.
+ *
+ * Instances are allocated from a static pool inside the HAL by
+ * `hal_motor_init()`; no heap memory is used.
+ */
+typedef struct hal_motor hal_motor_t;
+
 /**
  * @brief Callback function pointer type for BEMF updates.
  *
- * This function is called from an interrupt context whenever a new
- * differential BEMF measurement is available from the hardware. It is the
- * responsibility of the callee to perform any necessary filtering, processing,
- * and control logic adjustments.
+ * This function is called from `hal_motor_service()` (i.e. from the main loop,
+ * not from an interrupt) whenever a new differential BEMF measurement is
+ * available from the hardware. It is the responsibility of the callee to
+ * perform any necessary filtering, processing, and control logic adjustments.
  *
+ * @param context The user pointer that was passed to `hal_motor_init()` for
+ *                the motor this measurement belongs to.
  * @param raw_bemf_value The raw, unfiltered differential BEMF value, calculated
- *                       as the absolute difference between the two ADC readings
-.
+ *                       as the absolute difference between the two ADC readings.
+ *                       For a current sense instance the averaged ADC reading
+ *                       of the shunt.
  */
-typedef void (*hal_bemf_update_callback_t)(int raw_bemf_value);
+typedef void (*hal_bemf_update_callback_t)(void* context, int raw_bemf_value);
 
 /**
- * @brief Initializes the low-level hardware for motor control.
+ * @brief Initializes the low-level hardware for one motor instance.
  *
  * This function configures the hardware timers, PWM peripherals, ADC, and DMA
- * for hardware-accelerated motor control and BEMF measurement. It must be
- * called once during the application's setup phase.
+ * for hardware-accelerated motor control and BEMF measurement. The shared
+ * peripherals (ADC, DMA channel, interrupts) are set up on the first call;
+ * every further call only registers an additional instance. The ADC is
+ * time-sliced between all armed instances: each one gets the ADC for one
+ * buffer half, then the next instance takes over. A new instance starts
+ * disarmed.
  *
  * @param pwm_a_pin The GPIO pin number for PWM channel A (e.g., forward).
  * @param pwm_b_pin The GPIO pin number for PWM channel B (e.g., reverse).
- * @param bemf_a_pin The GPIO pin number for ADC input connected to motor termin
-al A.
- * @param bemf_b_pin The GPIO pin number for ADC input connected to motor termin
-al B.
- * @param callback A pointer to a function that will be called from an interrupt
- *                 context with new BEMF data.
+ *                  Must be on the same PWM slice as `pwm_a_pin`, and that
+ *                  slice must not be used by another instance.
+ * @param bemf_a_pin The GPIO pin number for ADC input connected to motor terminal A.
+ * @param bemf_b_pin The GPIO pin number for ADC input connected to motor terminal B.
+ * @param callback A pointer to a function that will be called from
+ *                 `hal_motor_service()` with new BEMF data for this instance.
+ * @param context A user pointer handed back unchanged to `callback`.
+ * @return A handle for the new instance, or `nullptr` if the pins are invalid,
+ *         the PWM slice is already taken or the instance pool is exhausted.
  */
-void hal_motor_init(uint8_t pwm_a_pin, uint8_t pwm_b_pin, uint8_t bemf_a_pin, uint8_t bemf_b_pin, hal_bemf_update_callback_t callback);
+hal_motor_t* hal_motor_init(uint8_t pwm_a_pin, uint8_t pwm_b_pin, uint8_t bemf_a_pin, uint8_t bemf_b_pin,
+                            hal_bemf_update_callback_t callback, void* context);
+
+/**
+ * @brief Initializes an instance that only measures a current.
+ *
+ * The instance samples one ADC input, typically the voltage across a shunt in
+ * the supply of a coil driver, and drives no outputs. Like a motor instance
+ * it starts disarmed; while its window is armed (`hal_motor_arm_bemf()`) the
+ * callback receives the average of every `HAL_CURRENT_SENSE_BLOCK` samples,
+ * in order. While other instances are armed at the same time, the ADC is
+ * shared and the values arrive in bursts of one buffer half.
+ *
+ * Only available in the hardware trigger mode, the alarm mode is paced by the
+ * PWM slice of a motor.
+ *
+ * @param sense_pin The GPIO pin number of the ADC input connected to the shunt.
+ * @param callback A pointer to a function that will be called from
+ *                 `hal_motor_service()` with every current value.
+ * @param context A user pointer handed back unchanged to `callback`.
+ * @return A handle for the new instance, or `nullptr` if the pin is no ADC
+ *         input, the alarm trigger mode is in use or the instance pool is
+ *         exhausted.
+ */
+hal_motor_t* hal_current_sense_init(uint8_t sense_pin, hal_bemf_update_callback_t callback, void* context);
+
+/**
+ * @brief Selects how ADC conversions are triggered.
+ *
+ * Must be called before the first `hal_motor_init()`. The hardware mode is
+ * the default. It reserves `HAL_BEMF_TRIGGER_PWM_SLICE`; if the first motor
+ * is on that slice, the HAL falls back to the alarm mode, later motors on it
+ * are rejected.
+ *
+ * @param mode The trigger mode to use.
+ */
+void hal_bemf_set_trigger_mode(hal_bemf_trigger_mode_t mode);
+
+/**
+ * @brief Returns the trigger mode that is actually in use.
+ */
+hal_bemf_trigger_mode_t hal_bemf_get_trigger_mode();
+
+/**
+ * @brief Returns the number of BEMF-related interrupts during the last second.
+ *
+ * Counts the PWM wrap, timer alarm and DMA interrupts of the acquisition
+ * pipeline. The value is updated by `hal_motor_service()`.
+ */
+uint32_t hal_bemf_get_irq_rate();
+
+/**
+ * @brief Interrupt service routines of the acquisition pipeline.
+ */
+typedef enum {
+    HAL_ISR_DMA,      ///< Buffer half completed
+    HAL_ISR_PWM_WRAP, ///< PWM wrap (alarm trigger mode only)
+    HAL_ISR_ALARM,    ///< Delayed ADC start (alarm trigger mode only)
+    HAL_ISR_COUNT
+} hal_isr_t;
+
+/**
+ * @brief Execution time of one interrupt service routine, measured with the RP2040 timer.
+ */
+typedef struct {
+    uint32_t count;    ///< Number of executions
+    uint32_t total_us; ///< Sum of the execution times
+    uint32_t max_us;   ///< Longest execution time
+} hal_isr_stats_t;
+
+/**
+ * @brief Copies the execution time statistics of one interrupt service routine.
+ *
+ * The timer has a resolution of 1µs, so `total_us / count` is a coarse
+ * average for short routines; `max_us` shows the outliers.
+ */
+void hal_get_isr_stats(hal_isr_t isr, hal_isr_stats_t* stats);
+
+/**
+ * @brief Clears the execution time statistics of all interrupt service routines.
+ */
+void hal_reset_isr_stats();
 
 /**
  * @brief Sets the motor's PWM duty cycle and direction.
@@ -50,25 +211,139 @@ void hal_motor_init(uint8_t pwm_a_pin, uint8_t pwm_b_pin, uint8_t bemf_a_pin, ui
  * be called periodically from the main application loop to reflect the latest
  * output from the motor control algorithm (e.g., a PI controller).
  *
+ * @param motor The motor instance returned by `hal_motor_init()`.
  * @param duty_cycle The desired duty cycle, typically in a range from 0 to 255.
- * @param forward The desired motor direction (true for forward, false for rever
-se).
+ * @param forward The desired motor direction (true for forward, false for reverse).
+ */
+void hal_motor_set_pwm(hal_motor_t* motor, int duty_cycle, bool forward);
+
+/**
+ * @brief Opens a BEMF measurement window for one instance.
+ *
+ * Adds the instance to the ADC schedule and starts the acquisition pipeline
+ * if it was idle. Only buffer halves sampled completely after this call are
+ * delivered to the callback. Call this when the drive is switched off for
+ * the measurement, or for a current sense instance when the coil is switched
+ * on; calling it on an armed instance has no effect.
+ *
+ * @param motor The motor instance returned by `hal_motor_init()`.
+ */
+void hal_motor_arm_bemf(hal_motor_t* motor);
+
+/**
+ * @brief Closes the BEMF measurement window of one instance.
+ *
+ * Removes the instance from the ADC schedule and discards its pending
+ * samples. When no instance is armed anymore, the PWM wrap interrupt, the
+ * ADC and the DMA channels are stopped. Call this before the drive is
+ * switched on again.
+ *
+ * @param motor The motor instance returned by `hal_motor_init()`.
+ */
+void hal_motor_disarm_bemf(hal_motor_t* motor);
+
+/**
+ * @brief Processes all completed sample buffer halves.
+ *
+ * Reduces every buffer half the DMA has finished since the last call to a
+ * differential BEMF value and hands it to the owning instance's callback.
+ * Must be called regularly from the main loop; it returns immediately if
+ * no data is pending. A half that the DMA has started to overwrite is
+ * dropped and counted, without reducing it.
+ *
+ * Every half of a motor instance holds its 64 samples as A, B, A, B, ...:
+ * the DMA interrupt points the round robin at input A of the instance whose
+ * half has just started. That interrupt runs after the first conversion of
+ * the half was started, which may still have taken the inputs of the instance
+ * before. The first sample is therefore dropped and the 31 B/A pairs after it
+ * are reduced with `hal_bemf_reduce_terminals()`; the last B is left over.
+ * The value is the average of 31 instead of 32 samples per terminal, so it is
+ * not bit-identical to the former reduction of the whole half in the
+ * interrupt, which could mix the inputs of two instances in its first sample.
+ * A current sense instance drops the first sample of the half the same way
+ * (`hal_current_reduce()`).
+ */
+void hal_motor_service();
+
+/**
+ * @brief Returns the number of sample buffer halves dropped because
+ *        `hal_motor_service()` was called too late.
+ */
+uint32_t hal_motor_get_overrun_count();
+
+/**
+ * @brief Reduces a block of interleaved BEMF samples to a differential value.
+ *
+ * The samples are interleaved as B, A, B, A, ..., i.e. the block starts one
+ * sample into a buffer half (see `hal_motor_service()`). Both terminals are
+ * averaged separately and the absolute difference of the averages is
+ * returned. This is a pure function without hardware access.
+ *
+ * @param samples The interleaved sample block.
+ * @param count The number of samples in the block, must be even.
+ * @return The averaged differential BEMF value.
+ */
+int hal_bemf_reduce(const volatile uint16_t* samples, int count);
+
+/**
+ * @brief Same as `hal_bemf_reduce()`, additionally returns the terminal averages.
+ *
+ * The differential value is exactly `abs(*avg_a - *avg_b)`.
+ *
+ * @param samples The interleaved sample block.
+ * @param count The number of samples in the block, must be even.
+ * @param[out] avg_a The average of the A terminal samples.
+ * @param[out] avg_b The average of the B terminal samples.
+ * @return The averaged differential BEMF value.
+ */
+int hal_bemf_reduce_terminals(const volatile uint16_t* samples, int count, int* avg_a, int* avg_b);
+
+/**
+ * @brief Reduces a block of current samples to one value per `block` samples.
+ *
+ * The first sample of the block may still stem from the inputs of the
+ * instance that had the ADC before and is left out. This is a pure function
+ * without hardware access.
+ *
+ * @param samples The sample block.
+ * @param count The number of samples in the block, a multiple of `block`.
+ * @param block The number of samples averaged into one value, at least 2.
+ * @param[out] values `count / block` averaged values.
+ * @return The number of values.
+ */
+int hal_current_reduce(const volatile uint16_t* samples, int count, int block, int* values);
+
+/**
+ * @brief Returns the terminal averages behind the last measurement of an instance.
+ *
+ * The values are updated by `hal_motor_service()` right before the update
+ * callback is called (for a current sense instance `avg_a` is the current
+ * value and `avg_b` is 0), so inside the callback they belong to the value it
+ * receives. Unlike `hal_motor_get_bemf_buffer()` this is free of races with
+ * the DMA and meant for recording measurements while the control runs.
+ *
+ * @param motor The motor instance returned by `hal_motor_init()`.
+ * @param[out] avg_a The average of the A terminal samples.
+ * @param[out] avg_b The average of the B terminal samples.
  */
-void hal_motor_set_pwm(int duty_cycle, bool forward);
+void hal_motor_get_last_terminals(hal_motor_t* motor, int* avg_a, int* avg_b);
 
 /**
- * @brief Retrieves the BEMF ring buffer for diagnostics.
+ * @brief Retrieves the BEMF sample buffer of one instance for diagnostics.
  *
  * This function provides low-level access to the raw ADC sample buffer.
  * It is intended for debugging and visualization, not for real-time control.
- * The buffer contains interleaved samples from ADC A and ADC B.
+ * The buffer consists of the two ping-pong halves back to back, each with
+ * the interleaved samples A, B, A, B, ... of both terminals; the first sample
+ * of a half may stem from the inputs of another instance.
  *
+ * @param motor The motor instance returned by `hal_motor_init()`.
  * @param[out] buffer A pointer to a uint16_t pointer that will be set to the
- *                    address of the internal ring buffer.
+ *                    address of the instance's sample buffer.
  * @param[out] last_write_pos A pointer to an integer that will be set to the
  *                            last written position in the buffer.
- * @return The total size of the ring buffer (number of samples).
+ * @return The total size of the buffer (number of samples).
  */
-int hal_motor_get_bemf_buffer(volatile uint16_t** buffer, int* last_write_pos);
+int hal_motor_get_bemf_buffer(hal_motor_t* motor, volatile uint16_t** buffer, int* last_write_pos);
 
 #endif // MOTOR_CONTROL_HAL_H
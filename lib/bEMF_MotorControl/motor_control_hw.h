@@ -0,0 +1,155 @@
+/**
+ * @file motor_control_hw.h
+ * @brief Register access behind the motor control HAL.
+ *
+ * `motor_control_hal.cpp` keeps the instances, the round-robin schedule of the
+ * shared ADC, the window generations and the overrun detection free of any
+ * hardware access, so the same code runs on the board and in the native
+ * simulation. It reaches the peripherals only through the `hal_hw_*`
+ * functions below: `motor_control_hw_rp2040.cpp` implements them with the
+ * Pico-SDK, the simulation (`sim/xDuinoRails_Sim/src/hal_sim.cpp`) with a fake
+ * ADC round robin and two fake chained DMA channels.
+ *
+ * This header is internal to the HAL and its platform layers.
+ */
+
+#ifndef MOTOR_CONTROL_HW_H
+#define MOTOR_CONTROL_HW_H
+
+#include "motor_control_hal.h"
+
+/**
+ * @brief Samples per buffer half, i.e. per BEMF measurement.
+ *
+ * Must be even: input A first, then B/A pairs.
+ */
+#define HAL_BEMF_HALF_SAMPLES 64
+
+/**
+ * @brief GPIO of ADC input 0; the inputs 0-3 are located on GPIO 26-29.
+ */
+#define HAL_ADC_FIRST_GPIO 26
+#define HAL_ADC_INPUT_COUNT 4
+
+//== Implemented by motor_control_hal.cpp ==
+
+/**
+ * @brief Hands a completed buffer half over to the HAL.
+ *
+ * Called from the DMA interrupt after the channel of `half` (0: ping,
+ * 1: pong) has written its `HAL_BEMF_HALF_SAMPLES` samples and the chained
+ * channel has taken over. Publishes the half for `hal_motor_service()` and
+ * re-arms the finished channel with `hal_hw_rearm()`.
+ *
+ * @param half The buffer half, i.e. the DMA channel, that is complete.
+ */
+void hal_motor_half_complete(int half);
+
+/**
+ * @brief Returns the HAL to its state after boot.
+ *
+ * Forgets all instances and the trigger mode. Only the native simulation
+ * calls it, between two tests; the peripherals are not touched.
+ */
+void hal_motor_reset();
+
+//== Implemented per platform ==
+
+/**
+ * @brief Tells whether a PWM slice is already running, e.g. for a servo.
+ */
+bool hal_hw_pwm_slice_running(uint8_t slice);
+
+/**
+ * @brief One-time setup of the ADC, both DMA channels and the trigger.
+ *
+ * The ADC stays powered down until `hal_hw_start()`.
+ *
+ * @param mode The trigger mode in use from now on.
+ */
+void hal_hw_init_shared(hal_bemf_trigger_mode_t mode);
+
+/**
+ * @brief Sets up the PWM slice and the BEMF inputs of a motor instance.
+ *
+ * The slice is running afterwards, with both outputs low.
+ */
+void hal_hw_init_motor(uint8_t slice, uint8_t pwm_a_pin, uint8_t pwm_b_pin, uint8_t bemf_a_pin, uint8_t bemf_b_pin);
+
+/**
+ * @brief Sets up the ADC input of a current sense instance.
+ */
+void hal_hw_init_sense(uint8_t sense_pin);
+
+/**
+ * @brief Restarts the motor slices in `slice_mask` together with the trigger slice.
+ *
+ * Only used in the hardware trigger mode, so the trigger wraps a fixed delay
+ * after every motor slice.
+ */
+void hal_hw_sync_trigger_phase(uint32_t slice_mask);
+
+/**
+ * @brief Starts the conversions into the two halves of the first armed instance.
+ *
+ * Must be called with interrupts disabled.
+ *
+ * @param ping The buffer the ping channel fills first.
+ * @param pong The buffer the pong channel fills after it.
+ * @param rrobin_mask The ADC round-robin mask of the instance.
+ * @param first_input The ADC input converted first.
+ * @param sync_slice The PWM slice whose wrap interrupt paces the alarm mode.
+ */
+void hal_hw_start(volatile uint16_t* ping, volatile uint16_t* pong, uint32_t rrobin_mask, uint8_t first_input,
+                  uint8_t sync_slice);
+
+/**
+ * @brief Stops the ADC and both DMA channels, a pending half interrupt is discarded.
+ *
+ * Must be called with interrupts disabled.
+ */
+void hal_hw_stop(uint8_t sync_slice);
+
+/**
+ * @brief Re-arms a finished DMA channel and switches the ADC inputs.
+ *
+ * Called from `hal_motor_half_complete()`, i.e. inside the DMA interrupt.
+ *
+ * @param half The channel that has finished.
+ * @param buffer The buffer it fills when the chained channel is done.
+ * @param rrobin_mask The round-robin mask of the instance whose half is being filled now.
+ * @param input The input of that instance the next conversion is taken on.
+ */
+void hal_hw_rearm(int half, volatile uint16_t* buffer, uint32_t rrobin_mask, uint8_t input);
+
+/**
+ * @brief Returns the number of samples the DMA channel of `half` has written into its buffer.
+ */
+int hal_hw_samples_written(int half);
+
+/**
+ * @brief Returns the address the DMA channel of `half` writes next, `nullptr` if it is idle.
+ */
+volatile uint16_t* hal_hw_write_address(int half);
+
+/**
+ * @brief Sets the PWM level of a motor pin from an 8-bit duty cycle (0-255).
+ */
+void hal_hw_set_pwm(uint8_t pin, int duty_cycle);
+
+/**
+ * @brief Disables the interrupts of the acquisition, returns the state to restore.
+ */
+uint32_t hal_hw_disable_interrupts();
+
+/**
+ * @brief Restores the state returned by `hal_hw_disable_interrupts()`.
+ */
+void hal_hw_restore_interrupts(uint32_t state);
+
+/**
+ * @brief Updates the value of `hal_bemf_get_irq_rate()`, called by `hal_motor_service()`.
+ */
+void hal_hw_update_irq_rate();
+
+#endif // MOTOR_CONTROL_HW_H
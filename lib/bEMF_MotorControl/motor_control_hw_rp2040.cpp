@@ -0,0 +1,326 @@
+/**
+ * @file motor_control_hw_rp2040.cpp
+ * @brief RP2040 register access of the motor control HAL.
+ *
+ * Implements `motor_control_hw.h` with the Pico-SDK's hardware peripherals
+ * (PWM, ADC, DMA). All bookkeeping of the instances and the buffer halves
+ * lives in `motor_control_hal.cpp`; this file only configures and pokes the
+ * peripherals and runs the interrupt handlers.
+ *
+ * In the default hardware trigger mode a spare PWM slice runs with the same
+ * period as the motor slices, but wraps BEMF_MEASUREMENT_DELAY_US later. Its
+ * wrap DREQ paces a DMA channel that sets the START_ONCE bit of the ADC, so
+ * every PWM cycle yields one conversion without any interrupt. The alarm
+ * mode keeps the original PWM wrap IRQ + timer alarm path as a fallback.
+ */
+
+#include "motor_control_hw.h"
+
+#if defined(ARDUINO_ARCH_RP2040)
+
+#include <Arduino.h>
+#include "hardware/pwm.h"
+#include "hardware/dma.h"
+#include "hardware/adc.h"
+#include "hardware/gpio.h"
+#include "hardware/irq.h"
+#include "hardware/sync.h"
+#include "hardware/timer.h"
+
+//== Hardware PWM & BEMF Measurement Parameters ==
+
+// PWM frequency for the motor driver, 25kHz is high enough to be inaudible.
+const uint PWM_FREQUENCY_HZ = 25000;
+// PWM counter wrap value, calculated from the 125MHz system clock.
+// Formula: (SystemClock / PWM_Frequency) - 1. This value determines the PWM resolution.
+static uint16_t PWM_WRAP_VALUE = (125000000 / PWM_FREQUENCY_HZ) - 1;
+// Delay after the PWM cycle before triggering ADC, allows the motor coils' magnetic field to collapse.
+const uint BEMF_MEASUREMENT_DELAY_US = 10;
+// The same delay in PWM counter ticks of the 125MHz system clock.
+const uint BEMF_MEASUREMENT_DELAY_TICKS = BEMF_MEASUREMENT_DELAY_US * (125000000 / 1000000);
+
+//== Static Globals for the shared Hardware ==
+static uint dma_channels[2];             // Chained ping/pong DMA channels for ADC->memory transfers
+static hal_bemf_trigger_mode_t trigger_mode = HAL_BEMF_TRIGGER_HARDWARE;
+static int trigger_dma_channel = -1;     // DMA channel starting the ADC on each trigger slice wrap
+// Written by the trigger DMA to the atomic set alias of ADC CS, so only START_ONCE is touched.
+static const uint32_t adc_start_once = ADC_CS_START_ONCE_BITS;
+static volatile bool acquisition_running = false;
+static volatile uint sync_slice = 0;     // Slice whose wrap interrupt paces the alarm mode
+
+//== Interrupt load statistics ==
+static volatile uint32_t irq_count = 0;  // All BEMF pipeline interrupts since boot
+static uint32_t irq_count_window_start = 0;
+static uint32_t irq_window_start_us = 0;
+static uint32_t irq_rate = 0;
+static volatile hal_isr_stats_t isr_stats[HAL_ISR_COUNT];
+
+// Adds one execution of `isr` that started at `start_us`. Only called from the ISRs.
+static inline void hal_record_isr(hal_isr_t isr, uint32_t start_us) {
+    uint32_t duration = time_us_32() - start_us;
+    volatile hal_isr_stats_t* stats = &isr_stats[isr];
+    stats->count++;
+    stats->total_us += duration;
+    if (duration > stats->max_us) {
+        stats->max_us = duration;
+    }
+}
+
+// DMA ISR: triggered when one buffer half is full.
+static void dma_irq_handler() {
+    uint32_t start_us = time_us_32();
+    irq_count++;
+
+    if (trigger_dma_channel >= 0 && (dma_hw->ints0 & (1u << trigger_dma_channel))) {
+        // The trigger channel ran through its maximum transfer count (~48h at 25kHz), restart it.
+        dma_hw->ints0 = 1u << trigger_dma_channel;
+        dma_channel_set_trans_count(trigger_dma_channel, 0xffffffff, true);
+    }
+
+    for (int half = 0; half < 2; half++) {
+        uint channel = dma_channels[half];
+        if (!(dma_hw->ints0 & (1u << channel))) {
+            continue;
+        }
+        // Clear the DMA interrupt flag for this channel using a bitmask.
+        dma_hw->ints0 = 1u << channel;
+        hal_motor_half_complete(half);
+    }
+    hal_record_isr(HAL_ISR_DMA, start_us);
+}
+
+// One-shot hardware timer callback to trigger the ADC conversion.
+// This is called after the BEMF_MEASUREMENT_DELAY_US to ensure a stable reading.
+static int64_t delayed_adc_trigger_callback(alarm_id_t id, void *user_data) {
+    uint32_t start_us = time_us_32();
+    irq_count++;
+    // Start the ADC in free-running mode, the ping-pong DMA keeps consuming its samples.
+    // The alarm may fire after the acquisition was stopped, the ADC must stay off then.
+    if (acquisition_running) {
+        adc_run(true);
+    }
+    hal_record_isr(HAL_ISR_ALARM, start_us);
+    return 0; // Returning 0 prevents the timer from rescheduling.
+}
+
+// PWM Wrap ISR: synchronizes ADC measurement with the PWM cycle.
+// This is triggered at the end of each PWM cycle of the sync slice.
+static void on_pwm_wrap() {
+    uint32_t start_us = time_us_32();
+    irq_count++;
+    pwm_clear_irq(sync_slice);
+    // Schedule the ADC trigger to run after the specified delay.
+    add_alarm_in_us(BEMF_MEASUREMENT_DELAY_US, delayed_adc_trigger_callback, NULL, true);
+    hal_record_isr(HAL_ISR_PWM_WRAP, start_us);
+}
+
+// Sets up the trigger slice and the DMA channel that starts one ADC conversion per wrap.
+static void hal_init_trigger() {
+    // Same period as the motor slices, the phase is aligned in hal_hw_sync_trigger_phase().
+    pwm_config trigger_pwm_conf = pwm_get_default_config();
+    pwm_config_set_wrap(&trigger_pwm_conf, PWM_WRAP_VALUE);
+    pwm_init(HAL_BEMF_TRIGGER_PWM_SLICE, &trigger_pwm_conf, false);
+
+    trigger_dma_channel = dma_claim_unused_channel(true);
+    dma_channel_config dma_config = dma_channel_get_default_config(trigger_dma_channel);
+    channel_config_set_transfer_data_size(&dma_config, DMA_SIZE_32);
+    channel_config_set_read_increment(&dma_config, false);
+    channel_config_set_write_increment(&dma_config, false);
+    channel_config_set_dreq(&dma_config, pwm_get_dreq(HAL_BEMF_TRIGGER_PWM_SLICE)); // One transfer per trigger wrap
+    dma_channel_configure(trigger_dma_channel, &dma_config, hw_set_alias(&adc_hw->cs), &adc_start_once, 0xffffffff, false);
+    dma_channel_set_irq0_enabled(trigger_dma_channel, true);
+}
+
+bool hal_hw_pwm_slice_running(uint8_t slice) {
+    return pwm_hw->slice[slice].csr & PWM_CH0_CSR_EN_BITS;
+}
+
+void hal_hw_init_shared(hal_bemf_trigger_mode_t mode) {
+    trigger_mode = mode;
+
+    // --- ADC and DMA Setup ---
+    adc_init();
+    // Configure the ADC FIFO to generate a DMA request (DREQ) for every sample.
+    adc_fifo_setup(true, true, 1, false, false);
+
+    dma_channels[0] = dma_claim_unused_channel(true);
+    dma_channels[1] = dma_claim_unused_channel(true);
+    for (uint half = 0; half < 2; half++) {
+        dma_channel_config dma_config = dma_channel_get_default_config(dma_channels[half]);
+        channel_config_set_transfer_data_size(&dma_config, DMA_SIZE_16); // 16-bit ADC samples
+        channel_config_set_read_increment(&dma_config, false);           // Read from same ADC FIFO address
+        channel_config_set_write_increment(&dma_config, true);           // Write to sequential buffer addresses
+        channel_config_set_dreq(&dma_config, DREQ_ADC);                  // Trigger DMA from ADC
+        // When this half is full, the other channel continues without a gap.
+        channel_config_set_chain_to(&dma_config, dma_channels[half ^ 1]);
+
+        // Apply the DMA config: read from ADC FIFO, the write address is set per instance.
+        dma_channel_configure(dma_channels[half], &dma_config, NULL, &adc_hw->fifo, HAL_BEMF_HALF_SAMPLES, false);
+        dma_channel_set_irq0_enabled(dma_channels[half], true);
+    }
+    if (trigger_mode == HAL_BEMF_TRIGGER_HARDWARE) {
+        hal_init_trigger();
+    } else {
+        // --- PWM Interrupt for Synchronization ---
+        // The wrap interrupt itself is only enabled while acquisition runs.
+        irq_set_exclusive_handler(PWM_IRQ_WRAP, on_pwm_wrap);
+        irq_set_enabled(PWM_IRQ_WRAP, true);
+    }
+    // The ADC stays powered down until the first measurement window is armed.
+    hw_clear_bits(&adc_hw->cs, ADC_CS_EN_BITS);
+
+    // Set up the DMA interrupt handler.
+    irq_set_exclusive_handler(DMA_IRQ_0, dma_irq_handler);
+    irq_set_enabled(DMA_IRQ_0, true);
+}
+
+void hal_hw_init_motor(uint8_t slice, uint8_t pwm_a_pin, uint8_t pwm_b_pin, uint8_t bemf_a_pin, uint8_t bemf_b_pin) {
+    adc_gpio_init(bemf_b_pin);
+    adc_gpio_init(bemf_a_pin);
+
+    // --- PWM Setup for Motor Control ---
+    gpio_set_function(pwm_a_pin, GPIO_FUNC_PWM);
+    gpio_set_function(pwm_b_pin, GPIO_FUNC_PWM);
+
+    pwm_config motor_pwm_conf = pwm_get_default_config();
+    pwm_config_set_wrap(&motor_pwm_conf, PWM_WRAP_VALUE);
+    pwm_init(slice, &motor_pwm_conf, true);
+}
+
+void hal_hw_init_sense(uint8_t sense_pin) {
+    adc_gpio_init(sense_pin);
+}
+
+void hal_hw_sync_trigger_phase(uint32_t slice_mask) {
+    uint32_t enabled = pwm_hw->en;
+    pwm_set_mask_enabled(enabled & ~slice_mask);
+    for (uint slice = 0; slice < NUM_PWM_SLICES; slice++) {
+        if ((slice_mask & (1u << slice)) && slice != HAL_BEMF_TRIGGER_PWM_SLICE) {
+            pwm_set_counter(slice, 0);
+        }
+    }
+    // The trigger wraps exactly BEMF_MEASUREMENT_DELAY_TICKS after every motor slice.
+    pwm_set_counter(HAL_BEMF_TRIGGER_PWM_SLICE, PWM_WRAP_VALUE + 1 - BEMF_MEASUREMENT_DELAY_TICKS);
+    // A single register write starts all slices on the same clock edge.
+    pwm_set_mask_enabled(enabled | slice_mask);
+}
+
+void hal_hw_start(volatile uint16_t* ping, volatile uint16_t* pong, uint32_t rrobin_mask, uint8_t first_input,
+                  uint8_t slice) {
+    hw_set_bits(&adc_hw->cs, ADC_CS_EN_BITS);
+    adc_fifo_drain();
+
+    dma_channel_set_trans_count(dma_channels[1], HAL_BEMF_HALF_SAMPLES, false);
+    dma_channel_set_write_addr(dma_channels[1], pong, false);
+    // Round robin starts at the selected input. Without this the first halves would start
+    // wherever AINSEL was left, and A and B would be swapped.
+    adc_select_input(first_input);
+    adc_set_round_robin(rrobin_mask);
+    // Arm the ping channel, which will now wait for the first ADC trigger.
+    dma_channel_set_trans_count(dma_channels[0], HAL_BEMF_HALF_SAMPLES, false);
+    dma_channel_set_write_addr(dma_channels[0], ping, true);
+
+    acquisition_running = true;
+    sync_slice = slice;
+    if (trigger_mode == HAL_BEMF_TRIGGER_HARDWARE) {
+        // From now on the trigger slice starts every conversion, no PWM interrupt is needed.
+        dma_channel_set_trans_count(trigger_dma_channel, 0xffffffff, true);
+        return;
+    }
+
+    // All slices run at the same frequency, so one of them is enough to pace the ADC start.
+    pwm_clear_irq(slice);
+    // Enable the interrupt that fires when the PWM counter wraps.
+    pwm_set_irq_enabled(slice, true);
+}
+
+void hal_hw_stop(uint8_t slice) {
+    if (trigger_mode == HAL_BEMF_TRIGGER_HARDWARE) {
+        dma_channel_abort(trigger_dma_channel);
+    } else {
+        pwm_set_irq_enabled(slice, false);
+        pwm_clear_irq(slice);
+    }
+    acquisition_running = false;
+    adc_run(false);
+
+    // Abort both chained channels at once, so neither can restart the other.
+    uint32_t channel_mask = (1u << dma_channels[0]) | (1u << dma_channels[1]);
+    dma_hw->abort = channel_mask;
+    while (dma_hw->abort & channel_mask) {
+        tight_loop_contents();
+    }
+    // An abort may raise a completion interrupt, discard it.
+    dma_hw->ints0 = channel_mask | (trigger_dma_channel >= 0 ? (1u << trigger_dma_channel) : 0);
+
+    adc_fifo_drain();
+    hw_clear_bits(&adc_hw->cs, ADC_CS_EN_BITS);
+}
+
+void hal_hw_rearm(int half, volatile uint16_t* buffer, uint32_t rrobin_mask, uint8_t input) {
+    dma_channel_set_write_addr(dma_channels[half], buffer, false);
+    hw_write_masked(&adc_hw->cs,
+                    (rrobin_mask << ADC_CS_RROBIN_LSB) | ((uint32_t)input << ADC_CS_AINSEL_LSB),
+                    ADC_CS_RROBIN_BITS | ADC_CS_AINSEL_BITS);
+}
+
+int hal_hw_samples_written(int half) {
+    // The transfer count of a running channel counts down the transfers still to do.
+    return HAL_BEMF_HALF_SAMPLES - dma_hw->ch[dma_channels[half]].transfer_count;
+}
+
+volatile uint16_t* hal_hw_write_address(int half) {
+    uint channel = dma_channels[half];
+    if (!dma_channel_is_busy(channel)) {
+        return nullptr;
+    }
+    return (volatile uint16_t*)(uintptr_t)dma_hw->ch[channel].write_addr;
+}
+
+void hal_hw_set_pwm(uint8_t pin, int duty_cycle) {
+    // Map the 8-bit duty cycle (0-255) to the PWM counter's range.
+    pwm_set_gpio_level(pin, map(duty_cycle, 0, 255, 0, PWM_WRAP_VALUE));
+}
+
+uint32_t hal_hw_disable_interrupts() {
+    return save_and_disable_interrupts();
+}
+
+void hal_hw_restore_interrupts(uint32_t state) {
+    restore_interrupts(state);
+}
+
+void hal_hw_update_irq_rate() {
+    uint32_t now_us = time_us_32();
+    if (now_us - irq_window_start_us >= 1000000) {
+        uint32_t count = irq_count;
+        irq_rate = count - irq_count_window_start;
+        irq_count_window_start = count;
+        irq_window_start_us = now_us;
+    }
+}
+
+uint32_t hal_bemf_get_irq_rate() {
+    return irq_rate;
+}
+
+void hal_get_isr_stats(hal_isr_t isr, hal_isr_stats_t* stats) {
+    // Consistent snapshot, the ISRs may update the fields at any time.
+    uint32_t irq_state = save_and_disable_interrupts();
+    stats->count = isr_stats[isr].count;
+    stats->total_us = isr_stats[isr].total_us;
+    stats->max_us = isr_stats[isr].max_us;
+    restore_interrupts(irq_state);
+}
+
+void hal_reset_isr_stats() {
+    uint32_t irq_state = save_and_disable_interrupts();
+    for (int isr = 0; isr < HAL_ISR_COUNT; isr++) {
+        isr_stats[isr].count = 0;
+        isr_stats[isr].total_us = 0;
+        isr_stats[isr].max_us = 0;
+    }
+    restore_interrupts(irq_state);
+}
+
+#endif // ARDUINO_ARCH_RP2040
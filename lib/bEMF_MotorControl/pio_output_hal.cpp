@@ -0,0 +1,349 @@
+#include "pio_output_hal.h"
+
+// Widths above this leave no room for the other segments and count as constantly high.
+static const uint32_t PIO_OUT_MAX_PULSE_US = HAL_PIO_OUT_FRAME_US - HAL_PIO_OUT_SEGMENTS * HAL_PIO_OUT_MIN_SEGMENT_US;
+
+static bool is_pulse(uint16_t width) {
+    return width != 0 && width <= PIO_OUT_MAX_PULSE_US;
+}
+
+// Platform independent, so the table semantics can be verified off-target.
+void hal_pio_out_build_table(const uint32_t* masks, const uint16_t* widths, int count,
+                             hal_pio_out_segment_t* table) {
+    uint32_t levels = 0;
+    // Channels with a pulse, sorted by width (insertion sort, there are only a few)
+    int order[HAL_PIO_OUT_MAX_CHANNELS];
+    int pulses = 0;
+    for (int i = 0; i < count; i++) {
+        if (widths[i] == 0) {
+            continue;
+        }
+        levels |= masks[i];
+        if (is_pulse(widths[i])) {
+            int j = pulses++;
+            while (j > 0 && widths[order[j - 1]] > widths[i]) {
+                order[j] = order[j - 1];
+                j--;
+            }
+            order[j] = i;
+        }
+    }
+
+    // One segment up to each distinct pulse end, then the pulses of that width end.
+    int n = 0;
+    uint32_t t = 0;
+    for (int i = 0; i < pulses;) {
+        uint16_t width = widths[order[i]];
+        uint32_t duration = width > t + HAL_PIO_OUT_MIN_SEGMENT_US ? width - t : HAL_PIO_OUT_MIN_SEGMENT_US;
+        table[n].levels = levels;
+        table[n].delay = duration - HAL_PIO_OUT_MIN_SEGMENT_US;
+        n++;
+        t += duration;
+        while (i < pulses && widths[order[i]] == width) {
+            levels &= ~masks[order[i]];
+            i++;
+        }
+    }
+
+    // The rest of the frame in equal slices, the last one takes the remainder.
+    int slices = HAL_PIO_OUT_SEGMENTS - n;
+    uint32_t slice = (HAL_PIO_OUT_FRAME_US - t) / slices;
+    for (; n < HAL_PIO_OUT_SEGMENTS - 1; n++) {
+        table[n].levels = levels;
+        table[n].delay = slice - HAL_PIO_OUT_MIN_SEGMENT_US;
+        t += slice;
+    }
+    table[n].levels = levels;
+    table[n].delay = HAL_PIO_OUT_FRAME_US - t - HAL_PIO_OUT_MIN_SEGMENT_US;
+}
+
+#if defined(ARDUINO_ARCH_RP2040)
+
+#include <Arduino.h>
+#include "hardware/pio.h"
+#include "hardware/dma.h"
+#include "hardware/clocks.h"
+#include "hardware/timer.h"
+
+// The state machine runs at 1MHz, one cycle per µs.
+static const uint32_t PIO_OUT_SM_HZ = 1000000;
+
+struct hal_pio_out {
+    bool in_use;
+    bool playing;
+    uint8_t pin;
+    uint16_t width;       // Width of the channel, published or to be published
+    int frames;           // Length of the playing profile
+    uint32_t start_us;    // Start of the playing profile
+};
+
+static hal_pio_out_t channels[HAL_PIO_OUT_MAX_CHANNELS];
+static uint16_t profile_buffers[HAL_PIO_OUT_MAX_CHANNELS][HAL_PIO_OUT_MAX_FRAMES];
+static int channel_count;
+
+// Double-buffered tables. The spare segment keeps the end of the first table apart
+// from the start of the second, so the DMA read address tells which one is read.
+static hal_pio_out_segment_t tables[2][HAL_PIO_OUT_SEGMENTS + 1];
+// Table the control DMA channel restarts the data channel with at the end of a frame.
+static const hal_pio_out_segment_t* volatile next_table;
+static bool table_pending;  // A width changed that needs a new table
+static int playing_count;
+
+static PIO out_pio;
+static uint out_sm;
+static uint out_offset;
+static uint out_base;       // GPIO of level bit 0
+static int data_dma = -1;
+static int control_dma = -1;
+
+// Program, in pioasm notation (autopull of 32 bits):
+//
+//   .wrap_target
+//       out pins, 32          ; levels of the segment
+//       out x, 32             ; duration - 3
+//   delay:
+//       jmp x-- delay
+//   .wrap
+static uint16_t out_program_instructions[3];
+
+static uint32_t channel_mask(const hal_pio_out_t* channel) {
+    return 1u << (channel->pin - out_base);
+}
+
+static void build_into(hal_pio_out_segment_t* table) {
+    uint32_t masks[HAL_PIO_OUT_MAX_CHANNELS];
+    uint16_t widths[HAL_PIO_OUT_MAX_CHANNELS];
+    for (int i = 0; i < channel_count; i++) {
+        masks[i] = channel_mask(&channels[i]);
+        widths[i] = channels[i].width;
+    }
+    hal_pio_out_build_table(masks, widths, channel_count, table);
+}
+
+static bool claim_state_machine(PIO pio, const pio_program_t* program) {
+    if (!pio_can_add_program(pio, program)) {
+        return false;
+    }
+    int sm = pio_claim_unused_sm(pio, false);
+    if (sm < 0) {
+        return false;
+    }
+    out_pio = pio;
+    out_sm = sm;
+    out_offset = pio_add_program(pio, program);
+    return true;
+}
+
+static bool claim_engine() {
+    out_program_instructions[0] = pio_encode_out(pio_pins, 32);
+    out_program_instructions[1] = pio_encode_out(pio_x, 32);
+    out_program_instructions[2] = pio_encode_jmp_x_dec(2);
+    pio_program_t program = {};
+    program.instructions = out_program_instructions;
+    program.length = 3;
+    program.origin = -1;
+
+    if (!claim_state_machine(pio0, &program) && !claim_state_machine(pio1, &program)) {
+        return false;
+    }
+    data_dma = dma_claim_unused_channel(false);
+    control_dma = dma_claim_unused_channel(false);
+    if (data_dma >= 0 && control_dma >= 0) {
+        return true;
+    }
+    // Give everything back, so a later hal_pio_out_add() or another driver can use it.
+    if (data_dma >= 0) {
+        dma_channel_unclaim(data_dma);
+    }
+    if (control_dma >= 0) {
+        dma_channel_unclaim(control_dma);
+    }
+    data_dma = -1;
+    control_dma = -1;
+    pio_remove_program(out_pio, &program, out_offset);
+    pio_sm_unclaim(out_pio, out_sm);
+    return false;
+}
+
+static void stop_engine() {
+    pio_sm_set_enabled(out_pio, out_sm, false);
+    // Without its chain the data channel cannot restart the control channel while it is aborted.
+    dma_channel_config config = dma_channel_get_default_config(data_dma);
+    channel_config_set_chain_to(&config, data_dma);
+    dma_channel_set_config(data_dma, &config, false);
+    dma_channel_abort(control_dma);
+    dma_channel_abort(data_dma);
+    pio_sm_clear_fifos(out_pio, out_sm);
+}
+
+static void start_engine() {
+    uint lowest = 31, highest = 0;
+    uint32_t pins = 0;
+    for (int i = 0; i < channel_count; i++) {
+        lowest = channels[i].pin < lowest ? channels[i].pin : lowest;
+        highest = channels[i].pin > highest ? channels[i].pin : highest;
+        pins |= 1u << channels[i].pin;
+    }
+    out_base = lowest;
+
+    pio_sm_config sm_config = pio_get_default_sm_config();
+    sm_config_set_wrap(&sm_config, out_offset, out_offset + 2);
+    sm_config_set_out_pins(&sm_config, out_base, highest - out_base + 1);
+    sm_config_set_out_shift(&sm_config, true, true, 32);
+    sm_config_set_clkdiv(&sm_config, (float)clock_get_hz(clk_sys) / PIO_OUT_SM_HZ);
+    pio_sm_init(out_pio, out_sm, out_offset, &sm_config);
+    pio_sm_set_pins_with_mask(out_pio, out_sm, 0, pins);
+    pio_sm_set_pindirs_with_mask(out_pio, out_sm, pins, pins);
+
+    build_into(tables[0]);
+    next_table = tables[0];
+    table_pending = false;
+
+    // The control channel writes the next table's address into the data channel and retriggers it.
+    dma_channel_config control_config = dma_channel_get_default_config(control_dma);
+    channel_config_set_transfer_data_size(&control_config, DMA_SIZE_32);
+    channel_config_set_read_increment(&control_config, false);
+    channel_config_set_write_increment(&control_config, false);
+    dma_channel_configure(control_dma, &control_config, &dma_hw->ch[data_dma].al3_read_addr_trig,
+                          &next_table, 1, false);
+
+    dma_channel_config data_config = dma_channel_get_default_config(data_dma);
+    channel_config_set_transfer_data_size(&data_config, DMA_SIZE_32);
+    channel_config_set_read_increment(&data_config, true);
+    channel_config_set_write_increment(&data_config, false);
+    channel_config_set_dreq(&data_config, pio_get_dreq(out_pio, out_sm, true));
+    channel_config_set_chain_to(&data_config, control_dma);
+    dma_channel_configure(data_dma, &data_config, &out_pio->txf[out_sm], tables[0],
+                          HAL_PIO_OUT_SEGMENTS * 2, true);
+
+    pio_sm_set_enabled(out_pio, out_sm, true);
+}
+
+hal_pio_out_t* hal_pio_out_add(uint8_t pin, uint16_t width_us) {
+    if (channel_count >= HAL_PIO_OUT_MAX_CHANNELS) {
+        return nullptr;
+    }
+    if (data_dma < 0) {
+        if (!claim_engine()) {
+            return nullptr;
+        }
+    } else {
+        stop_engine();
+    }
+
+    // All pins of one `out` must be within 32 GPIOs, which the RP2040 always satisfies.
+    hal_pio_out_t* channel = &channels[channel_count++];
+    channel->in_use = true;
+    channel->playing = false;
+    channel->pin = pin;
+    channel->width = width_us;
+    pio_gpio_init(out_pio, pin);
+
+    start_engine();
+    return channel;
+}
+
+// Switches a constantly low or high channel in the running table and in the spare one.
+static void patch_level(hal_pio_out_t* channel, bool high) {
+    uint32_t mask = channel_mask(channel);
+    for (int t = 0; t < 2; t++) {
+        for (int s = 0; s < HAL_PIO_OUT_SEGMENTS; s++) {
+            if (high) {
+                tables[t][s].levels |= mask;
+            } else {
+                tables[t][s].levels &= ~mask;
+            }
+        }
+    }
+}
+
+static void set_width(hal_pio_out_t* channel, uint16_t width_us) {
+    if (channel->width == width_us) {
+        return;
+    }
+    if (!is_pulse(channel->width) && !is_pulse(width_us)) {
+        patch_level(channel, width_us != 0);
+    } else {
+        table_pending = true;
+    }
+    channel->width = width_us;
+}
+
+void hal_pio_out_set(hal_pio_out_t* channel, uint16_t width_us) {
+    if (channel == nullptr) {
+        return;
+    }
+    hal_pio_out_stop(channel);
+    set_width(channel, width_us);
+    hal_pio_out_service();
+}
+
+uint16_t hal_pio_out_get(hal_pio_out_t* channel) {
+    return channel->width;
+}
+
+uint16_t* hal_pio_out_get_profile_buffer(hal_pio_out_t* channel) {
+    return profile_buffers[channel - channels];
+}
+
+void hal_pio_out_play(hal_pio_out_t* channel, int frames) {
+    if (channel == nullptr || frames <= 0) {
+        return;
+    }
+    if (frames > HAL_PIO_OUT_MAX_FRAMES) {
+        frames = HAL_PIO_OUT_MAX_FRAMES;
+    }
+    hal_pio_out_stop(channel);
+    channel->frames = frames;
+    channel->start_us = time_us_32();
+    channel->playing = true;
+    playing_count++;
+    hal_pio_out_service();
+}
+
+void hal_pio_out_stop(hal_pio_out_t* channel) {
+    if (channel != nullptr && channel->playing) {
+        channel->playing = false;
+        playing_count--;
+    }
+}
+
+bool hal_pio_out_is_playing(hal_pio_out_t* channel) {
+    return channel != nullptr && channel->playing;
+}
+
+void hal_pio_out_service() {
+    if (!table_pending && playing_count == 0) {
+        return;
+    }
+
+    uint32_t now_us = time_us_32();
+    for (int i = 0; i < channel_count && playing_count > 0; i++) {
+        hal_pio_out_t* channel = &channels[i];
+        if (!channel->playing) {
+            continue;
+        }
+        int frame = (now_us - channel->start_us) / HAL_PIO_OUT_FRAME_US;
+        if (frame >= channel->frames - 1) {
+            frame = channel->frames - 1;
+            hal_pio_out_stop(channel);
+        }
+        set_width(channel, profile_buffers[i][frame]);
+    }
+
+    if (!table_pending) {
+        return;
+    }
+    // The spare table may only be rewritten once the data channel has moved on to the published one.
+    const hal_pio_out_segment_t* published = next_table;
+    uintptr_t read_addr = dma_hw->ch[data_dma].read_addr;
+    if (read_addr < (uintptr_t)published || read_addr > (uintptr_t)(published + HAL_PIO_OUT_SEGMENTS)) {
+        return; // Still in the frame of the previous table, try again on the next call
+    }
+    hal_pio_out_segment_t* spare = published == tables[0] ? tables[1] : tables[0];
+    build_into(spare);
+    next_table = spare;
+    table_pending = false;
+}
+
+#endif // ARDUINO_ARCH_RP2040
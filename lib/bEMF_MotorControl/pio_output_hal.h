@@ -0,0 +1,167 @@
+/**
+ * @file pio_output_hal.h
+ * @brief Hardware Abstraction Layer (HAL) for servo and coil outputs on a PIO state machine.
+ *
+ * One PIO state machine drives up to `HAL_PIO_OUT_MAX_CHANNELS` outputs on
+ * any GPIOs, independent of the PWM slices. Every channel has a width: 0 is
+ * constantly low, `HAL_PIO_OUT_ON` constantly high (a coil pulse), and any
+ * other value a pulse of that many µs at the start of every frame of
+ * `HAL_PIO_OUT_FRAME_US` (a servo signal).
+ *
+ * The widths are compiled into a table of segments, each one the levels of
+ * all channels and how long they are held (see `hal_pio_out_build_table()`).
+ * A DMA channel feeds the table to the state machine and a second one restarts
+ * it at the end of every frame, so the waveform runs without CPU work. A new
+ * pulse width is written into a second table that takes effect at the next
+ * frame. Switching a channel between constantly low and high only patches its
+ * level bit in the tables; as the time after the pulses is split into slices
+ * of at most 1ms, a coil is switched within about 2ms.
+ *
+ * Servo motion profiles (one width per frame) are advanced by
+ * `hal_pio_out_service()`, which must be called regularly from the main loop.
+ * It rebuilds the table at most once per frame and only while something
+ * changed.
+ *
+ * All channels are driven by one `out` instruction over the GPIO range from
+ * the lowest to the highest channel pin. No other state machine of the same
+ * PIO block may drive a pin within that range.
+ */
+#ifndef PIO_OUTPUT_HAL_H
+#define PIO_OUTPUT_HAL_H
+
+#include <cstdint>
+
+/**
+ * @brief Maximum number of output channels.
+ */
+#ifndef HAL_PIO_OUT_MAX_CHANNELS
+#define HAL_PIO_OUT_MAX_CHANNELS 16
+#endif
+
+/**
+ * @brief Capacity of the profile buffer of each channel, in frames.
+ *
+ * 128 frames of 20ms allow servo moves of up to 2.56s.
+ */
+#ifndef HAL_PIO_OUT_MAX_FRAMES
+#define HAL_PIO_OUT_MAX_FRAMES 128
+#endif
+
+/**
+ * @brief Length of one frame in µs, the servo frame rate.
+ */
+#define HAL_PIO_OUT_FRAME_US 20000
+
+/**
+ * @brief Width of a channel that is constantly high.
+ */
+#define HAL_PIO_OUT_ON 0xFFFF
+
+/**
+ * @brief Number of slices the time after the pulses is split into.
+ */
+#define HAL_PIO_OUT_SLICES (HAL_PIO_OUT_FRAME_US / 1000)
+
+/**
+ * @brief Segments of a table: one per distinct pulse width plus the slices of the rest of the frame.
+ */
+#define HAL_PIO_OUT_SEGMENTS (HAL_PIO_OUT_MAX_CHANNELS + HAL_PIO_OUT_SLICES)
+
+/**
+ * @brief Shortest segment in µs, the state machine needs 3 cycles per segment.
+ */
+#define HAL_PIO_OUT_MIN_SEGMENT_US 3
+
+/**
+ * @brief One segment of the output table, as read by the state machine.
+ */
+typedef struct {
+    uint32_t levels; ///< Output levels, bit n is the pin `base + n`
+    uint32_t delay;  ///< Duration in µs minus `HAL_PIO_OUT_MIN_SEGMENT_US`
+} hal_pio_out_segment_t;
+
+/**
+ * @brief Opaque handle of one output channel.
+ */
+typedef struct hal_pio_out hal_pio_out_t;
+
+/**
+ * @brief Adds an output channel on `pin` and (re)starts the engine.
+ *
+ * The first call claims a PIO state machine and two DMA channels. Adding a
+ * channel restarts the waveform, so add all channels at startup.
+ *
+ * @param pin GPIO of the output.
+ * @param width_us Initial width, see the file description.
+ * @return The channel, or `nullptr` if the channel pool is exhausted or no
+ *         state machine, instruction memory or DMA channel is free.
+ */
+hal_pio_out_t* hal_pio_out_add(uint8_t pin, uint16_t width_us);
+
+/**
+ * @brief Sets the width of a channel; a running profile is stopped.
+ *
+ * A change between 0 and `HAL_PIO_OUT_ON` takes effect within about 2ms.
+ * A pulse width takes effect with the next frame that starts after
+ * `hal_pio_out_service()` has published it.
+ */
+void hal_pio_out_set(hal_pio_out_t* channel, uint16_t width_us);
+
+/**
+ * @brief Returns the width the channel outputs (or will output from the next frame on).
+ */
+uint16_t hal_pio_out_get(hal_pio_out_t* channel);
+
+/**
+ * @brief Returns the profile buffer of a channel (HAL_PIO_OUT_MAX_FRAMES entries).
+ *
+ * Fill it with widths in µs, then start it with `hal_pio_out_play()`. The
+ * buffer must not be changed while a profile is playing.
+ */
+uint16_t* hal_pio_out_get_profile_buffer(hal_pio_out_t* channel);
+
+/**
+ * @brief Plays the first `frames` entries of the profile buffer, one per frame.
+ *
+ * After the last frame the final width is held.
+ */
+void hal_pio_out_play(hal_pio_out_t* channel, int frames);
+
+/**
+ * @brief Stops a running profile, the current width is held.
+ */
+void hal_pio_out_stop(hal_pio_out_t* channel);
+
+/**
+ * @brief True while a profile is being played.
+ */
+bool hal_pio_out_is_playing(hal_pio_out_t* channel);
+
+/**
+ * @brief Advances the profiles and publishes changed widths.
+ *
+ * Returns at once if nothing has changed and no profile is playing.
+ */
+void hal_pio_out_service();
+
+/**
+ * @brief Compiles channel widths into an output table.
+ *
+ * All channels with a width other than 0 start high at the beginning of the
+ * frame. The pulses end in the order of their widths; edges closer together
+ * than `HAL_PIO_OUT_MIN_SEGMENT_US` are delayed by the difference. Widths
+ * that leave no room for the rest of the frame count as `HAL_PIO_OUT_ON`.
+ * The rest of the frame is split evenly into the remaining segments. The
+ * table always has `HAL_PIO_OUT_SEGMENTS` segments whose durations add up to
+ * `HAL_PIO_OUT_FRAME_US`, so it can be exchanged without changing the DMA
+ * transfer count. This is a pure function without hardware access.
+ *
+ * @param masks The level bit of each channel.
+ * @param widths The width of each channel.
+ * @param count The number of channels, at most `HAL_PIO_OUT_MAX_CHANNELS`.
+ * @param[out] table `HAL_PIO_OUT_SEGMENTS` segments.
+ */
+void hal_pio_out_build_table(const uint32_t* masks, const uint16_t* widths, int count,
+                             hal_pio_out_segment_t* table);
+
+#endif // PIO_OUTPUT_HAL_H
@@ -0,0 +1,106 @@
+#include "servo_pwm_hal.h"
+
+#if defined(ARDUINO_ARCH_RP2040)
+
+#include <Arduino.h>
+#include "hardware/pwm.h"
+#include "hardware/dma.h"
+#include "hardware/gpio.h"
+#include "hardware/clocks.h"
+#include "motor_control_hal.h"
+
+// The slice counts in µs, whatever the system clock (125MHz by default, often overclocked).
+static const uint32_t SERVO_TICK_HZ = 1000000;
+static const uint16_t SERVO_WRAP = HAL_SERVO_FRAME_US - 1;
+
+struct hal_servo {
+    bool in_use;
+    uint slice;
+    uint channel;  // PWM channel (A/B) of the pin
+    int dma_channel;
+};
+
+static hal_servo_t servos[HAL_SERVO_MAX_INSTANCES];
+static uint16_t profile_buffers[HAL_SERVO_MAX_INSTANCES][HAL_SERVO_MAX_FRAMES];
+
+hal_servo_t* hal_servo_init(uint8_t pin, uint16_t pulse_us) {
+    uint slice = pwm_gpio_to_slice_num(pin);
+    // A running slice belongs to someone else (e.g. a BEMF motor); the trigger slice is reserved.
+    if ((pwm_hw->slice[slice].csr & PWM_CH0_CSR_EN_BITS) || slice == HAL_BEMF_TRIGGER_PWM_SLICE) {
+        return nullptr;
+    }
+
+    int index = -1;
+    for (int i = 0; i < HAL_SERVO_MAX_INSTANCES; i++) {
+        if (!servos[i].in_use) {
+            index = i;
+            break;
+        }
+    }
+    if (index < 0) {
+        return nullptr; // Instance pool exhausted
+    }
+    int dma_channel = dma_claim_unused_channel(false);
+    if (dma_channel < 0) {
+        return nullptr;
+    }
+
+    hal_servo_t* servo = &servos[index];
+    servo->slice = slice;
+    servo->channel = pwm_gpio_to_channel(pin);
+    servo->dma_channel = dma_channel;
+    servo->in_use = true;
+
+    pwm_config config = pwm_get_default_config();
+    pwm_config_set_clkdiv(&config, (float)clock_get_hz(clk_sys) / SERVO_TICK_HZ);
+    pwm_config_set_wrap(&config, SERVO_WRAP);
+    pwm_init(slice, &config, false);
+    pwm_set_chan_level(slice, servo->channel, pulse_us);
+    gpio_set_function(pin, GPIO_FUNC_PWM);
+    pwm_set_enabled(slice, true);
+
+    // One 16-bit write per wrap into the compare register. The bus replicates it
+    // into both halves, so the pin's channel gets it regardless of A or B.
+    dma_channel_config dma_config = dma_channel_get_default_config(dma_channel);
+    channel_config_set_transfer_data_size(&dma_config, DMA_SIZE_16);
+    channel_config_set_read_increment(&dma_config, true);
+    channel_config_set_write_increment(&dma_config, false);
+    channel_config_set_dreq(&dma_config, pwm_get_dreq(slice));
+    dma_channel_configure(dma_channel, &dma_config, &pwm_hw->slice[slice].cc, profile_buffers[index], 0, false);
+    return servo;
+}
+
+uint16_t* hal_servo_get_profile_buffer(hal_servo_t* servo) {
+    return profile_buffers[servo - servos];
+}
+
+void hal_servo_play(hal_servo_t* servo, int frames) {
+    if (servo == nullptr || frames <= 0) {
+        return;
+    }
+    if (frames > HAL_SERVO_MAX_FRAMES) {
+        frames = HAL_SERVO_MAX_FRAMES;
+    }
+    hal_servo_stop(servo);
+    dma_channel_set_read_addr(servo->dma_channel, profile_buffers[servo - servos], false);
+    dma_channel_set_trans_count(servo->dma_channel, frames, true);
+}
+
+void hal_servo_stop(hal_servo_t* servo) {
+    if (servo == nullptr) {
+        return;
+    }
+    // The compare register keeps the last value written, so the servo holds its position.
+    dma_channel_abort(servo->dma_channel);
+}
+
+bool hal_servo_is_playing(hal_servo_t* servo) {
+    return servo != nullptr && dma_channel_is_busy(servo->dma_channel);
+}
+
+uint16_t hal_servo_get_pulse(hal_servo_t* servo) {
+    uint32_t cc = pwm_hw->slice[servo->slice].cc;
+    return servo->channel == PWM_CHAN_B ? cc >> 16 : cc & 0xFFFF;
+}
+
+#endif // ARDUINO_ARCH_RP2040
@@ -0,0 +1,87 @@
+/**
+ * @file servo_pwm_hal.h
+ * @brief Hardware Abstraction Layer (HAL) for servo outputs with hardware motion playback.
+ *
+ * Every servo is represented by a `hal_servo_t` instance that owns a PWM slice
+ * running at the servo frame rate with 1µs resolution, a DMA channel and a
+ * profile buffer. A move is a table of pulse widths, one per frame; the DMA
+ * channel is paced by the wrap of the slice and writes the next pulse width
+ * into the compare register, so the CPU only starts a move and checks when it
+ * has finished. After the last frame the final pulse width is held.
+ *
+ * The DMA writes 16-bit values, which the RP2040 replicates into both
+ * channels of the slice. The second GPIO of the slice must therefore not be
+ * used as a PWM output.
+ */
+#ifndef SERVO_PWM_HAL_H
+#define SERVO_PWM_HAL_H
+
+#include <cstdint>
+
+/**
+ * @brief Maximum number of servo instances the HAL can manage.
+ */
+#ifndef HAL_SERVO_MAX_INSTANCES
+#define HAL_SERVO_MAX_INSTANCES 8
+#endif
+
+/**
+ * @brief Capacity of the profile buffer of each instance, in frames.
+ *
+ * 256 frames of 20ms allow moves of up to 5.12s.
+ */
+#ifndef HAL_SERVO_MAX_FRAMES
+#define HAL_SERVO_MAX_FRAMES 256
+#endif
+
+/**
+ * @brief Length of one servo frame (PWM period) in µs.
+ */
+#define HAL_SERVO_FRAME_US 20000
+
+/**
+ * @brief Opaque handle of one servo output.
+ */
+typedef struct hal_servo hal_servo_t;
+
+/**
+ * @brief Sets up the PWM slice of `pin` and a DMA channel for one servo.
+ *
+ * @param pin GPIO of the servo signal. Its slice must not be used by anything else.
+ * @param pulse_us Pulse width output from the start.
+ * @return The instance, or `nullptr` if the slice is already in use, no DMA
+ *         channel is free or the instance pool is exhausted.
+ */
+hal_servo_t* hal_servo_init(uint8_t pin, uint16_t pulse_us);
+
+/**
+ * @brief Returns the profile buffer of an instance (HAL_SERVO_MAX_FRAMES entries).
+ *
+ * Fill it with pulse widths in µs, then start it with `hal_servo_play()`. The
+ * buffer must not be changed while a profile is playing.
+ */
+uint16_t* hal_servo_get_profile_buffer(hal_servo_t* servo);
+
+/**
+ * @brief Plays the first `frames` entries of the profile buffer, one per frame.
+ *
+ * A running profile is stopped first.
+ */
+void hal_servo_play(hal_servo_t* servo, int frames);
+
+/**
+ * @brief Stops a running profile, the current pulse width is held.
+ */
+void hal_servo_stop(hal_servo_t* servo);
+
+/**
+ * @brief True while a profile is being played.
+ */
+bool hal_servo_is_playing(hal_servo_t* servo);
+
+/**
+ * @brief Returns the pulse width currently output, in µs.
+ */
+uint16_t hal_servo_get_pulse(hal_servo_t* servo);
+
+#endif // SERVO_PWM_HAL_H
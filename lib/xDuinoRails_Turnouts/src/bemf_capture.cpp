@@ -0,0 +1,167 @@
+#include "bemf_capture.h"
+
+BemfCapture bemfCapture;
+
+// Little endian field writers for the payloads
+static uint8_t* put8(uint8_t* p, int value) {
+    *p++ = (uint8_t)value;
+    return p;
+}
+
+static uint8_t* put16(uint8_t* p, int value) {
+    *p++ = (uint8_t)value;
+    *p++ = (uint8_t)(value >> 8);
+    return p;
+}
+
+static uint8_t* put32(uint8_t* p, uint32_t value) {
+    p = put16(p, value & 0xFFFF);
+    return put16(p, value >> 16);
+}
+
+// Parameters beyond the i16 range of the START frame are sent saturated.
+static int clamp16(int value) {
+    return value > 32767 ? 32767 : value < -32768 ? -32768 : value;
+}
+
+BemfCapture::BemfCapture()
+    : _enabled(false), _trigger(ANY_TURNOUT), _turnoutId(NO_TURNOUT), _decimation(1), _skip(0), _pulses(0),
+      _samples(0), _moveDropped(0), _lastA(0), _lastB(0), _blockLength(0), _head(0), _tail(0), _dropped(0) {
+}
+
+void BemfCapture::enable(int turnoutId, uint8_t decimation) {
+    _trigger = turnoutId;
+    _decimation = decimation == 0 ? 1 : decimation;
+    _enabled = true;
+}
+
+void BemfCapture::disable() {
+    _enabled = false;
+}
+
+void BemfCapture::moveStarted(int turnoutId, int position, const StallDetectorParams& params) {
+    // One move at a time: the serial link cannot carry several drives at full rate.
+    if (!_enabled || _turnoutId != NO_TURNOUT || (_trigger != ANY_TURNOUT && _trigger != turnoutId)) {
+        return;
+    }
+    _turnoutId = turnoutId;
+    _skip = 0;
+    _pulses = 0;
+    _samples = 0;
+    _moveDropped = 0;
+    _blockLength = 0;
+
+    uint8_t payload[20];
+    uint8_t* p = put32(payload, micros());
+    p = put8(p, position);
+    p = put8(p, _decimation);
+    p = put8(p, params.type);
+    p = put16(p, clamp16(params.threshold));
+    p = put16(p, clamp16(params.stall_count));
+    p = put8(p, params.ema_shift);
+    p = put16(p, clamp16(params.slope_limit));
+    p = put16(p, clamp16(params.cusum_drift));
+    p = put16(p, clamp16(params.cusum_limit));
+    writeFrame(BEMF_CAPTURE_START, payload, p - payload);
+}
+
+void BemfCapture::pulseStarted(int turnoutId, uint16_t onMs) {
+    if (turnoutId != _turnoutId) {
+        return;
+    }
+    // The samples before the marker belong to the previous off window.
+    flushSamples();
+    _pulses++;
+    uint8_t payload[7];
+    uint8_t* p = put32(payload, micros());
+    p = put8(p, _pulses);
+    p = put16(p, onMs);
+    writeFrame(BEMF_CAPTURE_PULSE, payload, p - payload);
+}
+
+void BemfCapture::sample(int turnoutId, int a, int b) {
+    if (turnoutId != _turnoutId) {
+        return;
+    }
+    if (_skip > 0) {
+        _skip--;
+        return;
+    }
+    _skip = _decimation - 1;
+
+    int deltaA = a - _lastA;
+    int deltaB = b - _lastB;
+    bool fits = deltaA >= -128 && deltaA <= 127 && deltaB >= -128 && deltaB <= 127;
+    if (_blockLength != 0 && (!fits || _blockLength + 2 > MAX_PAYLOAD)) {
+        flushSamples();
+    }
+    if (_blockLength == 0) {
+        // A block starts with absolute values, so a dropped block does not corrupt the next one.
+        uint8_t* p = put16(_block, _samples);
+        p = put16(p, a);
+        p = put16(p, b);
+        _blockLength = SAMPLES_HEADER;
+    } else {
+        _block[_blockLength++] = (uint8_t)(int8_t)deltaA;
+        _block[_blockLength++] = (uint8_t)(int8_t)deltaB;
+    }
+    _lastA = a;
+    _lastB = b;
+    _samples++;
+}
+
+void BemfCapture::moveEnded(int turnoutId, bool reached) {
+    if (turnoutId != _turnoutId) {
+        return;
+    }
+    flushSamples();
+    uint8_t payload[9];
+    uint8_t* p = put32(payload, micros());
+    p = put8(p, reached);
+    p = put16(p, _samples);
+    p = put16(p, _moveDropped);
+    writeFrame(BEMF_CAPTURE_END, payload, p - payload);
+    _turnoutId = NO_TURNOUT;
+}
+
+void BemfCapture::flushSamples() {
+    if (_blockLength != 0) {
+        writeFrame(BEMF_CAPTURE_SAMPLES, _block, _blockLength);
+        _blockLength = 0;
+    }
+}
+
+void BemfCapture::writeFrame(uint8_t type, const uint8_t* payload, uint8_t length) {
+    uint32_t size = HEADER_SIZE + length + 1;
+    if (BEMF_CAPTURE_BUFFER_SIZE - (_head - _tail) < size) {
+        _dropped++;
+        _moveDropped++;
+        return;
+    }
+    uint8_t header[HEADER_SIZE] = {SYNC, type, (uint8_t)(_turnoutId & 0xFF), (uint8_t)(_turnoutId >> 8), length};
+    uint8_t checksum = 0;
+    for (int i = 0; i < HEADER_SIZE; i++) {
+        _buffer[_head++ & (BEMF_CAPTURE_BUFFER_SIZE - 1)] = header[i];
+        checksum ^= i > 0 ? header[i] : 0;
+    }
+    for (int i = 0; i < length; i++) {
+        _buffer[_head++ & (BEMF_CAPTURE_BUFFER_SIZE - 1)] = payload[i];
+        checksum ^= payload[i];
+    }
+    _buffer[_head++ & (BEMF_CAPTURE_BUFFER_SIZE - 1)] = checksum;
+}
+
+void BemfCapture::drain(Print& out) {
+    uint8_t frame[HEADER_SIZE + MAX_PAYLOAD + 1];
+    while (_tail != _head) {
+        uint32_t size = HEADER_SIZE + _buffer[(_tail + HEADER_SIZE - 1) & (BEMF_CAPTURE_BUFFER_SIZE - 1)] + 1;
+        // Whole frames only, the event log may write to the same port in between.
+        if (out.availableForWrite() < (int)size) {
+            break;
+        }
+        for (uint32_t i = 0; i < size; i++) {
+            frame[i] = _buffer[_tail++ & (BEMF_CAPTURE_BUFFER_SIZE - 1)];
+        }
+        out.write(frame, size);
+    }
+}
@@ -0,0 +1,120 @@
+/**
+ * @file bemf_capture.h
+ * @brief Streams the BEMF measurements of turnout moves for offline tuning.
+ *
+ * While enabled, every move of the selected BEMF turnout (or of any BEMF
+ * turnout, one move at a time) is recorded: the terminal averages A and B of
+ * each measurement, the coil pulses as phase markers, and the detector
+ * parameters and outcome of the move. The differential value the stall
+ * detector received is exactly |A - B| and is not sent separately.
+ *
+ * Recording happens in the BEMF update callback after the stall detector ran,
+ * and only copies a few bytes into a RAM ring buffer, so the detection timing
+ * is unchanged. `drain()` writes complete frames while the serial link has
+ * room, like EventLog::drain(); frames that do not fit into the buffer are
+ * dropped and counted. Both may share one serial port, frames are never split.
+ * All methods must be called from the loop that runs the turnouts.
+ *
+ * The frames are recorded and replayed through the stall detector on the
+ * host with tools/bemf_capture.py.
+ *
+ * Frame layout on the wire (little endian):
+ *   0     0xB5 sync byte
+ *   1     frame type (BemfCaptureFrame)
+ *   2..3  turnout id
+ *   4     payload length n
+ *   5..   payload
+ *   5+n   checksum, XOR of bytes 1..4+n
+ *
+ * Payloads:
+ *   START    timestamp u32 (micros), target position u8, decimation u8,
+ *            detector type u8, threshold i16, stall_count i16, ema_shift u8,
+ *            slope_limit i16, cusum_drift i16, cusum_limit i16
+ *   SAMPLES  index of the first sample u16, A u16, B u16, then one (dA, dB)
+ *            pair of i8 per further sample, each relative to its predecessor
+ *   PULSE    timestamp u32, pulse number u8, on time u16 (ms); the samples
+ *            after it belong to the off window of this pulse
+ *   END      timestamp u32, reached u8, samples u16, dropped frames u16
+ */
+#ifndef BEMF_CAPTURE_H
+#define BEMF_CAPTURE_H
+
+#include <Arduino.h>
+#include <cstdint>
+#include "bemf_stall_detector.h"
+
+// Size of the frame buffer in bytes, must be a power of 2
+#ifndef BEMF_CAPTURE_BUFFER_SIZE
+#define BEMF_CAPTURE_BUFFER_SIZE 2048
+#endif
+static_assert((BEMF_CAPTURE_BUFFER_SIZE & (BEMF_CAPTURE_BUFFER_SIZE - 1)) == 0,
+              "BEMF_CAPTURE_BUFFER_SIZE must be a power of 2");
+
+// Frame types, keep in sync with tools/bemf_capture.py
+enum BemfCaptureFrame : uint8_t {
+    BEMF_CAPTURE_START = 1,
+    BEMF_CAPTURE_SAMPLES = 2,
+    BEMF_CAPTURE_PULSE = 3,
+    BEMF_CAPTURE_END = 4
+};
+
+class BemfCapture {
+public:
+    static const uint8_t SYNC = 0xB5;
+    static const int ANY_TURNOUT = -1;
+
+    BemfCapture();
+
+    // Records the following moves of `turnoutId` (ANY_TURNOUT: of every BEMF turnout),
+    // keeping every `decimation`th measurement. A running move is not recorded.
+    void enable(int turnoutId = ANY_TURNOUT, uint8_t decimation = 1);
+    // No further moves are recorded; a move being recorded is recorded to its end.
+    void disable();
+    bool isEnabled() const { return _enabled; }
+    // A move is being recorded
+    bool isRecording() const { return _turnoutId != NO_TURNOUT; }
+
+    // Writes buffered frames while `out` has room for a complete frame.
+    void drain(Print& out);
+    uint32_t droppedCount() const { return _dropped; }
+
+    // Called by the BEMF motor policy, in the context that runs the turnouts.
+    void moveStarted(int turnoutId, int position, const StallDetectorParams& params);
+    void pulseStarted(int turnoutId, uint16_t onMs);
+    void sample(int turnoutId, int a, int b);
+    void moveEnded(int turnoutId, bool reached);
+
+private:
+    static const int MAX_PAYLOAD = 64;
+    static const int HEADER_SIZE = 5;
+    static const int SAMPLES_HEADER = 6;
+    static const int NO_TURNOUT = -2;
+
+    void flushSamples();
+    // Appends one frame to the ring, or drops it if it does not fit.
+    void writeFrame(uint8_t type, const uint8_t* payload, uint8_t length);
+
+    bool _enabled;
+    int _trigger;           // Turnout id to record, or ANY_TURNOUT
+    int _turnoutId;         // Turnout being recorded, NO_TURNOUT between moves
+    uint8_t _decimation;
+    uint8_t _skip;          // Measurements left to skip before the next recorded one
+    uint8_t _pulses;        // Pulses of the recorded move
+    uint16_t _samples;      // Recorded measurements of the move
+    uint16_t _moveDropped;  // Frames dropped during the move
+    int _lastA;
+    int _lastB;
+
+    uint8_t _block[MAX_PAYLOAD]; // SAMPLES payload being filled
+    uint8_t _blockLength;        // 0 if no block is open
+
+    uint8_t _buffer[BEMF_CAPTURE_BUFFER_SIZE];
+    uint32_t _head;         // Next byte to write
+    uint32_t _tail;         // Next byte to send
+    uint32_t _dropped;
+};
+
+// Shared capture of the library and the sketch
+extern BemfCapture bemfCapture;
+
+#endif
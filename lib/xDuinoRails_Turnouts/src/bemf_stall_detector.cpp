@@ -0,0 +1,75 @@
+#include "bemf_stall_detector.h"
+
+// Fractional bits of the EMA state
+static const int EMA_FRACTION_BITS = 8;
+
+void BemfStallDetector::configure(const StallDetectorParams& params) {
+    _params = clampParams(params);
+    reset();
+}
+
+void BemfStallDetector::reset() {
+    _count = 0;
+    _ema = 0;
+    _cusum = 0;
+    _primed = false;
+}
+
+bool BemfStallDetector::countStall(bool condition) {
+    if (condition) {
+        _count++;
+    } else {
+        _count = 0;
+    }
+    if (_count > _params.stall_count) {
+        _count = 0;
+        return true;
+    }
+    return false;
+}
+
+bool BemfStallDetector::update(int raw_bemf) {
+    int32_t sample = raw_bemf;
+
+    switch (_params.type) {
+        case STALL_DETECTOR_THRESHOLD:
+            // Legacy behavior: a single sample above the threshold restarts the count.
+            return countStall(sample < _params.threshold);
+
+        case STALL_DETECTOR_EMA:
+        case STALL_DETECTOR_SLOPE: {
+            int32_t previous = _ema;
+            int32_t scaled = sample << EMA_FRACTION_BITS;
+            if (!_primed) {
+                _ema = scaled;
+                previous = scaled;
+                _primed = true;
+            } else {
+                // ema += (x - ema) * 2^-shift, an outlier only moves the average a little.
+                _ema += (scaled - _ema) >> _params.ema_shift;
+            }
+            bool below = _ema < ((int32_t)_params.threshold << EMA_FRACTION_BITS);
+            if (_params.type == STALL_DETECTOR_EMA) {
+                return countStall(below);
+            }
+            // The armature has stopped when the filtered BEMF is low and no longer falling.
+            int32_t slope = (_ema - previous) >> EMA_FRACTION_BITS;
+            bool flat = slope <= _params.slope_limit && slope >= -_params.slope_limit;
+            return countStall(below && flat);
+        }
+
+        case STALL_DETECTOR_CUSUM:
+            // S = max(0, S + (threshold - x) - drift): accumulates evidence that the level
+            // dropped below the threshold, while noise around a high level decays to zero.
+            _cusum += _params.threshold - sample - _params.cusum_drift;
+            if (_cusum < 0) {
+                _cusum = 0;
+            }
+            if (_cusum > _params.cusum_limit) {
+                _cusum = 0;
+                return true;
+            }
+            return false;
+    }
+    return false;
+}
@@ -0,0 +1,68 @@
+/**
+ * @file bemf_stall_detector.h
+ * @brief Streaming end-of-travel detection on BEMF measurements.
+ *
+ * The detector consumes one differential BEMF value per measurement and
+ * reports when the armature has stopped. All arithmetic is integer/fixed
+ * point without allocation, so `update()` may be called from an interrupt.
+ * The detector has no hardware dependencies.
+ */
+#ifndef BEMF_STALL_DETECTOR_H
+#define BEMF_STALL_DETECTOR_H
+
+#include <cstdint>
+
+// Detection algorithm used by BemfStallDetector
+enum StallDetectorType {
+    STALL_DETECTOR_THRESHOLD, // Raw value below threshold for `stall_count` consecutive samples
+    STALL_DETECTOR_EMA,       // Exponential moving average below threshold for `stall_count` samples
+    STALL_DETECTOR_SLOPE,     // EMA below threshold and flat (|slope| <= slope_limit) for `stall_count` samples
+    STALL_DETECTOR_CUSUM      // One-sided CUSUM of the drop below threshold exceeds `cusum_limit`
+};
+
+// Parameters of BemfStallDetector, see BEMF_Config for their meaning
+struct StallDetectorParams {
+    StallDetectorType type = STALL_DETECTOR_THRESHOLD;
+    int threshold = 10;
+    int stall_count = 5;
+    int ema_shift = 2;
+    int slope_limit = 2;
+    int cusum_drift = 2;
+    int cusum_limit = 40;
+};
+
+class BemfStallDetector {
+public:
+    constexpr BemfStallDetector() : BemfStallDetector(StallDetectorParams()) {}
+    constexpr explicit BemfStallDetector(const StallDetectorParams& params)
+        : _params(clampParams(params)), _count(0), _ema(0), _cusum(0), _primed(false) {}
+
+    void configure(const StallDetectorParams& params);
+
+    // Clears the detector state, call at the start of every move.
+    void reset();
+
+    // Feeds one BEMF measurement, returns true once the end of travel is detected.
+    bool update(int raw_bemf);
+
+    constexpr const StallDetectorParams& params() const { return _params; }
+
+private:
+    // Keeps the shift in a range that cannot overflow the Q8 state.
+    static constexpr StallDetectorParams clampParams(StallDetectorParams params) {
+        params.ema_shift = params.ema_shift < 0 ? 0 : params.ema_shift > 8 ? 8 : params.ema_shift;
+        return params;
+    }
+
+    // Counts consecutive samples that satisfy `condition`, true once more than stall_count are seen.
+    bool countStall(bool condition);
+
+    StallDetectorParams _params;
+
+    int32_t _count;      // Consecutive stall samples
+    int32_t _ema;        // Filtered BEMF in Q8 fixed point
+    int32_t _cusum;      // Accumulated drop below the threshold
+    bool _primed;        // EMA holds a value
+};
+
+#endif
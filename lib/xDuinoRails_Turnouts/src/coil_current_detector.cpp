@@ -0,0 +1,65 @@
+#include "coil_current_detector.h"
+
+// Fractional bits of the EMA state
+static const int EMA_FRACTION_BITS = 8;
+
+void CoilCurrentDetector::configure(const CurrentDetectorParams& params) {
+    _params = clampParams(params);
+    reset();
+}
+
+void CoilCurrentDetector::reset() {
+    _seen = 0;
+    _count = 0;
+    _ema = 0;
+    _peak = 0;
+    _bottom = 0;
+    _moved = false;
+}
+
+bool CoilCurrentDetector::update(int current) {
+    int32_t scaled = (int32_t)current << EMA_FRACTION_BITS;
+    if (_seen < _params.blank) {
+        _seen++;
+        return false;
+    }
+    if (_seen == _params.blank) {
+        // First value after the blanking time primes the filter.
+        _seen++;
+        _ema = scaled;
+        _peak = current;
+        return false;
+    }
+
+    int32_t previous = _ema;
+    _ema += (scaled - _ema) >> _params.ema_shift;
+    int32_t level = _ema >> EMA_FRACTION_BITS;
+
+    if (_moved) {
+        // Past the dip: the armature has stopped once the current rises again.
+        if (level < _bottom) {
+            _bottom = level;
+        }
+        return level > _bottom + _params.rise;
+    }
+
+    if (level > _peak) {
+        _peak = level;
+    }
+    if (level < _peak - _params.dip) {
+        _moved = true;
+        _bottom = level;
+        return false;
+    }
+
+    // No dip yet: a current that no longer changes has reached V/R without any motion.
+    // A slow armature pulls the current down only gently, that is no plateau: it has
+    // to stay at its peak.
+    int32_t slope = (_ema - previous) >> EMA_FRACTION_BITS;
+    if (slope <= _params.flat && slope >= -_params.flat && level >= _peak - _params.flat) {
+        _count++;
+    } else {
+        _count = 0;
+    }
+    return _count > _params.settle_count;
+}
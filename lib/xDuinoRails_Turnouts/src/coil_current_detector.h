@@ -0,0 +1,72 @@
+/**
+ * @file coil_current_detector.h
+ * @brief End-of-travel detection on the current of a solenoid pulse.
+ *
+ * When a coil is switched on, its current rises with the L/R time constant.
+ * As soon as the armature moves, the growing inductance and the voltage it
+ * induces pull the current down, so the rise turns into a dip. When the
+ * armature hits its end stop the motion stops and the current rises again
+ * towards V/R. The detector follows this peak - dip - rise signature and
+ * reports the end of travel at the start of the second rise.
+ *
+ * If the armature already rests at the end stop of the energized coil, the
+ * current rises into a plateau without a dip; this is reported as well,
+ * because further pulses could not move it either. A jammed armature looks
+ * the same.
+ *
+ * The detector consumes one current value per call (see
+ * `hal_current_sense_init()`), uses integer/fixed point arithmetic only and
+ * has no hardware dependencies.
+ */
+#ifndef COIL_CURRENT_DETECTOR_H
+#define COIL_CURRENT_DETECTOR_H
+
+#include <cstdint>
+
+// Parameters of CoilCurrentDetector, currents in ADC counts
+struct CurrentDetectorParams {
+    int ema_shift = 1;     // Smoothing factor 1/2^ema_shift (0..8)
+    int blank = 3;         // Values ignored after switch-on (driver turn-on, ADC hand-over)
+    int dip = 40;          // Drop below the peak that shows the armature moving
+    int rise = 20;         // Rise above the bottom of the dip that shows it has hit the end stop
+    int flat = 3;          // Largest change per value that counts as a plateau
+    int settle_count = 10; // Plateau values without a dip after which the armature counts as resting
+};
+
+class CoilCurrentDetector {
+public:
+    constexpr CoilCurrentDetector() : CoilCurrentDetector(CurrentDetectorParams()) {}
+    constexpr explicit CoilCurrentDetector(const CurrentDetectorParams& params)
+        : _params(clampParams(params)), _seen(0), _count(0), _ema(0), _peak(0), _bottom(0), _moved(false) {}
+
+    void configure(const CurrentDetectorParams& params);
+
+    // Clears the detector state, call at the start of every pulse.
+    void reset();
+
+    // Feeds one current value, returns true once the armature rests at an end stop.
+    bool update(int current);
+
+    // The dip was seen, the armature moved during this pulse
+    bool moved() const { return _moved; }
+
+    constexpr const CurrentDetectorParams& params() const { return _params; }
+
+private:
+    // Keeps the shift in a range that cannot overflow the Q8 state.
+    static constexpr CurrentDetectorParams clampParams(CurrentDetectorParams params) {
+        params.ema_shift = params.ema_shift < 0 ? 0 : params.ema_shift > 8 ? 8 : params.ema_shift;
+        return params;
+    }
+
+    CurrentDetectorParams _params;
+
+    int32_t _seen;       // Values since reset, counted up to the blanking time
+    int32_t _count;      // Consecutive plateau values
+    int32_t _ema;        // Filtered current in Q8 fixed point
+    int32_t _peak;       // Highest filtered current before the dip
+    int32_t _bottom;     // Lowest filtered current since the dip
+    bool _moved;
+};
+
+#endif
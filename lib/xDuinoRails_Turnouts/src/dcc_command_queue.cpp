@@ -0,0 +1,103 @@
+#include "dcc_command_queue.h"
+
+DccCommandQueue::DccCommandQueue(unsigned long coalesceWindowMs)
+    : _head(0), _tail(0), _coalesceWindowMs(coalesceWindowMs),
+      _enqueued(0), _coalesced(0), _dropped(0), _superseded(0) {
+    for (int i = 0; i < DCC_COMMAND_HISTORY_SIZE; i++) {
+        _history[i].valid = false;
+    }
+}
+
+bool DccCommandQueue::push(uint16_t address, uint8_t direction, uint8_t outputPower, unsigned long now) {
+    // Look for a repeat of a recent command, and remember the oldest entry for replacement.
+    int oldest = 0;
+    for (int i = 0; i < DCC_COMMAND_HISTORY_SIZE; i++) {
+        HistoryEntry& entry = _history[i];
+        if (!entry.valid) {
+            oldest = i;
+            continue;
+        }
+        if (entry.address == address) {
+            if (entry.direction == direction && entry.outputPower == outputPower &&
+                now - entry.timestamp < _coalesceWindowMs) {
+                // Repeated packet: refresh the window, so a steady repetition stays coalesced.
+                entry.timestamp = now;
+                _coalesced.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            // Same address with a new command: reuse this entry.
+            oldest = i;
+            break;
+        }
+        if (_history[oldest].valid && (long)(entry.timestamp - _history[oldest].timestamp) < 0) {
+            oldest = i;
+        }
+    }
+
+    uint32_t head = _head.load(std::memory_order_relaxed);
+    uint32_t tail = _tail.load(std::memory_order_acquire);
+    if (head - tail >= DCC_COMMAND_QUEUE_SIZE) {
+        _dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    DccCommand& command = _commands[head & (DCC_COMMAND_QUEUE_SIZE - 1)];
+    command.address = address;
+    command.direction = direction;
+    command.outputPower = outputPower;
+    command.timestamp = now;
+    // Publish the record only after it is completely written.
+    _head.store(head + 1, std::memory_order_release);
+
+    HistoryEntry& entry = _history[oldest];
+    entry.address = address;
+    entry.direction = direction;
+    entry.outputPower = outputPower;
+    entry.timestamp = now;
+    entry.valid = true;
+
+    _enqueued.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+bool DccCommandQueue::pop(DccCommand& command) {
+    uint32_t tail = _tail.load(std::memory_order_relaxed);
+    uint32_t head = _head.load(std::memory_order_acquire);
+
+    while (tail != head) {
+        const DccCommand& candidate = _commands[tail & (DCC_COMMAND_QUEUE_SIZE - 1)];
+        // Published records are immutable until consumed, so scanning ahead is safe.
+        bool superseded = false;
+        for (uint32_t later = tail + 1; later != head; later++) {
+            const DccCommand& next = _commands[later & (DCC_COMMAND_QUEUE_SIZE - 1)];
+            // Activate and deactivate packets are separate commands, only the same kind supersedes.
+            if (next.address == candidate.address && next.outputPower == candidate.outputPower) {
+                superseded = true;
+                break;
+            }
+        }
+        tail++;
+        if (superseded) {
+            // A newer command for the same address is queued, only the last target counts.
+            _superseded.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+        command = candidate;
+        _tail.store(tail, std::memory_order_release);
+        return true;
+    }
+    _tail.store(tail, std::memory_order_release);
+    return false;
+}
+
+uint32_t DccCommandQueue::enqueuedCount() const {
+    return _enqueued.load(std::memory_order_relaxed);
+}
+
+uint32_t DccCommandQueue::coalescedCount() const {
+    return _coalesced.load(std::memory_order_relaxed) + _superseded.load(std::memory_order_relaxed);
+}
+
+uint32_t DccCommandQueue::droppedCount() const {
+    return _dropped.load(std::memory_order_relaxed);
+}
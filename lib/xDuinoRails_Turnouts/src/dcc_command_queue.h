@@ -0,0 +1,71 @@
+#ifndef DCC_COMMAND_QUEUE_H
+#define DCC_COMMAND_QUEUE_H
+
+#include <atomic>
+#include <cstdint>
+
+// Number of queued commands, must be a power of 2
+#ifndef DCC_COMMAND_QUEUE_SIZE
+#define DCC_COMMAND_QUEUE_SIZE 16
+#endif
+// Number of recently enqueued commands remembered for coalescing repeats
+#ifndef DCC_COMMAND_HISTORY_SIZE
+#define DCC_COMMAND_HISTORY_SIZE 8
+#endif
+
+static_assert((DCC_COMMAND_QUEUE_SIZE & (DCC_COMMAND_QUEUE_SIZE - 1)) == 0, "DCC_COMMAND_QUEUE_SIZE must be a power of 2");
+
+// One accessory command as received from the DCC decoder
+struct DccCommand {
+    uint16_t address;
+    uint8_t direction;
+    uint8_t outputPower;
+    unsigned long timestamp; // millis() when the packet was received
+};
+
+// Single-producer/single-consumer ring buffer between the DCC callback and the turnout layer.
+//
+// Command stations repeat every accessory packet several times. The producer drops a
+// command if the same address/direction/power was enqueued within the coalescing window.
+// If a turnout receives conflicting commands (same address and output power) before the
+// consumer gets to them, the consumer only returns the last one for that address. The queue never blocks: when it
+// is full, new commands are dropped and counted.
+class DccCommandQueue {
+public:
+    explicit DccCommandQueue(unsigned long coalesceWindowMs = 250);
+
+    // Producer side (DCC callback). Returns false if the command was coalesced or dropped.
+    bool push(uint16_t address, uint8_t direction, uint8_t outputPower, unsigned long now);
+
+    // Consumer side (turnout layer). Returns false if no command is pending.
+    bool pop(DccCommand& command);
+
+    uint32_t enqueuedCount() const;
+    uint32_t coalescedCount() const; // Repeats within the window plus superseded commands
+    uint32_t droppedCount() const;   // Queue full
+
+private:
+    struct HistoryEntry {
+        uint16_t address;
+        uint8_t direction;
+        uint8_t outputPower;
+        unsigned long timestamp;
+        bool valid;
+    };
+
+    DccCommand _commands[DCC_COMMAND_QUEUE_SIZE];
+    std::atomic<uint32_t> _head; // Written by the producer only
+    std::atomic<uint32_t> _tail; // Written by the consumer only
+
+    // Producer-owned state
+    HistoryEntry _history[DCC_COMMAND_HISTORY_SIZE];
+    unsigned long _coalesceWindowMs;
+    std::atomic<uint32_t> _enqueued;
+    std::atomic<uint32_t> _coalesced;
+    std::atomic<uint32_t> _dropped;
+
+    // Consumer-owned state
+    std::atomic<uint32_t> _superseded;
+};
+
+#endif
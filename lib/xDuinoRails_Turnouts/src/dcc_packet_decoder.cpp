@@ -0,0 +1,149 @@
+#include "dcc_packet_decoder.h"
+
+DccPacketDecoder::DccPacketDecoder()
+    : _state(STATE_PREAMBLE), _ones(0), _bitCount(0), _length(0), _byte(0), _data(),
+      _accessoryCallback(nullptr), _accessoryContext(nullptr), _cvWriteCallback(nullptr), _cvWriteContext(nullptr),
+      _packets(0), _checksumErrors(0), _framingErrors(0) {
+}
+
+void DccPacketDecoder::setAccessoryCallback(DccAccessoryCallback callback, void* context) {
+    _accessoryCallback = callback;
+    _accessoryContext = context;
+}
+
+void DccPacketDecoder::setCvWriteCallback(DccCvWriteCallback callback, void* context) {
+    _cvWriteCallback = callback;
+    _cvWriteContext = context;
+}
+
+void DccPacketDecoder::resetCounters() {
+    _packets = 0;
+    _checksumErrors = 0;
+    _framingErrors = 0;
+}
+
+void DccPacketDecoder::feed(uint8_t bits, int count) {
+    for (int i = count - 1; i >= 0; i--) {
+        feedBit((bits >> i) & 1);
+    }
+}
+
+void DccPacketDecoder::feedBit(bool one) {
+    switch (_state) {
+        case STATE_PREAMBLE:
+            if (one) {
+                if (_ones < MIN_PREAMBLE_BITS) {
+                    _ones++;
+                }
+            } else if (_ones >= MIN_PREAMBLE_BITS) {
+                // Start bit of the first byte
+                _state = STATE_DATA;
+                _bitCount = 0;
+                _length = 0;
+            } else {
+                _ones = 0; // Too short, noise or a bit in the middle of a packet
+            }
+            break;
+
+        case STATE_DATA:
+            _byte = (_byte << 1) | (one ? 1 : 0);
+            if (++_bitCount == 8) {
+                if (_length == DCC_PACKET_MAX_SIZE) {
+                    // Longer than any valid packet, wait for the next preamble.
+                    _framingErrors++;
+                    _state = STATE_PREAMBLE;
+                    _ones = 0;
+                    break;
+                }
+                _data[_length++] = _byte;
+                _state = STATE_END;
+            }
+            break;
+
+        case STATE_END:
+            if (one) {
+                packetComplete();
+                // The end bit counts towards the preamble of the next packet.
+                _state = STATE_PREAMBLE;
+                _ones = 1;
+            } else {
+                _state = STATE_DATA;
+                _bitCount = 0;
+            }
+            break;
+    }
+}
+
+void DccPacketDecoder::packetComplete() {
+    if (_length < 3) {
+        _framingErrors++;
+        return;
+    }
+    uint8_t check = 0;
+    for (int i = 0; i < _length; i++) {
+        check ^= _data[i];
+    }
+    if (check != 0) {
+        _checksumErrors++;
+        return;
+    }
+    _packets++;
+    decode(_data, _length);
+}
+
+// Same address calculation as NmraDcc with CV29_OUTPUT_ADDRESS_MODE.
+void DccPacketDecoder::decode(const uint8_t* data, int length) {
+    if ((data[0] & 0xC0) != 0x80 || (data[1] & 0x80) == 0) {
+        return; // Not a basic accessory packet
+    }
+    if (length == 6) {
+        decodeCvAccess(data);
+        return;
+    }
+    // Basic accessory packet: 10AAAAAA 1AAACDDD EEEEEEEE, the upper address bits are inverted.
+    if (length != 3) {
+        return;
+    }
+    int boardAddress = ((~data[1] & 0x70) << 2) | (data[0] & 0x3F);
+    int pairIndex = (data[1] & 0x06) >> 1;
+    int outputAddress = (((boardAddress - 1) << 2) | pairIndex) + 1;
+    if (outputAddress < 1 || _accessoryCallback == nullptr) {
+        return; // Board address 0 has no outputs
+    }
+    _accessoryCallback(_accessoryContext, outputAddress, data[1] & 0x01, (data[1] & 0x08) >> 3);
+}
+
+// Operations mode CV access of a basic accessory decoder (NMRA S-9.2.1):
+// 10AAAAAA 1AAACDDD 1110CCVV VVVVVVVV DDDDDDDD EEEEEEEE
+// C = 1: output address as in an accessory packet, C = 0 and DDD = 000: board address.
+void DccPacketDecoder::decodeCvAccess(const uint8_t* data) {
+    if ((data[2] & 0xF0) != 0xE0 || _cvWriteCallback == nullptr) {
+        return;
+    }
+    int boardAddress = ((~data[1] & 0x70) << 2) | (data[0] & 0x3F);
+    int outputAddress;
+    if (data[1] & 0x08) {
+        outputAddress = (((boardAddress - 1) << 2) | ((data[1] & 0x06) >> 1)) + 1;
+    } else if ((data[1] & 0x07) == 0) {
+        outputAddress = ((boardAddress - 1) << 2) + 1;
+    } else {
+        return;
+    }
+    if (outputAddress < 1) {
+        return;
+    }
+    uint16_t cv = (((data[2] & 0x03) << 8) | data[3]) + 1;
+    switch ((data[2] >> 2) & 0x03) {
+        case 0x03: // Write byte
+            _cvWriteCallback(_cvWriteContext, outputAddress, cv, data[4], 0xFF);
+            break;
+        case 0x02: // Bit manipulation: 111KDBBB, K = 1 writes bit BBB with D
+            if ((data[4] & 0xF0) == 0xF0) {
+                uint8_t mask = 1u << (data[4] & 0x07);
+                _cvWriteCallback(_cvWriteContext, outputAddress, cv, data[4] & 0x08 ? mask : 0, mask);
+            }
+            break;
+        default: // Verify needs a RailCom answer, reserved
+            break;
+    }
+}
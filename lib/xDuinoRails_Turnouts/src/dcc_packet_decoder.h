@@ -0,0 +1,80 @@
+#ifndef DCC_PACKET_DECODER_H
+#define DCC_PACKET_DECODER_H
+
+#include <cstdint>
+
+// Longest packet including the error detection byte (NMRA S-9.2: 6 bytes)
+#define DCC_PACKET_MAX_SIZE 6
+
+// Called for every valid basic accessory packet, including repetitions, with the
+// same arguments as NmraDcc's notifyDccAccTurnoutOutput() in output address mode.
+typedef void (*DccAccessoryCallback)(void* context, uint16_t address, uint8_t direction, uint8_t outputPower);
+
+// Called for every valid CV write of an operations mode (POM) packet to a basic
+// accessory decoder, including repetitions. `address` is the output address the
+// packet is sent to (the first output of the board for board addressed packets).
+// The bits of `mask` in the CV are to be set to those of `value`: 0xFF for a byte
+// write, a single bit for a bit write.
+typedef void (*DccCvWriteCallback)(void* context, uint16_t address, uint16_t cv, uint8_t value, uint8_t mask);
+
+// Assembles DCC packets from a stream of decoded bits (see dcc_rx_hal.h).
+//
+// A packet is a preamble of at least 10 "1" bits, then bytes that each follow a
+// "0" start bit, terminated by a "1" end bit. The end bit may be the first
+// preamble bit of the next packet. The bit state machine only runs a few
+// instructions per bit; the error detection byte and the packet contents are
+// checked once per packet. Malformed packets are dropped and counted.
+//
+// Basic accessory packets and their operations mode CV writes are decoded, so
+// the decoder can be programmed on the main track; verify packets, service mode
+// (programming track) and multi-function decoder packets are ignored.
+//
+// The decoder is plain C++ without hardware access, so it can also be fed
+// with recorded or synthetic bit streams.
+class DccPacketDecoder {
+public:
+    DccPacketDecoder();
+
+    void setAccessoryCallback(DccAccessoryCallback callback, void* context);
+    void setCvWriteCallback(DccCvWriteCallback callback, void* context);
+
+    // Feeds `count` bits (1..8) of `bits`, the first one in bit `count - 1`.
+    void feed(uint8_t bits, int count = 8);
+    void feedBit(bool one);
+
+    uint32_t packetCount() const { return _packets; }          // Packets with a valid error detection byte
+    uint32_t checksumErrorCount() const { return _checksumErrors; }
+    uint32_t framingErrorCount() const { return _framingErrors; } // Too long or too short packets
+    void resetCounters();
+
+private:
+    enum State : uint8_t {
+        STATE_PREAMBLE, // Counting "1" bits
+        STATE_DATA,     // Shifting in the bits of a byte
+        STATE_END       // After a byte: "0" starts the next one, "1" ends the packet
+    };
+
+    static const int MIN_PREAMBLE_BITS = 10;
+
+    void packetComplete();
+    void decode(const uint8_t* data, int length);
+    void decodeCvAccess(const uint8_t* data);
+
+    State _state;
+    uint8_t _ones;      // "1" bits of the preamble so far
+    uint8_t _bitCount;  // Bits of the current byte so far
+    uint8_t _length;    // Complete bytes of the packet
+    uint8_t _byte;
+    uint8_t _data[DCC_PACKET_MAX_SIZE];
+
+    DccAccessoryCallback _accessoryCallback;
+    void* _accessoryContext;
+    DccCvWriteCallback _cvWriteCallback;
+    void* _cvWriteContext;
+
+    uint32_t _packets;
+    uint32_t _checksumErrors;
+    uint32_t _framingErrors;
+};
+
+#endif
@@ -0,0 +1,126 @@
+#ifndef DCC_TURNOUT_REGISTRY_H
+#define DCC_TURNOUT_REGISTRY_H
+
+#include <Arduino.h>
+#include "xDuinoRails_Turnouts.h"
+
+// Highest output address of a DCC accessory decoder
+#define DCC_MAX_ACCESSORY_ADDRESS 2044
+
+// Maps a block of `Size` consecutive DCC accessory (output) addresses to turnouts.
+//
+// The block starts at the decoder's base address, which is read from the CVs at boot.
+// Turnouts are assigned by their offset within the block, so changing the base address
+// moves all of them. Dispatch is a bounds check and one array lookup, independent of the
+// number of registered turnouts.
+//
+// Direction mapping (NMRA): direction 1 ("closed", green) selects position 1, direction 0
+// ("thrown", red) selects position 2. A composite turnout with N positions claims N - 1
+// addresses: direction 1 of any of them selects position 0, direction 0 of the k-th one
+// position k. For a three-way turnout the first address switches between straight and
+// left, the second one between straight and right.
+template <int Size>
+class DccTurnoutRegistry {
+public:
+    DccTurnoutRegistry() : _baseAddress(1) {
+        for (int i = 0; i < Size; i++) {
+            _entries[i].kind = ENTRY_NONE;
+        }
+    }
+
+    // Sets the first address of the block, e.g. from Dcc.getAddr(). Invalid values are ignored.
+    bool setBaseAddress(uint16_t address) {
+        if (address < 1 || address > DCC_MAX_ACCESSORY_ADDRESS) {
+            return false;
+        }
+        _baseAddress = address;
+        return true;
+    }
+
+    uint16_t baseAddress() const {
+        return _baseAddress;
+    }
+
+    // Assigns a turnout to base address + offset.
+    bool assign(uint16_t offset, TurnoutBase& turnout) {
+        if (offset >= Size || _entries[offset].kind != ENTRY_NONE) {
+            return false;
+        }
+        _entries[offset].kind = ENTRY_TURNOUT;
+        _entries[offset].turnout = &turnout;
+        return true;
+    }
+
+    // Assigns a composite (e.g. three-way) turnout to base address + offset and the
+    // following addresses, one per position except position 0.
+    bool assign(uint16_t offset, CompositeTurnoutBase& turnout) {
+        int span = turnout.positionCount() - 1;
+        if (span < 1 || offset + span > Size) {
+            return false;
+        }
+        for (int i = 0; i < span; i++) {
+            if (_entries[offset + i].kind != ENTRY_NONE) {
+                return false;
+            }
+        }
+        for (int i = 0; i < span; i++) {
+            _entries[offset + i].kind = ENTRY_COMPOSITE;
+            _entries[offset + i].leg = i;
+            _entries[offset + i].composite = &turnout;
+        }
+        return true;
+    }
+
+    // Forwards an accessory command to the turnout at `address`. `timestamp` is the
+    // millis() at which the packet was received, it feeds the latency statistics.
+    // Returns false if the address is not assigned or the packet is a deactivate packet.
+    bool dispatch(uint16_t address, uint8_t direction, uint8_t outputPower) {
+        return dispatch(address, direction, outputPower, millis());
+    }
+
+    bool dispatch(uint16_t address, uint8_t direction, uint8_t outputPower, unsigned long timestamp) {
+        // Turnouts act on the activate packet only.
+        if (outputPower == 0) {
+            return false;
+        }
+        // Unsigned wrap-around turns addresses below the base into large offsets.
+        uint16_t offset = address - _baseAddress;
+        if (offset >= Size) {
+            return false;
+        }
+
+        Entry& entry = _entries[offset];
+        switch (entry.kind) {
+            case ENTRY_TURNOUT:
+                entry.turnout->setPosition(direction ? 1 : 2, timestamp);
+                return true;
+            case ENTRY_COMPOSITE:
+                // Address k: position 0 or position k + 1
+                entry.composite->setPosition(direction ? 0 : entry.leg + 1, timestamp);
+                return true;
+            default:
+                return false;
+        }
+    }
+
+private:
+    enum EntryKind : uint8_t {
+        ENTRY_NONE,
+        ENTRY_TURNOUT,
+        ENTRY_COMPOSITE
+    };
+
+    struct Entry {
+        EntryKind kind;
+        uint8_t leg; // Address index within a multi-address turnout
+        union {
+            TurnoutBase* turnout;
+            CompositeTurnoutBase* composite;
+        };
+    };
+
+    uint16_t _baseAddress;
+    Entry _entries[Size];
+};
+
+#endif
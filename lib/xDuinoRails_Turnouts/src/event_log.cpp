@@ -0,0 +1,94 @@
+#include "event_log.h"
+
+#if defined(ARDUINO_ARCH_RP2040)
+#include "hardware/sync.h"
+
+// A striped spin lock is meant for short critical sections shared between unrelated users.
+// Together with disabled interrupts it serializes ISRs and both cores.
+static inline uint32_t log_lock() {
+    return spin_lock_blocking(spin_lock_instance(PICO_SPINLOCK_ID_STRIPED_FIRST));
+}
+
+static inline void log_unlock(uint32_t saved) {
+    spin_unlock(spin_lock_instance(PICO_SPINLOCK_ID_STRIPED_FIRST), saved);
+}
+#else
+static inline uint32_t log_lock() {
+    noInterrupts();
+    return 0;
+}
+
+static inline void log_unlock(uint32_t) {
+    interrupts();
+}
+#endif
+
+EventLog eventLog;
+
+EventLog::EventLog() : _head(0), _tail(0), _dropped(0), _droppedReported(0) {
+}
+
+void EventLog::log(uint8_t event, uint16_t turnoutId, uint16_t arg0, uint16_t arg1) {
+    uint32_t timestamp = micros();
+    uint32_t saved = log_lock();
+    if (_head - _tail >= EVENT_LOG_SIZE) {
+        _dropped = _dropped + 1;
+    } else {
+        Record& record = _records[_head & (EVENT_LOG_SIZE - 1)];
+        record.timestamp = timestamp;
+        record.arg0 = arg0;
+        record.arg1 = arg1;
+        record.event = event;
+        record.turnoutId = turnoutId;
+        _head = _head + 1;
+    }
+    log_unlock(saved);
+}
+
+void EventLog::encode(const Record& record, uint8_t* buffer) {
+    buffer[0] = SYNC;
+    buffer[1] = record.event;
+    buffer[2] = record.turnoutId & 0xFF;
+    buffer[3] = record.turnoutId >> 8;
+    buffer[4] = record.timestamp & 0xFF;
+    buffer[5] = (record.timestamp >> 8) & 0xFF;
+    buffer[6] = (record.timestamp >> 16) & 0xFF;
+    buffer[7] = (record.timestamp >> 24) & 0xFF;
+    buffer[8] = record.arg0 & 0xFF;
+    buffer[9] = record.arg0 >> 8;
+    buffer[10] = record.arg1 & 0xFF;
+    buffer[11] = record.arg1 >> 8;
+    uint8_t checksum = 0;
+    for (int i = 1; i < RECORD_SIZE - 1; i++) {
+        checksum ^= buffer[i];
+    }
+    buffer[RECORD_SIZE - 1] = checksum;
+}
+
+void EventLog::drain(Print& out) {
+    uint8_t buffer[RECORD_SIZE];
+
+    // Report drops first, so the host knows where records are missing.
+    uint32_t dropped = _dropped;
+    if (dropped != _droppedReported && out.availableForWrite() >= RECORD_SIZE) {
+        Record record = {(uint32_t)micros(), (uint16_t)(dropped & 0xFFFF), (uint16_t)(dropped >> 16), EVENT_LOG_DROPPED, 0};
+        encode(record, buffer);
+        out.write(buffer, RECORD_SIZE);
+        _droppedReported = dropped;
+    }
+
+    while (out.availableForWrite() >= RECORD_SIZE) {
+        // Copy under the lock, the producer on the other core must see the slot freed only afterwards.
+        uint32_t saved = log_lock();
+        if (_tail == _head) {
+            log_unlock(saved);
+            break;
+        }
+        Record record = _records[_tail & (EVENT_LOG_SIZE - 1)];
+        _tail = _tail + 1;
+        log_unlock(saved);
+
+        encode(record, buffer);
+        out.write(buffer, RECORD_SIZE);
+    }
+}
@@ -0,0 +1,87 @@
+/**
+ * @file event_log.h
+ * @brief Non-blocking binary event log.
+ *
+ * Status messages are recorded as small fixed-size binary records instead of
+ * text. `log()` only copies the record into a RAM ring buffer, so it is cheap
+ * and may be called from any context, including interrupts and either core.
+ * `drain()` is called from the main loop and writes as many records as the
+ * serial link can take without blocking. When the buffer is full, new records
+ * are dropped and counted; the count is reported as an EVENT_LOG_DROPPED record.
+ *
+ * The records are decoded on the host with tools/decode_event_log.py. Plain
+ * text (e.g. the startup banner) may be mixed into the same stream, the
+ * decoder passes it through.
+ *
+ * Record layout on the wire (13 bytes, little endian):
+ *   0      0xA5 sync byte
+ *   1      event id (EventLogId)
+ *   2..3   turnout id (0 if not related to a turnout)
+ *   4..7   timestamp, micros()
+ *   8..9   arg0
+ *   10..11 arg1
+ *   12     checksum, XOR of bytes 1..11
+ */
+#ifndef EVENT_LOG_H
+#define EVENT_LOG_H
+
+#include <Arduino.h>
+#include <cstdint>
+
+// Number of buffered records, must be a power of 2
+#ifndef EVENT_LOG_SIZE
+#define EVENT_LOG_SIZE 64
+#endif
+
+static_assert((EVENT_LOG_SIZE & (EVENT_LOG_SIZE - 1)) == 0, "EVENT_LOG_SIZE must be a power of 2");
+
+// Event ids, keep in sync with EVENTS in tools/decode_event_log.py
+enum EventLogId : uint8_t {
+    EVENT_LOG_DROPPED = 1,        // arg0/arg1: total number of dropped records (low/high word)
+    EVENT_MOVE_STARTED = 2,       // arg0: target position
+    EVENT_POSITION_REACHED = 3,   // arg0: position, arg1: move duration in ms
+    EVENT_MOVE_TIMEOUT = 4,       // arg0: target position
+    EVENT_BEMF_INIT_FAILED = 5,
+    EVENT_DCC_COMMAND = 6,        // arg0: address, arg1: direction | output power << 8
+    EVENT_ROUTE_COMPLETE = 7,     // arg0: number of steps, arg1: turnouts that timed out
+    EVENT_SERVO_INIT_FAILED = 8,
+    EVENT_CURRENT_SENSE_INIT_FAILED = 9
+};
+
+class EventLog {
+public:
+    static const int RECORD_SIZE = 13;
+    static const uint8_t SYNC = 0xA5;
+
+    EventLog();
+
+    // Records one event. Never blocks; drops the record if the buffer is full.
+    void log(uint8_t event, uint16_t turnoutId, uint16_t arg0 = 0, uint16_t arg1 = 0);
+
+    // Writes buffered records while `out` has room for a complete record.
+    void drain(Print& out);
+
+    uint32_t droppedCount() const { return _dropped; }
+
+private:
+    struct Record {
+        uint32_t timestamp;
+        uint16_t arg0;
+        uint16_t arg1;
+        uint8_t event;
+        uint16_t turnoutId;
+    };
+
+    static void encode(const Record& record, uint8_t* buffer);
+
+    Record _records[EVENT_LOG_SIZE];
+    volatile uint32_t _head;      // Next record to write, advanced by log()
+    volatile uint32_t _tail;      // Next record to send, advanced by drain()
+    volatile uint32_t _dropped;
+    uint32_t _droppedReported;    // Drop count already sent to the host
+};
+
+// Shared log of the library and the sketch
+extern EventLog eventLog;
+
+#endif
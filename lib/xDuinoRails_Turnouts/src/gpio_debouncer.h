@@ -0,0 +1,53 @@
+/**
+ * @file gpio_debouncer.h
+ * @brief Debounces 32 inputs at once with a vertical counter.
+ *
+ * Every input has a 2-bit counter of the consecutive samples that differ from
+ * its debounced level. The counters are stored "vertically": bit n of `_count0`
+ * and `_count1` is the counter of input n, so one update of a few bitwise
+ * operations advances all 32 counters. An input changes its debounced level
+ * after `GPIO_DEBOUNCE_SAMPLES` (4) samples in a row at the new level; a
+ * sample at the old level clears its counter. The cost does not depend on the
+ * number of inputs. The debouncer has no hardware dependencies.
+ */
+#ifndef GPIO_DEBOUNCER_H
+#define GPIO_DEBOUNCER_H
+
+#include <cstdint>
+
+// Consecutive samples at a new level before it is taken, fixed by the 2-bit counters
+#define GPIO_DEBOUNCE_SAMPLES 4
+
+class GpioDebouncer {
+public:
+    constexpr GpioDebouncer() : _state(0), _count0(0), _count1(0) {}
+
+    // Feeds one sample of all inputs, returns the inputs whose debounced level changed.
+    uint32_t update(uint32_t raw) {
+        uint32_t differs = raw ^ _state;
+        // Increment the counters of differing inputs (wrapping 3 -> 0), clear all others.
+        _count1 = (_count1 ^ _count0) & differs;
+        _count0 = ~_count0 & differs;
+        // A counter that wrapped to 0 while its input still differs has seen 4 samples.
+        uint32_t toggled = differs & ~(_count0 | _count1);
+        _state ^= toggled;
+        return toggled;
+    }
+
+    // Sets the debounced level of the inputs in `mask` without an edge, e.g. at startup.
+    void preset(uint32_t mask, uint32_t levels) {
+        _state = (_state & ~mask) | (levels & mask);
+        _count0 &= ~mask;
+        _count1 &= ~mask;
+    }
+
+    // Debounced levels, bit n is input n
+    uint32_t state() const { return _state; }
+
+private:
+    uint32_t _state;
+    uint32_t _count0; // Low bits of the counters
+    uint32_t _count1; // High bits of the counters
+};
+
+#endif
@@ -0,0 +1,306 @@
+#include "host_link.h"
+
+// State byte of a status record
+static const uint8_t STATE_MOVING = 0x10;
+static const uint8_t STATE_TIMED_OUT = 0x20;
+// Offset of the state byte in a status record
+static const int STATE_OFFSET = 2;
+// Never a state, marks a turnout whose status has to be sent
+static const uint8_t STATE_UNREPORTED = 0xFF;
+
+// CRC-16/CCITT-FALSE, bitwise; frames are short and arrive at most every few ms.
+static uint16_t crc16(const uint8_t* data, int length) {
+    uint16_t crc = 0xFFFF;
+    for (int i = 0; i < length; i++) {
+        crc ^= data[i] << 8;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+        }
+    }
+    return crc;
+}
+
+// Decodes a COBS frame without its delimiters in place, returns the decoded length or -1.
+static int cobs_decode(uint8_t* data, int length) {
+    int in = 0;
+    int out = 0;
+    while (in < length) {
+        uint8_t code = data[in++];
+        if (code == 0 || in + code - 1 > length) {
+            return -1;
+        }
+        for (int i = 1; i < code; i++) {
+            data[out++] = data[in++];
+        }
+        // A block shorter than 254 bytes stood for a zero, unless it is the last one.
+        if (code != 0xFF && in < length) {
+            data[out++] = 0;
+        }
+    }
+    return out;
+}
+
+HostLink::HostLink()
+    : _manager(nullptr), _rx(), _rxLength(0), _inFrame(false), _overflow(false), _subscribed(false),
+      _eventSequence(0), _lastEvent(0), _reported(), _reply(), _buffer(), _head(0), _tail(0), _frames(0),
+      _errors(0), _dropped(0) {
+}
+
+bool HostLink::begin(TurnoutManager& manager) {
+    _manager = nullptr;
+    for (int slot = 0; slot < manager.count(); slot++) {
+        int id = manager.turnout(slot).getId();
+        if (id < 0 || id > 0xFFFF) {
+            return false;
+        }
+    }
+    _manager = &manager;
+    return true;
+}
+
+bool HostLink::feed(uint8_t byte) {
+    if (byte != 0) {
+        if (!_inFrame) {
+            return false;
+        }
+        if (_rxLength < MAX_ENCODED) {
+            _rx[_rxLength++] = byte;
+        } else {
+            _overflow = true;
+        }
+        return true;
+    }
+    // A delimiter without data in front starts a frame, or keeps waiting for one.
+    if (_inFrame && _rxLength > 0) {
+        if (_overflow) {
+            _errors++;
+        } else {
+            handleFrame(_rxLength);
+        }
+        _inFrame = false;
+    } else {
+        _inFrame = true;
+    }
+    _rxLength = 0;
+    _overflow = false;
+    return true;
+}
+
+void HostLink::handleFrame(int length) {
+    length = cobs_decode(_rx, length);
+    if (length < 4 || crc16(_rx, length - 2) != (_rx[length - 2] | (_rx[length - 1] << 8))) {
+        _errors++;
+        return;
+    }
+    _frames++;
+    _reply[0] = _rx[0] | 0x80;
+    _reply[1] = _rx[1];
+    const uint8_t* payload = _rx + 2;
+    int payloadLength = length - 4;
+    if (_manager == nullptr) {
+        return;
+    }
+    switch (_rx[0]) {
+        case HOST_LINK_SET_POSITIONS:
+            setPositions(payload, payloadLength);
+            break;
+        case HOST_LINK_GET_STATUS:
+            getStatus(payload, payloadLength);
+            break;
+        case HOST_LINK_SUBSCRIBE:
+            subscribe(payload, payloadLength);
+            break;
+        default:
+            sendError(HOST_LINK_UNKNOWN_COMMAND);
+            break;
+    }
+}
+
+// Finds the manager slot of a turnout id, -1 if none
+static int find_slot(TurnoutManager& manager, uint16_t id) {
+    for (int slot = 0; slot < manager.count(); slot++) {
+        if (manager.turnout(slot).getId() == id) {
+            return slot;
+        }
+    }
+    return -1;
+}
+
+void HostLink::setPositions(const uint8_t* payload, int length) {
+    if (length % 3 != 0) {
+        sendError(HOST_LINK_BAD_LENGTH);
+        return;
+    }
+    uint8_t accepted = 0;
+    uint8_t rejected = 0;
+    for (int i = 0; i < length; i += 3) {
+        int slot = find_slot(*_manager, payload[i] | (payload[i + 1] << 8));
+        uint8_t position = payload[i + 2];
+        if (slot < 0 || (position != 1 && position != 2)) {
+            rejected++;
+            continue;
+        }
+        // All turnouts are woken at once; the power budget pipelines their pulses.
+        _manager->turnout(slot).setPosition(position);
+        accepted++;
+    }
+    _reply[2] = accepted;
+    _reply[3] = rejected;
+    if (!send(2)) {
+        _dropped++;
+    }
+}
+
+void HostLink::getStatus(const uint8_t* payload, int length) {
+    uint8_t* record = _reply + 2;
+    int count = 0;
+    if (length == 0) {
+        for (int slot = 0; slot < _manager->count(); slot++) {
+            statusRecord(slot, record + STATUS_SIZE * count++);
+        }
+    } else if (length % 2 != 0 || length > 2 * TURNOUT_MANAGER_CAPACITY) {
+        sendError(HOST_LINK_BAD_LENGTH);
+        return;
+    } else {
+        for (int i = 0; i < length; i += 2) {
+            int slot = find_slot(*_manager, payload[i] | (payload[i + 1] << 8));
+            if (slot >= 0) {
+                statusRecord(slot, record + STATUS_SIZE * count++);
+            }
+        }
+    }
+    if (!send(STATUS_SIZE * count)) {
+        _dropped++;
+    }
+}
+
+void HostLink::subscribe(const uint8_t* payload, int length) {
+    if (length != 1) {
+        sendError(HOST_LINK_BAD_LENGTH);
+        return;
+    }
+    _subscribed = payload[0] != 0;
+    if (_subscribed) {
+        // The first event tells the host the state of every turnout.
+        for (int slot = 0; slot < TURNOUT_MANAGER_CAPACITY; slot++) {
+            _reported[slot] = STATE_UNREPORTED;
+        }
+        _lastEvent = millis() - HOST_LINK_EVENT_MS;
+    }
+    _reply[2] = _subscribed;
+    if (!send(1)) {
+        _dropped++;
+    }
+}
+
+void HostLink::sendError(uint8_t code) {
+    // The sequence number of the command is kept, so the host knows which one failed.
+    _reply[2] = _rx[0];
+    _reply[3] = code;
+    _reply[0] = HOST_LINK_ERROR;
+    if (!send(2)) {
+        _dropped++;
+    }
+}
+
+void HostLink::statusRecord(int slot, uint8_t* record) const {
+    const TurnoutBase& turnout = _manager->turnout(slot);
+    uint8_t state = turnout.getPosition() | (turnout.getTargetPosition() << 2);
+    if (turnout.isMoving()) {
+        state |= STATE_MOVING;
+    }
+    if (turnout.hasTimedOut()) {
+        state |= STATE_TIMED_OUT;
+    }
+    uint16_t moveMs = turnout.getLastMoveMs();
+    // begin() has checked that the id fits.
+    uint16_t id = turnout.getId();
+    record[0] = id & 0xFF;
+    record[1] = id >> 8;
+    record[2] = state;
+    record[3] = moveMs & 0xFF;
+    record[4] = moveMs >> 8;
+}
+
+void HostLink::update(unsigned long now) {
+    if (!_subscribed || _manager == nullptr || now - _lastEvent < HOST_LINK_EVENT_MS) {
+        return;
+    }
+    _lastEvent = now;
+    uint8_t* record = _reply + 2;
+    uint8_t changed[TURNOUT_MANAGER_CAPACITY];
+    int count = 0;
+    for (int slot = 0; slot < _manager->count(); slot++) {
+        statusRecord(slot, record + STATUS_SIZE * count);
+        if (record[STATUS_SIZE * count + STATE_OFFSET] != _reported[slot]) {
+            changed[count++] = slot;
+        }
+    }
+    if (count == 0) {
+        return;
+    }
+    _reply[0] = HOST_LINK_EVENT;
+    _reply[1] = _eventSequence;
+    // A change that does not fit into the ring is sent with the next event.
+    if (!send(STATUS_SIZE * count)) {
+        return;
+    }
+    _eventSequence++;
+    for (int i = 0; i < count; i++) {
+        _reported[changed[i]] = record[STATUS_SIZE * i + STATE_OFFSET];
+    }
+}
+
+bool HostLink::send(int length) {
+    uint16_t crc = crc16(_reply, length + 2);
+    _reply[length + 2] = crc & 0xFF;
+    _reply[length + 3] = crc >> 8;
+    length += 4;
+    // Delimiters, the leading code byte and one more per 254 bytes
+    uint32_t size = length + length / 254 + 3;
+    if (HOST_LINK_TX_SIZE - (_head - _tail) < size) {
+        return false;
+    }
+    const uint32_t mask = HOST_LINK_TX_SIZE - 1;
+    _buffer[_head++ & mask] = 0;
+    uint32_t code = _head++;
+    uint8_t run = 1;
+    for (int i = 0; i < length; i++) {
+        if (_reply[i] == 0) {
+            _buffer[code & mask] = run;
+            code = _head++;
+            run = 1;
+            continue;
+        }
+        _buffer[_head++ & mask] = _reply[i];
+        if (++run == 0xFF) {
+            _buffer[code & mask] = run;
+            code = _head++;
+            run = 1;
+        }
+    }
+    _buffer[code & mask] = run;
+    _buffer[_head++ & mask] = 0;
+    return true;
+}
+
+void HostLink::drain(Print& out) {
+    const uint32_t mask = HOST_LINK_TX_SIZE - 1;
+    uint8_t frame[MAX_ENCODED + 2];
+    while (_tail != _head) {
+        // A frame runs from its leading 0x00 to the next one.
+        uint32_t size = 1;
+        while (_buffer[(_tail + size) & mask] != 0) {
+            size++;
+        }
+        size++;
+        // Whole frames only, the event log may write to the same port in between.
+        if (out.availableForWrite() < (int)size) {
+            break;
+        }
+        for (uint32_t i = 0; i < size; i++) {
+            frame[i] = _buffer[_tail++ & mask];
+        }
+        out.write(frame, size);
+    }
+}
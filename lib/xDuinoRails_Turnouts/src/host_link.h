@@ -0,0 +1,135 @@
+/**
+ * @file host_link.h
+ * @brief Binary command protocol for a PC on the USB serial link.
+ *
+ * Sets and queries many turnouts per frame. `feed()` takes the received
+ * bytes one at a time and handles a command as soon as its frame is
+ * complete; the replies go into a RAM ring that `drain()` writes while the
+ * serial link has room, like EventLog::drain(). Nothing blocks the loop.
+ * Bytes outside of frames are left to the sketch, so the single character
+ * commands keep working on the same port. All methods must be called from
+ * the loop that runs the turnouts.
+ *
+ * Frames in both directions are COBS encoded and enclosed in 0x00 bytes:
+ *   0x00, COBS(type u8, sequence u8, payload, CRC u16), 0x00
+ * The CRC is CRC-16/CCITT-FALSE (polynomial 0x1021, initial value 0xFFFF)
+ * of type, sequence and payload, little endian. A reply carries the type of
+ * its command | 0x80 and the sequence number of the command. Frames with a
+ * wrong CRC or longer than MAX_FRAME are dropped without reply; the host
+ * repeats a command whose reply does not arrive.
+ *
+ * Commands (payload):
+ *   SET_POSITIONS  n x (turnout id u16, position u8)
+ *                  Reply: accepted u8, rejected u8 (unknown id or position)
+ *   GET_STATUS     n x turnout id u16, none for all turnouts
+ *                  Reply: one status record per known turnout
+ *   SUBSCRIBE      1 to send EVENT frames, 0 to stop
+ *                  Reply: the same byte; the first EVENT has all turnouts
+ *   EVENT          (device only) status records of the turnouts that changed,
+ *                  at most every HOST_LINK_EVENT_MS. The sequence number counts
+ *                  the events, so the host sees a lost one.
+ *   ERROR          (device only) command type u8, error code (HostLinkError)
+ *
+ * Status record (5 bytes): turnout id u16, state u8, duration of the last
+ * move that reached its position u16 in ms. State bits 0-1: confirmed
+ * position (0: unknown or moving), bits 2-3: target position, bit 4: moving,
+ * bit 5: the last move timed out. All multi-byte fields are little endian.
+ *
+ * The frames are sent and decoded on the host with tools/turnout_link.py.
+ */
+#ifndef HOST_LINK_H
+#define HOST_LINK_H
+
+#include <Arduino.h>
+#include <cstdint>
+#include "turnout_manager.h"
+
+// Size of the reply ring in bytes, must be a power of 2
+#ifndef HOST_LINK_TX_SIZE
+#define HOST_LINK_TX_SIZE 1024
+#endif
+static_assert((HOST_LINK_TX_SIZE & (HOST_LINK_TX_SIZE - 1)) == 0, "HOST_LINK_TX_SIZE must be a power of 2");
+
+// Minimum time between two EVENT frames in ms; changes in between are sent together
+#ifndef HOST_LINK_EVENT_MS
+#define HOST_LINK_EVENT_MS 10
+#endif
+
+// Frame types, keep in sync with tools/turnout_link.py
+enum HostLinkFrame : uint8_t {
+    HOST_LINK_SET_POSITIONS = 0x01,
+    HOST_LINK_GET_STATUS = 0x02,
+    HOST_LINK_SUBSCRIBE = 0x03,
+    HOST_LINK_EVENT = 0x84,
+    HOST_LINK_ERROR = 0xFF
+};
+
+enum HostLinkError : uint8_t {
+    HOST_LINK_UNKNOWN_COMMAND = 1,
+    HOST_LINK_BAD_LENGTH = 2
+};
+
+class HostLink {
+public:
+    static const int STATUS_SIZE = 5;
+    // Largest frame before encoding: header, a status record of every turnout, CRC
+    static const int MAX_FRAME = 2 + STATUS_SIZE * TURNOUT_MANAGER_CAPACITY + 2;
+
+    HostLink();
+
+    // Serves the turnouts of `manager`. Call it after adding the turnouts.
+    // Returns false and serves nothing if a turnout id does not fit into u16.
+    bool begin(TurnoutManager& manager);
+
+    // Takes one received byte. Returns false if it is not part of a frame, the
+    // sketch handles it as a text command then.
+    bool feed(uint8_t byte);
+    // Sends the EVENT frame when subscribed. Call this in loop().
+    void update(unsigned long now);
+    // Writes queued frames while `out` has room for a complete frame.
+    void drain(Print& out);
+
+    // Commands handled
+    uint32_t frameCount() const { return _frames; }
+    // Received frames dropped for a wrong CRC, their length or a broken encoding
+    uint32_t errorCount() const { return _errors; }
+    // Replies dropped because the ring was full
+    uint32_t droppedCount() const { return _dropped; }
+
+private:
+    // Bytes of a frame of MAX_FRAME bytes after COBS encoding
+    static const int MAX_ENCODED = MAX_FRAME + MAX_FRAME / 254 + 1;
+
+    void handleFrame(int length);
+    void setPositions(const uint8_t* payload, int length);
+    void getStatus(const uint8_t* payload, int length);
+    void subscribe(const uint8_t* payload, int length);
+    void sendError(uint8_t code);
+    // Writes the status record of the turnout in `slot` to `record`.
+    void statusRecord(int slot, uint8_t* record) const;
+    // Encodes `_reply` (type, sequence and `length` bytes of payload) into the ring.
+    bool send(int length);
+
+    TurnoutManager* _manager;
+
+    uint8_t _rx[MAX_ENCODED];    // Frame being received, decoded in place
+    int _rxLength;
+    bool _inFrame;               // A 0x00 has started a frame
+    bool _overflow;              // The frame being received is longer than MAX_ENCODED
+
+    bool _subscribed;
+    uint8_t _eventSequence;
+    unsigned long _lastEvent;
+    uint8_t _reported[TURNOUT_MANAGER_CAPACITY]; // State last sent per manager slot, 0xFF to send it
+
+    uint8_t _reply[MAX_FRAME];   // Reply being built: type, sequence, payload
+    uint8_t _buffer[HOST_LINK_TX_SIZE];
+    uint32_t _head;              // Next byte to write
+    uint32_t _tail;              // Next byte to send
+
+    uint32_t _frames;
+    uint32_t _errors;
+    uint32_t _dropped;
+};
+
+#endif
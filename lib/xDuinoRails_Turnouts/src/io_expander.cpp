@@ -0,0 +1,216 @@
+#include "io_expander.h"
+
+// MCP23x17 registers, IOCON.BANK = 0
+static const uint8_t MCP_IODIRA = 0x00;
+static const uint8_t MCP_IOCON = 0x0A;
+static const uint8_t MCP_GPPUA = 0x0C;
+static const uint8_t MCP_GPIOA = 0x12;
+static const uint8_t MCP_OLATA = 0x14;
+// IOCON.HAEN: the MCP23S17 compares its A0..A2 pins with the opcode
+static const uint8_t MCP_IOCON_HAEN = 0x08;
+
+// --- Mcp23017 ---
+
+Mcp23017::Mcp23017(uint8_t address, TwoWire& wire) : _wire(wire), _address(address), _levels(0xFFFF) {
+}
+
+bool Mcp23017::writeRegisters(uint8_t reg, uint16_t value) {
+    _wire.beginTransmission(_address);
+    _wire.write(reg);
+    _wire.write(value & 0xFF);
+    _wire.write(value >> 8);
+    return _wire.endTransmission() == 0;
+}
+
+bool Mcp23017::configure(uint16_t inputs, uint16_t pullups, uint16_t outputs, uint32_t& transactions) {
+    // Latches first, so an output starts at its level when it is switched to output.
+    const uint8_t registers[] = { MCP_OLATA, MCP_GPPUA, MCP_IODIRA };
+    const uint16_t values[] = { outputs, pullups, inputs };
+    for (int i = 0; i < 3; i++) {
+        transactions++;
+        if (!writeRegisters(registers[i], values[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void Mcp23017::writeOutputs(uint16_t outputs) {
+    writeRegisters(MCP_OLATA, outputs);
+}
+
+void Mcp23017::startRead() {
+    _wire.beginTransmission(_address);
+    _wire.write(MCP_GPIOA);
+    if (_wire.endTransmission(false) != 0 || _wire.requestFrom(_address, (size_t)2) != 2) {
+        return; // Keeps the last levels
+    }
+    uint16_t a = _wire.read();
+    uint16_t b = _wire.read();
+    _levels = a | (b << 8);
+}
+
+bool Mcp23017::readDone(uint16_t& levels) {
+    levels = _levels;
+    return true;
+}
+
+// --- Mcp23S17 ---
+
+#if defined(ARDUINO_ARCH_RP2040)
+
+#include "hardware/spi.h"
+#include "hardware/dma.h"
+#include "hardware/gpio.h"
+#include "hardware/irq.h"
+
+// DMA channels shared by all chips, -1 until the first chip is configured
+static int spi_tx_channel = -1;
+static int spi_rx_channel = -1;
+static volatile uint8_t spi_cs_pin;    // Chip select of the running transaction
+static volatile bool spi_active = false; // A transaction has been started and not finished yet
+
+// The last byte has been received once the receive channel has finished; the chip
+// select goes up right then, not when the loop next looks.
+static void spi_dma_irq_handler() {
+    if (spi_rx_channel >= 0 && dma_channel_get_irq1_status(spi_rx_channel)) {
+        dma_channel_acknowledge_irq1(spi_rx_channel);
+        gpio_put(spi_cs_pin, true);
+        spi_active = false;
+    }
+}
+
+static spi_inst_t* spi_block(uint8_t index) {
+    return index == 0 ? spi0 : spi1;
+}
+
+static bool spi_setup(uint8_t index, uint8_t sck, uint8_t mosi, uint8_t miso, uint8_t cs) {
+    if (spi_tx_channel < 0) {
+        spi_tx_channel = dma_claim_unused_channel(false);
+        spi_rx_channel = dma_claim_unused_channel(false);
+        if (spi_tx_channel < 0 || spi_rx_channel < 0) {
+            if (spi_tx_channel >= 0) {
+                dma_channel_unclaim(spi_tx_channel);
+            }
+            if (spi_rx_channel >= 0) {
+                dma_channel_unclaim(spi_rx_channel);
+            }
+            spi_tx_channel = -1;
+            spi_rx_channel = -1;
+            return false;
+        }
+        // DMA_IRQ_0 belongs to the BEMF acquisition (motor_control_hal.cpp).
+        dma_channel_set_irq1_enabled(spi_rx_channel, true);
+        irq_add_shared_handler(DMA_IRQ_1, spi_dma_irq_handler, PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+        irq_set_enabled(DMA_IRQ_1, true);
+    }
+    spi_init(spi_block(index), MCP23S17_SPI_HZ);
+    spi_set_format(spi_block(index), 8, SPI_CPOL_0, SPI_CPHA_0, SPI_MSB_FIRST);
+    gpio_set_function(sck, GPIO_FUNC_SPI);
+    gpio_set_function(mosi, GPIO_FUNC_SPI);
+    gpio_set_function(miso, GPIO_FUNC_SPI);
+    gpio_init(cs);
+    gpio_put(cs, true);
+    gpio_set_dir(cs, true);
+    return true;
+}
+
+// Transfers `length` bytes in both directions; every byte sent clocks one byte in.
+static void spi_start(uint8_t index, uint8_t cs, const uint8_t* tx, volatile uint8_t* rx, int length) {
+    spi_inst_t* spi = spi_block(index);
+    dma_channel_config rx_config = dma_channel_get_default_config(spi_rx_channel);
+    channel_config_set_transfer_data_size(&rx_config, DMA_SIZE_8);
+    channel_config_set_read_increment(&rx_config, false);
+    channel_config_set_write_increment(&rx_config, true);
+    channel_config_set_dreq(&rx_config, spi_get_dreq(spi, false));
+    dma_channel_configure(spi_rx_channel, &rx_config, rx, &spi_get_hw(spi)->dr, length, false);
+
+    dma_channel_config tx_config = dma_channel_get_default_config(spi_tx_channel);
+    channel_config_set_transfer_data_size(&tx_config, DMA_SIZE_8);
+    channel_config_set_read_increment(&tx_config, true);
+    channel_config_set_write_increment(&tx_config, false);
+    channel_config_set_dreq(&tx_config, spi_get_dreq(spi, true));
+    dma_channel_configure(spi_tx_channel, &tx_config, &spi_get_hw(spi)->dr, tx, length, false);
+
+    spi_cs_pin = cs;
+    spi_active = true;
+    gpio_put(cs, false);
+    // Both at once, so the receive channel drains every byte the transmit channel clocks out.
+    dma_start_channel_mask((1u << spi_tx_channel) | (1u << spi_rx_channel));
+}
+
+static bool spi_busy() {
+    return spi_active;
+}
+
+#else
+
+static bool spi_setup(uint8_t, uint8_t, uint8_t, uint8_t, uint8_t) { return false; }
+static void spi_start(uint8_t, uint8_t, const uint8_t*, volatile uint8_t*, int) {}
+static bool spi_busy() { return false; }
+
+#endif
+
+// Receives the bytes clocked in during writes, the results of reads stay untouched.
+static volatile uint8_t spi_discard[4];
+// Chip whose read is the running transaction, nullptr otherwise
+static const Mcp23S17* spi_reader = nullptr;
+
+Mcp23S17::Mcp23S17(uint8_t spiIndex, uint8_t sckPin, uint8_t mosiPin, uint8_t misoPin, uint8_t csPin,
+                   uint8_t hardwareAddress)
+    : _spiIndex(spiIndex), _sckPin(sckPin), _mosiPin(mosiPin), _misoPin(misoPin), _csPin(csPin),
+      _opcode(0x40 | ((hardwareAddress & 0x07) << 1)), _reading(false), _tx(), _rx() {
+}
+
+void Mcp23S17::finish() {
+    while (spi_busy()) {
+    }
+}
+
+void Mcp23S17::transfer(const uint8_t* data, int length, bool read) {
+    finish();
+    for (int i = 0; i < length; i++) {
+        _tx[i] = data[i];
+    }
+    spi_reader = read ? this : nullptr;
+    spi_start(_spiIndex, _csPin, _tx, read ? _rx : spi_discard, length);
+}
+
+bool Mcp23S17::configure(uint16_t inputs, uint16_t pullups, uint16_t outputs, uint32_t& transactions) {
+    finish();
+    if (!spi_setup(_spiIndex, _sckPin, _mosiPin, _misoPin, _csPin)) {
+        return false;
+    }
+    // Until HAEN is set, every chip on the chip select takes this write as its own.
+    const uint8_t iocon[] = { 0x40, MCP_IOCON, MCP_IOCON_HAEN };
+    transfer(iocon, sizeof(iocon), false);
+    const uint8_t latches[] = { _opcode, MCP_OLATA, (uint8_t)(outputs & 0xFF), (uint8_t)(outputs >> 8) };
+    transfer(latches, sizeof(latches), false);
+    const uint8_t pull[] = { _opcode, MCP_GPPUA, (uint8_t)(pullups & 0xFF), (uint8_t)(pullups >> 8) };
+    transfer(pull, sizeof(pull), false);
+    const uint8_t direction[] = { _opcode, MCP_IODIRA, (uint8_t)(inputs & 0xFF), (uint8_t)(inputs >> 8) };
+    transfer(direction, sizeof(direction), false);
+    transactions += 4;
+    finish();
+    return true;
+}
+
+void Mcp23S17::writeOutputs(uint16_t outputs) {
+    const uint8_t data[] = { _opcode, MCP_OLATA, (uint8_t)(outputs & 0xFF), (uint8_t)(outputs >> 8) };
+    transfer(data, sizeof(data), false);
+}
+
+void Mcp23S17::startRead() {
+    // The two bytes after the register address clock the port values in.
+    const uint8_t data[] = { (uint8_t)(_opcode | 0x01), MCP_GPIOA, 0, 0 };
+    transfer(data, sizeof(data), true);
+    _reading = true;
+}
+
+bool Mcp23S17::readDone(uint16_t& levels) {
+    if (!_reading || (spi_reader == this && spi_busy())) {
+        return false;
+    }
+    levels = _rx[2] | (_rx[3] << 8);
+    return true;
+}
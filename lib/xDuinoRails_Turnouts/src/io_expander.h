@@ -0,0 +1,116 @@
+/**
+ * @file io_expander.h
+ * @brief GPIO expander drivers behind the turnout pins (see io_pins.h).
+ *
+ * A driver moves all 16 pins of one chip in single bus transactions: the
+ * output latches of both ports are written in one transaction and both input
+ * ports are read in one. IoPins decides when, within the read interval the
+ * driver asks for; the drivers only know their bus. Register addresses are those of the MCP23x17 in its default IOCON.BANK
+ * = 0 layout, where the A and B register of each kind are adjacent and the
+ * address pointer increments within a transaction.
+ */
+#ifndef IO_EXPANDER_H
+#define IO_EXPANDER_H
+
+#include <Arduino.h>
+#include <Wire.h>
+#include <cstdint>
+
+// One 16-bit GPIO expander. Bit n of a value is pin n (port A: 0..7, port B: 8..15).
+class IoExpander {
+public:
+    // Writes the pin directions (1: input), pull-ups and output latches and adds the
+    // bus transactions it took to `transactions`. Returns false if the chip does not answer.
+    virtual bool configure(uint16_t inputs, uint16_t pullups, uint16_t outputs, uint32_t& transactions) = 0;
+    // Writes both output latches in one transaction.
+    virtual void writeOutputs(uint16_t outputs) = 0;
+    // Starts reading both input ports in one transaction.
+    virtual void startRead() = 0;
+    // True once the read has finished, `levels` then holds the pin levels.
+    virtual bool readDone(uint16_t& levels) = 0;
+    // Minimum time between two reads in ms
+    virtual unsigned long readIntervalMs() const = 0;
+
+protected:
+    ~IoExpander() = default;
+};
+
+// Interval between two reads of an MCP23017 in ms. A read blocks the loop, so it
+// is not done on every switch scan; the end switches of the chip are debounced
+// from every read and take 4 reads to settle.
+#ifndef MCP23017_READ_MS
+#define MCP23017_READ_MS 5
+#endif
+
+// MCP23017 on an I2C bus. The sketch sets the bus up (Wire.begin(), Wire.setClock(400000)).
+// The Arduino Wire library blocks while it transfers, so a read of both ports
+// takes about 120µs at 400kHz and is finished when startRead() returns. It is
+// read every MCP23017_READ_MS instead of every switch scan.
+class Mcp23017 : public IoExpander {
+public:
+    // `address`: 0x20..0x27, set by the A0..A2 pins
+    explicit Mcp23017(uint8_t address = 0x20, TwoWire& wire = Wire);
+
+    bool configure(uint16_t inputs, uint16_t pullups, uint16_t outputs, uint32_t& transactions) override;
+    void writeOutputs(uint16_t outputs) override;
+    void startRead() override;
+    bool readDone(uint16_t& levels) override;
+    unsigned long readIntervalMs() const override { return MCP23017_READ_MS; }
+
+private:
+    bool writeRegisters(uint8_t reg, uint16_t value);
+
+    TwoWire& _wire;
+    uint8_t _address;
+    uint16_t _levels;
+};
+
+// SPI clock of the MCP23S17, the chip allows up to 10MHz
+#ifndef MCP23S17_SPI_HZ
+#define MCP23S17_SPI_HZ 10000000
+#endif
+
+// Interval between two reads of an MCP23S17 in ms, a read does not block the loop
+#ifndef MCP23S17_READ_MS
+#define MCP23S17_READ_MS 1
+#endif
+
+// MCP23S17 on an SPI bus. Every transaction is transferred by DMA, so startRead()
+// and writeOutputs() return at once; the DMA_IRQ_1 interrupt of the receive
+// channel releases the chip select as soon as the last byte is in. Up to 8 chips
+// can share a chip select through their hardware address (A0..A2). All chips
+// share one pair of DMA channels; a transaction waits for the previous one, a
+// few µs at 10MHz.
+class Mcp23S17 : public IoExpander {
+public:
+    // `spiIndex`: 0 or 1 for SPI0/SPI1, the pins must belong to that block
+    Mcp23S17(uint8_t spiIndex, uint8_t sckPin, uint8_t mosiPin, uint8_t misoPin, uint8_t csPin,
+             uint8_t hardwareAddress = 0);
+
+    bool configure(uint16_t inputs, uint16_t pullups, uint16_t outputs, uint32_t& transactions) override;
+    void writeOutputs(uint16_t outputs) override;
+    void startRead() override;
+    bool readDone(uint16_t& levels) override;
+    unsigned long readIntervalMs() const override { return MCP23S17_READ_MS; }
+
+private:
+    static const int MAX_TRANSFER = 4; // Opcode, register, port A, port B
+
+    // Starts a transaction of `length` bytes after the running one has finished.
+    // Only a read keeps the received bytes.
+    void transfer(const uint8_t* data, int length, bool read);
+    // Waits for the running transaction of any chip on the shared channels.
+    static void finish();
+
+    uint8_t _spiIndex;
+    uint8_t _sckPin;
+    uint8_t _mosiPin;
+    uint8_t _misoPin;
+    uint8_t _csPin;
+    uint8_t _opcode;      // Write opcode including the hardware address
+    bool _reading;        // A read has been started, `_rx` holds or will hold its result
+    uint8_t _tx[MAX_TRANSFER];
+    volatile uint8_t _rx[MAX_TRANSFER];
+};
+
+#endif
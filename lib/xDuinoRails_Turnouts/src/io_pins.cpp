@@ -0,0 +1,142 @@
+#include "io_pins.h"
+#include "switch_inputs.h"
+
+IoPins ioPins;
+
+IoPins::IoPins()
+    : _expanders(), _count(0), _inputs(), _pullups(), _outputs(), _levels(), _configDirty(0), _outputsDirty(0),
+      _polled(0), _reading(0), _fresh(0), _nextRead(), _transactions(0), _failed(0) {
+}
+
+int IoPins::addExpander(IoExpander& expander) {
+    if (_count >= IO_MAX_EXPANDERS) {
+        return -1;
+    }
+    int index = _count++;
+    _expanders[index] = &expander;
+    // Power-on state of the chip: all pins are inputs without pull-up.
+    _inputs[index] = 0xFFFF;
+    _configDirty |= 1u << index;
+    // Staggered by a ms each, so blocking reads of several chips fall into different loops.
+    _nextRead[index] = index;
+    return index;
+}
+
+void IoPins::mode(uint8_t pin, uint8_t mode) {
+    if (pin < IO_EXPANDER_PIN_BASE) {
+        // Spelled out, the core's pinMode() takes an enum.
+        ::pinMode(pin, mode == OUTPUT ? OUTPUT : mode == INPUT_PULLUP ? INPUT_PULLUP : INPUT);
+        return;
+    }
+    int expander = (pin - IO_EXPANDER_PIN_BASE) / IO_EXPANDER_PINS;
+    if (expander >= _count) {
+        return;
+    }
+    uint16_t bit = 1u << ((pin - IO_EXPANDER_PIN_BASE) % IO_EXPANDER_PINS);
+    if (mode == OUTPUT) {
+        _inputs[expander] &= ~bit;
+    } else {
+        _inputs[expander] |= bit;
+        _polled |= 1u << expander;
+    }
+    if (mode == INPUT_PULLUP) {
+        _pullups[expander] |= bit;
+        // Reads as high until the first read, like a native pin with pull-up.
+        _levels[expander] |= bit;
+    } else {
+        _pullups[expander] &= ~bit;
+    }
+    _configDirty |= 1u << expander;
+}
+
+void IoPins::write(uint8_t pin, uint8_t level) {
+    if (pin < IO_EXPANDER_PIN_BASE) {
+        ::digitalWrite(pin, level == LOW ? LOW : HIGH);
+        return;
+    }
+    int expander = (pin - IO_EXPANDER_PIN_BASE) / IO_EXPANDER_PINS;
+    if (expander >= _count) {
+        return;
+    }
+    uint16_t bit = 1u << ((pin - IO_EXPANDER_PIN_BASE) % IO_EXPANDER_PINS);
+    uint16_t outputs = level == LOW ? _outputs[expander] & ~bit : _outputs[expander] | bit;
+    if (outputs != _outputs[expander]) {
+        _outputs[expander] = outputs;
+        _outputsDirty |= 1u << expander;
+    }
+}
+
+bool IoPins::read(uint8_t pin) const {
+    if (pin < IO_EXPANDER_PIN_BASE) {
+        return ::digitalRead(pin) == HIGH;
+    }
+    int expander = (pin - IO_EXPANDER_PIN_BASE) / IO_EXPANDER_PINS;
+    if (expander >= _count) {
+        return false;
+    }
+    return (_levels[expander] >> ((pin - IO_EXPANDER_PIN_BASE) % IO_EXPANDER_PINS)) & 1;
+}
+
+void IoPins::poll(unsigned long now) {
+    if (_count == 0) {
+        return;
+    }
+    for (int expander = 0; expander < _count; expander++) {
+        uint8_t bit = 1u << expander;
+        uint16_t levels;
+        if (_reading & bit) {
+            if (!_expanders[expander]->readDone(levels)) {
+                continue;
+            }
+            _levels[expander] = levels;
+            _reading &= ~bit;
+            _fresh |= bit;
+        }
+        // Inputs are only needed as fast as the switches are debounced, and not faster
+        // than the bus of the chip allows.
+        unsigned long interval = _expanders[expander]->readIntervalMs();
+        if (interval < SWITCH_INPUTS_SCAN_MS) {
+            interval = SWITCH_INPUTS_SCAN_MS;
+        }
+        if (!((_polled & ~_configDirty) & bit) || (long)(now - _nextRead[expander]) < 0) {
+            continue;
+        }
+        // The next read stays on the grid of this chip, after a slow loop too, so the
+        // chips keep their stagger.
+        _nextRead[expander] += ((now - _nextRead[expander]) / interval + 1) * interval;
+        _expanders[expander]->startRead();
+        _reading |= bit;
+        _transactions++;
+    }
+}
+
+bool IoPins::takeExpanderLevels(int expander, uint16_t& levels) {
+    uint8_t bit = 1u << expander;
+    if (!(_fresh & bit)) {
+        return false;
+    }
+    _fresh &= ~bit;
+    levels = _levels[expander];
+    return true;
+}
+
+void IoPins::flush() {
+    if ((_configDirty | _outputsDirty) == 0) {
+        return;
+    }
+    for (int expander = 0; expander < _count; expander++) {
+        uint8_t bit = 1u << expander;
+        if (_configDirty & bit) {
+            // Also writes the latches; only happens while the turnouts start.
+            if (!_expanders[expander]->configure(_inputs[expander], _pullups[expander], _outputs[expander],
+                                                 _transactions)) {
+                _failed++;
+            }
+        } else if (_outputsDirty & bit) {
+            _expanders[expander]->writeOutputs(_outputs[expander]);
+            _transactions++;
+        }
+    }
+    _configDirty = 0;
+    _outputsDirty = 0;
+}
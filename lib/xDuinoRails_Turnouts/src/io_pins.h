@@ -0,0 +1,96 @@
+/**
+ * @file io_pins.h
+ * @brief Turnout pins on native GPIOs and on GPIO expanders.
+ *
+ * Pin numbers below `IO_EXPANDER_PIN_BASE` are RP2040 GPIOs and are switched
+ * at once. The pins of expander n (in the order of `addExpander()`) follow as
+ * `expanderPin(n, 0..15)`. Writes to them only change a shadow of the output
+ * latches; `flush()` sends every expander whose outputs changed in one
+ * transaction, so the bus traffic per loop is bounded by one write per
+ * expander, however many coils switched. Expanders with inputs are read in
+ * one transaction each by `poll()`, every read interval of their driver (see
+ * io_expander.h), so a chip on a blocking bus does not stall every switch
+ * scan. Each completed read feeds the end switch debouncing once (see
+ * switch_inputs.h).
+ *
+ * The TurnoutManager (or TurnoutBase::update()) calls `poll()` before and
+ * `flush()` after running the turnouts. All methods must be called from the
+ * core that runs the turnouts.
+ */
+#ifndef IO_PINS_H
+#define IO_PINS_H
+
+#include <Arduino.h>
+#include <cstdint>
+#include "io_expander.h"
+
+// Maximum number of expanders
+#ifndef IO_MAX_EXPANDERS
+#define IO_MAX_EXPANDERS 4
+#endif
+
+// First pin number of the expanders, above all RP2040 GPIOs
+#define IO_EXPANDER_PIN_BASE 32
+#define IO_EXPANDER_PINS 16
+
+static_assert(IO_MAX_EXPANDERS <= 8, "IO_MAX_EXPANDERS must be at most 8");
+
+// Pin number of `pin` (0..15) on expander `expander`
+constexpr uint8_t expanderPin(uint8_t expander, uint8_t pin) {
+    return IO_EXPANDER_PIN_BASE + expander * IO_EXPANDER_PINS + pin;
+}
+
+class IoPins {
+public:
+    IoPins();
+
+    // Adds an expander, returns its number or -1 if IO_MAX_EXPANDERS are in use. Add
+    // the expanders before TurnoutManager::begin().
+    int addExpander(IoExpander& expander);
+    int expanderCount() const { return _count; }
+
+    // Same as the Arduino functions, for native and expander pins. Only OUTPUT,
+    // INPUT and INPUT_PULLUP are supported on expanders.
+    void mode(uint8_t pin, uint8_t mode);
+    void write(uint8_t pin, uint8_t level);
+    // An expander pin returns the level of the last completed read.
+    bool read(uint8_t pin) const;
+
+    // Levels of all pins of an expander from the last completed read
+    uint16_t expanderLevels(int expander) const { return _levels[expander]; }
+    // Input pins of an expander
+    uint16_t expanderInputs(int expander) const { return _inputs[expander]; }
+    // True once per completed read of an expander, `levels` then holds its levels.
+    bool takeExpanderLevels(int expander, uint16_t& levels);
+
+    // Collects finished reads and starts the reads that are due.
+    void poll(unsigned long now);
+    // Writes changed pin modes and outputs, one transaction per changed expander.
+    void flush();
+
+    // Bus transactions since boot, for the statistics
+    uint32_t transactionCount() const { return _transactions; }
+    // Expanders that did not answer their configuration
+    uint32_t failedCount() const { return _failed; }
+
+private:
+    IoExpander* _expanders[IO_MAX_EXPANDERS];
+    int _count;
+    uint16_t _inputs[IO_MAX_EXPANDERS];   // Direction, 1: input
+    uint16_t _pullups[IO_MAX_EXPANDERS];
+    uint16_t _outputs[IO_MAX_EXPANDERS];  // Shadow of the output latches
+    uint16_t _levels[IO_MAX_EXPANDERS];   // Last read levels
+    uint8_t _configDirty;                 // Bit n: modes of expander n changed
+    uint8_t _outputsDirty;                // Bit n: outputs of expander n changed
+    uint8_t _polled;                      // Bit n: expander n has pins set up as inputs
+    uint8_t _reading;                     // Bit n: a read of expander n is running
+    uint8_t _fresh;                       // Bit n: expander n has levels not taken yet
+    unsigned long _nextRead[IO_MAX_EXPANDERS]; // On a grid of the read interval, see poll()
+    uint32_t _transactions;
+    uint32_t _failed;
+};
+
+// Pins of all turnouts
+extern IoPins ioPins;
+
+#endif
@@ -0,0 +1,34 @@
+#include "perf_counters.h"
+
+void Log2Histogram::print(Print& out) const {
+    bool empty = true;
+    for (int i = 0; i < PERF_HISTOGRAM_BUCKETS; i++) {
+        if (_buckets[i] == 0) {
+            continue;
+        }
+        if (!empty) {
+            out.print(' ');
+        }
+        // Upper bound (exclusive) of the bucket, the last one is open-ended.
+        if (i == PERF_HISTOGRAM_BUCKETS - 1) {
+            out.print(">=");
+            out.print(1ul << (i - 1));
+        } else {
+            out.print(1ul << i);
+        }
+        out.print(':');
+        out.print(_buckets[i]);
+        empty = false;
+    }
+    if (empty) {
+        out.print('-');
+    }
+}
+
+void LoopMonitor::print(Print& out) const {
+    out.print("loop max_us=");
+    out.print(_max);
+    out.print(" period_us ");
+    _period.print(out);
+    out.println();
+}
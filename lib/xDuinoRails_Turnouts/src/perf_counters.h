@@ -0,0 +1,104 @@
+/**
+ * @file perf_counters.h
+ * @brief Cheap runtime statistics: log2 histograms, turnout counters and loop jitter.
+ *
+ * Recording a value costs a count-leading-zeros and an increment, so the
+ * statistics can stay enabled in production. They are printed on request
+ * (see TurnoutManager::printStats()).
+ */
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <Arduino.h>
+#include <cstdint>
+
+// Number of histogram buckets, the last one also counts all larger values
+#ifndef PERF_HISTOGRAM_BUCKETS
+#define PERF_HISTOGRAM_BUCKETS 16
+#endif
+
+// Histogram with power-of-two buckets: bucket 0 counts the value 0,
+// bucket i the values 2^(i-1) .. 2^i - 1.
+class Log2Histogram {
+public:
+    constexpr Log2Histogram() : _buckets() {}
+
+    void add(uint32_t value) {
+        int bucket = value == 0 ? 0 : 32 - __builtin_clz(value);
+        if (bucket >= PERF_HISTOGRAM_BUCKETS) {
+            bucket = PERF_HISTOGRAM_BUCKETS - 1;
+        }
+        _buckets[bucket]++;
+    }
+
+    void reset() {
+        for (int i = 0; i < PERF_HISTOGRAM_BUCKETS; i++) {
+            _buckets[i] = 0;
+        }
+    }
+
+    uint32_t bucket(int index) const { return _buckets[index]; }
+
+    // Prints the non-empty buckets as "<upper bound>:<count>", e.g. "64:3 128:1".
+    void print(Print& out) const;
+
+private:
+    uint32_t _buckets[PERF_HISTOGRAM_BUCKETS];
+};
+
+// Counters of one turnout
+struct TurnoutStats {
+    uint32_t moves = 0;
+    uint32_t timeouts = 0;
+    uint32_t pulses = 0;            // Coil pulses, plain and BEMF
+    uint32_t onTimeMs = 0;          // Total coil on-time, proportional to the energy used
+    Log2Histogram moveDuration;     // ms from the start of a move to its end position
+    Log2Histogram commandLatency;   // ms from the command (DCC packet) to the start of the move
+
+    void reset() {
+        moves = 0;
+        timeouts = 0;
+        pulses = 0;
+        onTimeMs = 0;
+        moveDuration.reset();
+        commandLatency.reset();
+    }
+};
+
+// Measures the period of the main loop. Call tick() once per loop.
+class LoopMonitor {
+public:
+    LoopMonitor() : _last(0), _max(0), _started(false) {}
+
+    void tick() {
+        uint32_t now = micros();
+        if (_started) {
+            uint32_t period = now - _last;
+            _period.add(period);
+            if (period > _max) {
+                _max = period;
+            }
+        }
+        _last = now;
+        _started = true;
+    }
+
+    void reset() {
+        _period.reset();
+        _max = 0;
+        _started = false;
+    }
+
+    uint32_t maxPeriod() const { return _max; }
+    const Log2Histogram& period() const { return _period; }
+
+    void print(Print& out) const;
+
+private:
+    Log2Histogram _period; // µs
+    uint32_t _last;
+    uint32_t _max;
+    bool _started;
+};
+
+#endif
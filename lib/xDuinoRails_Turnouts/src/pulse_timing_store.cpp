@@ -0,0 +1,87 @@
+#include "pulse_timing_store.h"
+
+#include <EEPROM.h>
+
+PulseTimingStore::PulseTimingStore(int eepromOffset, unsigned long commitIntervalMs)
+    : _eepromOffset(eepromOffset), _commitIntervalMs(commitIntervalMs), _lastCommit(0) {
+    for (int i = 0; i < PULSE_TIMING_STORE_SIZE; i++) {
+        _entries[i] = {0xFFFF, 0xFF, 0xFF, 0xFFFF};
+    }
+}
+
+uint16_t PulseTimingStore::checkOf(const Entry& entry) {
+    return entry.id ^ (entry.onMs | (entry.offMs << 8)) ^ ENTRY_CHECK;
+}
+
+bool PulseTimingStore::valid(const Entry& entry) {
+    return checkOf(entry) == entry.check;
+}
+
+int PulseTimingStore::find(int id) const {
+    for (int i = 0; i < PULSE_TIMING_STORE_SIZE; i++) {
+        if (valid(_entries[i]) && _entries[i].id == id) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void PulseTimingStore::begin(TurnoutManager& manager) {
+    EEPROM.begin(PULSE_TIMING_EEPROM_SIZE);
+    EEPROM.get(_eepromOffset, _entries);
+    _lastCommit = millis();
+
+    for (int i = 0; i < manager.count(); i++) {
+        TurnoutBase& turnout = manager.turnout(i);
+        if (!turnout.isAdaptive() || turnout.getId() < 0 || turnout.getId() > MAX_ID) {
+            continue;
+        }
+        int index = find(turnout.getId());
+        if (index >= 0) {
+            turnout.setPulseTiming(_entries[index].onMs, _entries[index].offMs);
+        }
+    }
+}
+
+void PulseTimingStore::update(TurnoutManager& manager) {
+    unsigned long now = millis();
+    if (now - _lastCommit < _commitIntervalMs || manager.isBusy()) {
+        return;
+    }
+    _lastCommit = now;
+
+    bool changed = false;
+    for (int i = 0; i < manager.count(); i++) {
+        TurnoutBase& turnout = manager.turnout(i);
+        // An id that does not fit would share the entry of another turnout.
+        if (!turnout.isAdaptive() || turnout.getId() < 0 || turnout.getId() > MAX_ID) {
+            continue;
+        }
+        Entry entry;
+        entry.id = turnout.getId();
+        entry.onMs = turnout.getPulseOnMs();
+        entry.offMs = turnout.getPulseOffMs();
+        entry.check = checkOf(entry);
+
+        int index = find(entry.id);
+        if (index < 0) {
+            // First free (or erased) slot
+            for (int j = 0; j < PULSE_TIMING_STORE_SIZE && index < 0; j++) {
+                if (!valid(_entries[j])) {
+                    index = j;
+                }
+            }
+            if (index < 0) {
+                continue; // Table full, the turnout keeps learning from the defaults after a reset
+            }
+        }
+        if (_entries[index].onMs != entry.onMs || _entries[index].offMs != entry.offMs || _entries[index].check != entry.check) {
+            _entries[index] = entry;
+            EEPROM.put(_eepromOffset + index * (int)sizeof(Entry), entry);
+            changed = true;
+        }
+    }
+    if (changed) {
+        EEPROM.commit();
+    }
+}
@@ -0,0 +1,58 @@
+#ifndef PULSE_TIMING_STORE_H
+#define PULSE_TIMING_STORE_H
+
+#include <Arduino.h>
+#include "turnout_manager.h"
+
+// Number of adaptive turnouts whose learned timing can be stored
+#ifndef PULSE_TIMING_STORE_SIZE
+#define PULSE_TIMING_STORE_SIZE 16
+#endif
+// Start of the table in the emulated EEPROM, 6 bytes per entry. The first 256 bytes hold the DCC CVs.
+#ifndef PULSE_TIMING_EEPROM_OFFSET
+#define PULSE_TIMING_EEPROM_OFFSET 256
+#endif
+// Size of the emulated EEPROM passed to EEPROM.begin()
+#ifndef PULSE_TIMING_EEPROM_SIZE
+#define PULSE_TIMING_EEPROM_SIZE 512
+#endif
+
+// Keeps the learned pulse timing of adaptive BEMF turnouts in the (flash-emulated) EEPROM.
+//
+// begin() restores the timing of every adaptive turnout of a manager. update()
+// writes changed values back, but only while all turnouts are idle and at most
+// once per commit interval: committing rewrites a flash sector and stalls both
+// cores for a few milliseconds.
+class PulseTimingStore {
+public:
+    explicit PulseTimingStore(int eepromOffset = PULSE_TIMING_EEPROM_OFFSET, unsigned long commitIntervalMs = 60000);
+
+    // Reads the stored timing and applies it to the adaptive turnouts. Call after TurnoutManager::begin().
+    void begin(TurnoutManager& manager);
+    // Saves changed timing when the manager is idle. Call this in loop().
+    void update(TurnoutManager& manager);
+
+private:
+    struct Entry {
+        uint16_t id;
+        uint8_t onMs;
+        uint8_t offMs;
+        uint16_t check; // id ^ (onMs | offMs << 8) ^ ENTRY_CHECK, an erased entry does not match
+    };
+
+    static const uint16_t ENTRY_CHECK = 0xA55A;
+    // Turnout ids that fit into an entry
+    static const int MAX_ID = 0xFFFF;
+
+    static uint16_t checkOf(const Entry& entry);
+
+    static bool valid(const Entry& entry);
+    int find(int id) const;
+
+    Entry _entries[PULSE_TIMING_STORE_SIZE];
+    int _eepromOffset;
+    unsigned long _commitIntervalMs;
+    unsigned long _lastCommit;
+};
+
+#endif
@@ -0,0 +1,62 @@
+#include "servo_profile.h"
+
+#include <cmath>
+
+// Distance covered (0..1) after `t` ms of the acceleration phase of length `ta`
+// at top speed `v`. Both shapes cover v * ta / 2 during the ramp.
+static float ramp_distance(ServoProfileType type, float t, float ta, float v) {
+    if (type == SERVO_PROFILE_SCURVE) {
+        // v(t) = v * (1 - cos(pi t / ta)) / 2
+        return v / 2 * (t - ta / (float)M_PI * sinf((float)M_PI * t / ta));
+    }
+    // v(t) = v * t / ta
+    return v / (2 * ta) * t * t;
+}
+
+int servo_profile_generate(const ServoProfileParams& params, uint16_t from_us, uint16_t to_us,
+                           uint32_t frame_us, uint16_t* pulses, int capacity) {
+    float frame_ms = frame_us / 1000.0f;
+    float duration = params.duration_ms;
+    float accel = params.accel_ms;
+    if (accel > duration / 2) {
+        accel = duration / 2;
+    }
+
+    int frames = (int)ceilf(duration / frame_ms);
+    if (frames < 1) {
+        frames = 1;
+    }
+    if (frames > capacity) {
+        // Too long for the table: keep the shape, shorten the time.
+        float scale = capacity * frame_ms / duration;
+        frames = capacity;
+        duration *= scale;
+        accel *= scale;
+    }
+
+    // Top speed in distance per ms, so that the whole move covers a distance of 1
+    float speed = duration > accel ? 1 / (duration - accel) : 0;
+    int delta = (int)to_us - (int)from_us;
+
+    for (int i = 0; i < frames - 1; i++) {
+        float t = (i + 1) * frame_ms;
+        float s;
+        if (accel <= 0) {
+            s = speed * t;
+        } else if (t < accel) {
+            s = ramp_distance(params.type, t, accel, speed);
+        } else if (t <= duration - accel) {
+            s = speed * accel / 2 + speed * (t - accel);
+        } else {
+            s = 1 - ramp_distance(params.type, duration - t, accel, speed);
+        }
+        if (s < 0) {
+            s = 0;
+        } else if (s > 1) {
+            s = 1;
+        }
+        pulses[i] = (uint16_t)lroundf(from_us + delta * s);
+    }
+    pulses[frames - 1] = to_us;
+    return frames;
+}
@@ -0,0 +1,34 @@
+/**
+ * @file servo_profile.h
+ * @brief Motion profiles for servo turnouts.
+ *
+ * A profile is a table with one servo pulse width (µs) per PWM frame. The
+ * table is computed once at the start of a move and then played out by
+ * hardware (see servo_pwm_hal.h), so the CPU does not touch the single steps.
+ * The generator has no hardware dependencies.
+ */
+#ifndef SERVO_PROFILE_H
+#define SERVO_PROFILE_H
+
+#include <cstdint>
+
+// Shape of the velocity over the move
+enum ServoProfileType {
+    SERVO_PROFILE_TRAPEZOID, // Constant acceleration, constant velocity, constant deceleration
+    SERVO_PROFILE_SCURVE     // Acceleration ramps up and down smoothly (raised cosine), no jerk steps
+};
+
+// Parameters of a servo move
+struct ServoProfileParams {
+    ServoProfileType type = SERVO_PROFILE_SCURVE;
+    uint16_t duration_ms = 1000; // Total time of the move
+    uint16_t accel_ms = 250;     // Time to reach full speed, and to stop again (at most duration_ms / 2)
+};
+
+// Fills `pulses` with the pulse widths from `from_us` to `to_us`, one per frame of
+// `frame_us`. The last entry is exactly `to_us`. A move longer than `capacity`
+// frames is sped up to fit. Returns the number of entries written (at least 1).
+int servo_profile_generate(const ServoProfileParams& params, uint16_t from_us, uint16_t to_us,
+                           uint32_t frame_us, uint16_t* pulses, int capacity);
+
+#endif
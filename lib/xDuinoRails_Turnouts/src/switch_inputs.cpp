@@ -0,0 +1,92 @@
+#include "switch_inputs.h"
+#include "turnout_base.h"
+
+#if defined(ARDUINO_ARCH_RP2040)
+#include "hardware/gpio.h"
+#endif
+
+SwitchInputs switchInputs;
+
+SwitchInputs::SwitchInputs()
+    : _mask(0), _lastScan(0), _edges(0), _debouncer(), _owners(), _expanderMask(), _hasExpanderPins(false),
+      _expanderDebouncers(), _expanderOwners() {
+}
+
+uint32_t SwitchInputs::readAll() const {
+#if defined(ARDUINO_ARCH_RP2040)
+    // One read of the SIO input register returns the levels of all GPIOs.
+    return gpio_get_all();
+#else
+    uint32_t levels = 0;
+    for (int pin = 0; pin < MAX_PINS; pin++) {
+        if ((_mask & (1u << pin)) && digitalRead(pin) == HIGH) {
+            levels |= 1u << pin;
+        }
+    }
+    return levels;
+#endif
+}
+
+bool SwitchInputs::watch(uint8_t pin, TurnoutBase& turnout) {
+    if (pin >= IO_EXPANDER_PIN_BASE) {
+        int expander = (pin - IO_EXPANDER_PIN_BASE) / IO_EXPANDER_PINS;
+        int bit = (pin - IO_EXPANDER_PIN_BASE) % IO_EXPANDER_PINS;
+        if (expander >= ioPins.expanderCount()) {
+            return false;
+        }
+        TurnoutBase*& owner = _expanderOwners[expander][bit];
+        if (owner != nullptr && owner != &turnout) {
+            return false;
+        }
+        // Read as high until the first read of the expander, i.e. as an open switch.
+        ioPins.mode(pin, INPUT_PULLUP);
+        owner = &turnout;
+        _expanderMask[expander] |= 1u << bit;
+        _hasExpanderPins = true;
+        _expanderDebouncers[expander].preset(1u << bit, ioPins.expanderLevels(expander));
+        return true;
+    }
+    if (pin >= MAX_PINS || (_owners[pin] != nullptr && _owners[pin] != &turnout)) {
+        return false;
+    }
+    pinMode(pin, INPUT_PULLUP);
+    delayMicroseconds(10); // Let the pull-up charge the line before the first sample
+    _owners[pin] = &turnout;
+    _mask |= 1u << pin;
+    _debouncer.preset(1u << pin, readAll());
+    return true;
+}
+
+void SwitchInputs::update(unsigned long now) {
+    if ((_mask == 0 && !_hasExpanderPins) || now - _lastScan < SWITCH_INPUTS_SCAN_MS) {
+        return;
+    }
+    _lastScan = now;
+
+    uint32_t changed = _mask != 0 ? _debouncer.update(readAll() & _mask) : 0;
+    while (changed != 0) {
+        int pin = __builtin_ctz(changed);
+        changed &= changed - 1;
+        _edges++;
+        _owners[pin]->wake();
+    }
+
+    if (!_hasExpanderPins) {
+        return;
+    }
+    // Every completed read is one sample, so a chip read less often than every scan
+    // is not debounced from repeated copies of the same levels.
+    for (int expander = 0; expander < IO_MAX_EXPANDERS; expander++) {
+        uint16_t levels;
+        if (_expanderMask[expander] == 0 || !ioPins.takeExpanderLevels(expander, levels)) {
+            continue;
+        }
+        changed = _expanderDebouncers[expander].update(levels & _expanderMask[expander]);
+        while (changed != 0) {
+            int bit = __builtin_ctz(changed);
+            changed &= changed - 1;
+            _edges++;
+            _expanderOwners[expander][bit]->wake();
+        }
+    }
+}
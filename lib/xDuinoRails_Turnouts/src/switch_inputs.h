@@ -0,0 +1,83 @@
+/**
+ * @file switch_inputs.h
+ * @brief Debounced end switches of all turnouts, read in one register access.
+ *
+ * All watched GPIOs are sampled together with a single read of the GPIO input
+ * register and debounced at once (see gpio_debouncer.h). A debounced edge
+ * wakes the turnout that owns the pin, so moving turnouts no longer poll
+ * their switches. The cost per scan is constant, independent of the number
+ * of turnouts; only the pins that changed are looked at individually.
+ *
+ * Switches on GPIO expanders (see io_pins.h) are debounced the same way, one
+ * 16-bit word per expander; every completed batched read is one sample.
+ *
+ * The pins are sampled every `SWITCH_INPUTS_SCAN_MS`, so a level is taken
+ * after it was stable for 4 scans. `update()` is called by the TurnoutManager
+ * (or TurnoutBase::update()) and must run on the core that runs the turnouts.
+ */
+#ifndef SWITCH_INPUTS_H
+#define SWITCH_INPUTS_H
+
+#include <Arduino.h>
+#include <cstdint>
+#include "gpio_debouncer.h"
+#include "io_pins.h"
+
+class TurnoutBase;
+
+// Interval between two samples of the switches in ms
+#ifndef SWITCH_INPUTS_SCAN_MS
+#define SWITCH_INPUTS_SCAN_MS 1
+#endif
+
+class SwitchInputs {
+public:
+    // GPIOs the input register covers
+    static const int MAX_PINS = 30;
+
+    SwitchInputs();
+
+    // Makes `pin` (native or expander pin) an input with pull-up whose edges wake
+    // `turnout`. The current level is taken as debounced level. Each pin belongs
+    // to one turnout.
+    bool watch(uint8_t pin, TurnoutBase& turnout);
+
+    // Samples and debounces all watched pins if the scan interval has passed.
+    void update(unsigned long now);
+
+    // Debounced level of a watched pin, false for pins that cannot be watched
+    bool isLow(uint8_t pin) const {
+        if (pin < IO_EXPANDER_PIN_BASE) {
+            // GPIO 30 and 31 do not exist, their debouncer bits are never set.
+            return pin < MAX_PINS && (_debouncer.state() & (1u << pin)) == 0;
+        }
+        int bit = pin - IO_EXPANDER_PIN_BASE;
+        if (bit >= IO_MAX_EXPANDERS * IO_EXPANDER_PINS) {
+            return false;
+        }
+        return (_expanderDebouncers[bit / IO_EXPANDER_PINS].state() & (1u << (bit % IO_EXPANDER_PINS))) == 0;
+    }
+
+    // Debounced edges since boot
+    uint32_t edgeCount() const { return _edges; }
+
+private:
+    uint32_t readAll() const;
+
+    uint32_t _mask;          // Watched pins
+    unsigned long _lastScan;
+    uint32_t _edges;
+    GpioDebouncer _debouncer;
+    TurnoutBase* _owners[MAX_PINS];
+
+    // Switches on expanders
+    uint16_t _expanderMask[IO_MAX_EXPANDERS];
+    bool _hasExpanderPins;
+    GpioDebouncer _expanderDebouncers[IO_MAX_EXPANDERS];
+    TurnoutBase* _expanderOwners[IO_MAX_EXPANDERS][IO_EXPANDER_PINS];
+};
+
+// End switches of all turnouts
+extern SwitchInputs switchInputs;
+
+#endif
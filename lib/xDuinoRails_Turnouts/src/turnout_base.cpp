@@ -0,0 +1,170 @@
+#include "turnout_base.h"
+#include "turnout_manager.h"
+#include "event_log.h"
+#include "motor_control_hal.h"
+#include "pio_output_hal.h"
+#include "switch_inputs.h"
+#include "io_pins.h"
+
+TurnoutBase::TurnoutBase(TurnoutBase&& other)
+    : _id(other._id), _name(other._name), _motorType(other._motorType), _state(other._state),
+      _targetPosition(other._targetPosition), _position(other._position),
+      _commandPending(other._commandPending), _timedOut(other._timedOut),
+      _adaptivePulse(other._adaptivePulse), _movePulses(0), _movePowered(other._movePowered),
+      _settledCallback(other._settledCallback), _settledContext(other._settledContext),
+      _commandTime(other._commandTime), _stats(other._stats),
+      _manager(nullptr), _managerSlot(-1), _powerGranted(0),
+      _moveStartTime(other._moveStartTime), _timeoutStart(other._timeoutStart), _lastMoveTime(other._lastMoveTime),
+      _lastMoveMs(other._lastMoveMs), _pulseOnMs(other._pulseOnMs), _pulseOffMs(other._pulseOffMs) {
+}
+
+void TurnoutBase::update() {
+    if (_motorType == MOTOR_COIL_BEMF || _motorType == MOTOR_COIL_CURRENT) {
+        // Reduce pending BEMF or current samples; this delivers the measurements outside the ISR.
+        hal_motor_service();
+    }
+    hal_pio_out_service();
+    unsigned long now = millis();
+    ioPins.poll(now);
+    switchInputs.update(now);
+    unsigned long nextDeadline;
+    service(now, nextDeadline);
+    ioPins.flush();
+}
+
+void TurnoutBase::setSettledCallback(TurnoutSettledCallback callback, void* context) {
+    _settledCallback = callback;
+    _settledContext = context;
+}
+
+void TurnoutBase::restorePosition(int position) {
+    if (position == 1 || position == 2) {
+        _position = position;
+        _targetPosition = position;
+    }
+}
+
+void TurnoutBase::setPosition(int position) {
+    setPosition(position, millis());
+}
+
+void TurnoutBase::setPosition(int position, unsigned long commandTime) {
+    if (position == 1 || position == 2) {
+        _targetPosition = position;
+        _commandTime = commandTime;
+        _commandPending = true;
+        wake();
+    }
+}
+
+void TurnoutBase::wake() {
+    if (_manager) {
+        _manager->wake(_managerSlot);
+    }
+}
+
+bool TurnoutBase::acquirePower() {
+    if (_powerGranted != 0) {
+        return true;
+    }
+    // Without a manager there is no budget to respect.
+    if (_manager != nullptr && !_manager->acquirePower(*this)) {
+        return false;
+    }
+    _movePowered = true;
+    return true;
+}
+
+void TurnoutBase::releasePower() {
+    if (_powerGranted != 0) {
+        _manager->releasePower(*this);
+    }
+}
+
+void TurnoutBase::pulseStarted(unsigned long now) {
+    _lastMoveTime = now;
+    _stats.pulses++;
+    _stats.onTimeMs += _pulseOnMs;
+    _movePulses++;
+}
+
+void TurnoutBase::setPulseTiming(uint16_t onMs, uint16_t offMs) {
+    _pulseOnMs = constrain(onMs, ADAPT_ON_MIN_MS, ADAPT_ON_MAX_MS);
+    _pulseOffMs = constrain(offMs, ADAPT_OFF_MIN_MS, COIL_PULSE_OFF_MS);
+}
+
+// The on time walks down while the armature has already stopped when a single pulse
+// ends (the pulse was longer than the travel), and steps up quickly whenever a throw
+// needed more pulses. The off time follows the time the end detection needed.
+void TurnoutBase::adaptPulseTiming(unsigned long now, bool reached, bool overdriven) {
+    if (!reached) {
+        // Timeout: fall back to the longest off window and a stronger pulse.
+        setPulseTiming(_pulseOnMs + ADAPT_ON_STEP_UP_MS, COIL_PULSE_OFF_MS);
+        return;
+    }
+
+    int onMs = _pulseOnMs;
+    int offMs;
+    if (_movePulses > 1) {
+        onMs += ADAPT_ON_STEP_UP_MS * (_movePulses - 1);
+        // A further pulse only starts if the off window ended without detecting the end,
+        // the armature was still coasting. The quick detection after the last pulse does
+        // not tell how long that takes, so the off window widens towards the default.
+        offMs = _pulseOffMs + (COIL_PULSE_OFF_MS - _pulseOffMs + 1) / 2;
+    } else {
+        if (overdriven) {
+            onMs -= ADAPT_ON_STEP_DOWN_MS;
+        }
+        // Time from the end of the pulse to the detection, with a margin, averaged over throws.
+        long detectMs = (long)(now - _lastMoveTime) - _pulseOnMs;
+        if (detectMs < 0) {
+            detectMs = 0;
+        }
+        int targetOffMs = detectMs + detectMs / 2 + ADAPT_OFF_MARGIN_MS;
+        offMs = _pulseOffMs + (targetOffMs - _pulseOffMs) / 4;
+    }
+
+    setPulseTiming(onMs < 0 ? 0 : onMs, offMs < 0 ? 0 : offMs);
+}
+
+void TurnoutBase::startMove(unsigned long now) {
+    _state = _targetPosition == 1 ? STATE_MOVING_TO_POS1 : STATE_MOVING_TO_POS2;
+    _position = 0; // Unknown until the end of travel is confirmed
+    _moveStartTime = now;
+    _timeoutStart = now;
+    _movePowered = false;
+    _movePulses = 0;
+    _stats.moves++;
+    _stats.commandLatency.add(now - _commandTime);
+    // Ensure immediate first pulse
+    _lastMoveTime = now - (_pulseOnMs + _pulseOffMs) - 1;
+
+    eventLog.log(EVENT_MOVE_STARTED, _id, _targetPosition);
+}
+
+void TurnoutBase::stopMove() {
+    releasePower();
+    _state = STATE_IDLE;
+}
+
+void TurnoutBase::positionReached(unsigned long now, int position) {
+    _position = position;
+    _stats.moveDuration.add(now - _moveStartTime);
+    _lastMoveMs = now - _moveStartTime > 0xFFFF ? 0xFFFF : now - _moveStartTime;
+    eventLog.log(EVENT_POSITION_REACHED, _id, position, now - _moveStartTime);
+}
+
+void TurnoutBase::moveTimedOut(int position) {
+    _timedOut = true;
+    _stats.timeouts++;
+    eventLog.log(EVENT_MOVE_TIMEOUT, _id, position);
+}
+
+bool TurnoutBase::settle(unsigned long now, unsigned long& nextDeadline) {
+    // A command that arrived during the move is started on the next run.
+    nextDeadline = now;
+    if (!_commandPending && _settledCallback) {
+        _settledCallback(_settledContext);
+    }
+    return _commandPending;
+}
@@ -0,0 +1,240 @@
+#ifndef TURNOUT_BASE_H
+#define TURNOUT_BASE_H
+
+#include <Arduino.h>
+#include "perf_counters.h"
+
+class TurnoutManager;
+
+// Called when a turnout has settled: it is idle and has no pending command
+typedef void (*TurnoutSettledCallback)(void* context);
+
+// State, commands and scheduling of one turnout, independent of its motor and sensors.
+//
+// This is the part a TurnoutManager, a route, the DCC registry and the journals work
+// with. The state machine is the template serviceWith(); every turnout type
+// instantiates it for its motor and sensor policies (see turnout_policies.h), so all
+// motor and sensor code is resolved at compile time. The only virtual calls are
+// begin() and one service() per scheduled run.
+class TurnoutBase {
+public:
+    enum MotorType {
+        MOTOR_SERVO,
+        MOTOR_COIL,
+        MOTOR_COIL_BEMF,
+        MOTOR_COIL_CURRENT
+    };
+
+    TurnoutBase(const TurnoutBase&) = delete;
+    TurnoutBase& operator=(const TurnoutBase&) = delete;
+
+    virtual void begin() = 0;
+    // Runs the turnout on its own, only needed without a TurnoutManager
+    void update();
+    void setPosition(int position); // 1 for position 1, 2 for position 2
+    // Same with the time (millis) the command was received, for the latency statistics
+    void setPosition(int position, unsigned long commandTime);
+
+    // Runs the state machine once at time `now` (millis). Returns true and sets
+    // `nextDeadline` if the turnout has to run again, false if it is idle and
+    // has no pending command.
+    virtual bool service(unsigned long now, unsigned long& nextDeadline) = 0;
+
+    // True while the turnout moves or has a command that was not acted upon yet
+    bool isMoving() const { return _state != STATE_IDLE || _commandPending; }
+    // True if the last move ended with a timeout instead of reaching its position
+    bool hasTimedOut() const { return _timedOut; }
+    // Last confirmed position: 1 or 2 once reached, 0 while unknown or moving
+    int getPosition() const { return _position; }
+    // Position of the last command, 0 if there was none
+    int getTargetPosition() const { return _targetPosition; }
+    // Duration of the last move that reached its position in ms (saturated), 0 before the first one
+    uint16_t getLastMoveMs() const { return _lastMoveMs; }
+    // Takes `position` as confirmed without moving, e.g. replayed from a journal. Call before begin().
+    void restorePosition(int position);
+    // `callback` is called every time the turnout settles after a command
+    void setSettledCallback(TurnoutSettledCallback callback, void* context);
+
+    // Coil pulse timing in ms. Adaptive BEMF turnouts tune it after every move;
+    // setPulseTiming() restores learned values (clamped to the safe bounds).
+    uint16_t getPulseOnMs() const { return _pulseOnMs; }
+    uint16_t getPulseOffMs() const { return _pulseOffMs; }
+    void setPulseTiming(uint16_t onMs, uint16_t offMs);
+    bool isAdaptive() const { return _adaptivePulse; }
+
+    int getId() const { return _id; }
+    MotorType getMotorType() const { return _motorType; }
+    const TurnoutStats& stats() const { return _stats; }
+    void resetStats() { _stats.reset(); }
+
+    // Called by the motor policies while the turnout moves.
+
+    // Asks the manager for the supply current of this motor, true if the pulse or step may start.
+    bool acquirePower();
+    void releasePower();
+    // The off time since the last pulse has passed, the next one may start
+    bool pulseDue(unsigned long now) const { return now - _lastMoveTime > (unsigned long)(_pulseOnMs + _pulseOffMs); }
+    // The running pulse has reached its on time
+    bool pulseOver(unsigned long now) const { return now - _lastMoveTime > _pulseOnMs; }
+    void pulseStarted(unsigned long now);
+    // Tunes the pulse timing after a move. `overdriven`: the armature had already stopped when the pulse ended.
+    void adaptPulseTiming(unsigned long now, bool reached, bool overdriven);
+    // Runs the turnout on the next manager update, e.g. when its end of travel was detected
+    void wake();
+
+protected:
+    constexpr TurnoutBase(int id, const char* name, MotorType motorType, bool adaptivePulse)
+        : _id(id), _name(name), _motorType(motorType), _state(STATE_IDLE), _targetPosition(0), _position(0),
+          _commandPending(false), _timedOut(false), _adaptivePulse(adaptivePulse), _movePulses(0),
+          _movePowered(false),
+          _settledCallback(nullptr), _settledContext(nullptr), _commandTime(0), _stats(),
+          _manager(nullptr), _managerSlot(-1), _powerGranted(0), _moveStartTime(0), _timeoutStart(0),
+          _lastMoveTime(0), _lastMoveMs(0), _pulseOnMs(COIL_PULSE_ON_MS), _pulseOffMs(COIL_PULSE_OFF_MS) {}
+    // Takes over a turnout that has not been started or registered yet
+    TurnoutBase(TurnoutBase&& other);
+    ~TurnoutBase() = default;
+
+    // The state machine, shared by all turnout types
+    template<typename Motor, typename Sensor>
+    bool serviceWith(Motor& motor, Sensor& sensor, unsigned long now, unsigned long& nextDeadline);
+
+private:
+    friend class TurnoutManager;
+
+    enum State : uint8_t {
+        STATE_IDLE,
+        STATE_MOVING_TO_POS1,
+        STATE_MOVING_TO_POS2
+    };
+
+    // Earliest time at which a moving turnout has something to do: the timeout,
+    // the next pulse edge, and for end switches the next poll.
+    template<typename Motor, typename Sensor>
+    unsigned long nextMoveDeadline(unsigned long now) const;
+
+    void startMove(unsigned long now);
+    void stopMove();
+    void positionReached(unsigned long now, int position);
+    void moveTimedOut(int position);
+    bool settle(unsigned long now, unsigned long& nextDeadline);
+
+    // Wrap-around safe "a is before b" for millis() timestamps.
+    static bool before(unsigned long a, unsigned long b) { return (long)(a - b) < 0; }
+
+    // General properties
+    int _id;
+    const char* _name;
+    MotorType _motorType;
+    State _state;
+    uint8_t _targetPosition; // 0: unset, 1: pos1, 2: pos2
+    uint8_t _position;       // Confirmed position, 0: unknown
+    bool _commandPending;    // setPosition() was called and not yet acted upon
+    bool _timedOut;          // The last move ended without reaching its position
+    bool _adaptivePulse;     // The pulse timing is tuned after every move
+    uint8_t _movePulses;     // Pulses of the running move
+    bool _movePowered;       // The power budget has granted the running move its first pulse or step
+    TurnoutSettledCallback _settledCallback;
+    void* _settledContext;
+    unsigned long _commandTime; // millis() of the last command
+    TurnoutStats _stats;
+
+    // Scheduling (set when registered with a TurnoutManager)
+    TurnoutManager* _manager;
+    int _managerSlot;
+    unsigned int _powerGranted; // Current granted from the manager's power budget in mA, 0 if none
+
+    // Timing
+    unsigned long _moveStartTime;
+    unsigned long _timeoutStart; // TIMEOUT_MS runs from here, held at now while the budget refuses the move
+    unsigned long _lastMoveTime;
+    uint16_t _lastMoveMs;
+    uint16_t _pulseOnMs;
+    uint16_t _pulseOffMs;
+
+    // Constants
+    static const unsigned long TIMEOUT_MS = 5000;
+    static const int COIL_PULSE_ON_MS = 50;
+    static const int COIL_PULSE_OFF_MS = 150;
+    // Bounds and steps of the adaptive pulse timing
+    static const int ADAPT_ON_MIN_MS = 10;
+    static const int ADAPT_ON_MAX_MS = 100;
+    static const int ADAPT_ON_STEP_DOWN_MS = 2;
+    static const int ADAPT_ON_STEP_UP_MS = 10;
+    static const int ADAPT_OFF_MIN_MS = 30;
+    static const int ADAPT_OFF_MARGIN_MS = 10;
+    static const int SENSOR_POLL_MS = 1; // Polling interval of POLLED sensors while moving
+};
+
+template<typename Motor, typename Sensor>
+unsigned long TurnoutBase::nextMoveDeadline(unsigned long now) const {
+    unsigned long deadline = _timeoutStart + TIMEOUT_MS + 1;
+    // A servo profile is played by the hardware, only coils have pulse edges.
+    if (Motor::PULSED) {
+        unsigned long step;
+        if (now - _lastMoveTime <= (unsigned long)_pulseOnMs) {
+            step = _lastMoveTime + _pulseOnMs + 1; // End of the running pulse
+        } else {
+            step = _lastMoveTime + _pulseOnMs + _pulseOffMs + 1; // Next pulse
+        }
+        if (before(step, deadline)) {
+            deadline = step;
+        }
+    }
+    // End detection and end switch edges wake the turnout, only other sensors have to be polled.
+    if (Sensor::POLLED && before(now + SENSOR_POLL_MS, deadline)) {
+        deadline = now + SENSOR_POLL_MS;
+    }
+    // A move that has not started yet, e.g. waiting for the power budget, is retried on the
+    // next poll, and so is a pulse or step that is already due.
+    if (!_movePowered || before(deadline, now + SENSOR_POLL_MS)) {
+        deadline = now + SENSOR_POLL_MS;
+    }
+    return deadline;
+}
+
+template<typename Motor, typename Sensor>
+bool TurnoutBase::serviceWith(Motor& motor, Sensor& sensor, unsigned long now, unsigned long& nextDeadline) {
+    // An idle turnout without a new command has nothing to do, not even reading its sensors.
+    if (_state == STATE_IDLE && !_commandPending) {
+        return false;
+    }
+
+    if (_state == STATE_IDLE) {
+        // Every command is acted upon once; a turnout already in position stays idle.
+        _commandPending = false;
+        _timedOut = false;
+        if (sensor.atPosition(*this, motor, _targetPosition)) {
+            _position = _targetPosition;
+        } else {
+            startMove(now);
+            motor.startMove(*this);
+        }
+    } else {
+        int target = _state == STATE_MOVING_TO_POS1 ? 1 : 2;
+        // Waiting for the power budget does not count towards the timeout.
+        if (!_movePowered) {
+            _timeoutStart = now;
+        }
+        if (sensor.reached(motor, target)) {
+            motor.stop(*this);
+            stopMove();
+            motor.moveEnded(*this, now, true);
+            positionReached(now, target);
+        } else if (now - _timeoutStart > TIMEOUT_MS) {
+            motor.stop(*this);
+            stopMove();
+            moveTimedOut(target);
+            motor.moveEnded(*this, now, false);
+        } else {
+            motor.drive(*this, target, now);
+        }
+    }
+
+    if (_state == STATE_IDLE) {
+        return settle(now, nextDeadline);
+    }
+    nextDeadline = nextMoveDeadline<Motor, Sensor>(now);
+    return true;
+}
+
+#endif
@@ -0,0 +1,313 @@
+#include "turnout_manager.h"
+#include "event_log.h"
+#include "pio_output_hal.h"
+#include "switch_inputs.h"
+#include "io_pins.h"
+
+// Wrap-around safe "a is before b" for millis() timestamps.
+static inline bool time_before(unsigned long a, unsigned long b) {
+    return (long)(a - b) < 0;
+}
+
+// Default motor currents in mA, typical values for solenoid drives and hobby servos
+static const unsigned int DEFAULT_SERVO_CURRENT = 250;
+static const unsigned int DEFAULT_COIL_CURRENT = 1000;
+
+TurnoutManager::TurnoutManager()
+    : _count(0), _hasBemf(false), _heapSize(0), _now(0), _powerBudget(0), _powerInUse(0),
+      _routeRemaining(0), _routeFailed(0), _routeSteps(0), _routeCallback(nullptr), _routeContext(nullptr) {
+    _motorCurrent[TurnoutBase::MOTOR_SERVO] = DEFAULT_SERVO_CURRENT;
+    _motorCurrent[TurnoutBase::MOTOR_COIL] = DEFAULT_COIL_CURRENT;
+    _motorCurrent[TurnoutBase::MOTOR_COIL_BEMF] = DEFAULT_COIL_CURRENT;
+    _motorCurrent[TurnoutBase::MOTOR_COIL_CURRENT] = DEFAULT_COIL_CURRENT;
+}
+
+bool TurnoutManager::add(TurnoutBase& turnout) {
+    if (_count >= TURNOUT_MANAGER_CAPACITY || turnout._manager != nullptr) {
+        return false;
+    }
+    int slot = _count++;
+    _turnouts[slot] = &turnout;
+    _heapPos[slot] = -1;
+    _inRoute[slot] = false;
+    turnout._manager = this;
+    turnout._managerSlot = slot;
+    if (turnout._motorType == TurnoutBase::MOTOR_COIL_BEMF || turnout._motorType == TurnoutBase::MOTOR_COIL_CURRENT) {
+        _hasBemf = true;
+    }
+    // A command given before registration must not get lost.
+    if (turnout._commandPending || turnout._state != TurnoutBase::STATE_IDLE) {
+        wake(slot);
+    }
+    return true;
+}
+
+void TurnoutManager::begin() {
+    _now = millis();
+    for (int slot = 0; slot < _count; slot++) {
+        _turnouts[slot]->begin();
+    }
+    // Configures the expander pins the turnouts set up, before the first move.
+    ioPins.flush();
+}
+
+void TurnoutManager::update() {
+    update(millis());
+}
+
+void TurnoutManager::update(unsigned long now) {
+    _now = now;
+    if (_hasBemf) {
+        // Reduce pending BEMF and current samples; a detected end of travel wakes its turnout.
+        hal_motor_service();
+    }
+    // Advances servo profiles on the PIO output engine, returns at once if none plays.
+    hal_pio_out_service();
+    // Collects the expander reads and starts the ones that are due.
+    ioPins.poll(now);
+    // Debounces all end switches in one pass, an edge wakes its turnout.
+    switchInputs.update(now);
+    if (_heapSize == 0) {
+        // A current-sensed pulse may have been cut in hal_motor_service().
+        ioPins.flush();
+        return;
+    }
+
+    while (_heapSize > 0) {
+        int slot = _heap[0];
+        if (time_before(now, _deadline[slot])) {
+            break;
+        }
+        removeTop();
+        unsigned long nextDeadline;
+        if (_turnouts[slot]->service(now, nextDeadline)) {
+            schedule(slot, nextDeadline);
+        } else if (_inRoute[slot]) {
+            settleRouteStep(slot);
+        }
+    }
+    // One write per expander whose outputs changed, however many coils switched.
+    ioPins.flush();
+}
+
+bool TurnoutManager::isBusy() const {
+    return _heapSize > 0;
+}
+
+int TurnoutManager::count() const {
+    return _count;
+}
+
+bool TurnoutManager::setRoute(const TurnoutRouteStep* steps, int count, TurnoutRouteCallback callback, void* context) {
+    for (int i = 0; i < count; i++) {
+        TurnoutBase* turnout = steps[i].turnout;
+        if (turnout == nullptr || turnout->_manager != this ||
+            (steps[i].position != 1 && steps[i].position != 2)) {
+            return false;
+        }
+    }
+
+    for (int slot = 0; slot < _count; slot++) {
+        _inRoute[slot] = false;
+    }
+    _routeRemaining = 0;
+    _routeFailed = 0;
+    _routeSteps = count;
+    _routeCallback = callback;
+    _routeContext = context;
+
+    for (int i = 0; i < count; i++) {
+        int slot = steps[i].turnout->_managerSlot;
+        if (!_inRoute[slot]) {
+            _inRoute[slot] = true;
+            _routeRemaining++;
+        }
+        // Wakes the turnout; the power budget decides how many of them pulse at the same time.
+        steps[i].turnout->setPosition(steps[i].position);
+    }
+    if (_routeRemaining == 0 && _routeCallback) {
+        _routeCallback(_routeContext, 0);
+    }
+    return true;
+}
+
+bool TurnoutManager::isRouteActive() const {
+    return _routeRemaining > 0;
+}
+
+void TurnoutManager::settleRouteStep(int slot) {
+    _inRoute[slot] = false;
+    if (_turnouts[slot]->_timedOut) {
+        _routeFailed++;
+    }
+    if (--_routeRemaining == 0) {
+        eventLog.log(EVENT_ROUTE_COMPLETE, 0, _routeSteps, _routeFailed);
+        if (_routeCallback) {
+            _routeCallback(_routeContext, _routeFailed);
+        }
+    }
+}
+
+void TurnoutManager::setPowerBudget(unsigned int milliamps) {
+    _powerBudget = milliamps;
+}
+
+void TurnoutManager::setMotorCurrent(TurnoutBase::MotorType type, unsigned int milliamps) {
+    _motorCurrent[type] = milliamps;
+}
+
+unsigned int TurnoutManager::powerInUse() const {
+    return _powerInUse;
+}
+
+static const char* const ISR_NAMES[HAL_ISR_COUNT] = { "dma", "pwm_wrap", "alarm" };
+
+void TurnoutManager::printStats(Print& out) const {
+    for (int slot = 0; slot < _count; slot++) {
+        const TurnoutBase& turnout = *_turnouts[slot];
+        const TurnoutStats& stats = turnout.stats();
+        out.print("turnout ");
+        out.print(turnout.getId());
+        out.print(" moves=");
+        out.print(stats.moves);
+        out.print(" timeouts=");
+        out.print(stats.timeouts);
+        out.print(" pulses=");
+        out.print(stats.pulses);
+        out.print(" on_ms=");
+        out.print(stats.onTimeMs);
+        out.print(" move_ms ");
+        stats.moveDuration.print(out);
+        out.print(" latency_ms ");
+        stats.commandLatency.print(out);
+        out.println();
+    }
+    if (_hasBemf) {
+        for (int isr = 0; isr < HAL_ISR_COUNT; isr++) {
+            hal_isr_stats_t stats;
+            hal_get_isr_stats((hal_isr_t)isr, &stats);
+            out.print("isr ");
+            out.print(ISR_NAMES[isr]);
+            out.print(" count=");
+            out.print(stats.count);
+            out.print(" total_us=");
+            out.print(stats.total_us);
+            out.print(" max_us=");
+            out.print(stats.max_us);
+            out.println();
+        }
+        out.print("bemf overruns=");
+        out.println(hal_motor_get_overrun_count());
+    }
+    if (ioPins.expanderCount() > 0) {
+        out.print("expander transactions=");
+        out.print(ioPins.transactionCount());
+        out.print(" failed=");
+        out.println(ioPins.failedCount());
+    }
+}
+
+void TurnoutManager::resetStats() {
+    for (int slot = 0; slot < _count; slot++) {
+        _turnouts[slot]->resetStats();
+    }
+    if (_hasBemf) {
+        hal_reset_isr_stats();
+    }
+}
+
+bool TurnoutManager::acquirePower(TurnoutBase& turnout) {
+    unsigned int current = _motorCurrent[turnout._motorType];
+    // A single motor may always run, even if it alone exceeds the budget, otherwise it would never move.
+    if (_powerBudget != 0 && _powerInUse != 0 && _powerInUse + current > _powerBudget) {
+        return false;
+    }
+    _powerInUse += current;
+    turnout._powerGranted = current;
+    return true;
+}
+
+void TurnoutManager::releasePower(TurnoutBase& turnout) {
+    _powerInUse -= turnout._powerGranted;
+    turnout._powerGranted = 0;
+}
+
+void TurnoutManager::wake(int slot) {
+    if (slot < 0 || slot >= _count) {
+        return;
+    }
+    schedule(slot, _now);
+}
+
+void TurnoutManager::schedule(int slot, unsigned long deadline) {
+    int position = _heapPos[slot];
+    if (position < 0) {
+        position = _heapSize++;
+        _heap[position] = slot;
+        _heapPos[slot] = position;
+        _deadline[slot] = deadline;
+        siftUp(position);
+        return;
+    }
+    // Already scheduled: move the entry to its new deadline.
+    bool sooner = time_before(deadline, _deadline[slot]);
+    _deadline[slot] = deadline;
+    if (sooner) {
+        siftUp(position);
+    } else {
+        siftDown(position);
+    }
+}
+
+void TurnoutManager::removeTop() {
+    int slot = _heap[0];
+    _heapPos[slot] = -1;
+    _heapSize--;
+    if (_heapSize > 0) {
+        _heap[0] = _heap[_heapSize];
+        _heapPos[_heap[0]] = 0;
+        siftDown(0);
+    }
+}
+
+bool TurnoutManager::earlier(int a, int b) const {
+    return time_before(_deadline[_heap[a]], _deadline[_heap[b]]);
+}
+
+void TurnoutManager::swap(int a, int b) {
+    uint8_t slot = _heap[a];
+    _heap[a] = _heap[b];
+    _heap[b] = slot;
+    _heapPos[_heap[a]] = a;
+    _heapPos[_heap[b]] = b;
+}
+
+void TurnoutManager::siftUp(int position) {
+    while (position > 0) {
+        int parent = (position - 1) / 2;
+        if (!earlier(position, parent)) {
+            break;
+        }
+        swap(position, parent);
+        position = parent;
+    }
+}
+
+void TurnoutManager::siftDown(int position) {
+    while (true) {
+        int smallest = position;
+        int left = 2 * position + 1;
+        int right = left + 1;
+        if (left < _heapSize && earlier(left, smallest)) {
+            smallest = left;
+        }
+        if (right < _heapSize && earlier(right, smallest)) {
+            smallest = right;
+        }
+        if (smallest == position) {
+            break;
+        }
+        swap(position, smallest);
+        position = smallest;
+    }
+}
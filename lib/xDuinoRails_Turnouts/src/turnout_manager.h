@@ -0,0 +1,125 @@
+#ifndef TURNOUT_MANAGER_H
+#define TURNOUT_MANAGER_H
+
+#include <Arduino.h>
+#include "xDuinoRails_Turnouts.h"
+
+// Maximum number of turnouts one manager can schedule (every leg of a composite turnout counts)
+#ifndef TURNOUT_MANAGER_CAPACITY
+#define TURNOUT_MANAGER_CAPACITY 32
+#endif
+static_assert(TURNOUT_MANAGER_CAPACITY <= 255, "Turnout slots are stored as uint8_t");
+
+// One entry of a route: the turnout and the position it has to take
+struct TurnoutRouteStep {
+    TurnoutBase* turnout;
+    int position;
+};
+
+// Called once all turnouts of a route have settled. `failed` is the number of
+// turnouts that did not reach their position (timeout).
+typedef void (*TurnoutRouteCallback)(void* context, int failed);
+
+// Deadline-driven scheduler for all turnouts of a board.
+//
+// Instead of calling update() on every turnout in every loop, the manager keeps
+// a min-heap of the next deadline of each active turnout (pulse edge, servo step,
+// sensor poll, timeout) and only runs the turnouts that are due. A turnout enters
+// the heap when it receives a command and leaves it when it is idle again, so
+// idle turnouts cost nothing per loop.
+//
+// The manager also shares the supply current between the turnouts. A coil
+// pulse or a servo move only starts if its current fits into the power budget;
+// otherwise it waits until running pulses have ended. All turnouts of a route
+// are commanded at once and the budget pipelines their pulses.
+class TurnoutManager {
+public:
+    TurnoutManager();
+
+    // Registers a turnout, returns false if the manager is full.
+    bool add(TurnoutBase& turnout);
+    // Registers all legs of a composite (or three-way) turnout, returns false if they do not fit.
+    bool add(CompositeTurnoutBase& turnout) {
+        if (_count + turnout.legCount() > TURNOUT_MANAGER_CAPACITY) {
+            return false;
+        }
+        for (int leg = 0; leg < turnout.legCount(); leg++) {
+            if (!add(turnout.leg(leg))) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Calls begin() on all registered turnouts.
+    void begin();
+    // Runs all turnouts whose deadline has passed. Call this in loop().
+    void update();
+    // Same with an explicit time in ms, e.g. from a simulated clock. The manager
+    // reads no other time source, so all turnouts run on `now`.
+    void update(unsigned long now);
+
+    // True while at least one turnout is moving or has a pending command
+    bool isBusy() const;
+    int count() const;
+    TurnoutBase& turnout(int slot) { return *_turnouts[slot]; }
+
+    // Sets all turnouts of a route. Returns false, without moving anything, if a
+    // turnout is not registered with this manager or a position is invalid.
+    // `callback` is called from update() once all of them have settled. A new
+    // route replaces the completion tracking of a route still running.
+    bool setRoute(const TurnoutRouteStep* steps, int count, TurnoutRouteCallback callback = nullptr, void* context = nullptr);
+    // True until all turnouts of the last route have settled
+    bool isRouteActive() const;
+
+    // Maximum current of all simultaneous pulses and servo moves in mA, 0 for no limit (default)
+    void setPowerBudget(unsigned int milliamps);
+    // Current drawn by one turnout of the given motor type while its coil is on or its servo moves
+    void setMotorCurrent(TurnoutBase::MotorType type, unsigned int milliamps);
+    unsigned int powerInUse() const;
+
+    // Prints the counters and histograms of all turnouts, and the BEMF interrupt times
+    void printStats(Print& out) const;
+    void resetStats();
+
+    // Schedules the turnout in `slot` to run on the next update(). Called by the turnouts.
+    void wake(int slot);
+    // Grants the motor current of `turnout` if it fits into the budget. Called by the turnouts.
+    bool acquirePower(TurnoutBase& turnout);
+    void releasePower(TurnoutBase& turnout);
+
+private:
+    void schedule(int slot, unsigned long deadline);
+    void removeTop();
+    void siftUp(int position);
+    void siftDown(int position);
+    void swap(int a, int b);
+    bool earlier(int a, int b) const;
+    void settleRouteStep(int slot);
+
+    TurnoutBase* _turnouts[TURNOUT_MANAGER_CAPACITY];
+    int _count;
+    bool _hasBemf; // At least one BEMF or current sense turnout, the HAL has to be serviced
+
+    // Indexed binary min-heap of turnout slots, ordered by deadline
+    uint8_t _heap[TURNOUT_MANAGER_CAPACITY];      // Slot at each heap position
+    int16_t _heapPos[TURNOUT_MANAGER_CAPACITY];   // Heap position of each slot, -1 if not scheduled
+    unsigned long _deadline[TURNOUT_MANAGER_CAPACITY];
+    int _heapSize;
+    unsigned long _now; // Time of the last update(), woken turnouts are due from then
+
+    // Power budget
+    unsigned int _powerBudget;
+    unsigned int _powerInUse;
+    unsigned int _motorCurrent[4]; // Indexed by MotorType
+
+    // Route in progress
+    bool _inRoute[TURNOUT_MANAGER_CAPACITY]; // Slot belongs to the route and has not settled yet
+    int _routeRemaining;
+    int _routeFailed;
+    int _routeSteps;
+    TurnoutRouteCallback _routeCallback;
+    void* _routeContext;
+};
+
+#endif
@@ -0,0 +1,281 @@
+#include "turnout_policies.h"
+#include "event_log.h"
+#include "bemf_capture.h"
+#include "io_pins.h"
+
+// --- ServoMotor ---
+
+void ServoMotor::begin(TurnoutBase& turnout) {
+    // A restored position is output right away, so the servo does not swing at power-up.
+    int angle = turnout.getPosition() == 2 ? _angleMax : _angleMin;
+    _hal = hal_servo_init(_pin, servoPulse(angle));
+    if (_hal == nullptr) {
+        eventLog.log(EVENT_SERVO_INIT_FAILED, turnout.getId());
+    }
+}
+
+// The servo draws current while the profile plays, the budget is held until it ends.
+void ServoMotor::drive(TurnoutBase& turnout, int position, unsigned long) {
+    if (!_started && turnout.acquirePower()) {
+        startProfile(position == 1 ? _angleMin : _angleMax);
+    } else if (_started && !hal_servo_is_playing(_hal)) {
+        turnout.releasePower();
+    }
+}
+
+void ServoMotor::stop(TurnoutBase&) {
+    // Stops where it is, e.g. when the end switch is reached before the profile ends.
+    hal_servo_stop(_hal);
+}
+
+void ServoMotor::setProfile(ServoProfileType type, unsigned int durationMs, unsigned int accelMs) {
+    _profile.type = type;
+    _profile.duration_ms = durationMs;
+    _profile.accel_ms = accelMs;
+}
+
+void ServoMotor::startProfile(int angle) {
+    _started = true;
+    if (_hal == nullptr) {
+        return;
+    }
+    // The buffer must not change while the DMA reads it.
+    hal_servo_stop(_hal);
+    int frames = servo_profile_generate(_profile, hal_servo_get_pulse(_hal), servoPulse(angle), HAL_SERVO_FRAME_US,
+                                        hal_servo_get_profile_buffer(_hal), HAL_SERVO_MAX_FRAMES);
+    hal_servo_play(_hal, frames);
+}
+
+// --- PioServoMotor ---
+
+void PioServoMotor::begin(TurnoutBase& turnout) {
+    int angle = turnout.getPosition() == 2 ? _angleMax : _angleMin;
+    _hal = hal_pio_out_add(_pin, servoPulse(angle));
+    if (_hal == nullptr) {
+        eventLog.log(EVENT_SERVO_INIT_FAILED, turnout.getId());
+    }
+}
+
+void PioServoMotor::drive(TurnoutBase& turnout, int position, unsigned long) {
+    if (!_started && turnout.acquirePower()) {
+        startProfile(position == 1 ? _angleMin : _angleMax);
+    } else if (_started && !hal_pio_out_is_playing(_hal)) {
+        turnout.releasePower();
+    }
+}
+
+void PioServoMotor::stop(TurnoutBase&) {
+    hal_pio_out_stop(_hal);
+}
+
+void PioServoMotor::setProfile(ServoProfileType type, unsigned int durationMs, unsigned int accelMs) {
+    _profile.type = type;
+    _profile.duration_ms = durationMs;
+    _profile.accel_ms = accelMs;
+}
+
+void PioServoMotor::startProfile(int angle) {
+    _started = true;
+    if (_hal == nullptr) {
+        return;
+    }
+    hal_pio_out_stop(_hal);
+    int frames = servo_profile_generate(_profile, hal_pio_out_get(_hal), servoPulse(angle), HAL_PIO_OUT_FRAME_US,
+                                        hal_pio_out_get_profile_buffer(_hal), HAL_PIO_OUT_MAX_FRAMES);
+    hal_pio_out_play(_hal, frames);
+}
+
+// --- CoilMotor ---
+
+void CoilMotor::begin(TurnoutBase&) {
+    ioPins.mode(_pin1, OUTPUT);
+    ioPins.mode(_pin2, OUTPUT);
+    ioPins.write(_pin1, LOW);
+    ioPins.write(_pin2, LOW);
+}
+
+// A coil only takes its share of the budget while a pulse is on. Until the budget
+// grants the first pulse, pulseOver() is already true but there is nothing to end.
+void CoilMotor::drive(TurnoutBase& turnout, int position, unsigned long now) {
+    uint8_t pin = position == 1 ? _pin1 : _pin2;
+    if (turnout.pulseDue(now) && turnout.acquirePower()) {
+        ioPins.write(pin, HIGH);
+        _pulseOn = true;
+        turnout.pulseStarted(now);
+    }
+    if (_pulseOn && turnout.pulseOver(now)) {
+        ioPins.write(pin, LOW);
+        _pulseOn = false;
+        turnout.releasePower();
+    }
+}
+
+void CoilMotor::stop(TurnoutBase&) {
+    _pulseOn = false;
+    ioPins.write(_pin1, LOW);
+    ioPins.write(_pin2, LOW);
+}
+
+// --- PioCoilMotor ---
+
+void PioCoilMotor::begin(TurnoutBase&) {
+    _hal1 = hal_pio_out_add(_pin1, 0);
+    _hal2 = hal_pio_out_add(_pin2, 0);
+}
+
+// Same timing as CoilMotor, the engine switches the level within about 2ms.
+void PioCoilMotor::drive(TurnoutBase& turnout, int position, unsigned long now) {
+    hal_pio_out_t* coil = position == 1 ? _hal1 : _hal2;
+    if (turnout.pulseDue(now) && turnout.acquirePower()) {
+        hal_pio_out_set(coil, HAL_PIO_OUT_ON);
+        _pulseOn = true;
+        turnout.pulseStarted(now);
+    }
+    if (_pulseOn && turnout.pulseOver(now)) {
+        hal_pio_out_set(coil, 0);
+        _pulseOn = false;
+        turnout.releasePower();
+    }
+}
+
+void PioCoilMotor::stop(TurnoutBase&) {
+    _pulseOn = false;
+    hal_pio_out_set(_hal1, 0);
+    hal_pio_out_set(_hal2, 0);
+}
+
+// --- BemfCoilMotor ---
+
+void BemfCoilMotor::begin(TurnoutBase& turnout) {
+    _turnout = &turnout;
+    _hal = hal_motor_init(_pwmAPin, _pwmBPin, _bemfAPin, _bemfBPin, on_bemf_update, this);
+    if (_hal == nullptr) {
+        eventLog.log(EVENT_BEMF_INIT_FAILED, turnout.getId());
+    }
+}
+
+void BemfCoilMotor::startMove(TurnoutBase& turnout) {
+    _endDetected = false;
+    _detector.reset();
+    _active = true;
+    _pulseOn = false;
+    bemfCapture.moveStarted(turnout.getId(), turnout.getTargetPosition(), _detector.params());
+}
+
+void BemfCoilMotor::drive(TurnoutBase& turnout, int position, unsigned long now) {
+    if (turnout.pulseDue(now) && turnout.acquirePower()) {
+        // Close the measurement window first, drive-phase samples must not reach the detector.
+        hal_motor_disarm_bemf(_hal);
+        hal_motor_set_pwm(_hal, 255, position == 1); // Forward to position 1, reverse to position 2
+        turnout.pulseStarted(now);
+        _pulseOn = true;
+        _windowBemfPending = true;
+        bemfCapture.pulseStarted(turnout.getId(), turnout.getPulseOnMs());
+    }
+    // Only the off window after a pulse of this move is measured. While the budget
+    // refuses the first pulse the armature stands still, its flat BEMF would read
+    // as the end of travel.
+    if (_pulseOn && turnout.pulseOver(now)) {
+        hal_motor_set_pwm(_hal, 0, false); // OFF (BEMF measurement window)
+        hal_motor_arm_bemf(_hal);
+        _pulseOn = false;
+        turnout.releasePower();
+    }
+}
+
+void BemfCoilMotor::stop(TurnoutBase&) {
+    _pulseOn = false;
+    hal_motor_disarm_bemf(_hal);
+    hal_motor_set_pwm(_hal, 0, false);
+    _active = false;
+}
+
+void BemfCoilMotor::moveEnded(TurnoutBase& turnout, unsigned long now, bool reached) {
+    bemfCapture.moveEnded(turnout.getId(), reached);
+    if (turnout.isAdaptive()) {
+        turnout.adaptPulseTiming(now, reached, _windowBemf < _detector.params().threshold);
+    }
+}
+
+// Called from hal_motor_service() with the reduced measurement of this motor's HAL instance.
+void BemfCoilMotor::on_bemf_update(void* context, int raw_bemf) {
+    // Each HAL instance reports to its own motor, so no shared state is involved here.
+    BemfCoilMotor* motor = static_cast<BemfCoilMotor*>(context);
+    if (!motor->_active) {
+        return;
+    }
+
+    if (motor->_windowBemfPending) {
+        motor->_windowBemf = raw_bemf;
+        motor->_windowBemfPending = false;
+    }
+
+    if (motor->_detector.update(raw_bemf)) {
+        motor->_endDetected = true;
+        // Stop the coil right away instead of waiting for the next scheduled step.
+        motor->_turnout->wake();
+    }
+
+    // Recorded after the detector ran, a capture does not delay the end detection.
+    if (bemfCapture.isRecording()) {
+        int a, b;
+        hal_motor_get_last_terminals(motor->_hal, &a, &b);
+        bemfCapture.sample(motor->_turnout->getId(), a, b);
+    }
+}
+
+// --- CurrentSenseCoilMotor ---
+
+void CurrentSenseCoilMotor::begin(TurnoutBase& turnout) {
+    ioPins.mode(_pin1, OUTPUT);
+    ioPins.mode(_pin2, OUTPUT);
+    ioPins.write(_pin1, LOW);
+    ioPins.write(_pin2, LOW);
+    _turnout = &turnout;
+    _hal = hal_current_sense_init(_sensePin, on_current_update, this);
+    if (_hal == nullptr) {
+        eventLog.log(EVENT_CURRENT_SENSE_INIT_FAILED, turnout.getId());
+    }
+}
+
+// Same timing as CoilMotor, the measurement window spans the pulse.
+void CurrentSenseCoilMotor::drive(TurnoutBase& turnout, int position, unsigned long now) {
+    if (turnout.pulseDue(now) && turnout.acquirePower()) {
+        ioPins.write(position == 1 ? _pin1 : _pin2, HIGH);
+        _detector.reset();
+        _pulseOn = true;
+        hal_motor_arm_bemf(_hal);
+        turnout.pulseStarted(now);
+    }
+    // Like the other coil motors, only a pulse of this move is ended. A pulse the detector
+    // has already cut keeps its budget until the move ends on the next run.
+    if (_pulseOn && turnout.pulseOver(now)) {
+        endPulse();
+        turnout.releasePower();
+    }
+}
+
+void CurrentSenseCoilMotor::stop(TurnoutBase&) {
+    endPulse();
+}
+
+void CurrentSenseCoilMotor::endPulse() {
+    ioPins.write(_pin1, LOW);
+    ioPins.write(_pin2, LOW);
+    _pulseOn = false;
+    hal_motor_disarm_bemf(_hal);
+}
+
+// Called from hal_motor_service() with every current value of the running pulse.
+void CurrentSenseCoilMotor::on_current_update(void* context, int current) {
+    CurrentSenseCoilMotor* motor = static_cast<CurrentSenseCoilMotor*>(context);
+    if (!motor->_pulseOn) {
+        return;
+    }
+    if (motor->_detector.update(current)) {
+        // Cut the coil right here, the turnout ends the move on its next run.
+        motor->endPulse();
+        motor->_endDetected = true;
+        motor->_turnout->wake();
+    }
+}
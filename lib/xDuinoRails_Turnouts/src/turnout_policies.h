@@ -0,0 +1,316 @@
+#ifndef TURNOUT_POLICIES_H
+#define TURNOUT_POLICIES_H
+
+// Motor and sensor policies of Turnout<Motor, Sensor>.
+//
+// A motor policy holds the pins and hardware handles of one drive and moves it:
+//
+//   static const TurnoutBase::MotorType TYPE;
+//   static const bool PULSED;              // drive() works with the turnout's pulse timing
+//   constexpr bool adaptivePulse() const;  // the turnout tunes its pulse timing
+//   void begin(TurnoutBase& turnout);      // the turnout may have a restored position
+//   void startMove(TurnoutBase& turnout);
+//   void drive(TurnoutBase& turnout, int position, unsigned long now); // runs on every deadline of a move
+//   void stop(TurnoutBase& turnout);
+//   void moveEnded(TurnoutBase& turnout, unsigned long now, bool reached);
+//
+// A sensor policy tells whether the turnout is in a position:
+//
+//   static const bool POLLED;              // has to be read periodically while moving
+//   void begin(TurnoutBase& turnout);
+//   bool atPosition(const TurnoutBase& turnout, const Motor& motor, int position) const; // before a move
+//   bool reached(const Motor& motor, int position) const;                                 // during a move
+//
+// The policies are plain classes with constexpr constructors and no heap use, so
+// turnouts can be declared in constant-initialized tables.
+
+#include <Arduino.h>
+#include "turnout_base.h"
+#include "motor_control_hal.h"
+#include "servo_pwm_hal.h"
+#include "pio_output_hal.h"
+#include "servo_profile.h"
+#include "bemf_stall_detector.h"
+#include "coil_current_detector.h"
+#include "switch_inputs.h"
+
+// Configuration struct for BEMF-controlled turnouts
+struct BEMF_Config {
+    int pwm_a_pin;
+    int pwm_b_pin;
+    int bemf_a_pin;
+    int bemf_b_pin;
+    int bemf_threshold = 10;
+    int bemf_stall_count = 5;
+    // End-of-travel detection algorithm and its parameters
+    StallDetectorType stall_detector = STALL_DETECTOR_THRESHOLD;
+    int ema_shift = 2;    // EMA/SLOPE: smoothing factor 1/2^ema_shift (0..8)
+    int slope_limit = 2;  // SLOPE: maximum change per measurement that counts as flat
+    int cusum_drift = 2;  // CUSUM: allowance subtracted from every drop below the threshold
+    int cusum_limit = 40; // CUSUM: accumulated drop that signals the end of travel
+    // Learn the coil pulse timing of this drive over successive throws
+    bool adaptive_pulse = false;
+};
+
+// --- Motor policies ---
+
+// Servo pulse width in µs for an angle in degrees, the range of the Arduino Servo library
+constexpr uint16_t servoPulse(int angle) {
+    return 544 + (long)angle * (2400 - 544) / 180;
+}
+
+// Hobby servo on a PWM slice of its own, moves are played by DMA (see servo_pwm_hal.h)
+class ServoMotor {
+public:
+    static const TurnoutBase::MotorType TYPE = TurnoutBase::MOTOR_SERVO;
+    static const bool PULSED = false;
+
+    constexpr ServoMotor(uint8_t pin, uint8_t angleMin = 30, uint8_t angleMax = 150)
+        : _pin(pin), _angleMin(angleMin), _angleMax(angleMax), _started(false), _hal(nullptr), _profile() {}
+
+    constexpr bool adaptivePulse() const { return false; }
+    void begin(TurnoutBase& turnout);
+    void startMove(TurnoutBase&) { _started = false; }
+    void drive(TurnoutBase& turnout, int position, unsigned long now);
+    void stop(TurnoutBase&);
+    void moveEnded(TurnoutBase&, unsigned long, bool) {}
+
+    // Motion profile of a move (default: S-curve, 1000ms, 250ms acceleration)
+    void setProfile(ServoProfileType type, unsigned int durationMs, unsigned int accelMs);
+
+private:
+    // Computes the move from the current pulse width to `angle` and hands it to the hardware.
+    void startProfile(int angle);
+
+    uint8_t _pin;
+    uint8_t _angleMin;
+    uint8_t _angleMax;
+    bool _started; // The profile of the running move has been started
+    hal_servo_t* _hal;
+    ServoProfileParams _profile;
+
+};
+
+// Twin-coil drive, one output per position, switched by GPIO or expander pin (see io_pins.h)
+class CoilMotor {
+public:
+    static const TurnoutBase::MotorType TYPE = TurnoutBase::MOTOR_COIL;
+    static const bool PULSED = true;
+
+    constexpr CoilMotor(uint8_t pin1, uint8_t pin2) : _pin1(pin1), _pin2(pin2), _pulseOn(false) {}
+
+    constexpr bool adaptivePulse() const { return false; }
+    void begin(TurnoutBase& turnout);
+    void startMove(TurnoutBase&) { _pulseOn = false; }
+    void drive(TurnoutBase& turnout, int position, unsigned long now);
+    void stop(TurnoutBase&);
+    void moveEnded(TurnoutBase&, unsigned long, bool) {}
+
+private:
+    uint8_t _pin1;
+    uint8_t _pin2;
+    bool _pulseOn; // A pulse of the running move is on
+};
+
+// Hobby servo on a channel of the PIO output engine (see pio_output_hal.h). Needs no
+// PWM slice, so more servos fit on one board than with ServoMotor.
+class PioServoMotor {
+public:
+    static const TurnoutBase::MotorType TYPE = TurnoutBase::MOTOR_SERVO;
+    static const bool PULSED = false;
+
+    constexpr PioServoMotor(uint8_t pin, uint8_t angleMin = 30, uint8_t angleMax = 150)
+        : _pin(pin), _angleMin(angleMin), _angleMax(angleMax), _started(false), _hal(nullptr), _profile() {}
+
+    constexpr bool adaptivePulse() const { return false; }
+    void begin(TurnoutBase& turnout);
+    void startMove(TurnoutBase&) { _started = false; }
+    void drive(TurnoutBase& turnout, int position, unsigned long now);
+    void stop(TurnoutBase&);
+    void moveEnded(TurnoutBase&, unsigned long, bool) {}
+
+    // Motion profile of a move (default: S-curve, 1000ms, 250ms acceleration)
+    void setProfile(ServoProfileType type, unsigned int durationMs, unsigned int accelMs);
+
+private:
+    void startProfile(int angle);
+
+    uint8_t _pin;
+    uint8_t _angleMin;
+    uint8_t _angleMax;
+    bool _started; // The profile of the running move has been started
+    hal_pio_out_t* _hal;
+    ServoProfileParams _profile;
+};
+
+// Twin-coil drive on two channels of the PIO output engine
+class PioCoilMotor {
+public:
+    static const TurnoutBase::MotorType TYPE = TurnoutBase::MOTOR_COIL;
+    static const bool PULSED = true;
+
+    constexpr PioCoilMotor(uint8_t pin1, uint8_t pin2)
+        : _pin1(pin1), _pin2(pin2), _pulseOn(false), _hal1(nullptr), _hal2(nullptr) {}
+
+    constexpr bool adaptivePulse() const { return false; }
+    void begin(TurnoutBase& turnout);
+    void startMove(TurnoutBase&) { _pulseOn = false; }
+    void drive(TurnoutBase& turnout, int position, unsigned long now);
+    void stop(TurnoutBase&);
+    void moveEnded(TurnoutBase&, unsigned long, bool) {}
+
+private:
+    uint8_t _pin1;
+    uint8_t _pin2;
+    bool _pulseOn; // A pulse of the running move is on
+    hal_pio_out_t* _hal1;
+    hal_pio_out_t* _hal2;
+};
+
+// Coil (or motor) drive on an H-bridge with BEMF measurement in the off windows
+// of the pulses. The stall detector reports the end of travel.
+class BemfCoilMotor {
+public:
+    static const TurnoutBase::MotorType TYPE = TurnoutBase::MOTOR_COIL_BEMF;
+    static const bool PULSED = true;
+
+    constexpr explicit BemfCoilMotor(const BEMF_Config& config)
+        : _pwmAPin(config.pwm_a_pin), _pwmBPin(config.pwm_b_pin),
+          _bemfAPin(config.bemf_a_pin), _bemfBPin(config.bemf_b_pin),
+          _adaptivePulse(config.adaptive_pulse), _active(false), _pulseOn(false), _endDetected(false),
+          _windowBemfPending(false),
+          _windowBemf(0), _hal(nullptr), _turnout(nullptr), _detector(detectorParams(config)) {}
+    // Copies the configuration only; the HAL instance and the measurement state of a running move
+    // are not copied, the copy gets its own instance in begin().
+    constexpr BemfCoilMotor(const BemfCoilMotor& other)
+        : _pwmAPin(other._pwmAPin), _pwmBPin(other._pwmBPin), _bemfAPin(other._bemfAPin), _bemfBPin(other._bemfBPin),
+          _adaptivePulse(other._adaptivePulse), _active(false), _pulseOn(false), _endDetected(false),
+          _windowBemfPending(false),
+          _windowBemf(0), _hal(nullptr), _turnout(nullptr), _detector(other._detector.params()) {}
+
+    constexpr bool adaptivePulse() const { return _adaptivePulse; }
+    void begin(TurnoutBase& turnout);
+    void startMove(TurnoutBase& turnout);
+    void drive(TurnoutBase& turnout, int position, unsigned long now);
+    void stop(TurnoutBase& turnout);
+    void moveEnded(TurnoutBase& turnout, unsigned long now, bool reached);
+
+    bool endDetected() const { return _endDetected; }
+
+private:
+    static constexpr StallDetectorParams detectorParams(const BEMF_Config& config) {
+        StallDetectorParams params;
+        params.type = config.stall_detector;
+        params.threshold = config.bemf_threshold;
+        params.stall_count = config.bemf_stall_count;
+        params.ema_shift = config.ema_shift;
+        params.slope_limit = config.slope_limit;
+        params.cusum_drift = config.cusum_drift;
+        params.cusum_limit = config.cusum_limit;
+        return params;
+    }
+    static void on_bemf_update(void* context, int raw_bemf);
+
+    uint8_t _pwmAPin;
+    uint8_t _pwmBPin;
+    uint8_t _bemfAPin;
+    uint8_t _bemfBPin;
+    bool _adaptivePulse;
+    bool _active;              // Stall detection only runs while the turnout is moving
+    bool _pulseOn;             // A pulse of the running move is on, its off window has not started
+    bool _endDetected;
+    bool _windowBemfPending;   // The next measurement is the first one of an off window
+    int _windowBemf;           // First measurement of the last off window
+    hal_motor_t* _hal;         // Own HAL instance, several BEMF turnouts can move concurrently
+    TurnoutBase* _turnout;     // Woken when the end of travel is detected
+    BemfStallDetector _detector;
+};
+
+// Twin-coil drive switched by GPIO, with a shunt in the common return of both coils
+// on an ADC input. The current of every pulse is sampled and the pulse is cut as
+// soon as its signature shows the end of travel (see coil_current_detector.h).
+class CurrentSenseCoilMotor {
+public:
+    static const TurnoutBase::MotorType TYPE = TurnoutBase::MOTOR_COIL_CURRENT;
+    static const bool PULSED = true;
+
+    constexpr CurrentSenseCoilMotor(uint8_t pin1, uint8_t pin2, uint8_t sensePin,
+                                    const CurrentDetectorParams& params = CurrentDetectorParams())
+        : _pin1(pin1), _pin2(pin2), _sensePin(sensePin), _pulseOn(false), _endDetected(false),
+          _hal(nullptr), _turnout(nullptr), _detector(params) {}
+
+    constexpr bool adaptivePulse() const { return false; }
+    void begin(TurnoutBase& turnout);
+    void startMove(TurnoutBase&) { _endDetected = false; }
+    void drive(TurnoutBase& turnout, int position, unsigned long now);
+    void stop(TurnoutBase& turnout);
+    void moveEnded(TurnoutBase&, unsigned long, bool) {}
+
+    bool endDetected() const { return _endDetected; }
+
+private:
+    static void on_current_update(void* context, int current);
+    void endPulse();
+
+    uint8_t _pin1;
+    uint8_t _pin2;
+    uint8_t _sensePin;
+    bool _pulseOn;             // The detector only runs while a pulse is on
+    bool _endDetected;
+    hal_motor_t* _hal;         // Current sense instance of the motor HAL
+    TurnoutBase* _turnout;     // Woken when the end of travel is detected
+    CoilCurrentDetector _detector;
+};
+
+// --- Sensor policies ---
+
+// Two end switches to ground, one per position. They are debounced by switchInputs,
+// whose edges wake the turnout (see switch_inputs.h).
+class EndSwitches {
+public:
+    static const bool POLLED = false;
+
+    constexpr EndSwitches(uint8_t pin1, uint8_t pin2) : _pin1(pin1), _pin2(pin2) {}
+
+    void begin(TurnoutBase& turnout) {
+        switchInputs.watch(_pin1, turnout);
+        switchInputs.watch(_pin2, turnout);
+    }
+
+    template<typename Motor>
+    bool atPosition(const TurnoutBase&, const Motor& motor, int position) const {
+        return reached(motor, position);
+    }
+
+    template<typename Motor>
+    bool reached(const Motor&, int position) const {
+        return switchInputs.isLow(position == 1 ? _pin1 : _pin2);
+    }
+
+private:
+    uint8_t _pin1;
+    uint8_t _pin2;
+};
+
+// No sensors: the drive detects the end of travel (BemfCoilMotor, CurrentSenseCoilMotor),
+// the confirmed (or restored) position tells where the turnout is.
+class BemfSensor {
+public:
+    static const bool POLLED = false;
+
+    constexpr BemfSensor() {}
+
+    void begin(TurnoutBase&) {}
+
+    template<typename Motor>
+    bool atPosition(const TurnoutBase& turnout, const Motor&, int position) const {
+        return turnout.getPosition() == position;
+    }
+
+    template<typename Motor>
+    bool reached(const Motor& motor, int) const {
+        return motor.endDetected();
+    }
+};
+
+#endif
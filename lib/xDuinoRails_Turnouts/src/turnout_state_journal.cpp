@@ -0,0 +1,203 @@
+#include "turnout_state_journal.h"
+
+#include <string.h>
+
+#if defined(ARDUINO_ARCH_RP2040)
+
+#include "hardware/flash.h"
+
+// Filesystem area reserved by the linker script of the core
+extern "C" uint8_t _FS_start;
+extern "C" uint8_t _FS_end;
+
+static uint32_t flash_area_offset() {
+    return (uint32_t)((uintptr_t)&_FS_start - XIP_BASE);
+}
+
+static uint32_t flash_area_size() {
+    return (uint32_t)(&_FS_end - &_FS_start);
+}
+
+static void flash_read(uint32_t offset, void* data, size_t length) {
+    memcpy(data, (const void*)(uintptr_t)(XIP_BASE + offset), length);
+}
+
+// Flash operations run from RAM with the other core parked and interrupts off.
+static void flash_erase_sector(uint32_t offset) {
+    rp2040.idleOtherCore();
+    noInterrupts();
+    flash_range_erase(offset, FLASH_SECTOR_SIZE);
+    interrupts();
+    rp2040.resumeOtherCore();
+}
+
+// Programs `length` bytes at any offset. The rest of each page is written as 0xFF,
+// which leaves the bytes already programmed there unchanged.
+static void flash_write(uint32_t offset, const void* data, size_t length) {
+    static uint8_t page[FLASH_PAGE_SIZE];
+    const uint8_t* bytes = (const uint8_t*)data;
+    while (length > 0) {
+        uint32_t pageOffset = offset & ~(FLASH_PAGE_SIZE - 1);
+        size_t start = offset - pageOffset;
+        size_t count = FLASH_PAGE_SIZE - start < length ? FLASH_PAGE_SIZE - start : length;
+        memset(page, 0xFF, sizeof(page));
+        memcpy(page + start, bytes, count);
+
+        rp2040.idleOtherCore();
+        noInterrupts();
+        flash_range_program(pageOffset, page, FLASH_PAGE_SIZE);
+        interrupts();
+        rp2040.resumeOtherCore();
+
+        offset += count;
+        bytes += count;
+        length -= count;
+    }
+}
+
+#elif __has_include("sim_flash.h")
+
+// Native simulation: the flash mock of sim/, which can also cut the power mid-write
+#include "sim_flash.h"
+
+static const uint32_t FLASH_SECTOR_SIZE = SIM_FLASH_SECTOR_SIZE;
+
+static uint32_t flash_area_offset() { return 0; }
+static uint32_t flash_area_size() { return sim_flash_size(); }
+static void flash_read(uint32_t offset, void* data, size_t length) { sim_flash_read(offset, data, length); }
+static void flash_erase_sector(uint32_t offset) { sim_flash_erase_sector(offset); }
+static void flash_write(uint32_t offset, const void* data, size_t length) { sim_flash_program(offset, data, length); }
+
+#else
+
+static uint32_t flash_area_offset() { return 0; }
+static uint32_t flash_area_size() { return 0; }
+static void flash_read(uint32_t, void*, size_t) {}
+static void flash_erase_sector(uint32_t) {}
+static void flash_write(uint32_t, const void*, size_t) {}
+static const uint32_t FLASH_SECTOR_SIZE = 4096;
+
+#endif
+
+TurnoutStateJournal::TurnoutStateJournal()
+    : _offset(0), _sectors(0), _sector(-1), _sequence(0), _writeOffset(0), _lastWrite(0) {
+    memset(_journaled, 0xFF, sizeof(_journaled));
+}
+
+TurnoutStateJournal::Record TurnoutStateJournal::makeRecord(int id, int position) {
+    Record record;
+    record.id = id;
+    record.position = position;
+    record.check = (uint8_t)(record.id ^ (record.id >> 8) ^ record.position ^ RECORD_CHECK);
+    return record;
+}
+
+bool TurnoutStateJournal::valid(const Record& record) {
+    return (uint8_t)(record.id ^ (record.id >> 8) ^ record.position ^ RECORD_CHECK) == record.check;
+}
+
+bool TurnoutStateJournal::erased(const Record& record) {
+    return record.id == 0xFFFF && record.position == 0xFF && record.check == 0xFF;
+}
+
+bool TurnoutStateJournal::begin(TurnoutManager& manager) {
+    _offset = flash_area_offset();
+    _sectors = flash_area_size() / FLASH_SECTOR_SIZE;
+    if (_sectors < 2) {
+        _sectors = 0;
+        return false;
+    }
+
+    for (int slot = 0; slot < manager.count(); slot++) {
+        _journaled[slot] = manager.turnout(slot).getPosition();
+    }
+
+    // The valid sector with the highest sequence number is the current one.
+    for (int sector = 0; sector < _sectors; sector++) {
+        SectorHeader header;
+        flash_read(_offset + sector * FLASH_SECTOR_SIZE, &header, sizeof(header));
+        if (header.magic == SECTOR_MAGIC && header.check == ~header.sequence &&
+            (_sector < 0 || (int32_t)(header.sequence - _sequence) > 0)) {
+            _sector = sector;
+            _sequence = header.sequence;
+        }
+    }
+    if (_sector < 0) {
+        return true; // Empty journal, the first write starts it
+    }
+
+    // Replay up to the first erased record. Torn records are skipped and never overwritten.
+    uint32_t sectorOffset = _offset + _sector * FLASH_SECTOR_SIZE;
+    _writeOffset = sizeof(SectorHeader);
+    while (_writeOffset + sizeof(Record) <= FLASH_SECTOR_SIZE) {
+        Record record;
+        flash_read(sectorOffset + _writeOffset, &record, sizeof(record));
+        if (erased(record)) {
+            break;
+        }
+        _writeOffset += sizeof(Record);
+        if (!valid(record)) {
+            continue;
+        }
+        for (int slot = 0; slot < manager.count(); slot++) {
+            TurnoutBase& turnout = manager.turnout(slot);
+            if (turnout.getId() == record.id) {
+                turnout.restorePosition(record.position);
+                _journaled[slot] = record.position;
+            }
+        }
+    }
+    return true;
+}
+
+// Erases the next sector and writes a snapshot of all turnouts into it, then its header.
+void TurnoutStateJournal::startSector(TurnoutManager& manager) {
+    int sector = (_sector + 1) % _sectors;
+    uint32_t sectorOffset = _offset + sector * FLASH_SECTOR_SIZE;
+    flash_erase_sector(sectorOffset);
+
+    Record records[TURNOUT_MANAGER_CAPACITY];
+    for (int slot = 0; slot < manager.count(); slot++) {
+        TurnoutBase& turnout = manager.turnout(slot);
+        records[slot] = makeRecord(turnout.getId(), turnout.getPosition());
+        _journaled[slot] = turnout.getPosition();
+    }
+    flash_write(sectorOffset + sizeof(SectorHeader), records, manager.count() * sizeof(Record));
+
+    SectorHeader header = { SECTOR_MAGIC, _sequence + 1, ~(_sequence + 1) };
+    flash_write(sectorOffset, &header, sizeof(header));
+
+    _sector = sector;
+    _sequence = header.sequence;
+    _writeOffset = sizeof(SectorHeader) + manager.count() * sizeof(Record);
+}
+
+void TurnoutStateJournal::update(TurnoutManager& manager) {
+    unsigned long now = millis();
+    if (_sectors == 0 || now - _lastWrite < TURNOUT_JOURNAL_WRITE_INTERVAL_MS || manager.isBusy()) {
+        return;
+    }
+
+    Record records[TURNOUT_MANAGER_CAPACITY];
+    int changed = 0;
+    for (int slot = 0; slot < manager.count(); slot++) {
+        TurnoutBase& turnout = manager.turnout(slot);
+        if (turnout.getPosition() != _journaled[slot]) {
+            records[changed++] = makeRecord(turnout.getId(), turnout.getPosition());
+        }
+    }
+    if (changed == 0) {
+        return;
+    }
+    _lastWrite = now;
+
+    if (_sector < 0 || _writeOffset + changed * sizeof(Record) > FLASH_SECTOR_SIZE) {
+        startSector(manager);
+        return;
+    }
+    flash_write(_offset + _sector * FLASH_SECTOR_SIZE + _writeOffset, records, changed * sizeof(Record));
+    _writeOffset += changed * sizeof(Record);
+    for (int slot = 0; slot < manager.count(); slot++) {
+        _journaled[slot] = manager.turnout(slot).getPosition();
+    }
+}
@@ -0,0 +1,69 @@
+#ifndef TURNOUT_STATE_JOURNAL_H
+#define TURNOUT_STATE_JOURNAL_H
+
+#include <Arduino.h>
+#include "turnout_manager.h"
+
+// Minimum time between two flash writes in ms; changes in between are batched
+#ifndef TURNOUT_JOURNAL_WRITE_INTERVAL_MS
+#define TURNOUT_JOURNAL_WRITE_INTERVAL_MS 2000
+#endif
+
+// Append-only journal of the confirmed turnout positions in the flash.
+//
+// The journal occupies the filesystem area of the flash (board_build.filesystem_size,
+// LittleFS cannot be used at the same time) and uses its 4 KB sectors as a ring.
+// Every record holds a turnout id and its position; a later record overrides an
+// earlier one. When a sector is full, the next one is erased and starts with a
+// snapshot of all turnouts, so only the newest sector has to be replayed and every
+// sector is erased equally often.
+//
+// A sector header is written after its snapshot and records carry a checksum, so
+// a power cut during a write loses at most the changes of that write.
+//
+// Writing the flash stops both cores (about 1 ms per page, 50 ms per erase). The
+// journal therefore only writes while no turnout is moving, at most once per
+// TURNOUT_JOURNAL_WRITE_INTERVAL_MS.
+class TurnoutStateJournal {
+public:
+    TurnoutStateJournal();
+
+    // Replays the journal into the registered turnouts (restorePosition()). Call it
+    // after adding the turnouts and before TurnoutManager::begin(). Returns false
+    // if the flash has no filesystem area for the journal.
+    bool begin(TurnoutManager& manager);
+    // Writes the positions that changed since the last write. Call this in loop().
+    void update(TurnoutManager& manager);
+
+private:
+    struct Record {
+        uint16_t id;
+        uint8_t position;
+        uint8_t check; // Low byte of id ^ (id >> 8) ^ position ^ RECORD_CHECK
+    };
+
+    struct SectorHeader {
+        uint32_t magic;
+        uint32_t sequence; // Incremented for every new sector, the highest one is current
+        uint32_t check;    // ~sequence, detects a header torn by a power cut
+    };
+
+    static const uint32_t SECTOR_MAGIC = 0x4C4E4A54; // "TJNL"
+    static const uint8_t RECORD_CHECK = 0xA5;
+
+    static Record makeRecord(int id, int position);
+    static bool valid(const Record& record);
+    static bool erased(const Record& record);
+
+    void startSector(TurnoutManager& manager);
+
+    uint32_t _offset;       // Start of the journal area in the flash
+    int _sectors;           // Number of sectors of the area, 0 if there is none
+    int _sector;            // Current sector, -1 before the first write
+    uint32_t _sequence;     // Sequence number of the current sector
+    uint32_t _writeOffset;  // Offset of the next record within the current sector
+    unsigned long _lastWrite;
+    uint8_t _journaled[TURNOUT_MANAGER_CAPACITY]; // Position last written per manager slot, 0xFF if none
+};
+
+#endif
@@ -2,100 +2,254 @@
 #define xDuinoRails_Turnouts_h
 
 #include <Arduino.h>
-#include <Servo.h>
-#include "motor_control_hal.h"
-
-// Configuration struct for BEMF-controlled turnouts
-struct BEMF_Config {
-    int pwm_a_pin;
-    int pwm_b_pin;
-    int bemf_a_pin;
-    int bemf_b_pin;
-    int bemf_threshold = 10;
-    int bemf_stall_count = 5;
-};
+#include <tuple>
+#include <utility>
+#include "turnout_base.h"
+#include "turnout_policies.h"
 
-class xDuinoRails_Turnout {
+// A turnout whose motor and sensors are fixed at compile time.
+//
+// Each instance only holds the data of its own motor and sensor policy, and the
+// state machine is compiled for exactly this combination, without branches on the
+// motor type. The constructors are constexpr, so turnouts at namespace scope are
+// constant-initialized (no constructor code at boot) and can be kept in tables:
+//
+//   CoilTurnout yard[] = {
+//       { 1, "W1", CoilMotor(D0, D1), EndSwitches(D2, D3) },
+//       { 2, "W2", CoilMotor(D4, D5), EndSwitches(D6, D7) },
+//   };
+template<typename Motor, typename Sensor>
+class Turnout : public TurnoutBase {
 public:
-    enum MotorType {
-        MOTOR_SERVO,
-        MOTOR_COIL,
-        MOTOR_COIL_BEMF
-    };
+    constexpr Turnout(int id, const char* name, const Motor& motor, const Sensor& sensor = Sensor())
+        : TurnoutBase(id, name, Motor::TYPE, motor.adaptivePulse()), _motor(motor), _sensor(sensor) {}
+
+    void begin() override {
+        _motor.begin(*this);
+        _sensor.begin(*this);
+    }
+
+    bool service(unsigned long now, unsigned long& nextDeadline) override {
+        return serviceWith(_motor, _sensor, now, nextDeadline);
+    }
+
+    Motor& motor() { return _motor; }
+
+private:
+    Motor _motor;
+    Sensor _sensor;
+};
+
+typedef Turnout<ServoMotor, EndSwitches> ServoTurnout;
+typedef Turnout<CoilMotor, EndSwitches> CoilTurnout;
+typedef Turnout<BemfCoilMotor, BemfSensor> BemfTurnout;
+typedef Turnout<CurrentSenseCoilMotor, BemfSensor> CurrentSenseCoilTurnout;
+// Outputs on the PIO output engine instead of PWM slices and GPIO writes
+typedef Turnout<PioServoMotor, EndSwitches> PioServoTurnout;
+typedef Turnout<PioCoilMotor, EndSwitches> PioCoilTurnout;
 
+// Turnout whose motor type is chosen at run time, kept for existing sketches.
+//
+// It holds the policies of all motor types in a union and selects the state machine
+// of its type once per run. New code should prefer the Turnout<Motor, Sensor> types,
+// which need less RAM.
+class xDuinoRails_Turnout : public TurnoutBase {
+public:
     // Constructor for Servo and Coil
     xDuinoRails_Turnout(int id, const char* name, MotorType motorType, int pin1, int pin2, int sensorPin1, int sensorPin2, int angleMin = 30, int angleMax = 150);
 
     // Overloaded constructor for BEMF
     xDuinoRails_Turnout(int id, const char* name, const BEMF_Config& bemf_config);
-    ~xDuinoRails_Turnout();
+    // Moves a turnout that has not been started or registered yet, e.g. into a composite turnout
+    xDuinoRails_Turnout(xDuinoRails_Turnout&& other);
+
+    void begin() override;
+    bool service(unsigned long now, unsigned long& nextDeadline) override;
 
-    void begin();
-    void update();
-    void setPosition(int position); // 1 for position 1, 2 for position 2
+    // Motion profile of a servo move (default: S-curve, 1000ms, 250ms acceleration)
+    void setServoProfile(ServoProfileType type, unsigned int durationMs, unsigned int accelMs);
 
 private:
-    enum State {
-        STATE_IDLE,
-        STATE_MOVING_TO_POS1,
-        STATE_MOVING_TO_POS2
+    union Motor {
+        Motor() {}
+        ServoMotor servo;
+        CoilMotor coil;
+        BemfCoilMotor bemf;
     };
 
-    void stopMotor();
-    static void on_bemf_update(int raw_bemf);
+    Motor _motor;
+    EndSwitches _switches; // Used by servo and coil motors
+    BemfSensor _bemfSensor;
+};
+
+// Called when all legs of a composite turnout have settled. `failed` is the
+// number of legs that did not reach their position (timeout).
+typedef void (*CompositeSettledCallback)(void* context, int failed);
+
+// What the TurnoutManager and the DccTurnoutRegistry need of a composite turnout,
+// whatever the types of its legs.
+class CompositeTurnoutBase {
+public:
+    // Positions: 0 .. positionCount() - 1, their meaning is given by the table
+    virtual void setPosition(int position, unsigned long commandTime) = 0;
+    void setPosition(int position) { setPosition(position, millis()); }
+
+    virtual int positionCount() const = 0;
+    virtual int legCount() const = 0;
+    virtual TurnoutBase& leg(int index) = 0;
+
+protected:
+    ~CompositeTurnoutBase() = default;
+};
+
+// A turnout made of several simple turnouts ("legs") that are switched together,
+// e.g. a three-way turnout, a double slip or a scissors crossing.
+//
+// `table[position][leg]` is the state (1 or 2) of every leg in every position; it
+// has to outlive the composite, typically it is a static const array. The legs keep
+// their concrete Turnout<Motor, Sensor> types and are stored inline, so they cost
+// no more than on their own. On a position change only the legs whose state
+// changes are commanded, all of them at the same time.
+template<int Positions, typename... Legs>
+class CompositeTurnout : public CompositeTurnoutBase {
+public:
+    static const int LEGS = sizeof...(Legs);
+    typedef uint8_t PositionTable[Positions][LEGS];
+
+    // `legs` are moved into the composite, pass them as temporaries.
+    CompositeTurnout(int id, const char* name, const PositionTable& table, Legs&&... legs)
+        : _id(id), _name(name), _table(table), _legs(std::move(legs)...), _legList(), _targetPosition(-1),
+          _settling(false), _settledCallback(nullptr), _settledContext(nullptr) {
+        listLegs(std::make_index_sequence<LEGS>());
+        for (int leg = 0; leg < LEGS; leg++) {
+            _legState[leg] = 0;
+            _legList[leg]->setSettledCallback(on_leg_settled, this);
+        }
+    }
+
+    // The legs report to this object, so it must not be copied or moved.
+    CompositeTurnout(const CompositeTurnout&) = delete;
+    CompositeTurnout& operator=(const CompositeTurnout&) = delete;
+
+    void begin() {
+        for (int leg = 0; leg < LEGS; leg++) {
+            _legList[leg]->begin();
+        }
+    }
+
+    // Only needed without a TurnoutManager
+    void update() {
+        for (int leg = 0; leg < LEGS; leg++) {
+            _legList[leg]->update();
+        }
+    }
+
+    using CompositeTurnoutBase::setPosition;
+
+    // Same with the time (millis) the command was received, for the latency statistics
+    void setPosition(int position, unsigned long commandTime) override {
+        if (position < 0 || position >= Positions) {
+            return;
+        }
+        _targetPosition = position;
+        _settling = true;
+        bool commanded = false;
+        for (int leg = 0; leg < LEGS; leg++) {
+            uint8_t state = _table[position][leg];
+            // A leg that failed its last move is commanded again even if its state is unchanged.
+            if (state != _legState[leg] || _legList[leg]->hasTimedOut()) {
+                _legState[leg] = state;
+                _legList[leg]->setPosition(state, commandTime);
+                commanded = true;
+            }
+        }
+        if (!commanded) {
+            checkSettled();
+        }
+    }
+
+    int getPosition() const { return _targetPosition; }
+
+    // True once all legs have settled after the last setPosition()
+    bool isSettled() const {
+        for (int leg = 0; leg < LEGS; leg++) {
+            if (_legList[leg]->isMoving()) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void setSettledCallback(CompositeSettledCallback callback, void* context) {
+        _settledCallback = callback;
+        _settledContext = context;
+    }
+
+    int positionCount() const override { return Positions; }
+    int legCount() const override { return LEGS; }
+    TurnoutBase& leg(int index) override { return *_legList[index]; }
+    // A leg with its own type, e.g. to set a servo profile
+    template<int Index>
+    typename std::tuple_element<Index, std::tuple<Legs...>>::type& leg() { return std::get<Index>(_legs); }
+
+protected:
+    template<size_t... Index>
+    void listLegs(std::index_sequence<Index...>) {
+        TurnoutBase* legs[] = { &std::get<Index>(_legs)... };
+        for (int leg = 0; leg < LEGS; leg++) {
+            _legList[leg] = legs[leg];
+        }
+    }
+
+    static void on_leg_settled(void* context) {
+        static_cast<CompositeTurnout*>(context)->checkSettled();
+    }
+
+    void checkSettled() {
+        if (!_settling || !isSettled()) {
+            return;
+        }
+        _settling = false;
+        int failed = 0;
+        for (int leg = 0; leg < LEGS; leg++) {
+            if (_legList[leg]->hasTimedOut()) {
+                failed++;
+            }
+        }
+        if (_settledCallback) {
+            _settledCallback(_settledContext, failed);
+        }
+    }
 
-    // General properties
     int _id;
     const char* _name;
-    MotorType _motorType;
-    State _state;
-    int _targetPosition; // 0: unset, 1: pos1, 2: pos2
-
-    // BEMF-specific properties
-    volatile bool _bemfEndDetected;
-    volatile int _current_stall_count;
-    int _bemf_threshold;
-    int _bemf_stall_count;
-    static volatile xDuinoRails_Turnout* _active_bemf_turnout;
-    static volatile bool _bemf_motor_active;
-
-    // Motor-specific data
-    union {
-        struct {
-            int pin;
-            int angleMin;
-            int angleMax;
-            int currentAngle;
-            Servo* servo;
-        } servo;
-        struct {
-            int pin1;
-            int pin2;
-        } coil;
-        struct {
-            int pwm_a_pin;
-            int pwm_b_pin;
-            int bemf_a_pin;
-            int bemf_b_pin;
-        } bemf;
-    } _motor;
-
-    // Sensor pins (used for non-BEMF motors)
-    int _sensorPin1;
-    int _sensorPin2;
-
-    // Timing
-    unsigned long _moveStartTime;
-    unsigned long _lastMoveTime;
-
-    // Constants
-    static const unsigned long TIMEOUT_MS = 5000;
-    static const int SERVO_STEP_DELAY = 20;
-    static const int COIL_PULSE_ON_MS = 50;
-    static const int COIL_PULSE_OFF_MS = 150;
+    const PositionTable& _table;
+    std::tuple<Legs...> _legs;
+    TurnoutBase* _legList[LEGS]; // The legs in _legs, for the loops over all of them
+    uint8_t _legState[LEGS];     // Last commanded state of every leg, 0: none
+    int _targetPosition;         // -1: unset
+    bool _settling;              // A position change has not been reported as settled yet
+    CompositeSettledCallback _settledCallback;
+    void* _settledContext;
+};
+
+// `Count` legs of the same type
+template<int Positions, typename Leg, int Count, typename... Legs>
+struct UniformCompositeTurnout {
+    typedef typename UniformCompositeTurnout<Positions, Leg, Count - 1, Leg, Legs...>::type type;
+};
+
+template<int Positions, typename Leg, typename... Legs>
+struct UniformCompositeTurnout<Positions, Leg, 0, Legs...> {
+    typedef CompositeTurnout<Positions, Legs...> type;
 };
 
-class xDuinoRails_ThreeWayTurnout {
+// Composite whose legs choose their motor type at run time, kept for existing sketches
+template<int Legs, int Positions>
+using xDuinoRails_CompositeTurnout = typename UniformCompositeTurnout<Positions, xDuinoRails_Turnout, Legs>::type;
+
+// Märklin three-way turnout: two coil legs, A switches to the left, B to the right
+class xDuinoRails_ThreeWayTurnout : public CompositeTurnout<3, CoilTurnout, CoilTurnout> {
 public:
     xDuinoRails_ThreeWayTurnout(
         int id,
@@ -106,22 +260,7 @@ public:
         int coilPin1_B, int coilPin2_B, int sensorPin1_B, int sensorPin2_B
     );
 
-    void begin();
-    void update();
-
     // Positions: 0 for straight, 1 for left, 2 for right
-    void setPosition(int position);
-    ~xDuinoRails_ThreeWayTurnout();
-
-private:
-    int _id;
-    const char* _name;
-
-    // Two standard turnouts to control the two coil pairs
-    xDuinoRails_Turnout* _turnoutA;
-    xDuinoRails_Turnout* _turnoutB;
-
-    int _targetPosition; // 0: straight, 1: left, 2: right
 };
 
 #endif
@@ -0,0 +1,164 @@
+/**
+ * @file Arduino.h
+ * @brief Arduino API of the native simulation (see sim.h).
+ *
+ * Only what the libraries and their tests use: time runs on the virtual
+ * clock, pins are simulated pins the models drive and read, Serial writes
+ * into a buffer the test reads back. The signatures follow the ArduinoCore
+ * API of the RP2040 core, so code that compiles here compiles on the board.
+ */
+#ifndef ARDUINO_H
+#define ARDUINO_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <deque>
+#include <string>
+
+typedef uint8_t byte;
+typedef bool boolean;
+typedef uint8_t pin_size_t;
+
+typedef enum { LOW = 0, HIGH = 1, CHANGE = 2, FALLING = 3, RISING = 4 } PinStatus;
+typedef enum { INPUT = 0x0, OUTPUT = 0x1, INPUT_PULLUP = 0x2, INPUT_PULLDOWN = 0x3 } PinMode;
+
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+
+// --- Time, on the virtual clock ---
+
+unsigned long millis();
+unsigned long micros();
+// Advance the virtual clock, so the models move while the code waits.
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+// --- Pins ---
+
+void pinMode(pin_size_t pin, PinMode mode);
+void digitalWrite(pin_size_t pin, PinStatus level);
+PinStatus digitalRead(pin_size_t pin);
+int analogRead(pin_size_t pin);
+
+// Interrupts are no concern on the host, the simulation runs in one thread.
+inline void noInterrupts() {}
+inline void interrupts() {}
+inline int digitalPinToInterrupt(pin_size_t pin) { return pin; }
+void attachInterrupt(pin_size_t pin, void (*callback)(), PinStatus mode);
+void detachInterrupt(pin_size_t pin);
+
+// --- Helpers ---
+
+inline long map(long x, long inMin, long inMax, long outMin, long outMax) {
+    return (x - inMin) * (outMax - outMin) / (inMax - inMin) + outMin;
+}
+
+template<typename T, typename L, typename H>
+auto constrain(const T& amount, const L& low, const H& high) -> decltype(amount < low ? low : (amount > high ? high : amount)) {
+    return amount < low ? low : (amount > high ? high : amount);
+}
+
+// --- Print and Stream ---
+
+class Print {
+public:
+    virtual ~Print() {}
+
+    virtual size_t write(uint8_t byte) = 0;
+    virtual size_t write(const uint8_t* buffer, size_t size);
+    size_t write(const char* text) { return text == nullptr ? 0 : write((const uint8_t*)text, strlen(text)); }
+    virtual int availableForWrite() { return 0; }
+    virtual void flush() {}
+
+    size_t print(const char* text) { return write(text); }
+    size_t print(const std::string& text) { return write((const uint8_t*)text.data(), text.size()); }
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t print(unsigned char value, int base = DEC) { return print((unsigned long)value, base); }
+    size_t print(int value, int base = DEC) { return print((long)value, base); }
+    size_t print(unsigned int value, int base = DEC) { return print((unsigned long)value, base); }
+    size_t print(long value, int base = DEC);
+    size_t print(unsigned long value, int base = DEC);
+    size_t print(long long value, int base = DEC);
+    size_t print(unsigned long long value, int base = DEC);
+    size_t print(double value, int digits = 2);
+
+    size_t println() { return write("\r\n"); }
+    template<typename T>
+    size_t println(const T& value) { return print(value) + println(); }
+    template<typename T>
+    size_t println(const T& value, int format) { return print(value, format) + println(); }
+};
+
+class Stream : public Print {
+public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+};
+
+// USB serial port. What the code writes is collected in output(), what a test
+// puts in with receive() is read back.
+class SimSerial : public Stream {
+public:
+    SimSerial() : _room(4096) {}
+
+    void begin(unsigned long) {}
+    explicit operator bool() const { return true; }
+
+    using Print::write;
+    size_t write(uint8_t byte) override;
+    size_t write(const uint8_t* buffer, size_t size) override;
+    int availableForWrite() override { return _room; }
+    int available() override { return (int)_input.size(); }
+    int read() override;
+    int peek() override { return _input.empty() ? -1 : _input.front(); }
+
+    // Bytes written since the last clear
+    std::string& output() { return _output; }
+    // Queues bytes for read()
+    void receive(const uint8_t* data, size_t size) { _input.insert(_input.end(), data, data + size); }
+    // Room reported by availableForWrite(), to simulate a congested port
+    void setRoom(int bytes) { _room = bytes; }
+
+private:
+    std::string _output;
+    std::deque<uint8_t> _input;
+    int _room;
+};
+
+extern SimSerial Serial;
+
+// --- RP2040 core ---
+
+// Inter-core FIFO; both "cores" run in the one simulation thread.
+class SimFifo {
+public:
+    void push(uint32_t value) { _values.push_back(value); }
+    bool push_nb(uint32_t value) { push(value); return true; }
+    uint32_t pop();
+    bool pop_nb(uint32_t* value);
+    int available() const { return (int)_values.size(); }
+    void clear() { _values.clear(); }
+
+private:
+    std::deque<uint32_t> _values;
+};
+
+class SimRP2040 {
+public:
+    void idleOtherCore() {}
+    void resumeOtherCore() {}
+    // 125MHz cycles of the virtual clock
+    uint32_t getCycleCount() { return micros() * 125; }
+
+    SimFifo fifo;
+};
+
+extern SimRP2040 rp2040;
+
+#endif
@@ -0,0 +1,67 @@
+/**
+ * @file EEPROM.h
+ * @brief EEPROM emulation of the native simulation.
+ *
+ * Like the RP2040 core, begin() copies the "flash" into a RAM buffer, get()
+ * and put() work on the buffer and commit() writes it back. What was not
+ * committed is lost with the next begin(), which is how a test simulates a
+ * reset or power cut. Erased flash reads 0xFF.
+ */
+#ifndef EEPROM_H
+#define EEPROM_H
+
+#include <Arduino.h>
+#include <vector>
+
+class EEPROMClass {
+public:
+    // Size of the emulated flash sector
+    static const size_t FLASH_SIZE = 4096;
+
+    EEPROMClass() : _flash(FLASH_SIZE, 0xFF), _commits(0) {}
+
+    void begin(size_t size);
+    bool commit();
+    bool end() { bool ok = commit(); _data.clear(); return ok; }
+
+    uint8_t read(int address) const { return address >= 0 && (size_t)address < _data.size() ? _data[address] : 0; }
+    void write(int address, uint8_t value) {
+        if (address >= 0 && (size_t)address < _data.size()) {
+            _data[address] = value;
+        }
+    }
+    size_t length() const { return _data.size(); }
+    uint8_t* getDataPtr() { return _data.data(); }
+
+    template<typename T>
+    T& get(int address, T& value) {
+        if (address >= 0 && address + sizeof(T) <= _data.size()) {
+            memcpy((void*)&value, &_data[address], sizeof(T));
+        }
+        return value;
+    }
+
+    template<typename T>
+    const T& put(int address, const T& value) {
+        if (address >= 0 && address + sizeof(T) <= _data.size()) {
+            memcpy(&_data[address], (const void*)&value, sizeof(T));
+        }
+        return value;
+    }
+
+    // --- Simulation ---
+
+    // Erases the flash and drops the RAM buffer, as on a new board.
+    void erase();
+    // commit() calls that wrote the flash since erase()
+    uint32_t commitCount() const { return _commits; }
+
+private:
+    std::vector<uint8_t> _flash;
+    std::vector<uint8_t> _data;
+    uint32_t _commits;
+};
+
+extern EEPROMClass EEPROM;
+
+#endif
@@ -0,0 +1,37 @@
+/**
+ * @file Wire.h
+ * @brief I2C bus of the native simulation.
+ *
+ * The default bus has no devices: every transmission ends with a NACK of
+ * the address (2). A test derives from TwoWire to simulate a chip; all
+ * methods are virtual for that.
+ */
+#ifndef WIRE_H
+#define WIRE_H
+
+#include <Arduino.h>
+
+class TwoWire : public Stream {
+public:
+    virtual void begin() {}
+    virtual void setClock(uint32_t) {}
+
+    virtual void beginTransmission(uint8_t) {}
+    virtual uint8_t endTransmission(bool stopBit = true) { (void)stopBit; return 2; }
+    virtual size_t requestFrom(uint8_t address, size_t quantity, bool stopBit = true) {
+        (void)address;
+        (void)quantity;
+        (void)stopBit;
+        return 0;
+    }
+
+    using Print::write;
+    size_t write(uint8_t) override { return 1; }
+    int available() override { return 0; }
+    int read() override { return -1; }
+    int peek() override { return -1; }
+};
+
+extern TwoWire Wire;
+
+#endif
@@ -0,0 +1,278 @@
+#include "sim.h"
+
+#include <cstdio>
+#include <vector>
+#include <algorithm>
+
+SimSerial Serial;
+SimRP2040 rp2040;
+
+// Resets the HAL mocks, see hal_sim.cpp
+void hal_sim_reset();
+
+struct SimPin {
+    PinMode mode;
+    bool output;       // Level the firmware drives
+    int input;         // Level applied from outside, SIM_OPEN if none
+    int analog;        // ADC counts
+    uint16_t pulse_us;
+    uint32_t rising_edges;
+};
+
+static uint64_t now_us = 0;
+static SimPin pins[SIM_PINS];
+// Never destroyed, devices with static storage leave it at exit in any order.
+static std::vector<SimDevice*>& devices = *new std::vector<SimDevice*>();
+
+SimDevice::~SimDevice() {
+    sim_remove_device(*this);
+}
+
+void sim_reset() {
+    now_us = 0;
+    for (int pin = 0; pin < SIM_PINS; pin++) {
+        pins[pin] = SimPin{INPUT, false, SIM_OPEN, 0, 0, 0};
+    }
+    devices.clear();
+    Serial.output().clear();
+    rp2040.fifo.clear();
+    hal_sim_reset();
+}
+
+void sim_add_device(SimDevice& device) {
+    if (std::find(devices.begin(), devices.end(), &device) == devices.end()) {
+        devices.push_back(&device);
+    }
+}
+
+void sim_remove_device(SimDevice& device) {
+    devices.erase(std::remove(devices.begin(), devices.end(), &device), devices.end());
+}
+
+uint64_t sim_time_us() {
+    return now_us;
+}
+
+void sim_advance_us(uint64_t us) {
+    uint64_t end = now_us + us;
+    while (now_us < end) {
+        uint64_t step = end - now_us < SIM_STEP_US ? end - now_us : SIM_STEP_US;
+        now_us += step;
+        // A device may remove itself while it is stepped.
+        for (size_t i = 0; i < devices.size(); i++) {
+            devices[i]->step(now_us);
+        }
+    }
+}
+
+// --- Pins ---
+
+static SimPin* pin_state(uint8_t pin) {
+    return pin < SIM_PINS ? &pins[pin] : nullptr;
+}
+
+bool sim_pin_output(uint8_t pin) {
+    SimPin* p = pin_state(pin);
+    return p != nullptr && p->mode == OUTPUT && p->output;
+}
+
+PinMode sim_pin_mode(uint8_t pin) {
+    SimPin* p = pin_state(pin);
+    return p != nullptr ? p->mode : INPUT;
+}
+
+uint16_t sim_pin_pulse_us(uint8_t pin) {
+    SimPin* p = pin_state(pin);
+    return p != nullptr ? p->pulse_us : 0;
+}
+
+uint32_t sim_pin_rising_edges(uint8_t pin) {
+    SimPin* p = pin_state(pin);
+    return p != nullptr ? p->rising_edges : 0;
+}
+
+void sim_pin_input(uint8_t pin, int level) {
+    if (SimPin* p = pin_state(pin)) {
+        p->input = level;
+    }
+}
+
+void sim_pin_analog(uint8_t pin, int counts) {
+    if (SimPin* p = pin_state(pin)) {
+        p->analog = counts < 0 ? 0 : counts > 4095 ? 4095 : counts;
+    }
+}
+
+// The HALs switch their pins to a peripheral, which drives them like an output.
+void sim_set_output(uint8_t pin, bool high) {
+    if (SimPin* p = pin_state(pin)) {
+        if (high && !(p->mode == OUTPUT && p->output)) {
+            p->rising_edges++;
+        }
+        p->mode = OUTPUT;
+        p->output = high;
+    }
+}
+
+void sim_set_pulse_us(uint8_t pin, uint16_t width_us) {
+    if (SimPin* p = pin_state(pin)) {
+        p->mode = OUTPUT;
+        p->pulse_us = width_us;
+    }
+}
+
+int sim_read_analog(uint8_t pin) {
+    SimPin* p = pin_state(pin);
+    return p != nullptr ? p->analog : 0;
+}
+
+// --- Arduino API ---
+
+unsigned long millis() {
+    return (unsigned long)(now_us / 1000);
+}
+
+unsigned long micros() {
+    // Wraps at 32 bits like on the board.
+    return (unsigned long)(uint32_t)now_us;
+}
+
+void delay(unsigned long ms) {
+    sim_advance_us((uint64_t)ms * 1000);
+}
+
+void delayMicroseconds(unsigned int us) {
+    sim_advance_us(us);
+}
+
+void pinMode(pin_size_t pin, PinMode mode) {
+    if (SimPin* p = pin_state(pin)) {
+        p->mode = mode;
+    }
+}
+
+void digitalWrite(pin_size_t pin, PinStatus level) {
+    SimPin* p = pin_state(pin);
+    if (p == nullptr) {
+        return;
+    }
+    if (level == HIGH && !p->output && p->mode == OUTPUT) {
+        p->rising_edges++;
+    }
+    p->output = level == HIGH;
+}
+
+PinStatus digitalRead(pin_size_t pin) {
+    SimPin* p = pin_state(pin);
+    if (p == nullptr) {
+        return LOW;
+    }
+    if (p->mode == OUTPUT) {
+        return p->output ? HIGH : LOW;
+    }
+    if (p->input != SIM_OPEN) {
+        return p->input ? HIGH : LOW;
+    }
+    return p->mode == INPUT_PULLUP ? HIGH : LOW;
+}
+
+int analogRead(pin_size_t pin) {
+    return sim_read_analog(pin);
+}
+
+void attachInterrupt(pin_size_t, void (*)(), PinStatus) {}
+void detachInterrupt(pin_size_t) {}
+
+// --- Print ---
+
+size_t Print::write(const uint8_t* buffer, size_t size) {
+    size_t written = 0;
+    while (size-- > 0) {
+        written += write(*buffer++);
+    }
+    return written;
+}
+
+static size_t print_unsigned(Print& out, unsigned long long value, int base) {
+    char digits[65];
+    int n = 0;
+    if (base < 2 || base > 16) {
+        base = DEC;
+    }
+    do {
+        digits[n++] = "0123456789ABCDEF"[value % base];
+        value /= base;
+    } while (value != 0);
+    size_t written = 0;
+    while (n > 0) {
+        written += out.write((uint8_t)digits[--n]);
+    }
+    return written;
+}
+
+size_t Print::print(long value, int base) {
+    return print((long long)value, base);
+}
+
+size_t Print::print(unsigned long value, int base) {
+    return print_unsigned(*this, value, base);
+}
+
+size_t Print::print(long long value, int base) {
+    // Like the Arduino core, only decimal numbers get a sign.
+    if (base == DEC && value < 0) {
+        return write('-') + print_unsigned(*this, 0ull - (unsigned long long)value, DEC);
+    }
+    return print_unsigned(*this, (unsigned long long)value, base);
+}
+
+size_t Print::print(unsigned long long value, int base) {
+    return print_unsigned(*this, value, base);
+}
+
+size_t Print::print(double value, int digits) {
+    char text[64];
+    snprintf(text, sizeof(text), "%.*f", digits, value);
+    return write(text);
+}
+
+// --- Serial ---
+
+size_t SimSerial::write(uint8_t byte) {
+    _output.push_back((char)byte);
+    return 1;
+}
+
+size_t SimSerial::write(const uint8_t* buffer, size_t size) {
+    _output.append((const char*)buffer, size);
+    return size;
+}
+
+int SimSerial::read() {
+    if (_input.empty()) {
+        return -1;
+    }
+    int byte = _input.front();
+    _input.pop_front();
+    return byte;
+}
+
+// --- rp2040 ---
+
+uint32_t SimFifo::pop() {
+    // Nothing else could ever push, a blocking pop on an empty FIFO is a bug in the test.
+    if (_values.empty()) {
+        abort();
+    }
+    uint32_t value = _values.front();
+    _values.pop_front();
+    return value;
+}
+
+bool SimFifo::pop_nb(uint32_t* value) {
+    if (_values.empty()) {
+        return false;
+    }
+    *value = pop();
+    return true;
+}
@@ -0,0 +1,359 @@
+// HAL of bEMF_MotorControl on the simulated pins (see sim.h).
+//
+// The motor HAL itself (motor_control_hal.cpp) runs unchanged; only its
+// register access (motor_control_hw.h) is faked here: an ADC round robin over
+// the four inputs with one conversion per simulation step, and two chained DMA
+// channels that write the conversions into the buffer halves and raise the
+// half interrupt, which may be delayed (sim_set_dma_irq_latency_us()). The
+// servo HAL writes one profile value per 20ms frame; the PIO output engine
+// plays its profiles from hal_pio_out_service(). The PWM slice checks of the
+// board are kept, so a pin setup that fails there fails here.
+#include "sim.h"
+#include "motor_control_hal.h"
+#include "motor_control_hw.h"
+#include "servo_pwm_hal.h"
+#include "pio_output_hal.h"
+
+static int pwm_slice_of(uint8_t pin) {
+    return (pin >> 1) & 7;
+}
+
+// PWM slices running for motors, servos and the ADC trigger
+static uint32_t slices_in_use = 0;
+
+// --- Register access of the motor HAL ---
+
+// One of the chained DMA channels
+struct SimDmaChannel {
+    volatile uint16_t* write_address;
+    int remaining;       // Transfers left, 0 while idle
+};
+
+static SimDmaChannel dma[2];
+static int dma_active = 0;            // Channel that takes the next conversion
+static bool adc_running = false;
+static uint32_t adc_rrobin_mask = 0;
+static uint8_t adc_ainsel = 0;
+static uint32_t irq_pending = 0;      // Completed channels whose interrupt has not run yet
+static uint64_t irq_due_us = 0;
+static uint32_t irq_latency_us = 0;
+static uint32_t dma_irq_count = 0;
+
+// The next input of the round robin after `input`, like the ADC's RROBIN field
+static uint8_t next_input(uint8_t input, uint32_t mask) {
+    for (int i = 1; i <= HAL_ADC_INPUT_COUNT; i++) {
+        uint8_t candidate = (input + i) % HAL_ADC_INPUT_COUNT;
+        if (mask & (1u << candidate)) {
+            return candidate;
+        }
+    }
+    return input;
+}
+
+// The ADC with its DMA: one conversion per simulation step, then the interrupt once it is due
+class SimAdc : public SimDevice {
+public:
+    void step(uint64_t now_us) override {
+        if (adc_running) {
+            uint16_t sample = sim_read_analog(HAL_ADC_FIRST_GPIO + adc_ainsel);
+            adc_ainsel = next_input(adc_ainsel, adc_rrobin_mask);
+            SimDmaChannel* channel = &dma[dma_active];
+            // Without a busy channel the sample stays in the FIFO and is lost.
+            if (channel->remaining > 0) {
+                *channel->write_address++ = sample;
+                if (--channel->remaining == 0) {
+                    // The chained channel starts with the transfer count it was set up with.
+                    irq_pending |= 1u << dma_active;
+                    irq_due_us = now_us + irq_latency_us;
+                    dma_active ^= 1;
+                    dma[dma_active].remaining = HAL_BEMF_HALF_SAMPLES;
+                }
+            }
+        }
+        if (irq_pending && now_us >= irq_due_us) {
+            dma_irq_count++;
+            for (int half = 0; half < 2; half++) {
+                if (irq_pending & (1u << half)) {
+                    irq_pending &= ~(1u << half);
+                    hal_motor_half_complete(half);
+                }
+            }
+        }
+    }
+};
+
+static SimAdc adc;
+
+void sim_set_dma_irq_latency_us(uint32_t us) {
+    irq_latency_us = us;
+}
+
+bool hal_hw_pwm_slice_running(uint8_t slice) {
+    return slices_in_use & (1u << slice);
+}
+
+void hal_hw_init_shared(hal_bemf_trigger_mode_t mode) {}
+
+void hal_hw_init_motor(uint8_t slice, uint8_t pwm_a_pin, uint8_t pwm_b_pin, uint8_t bemf_a_pin, uint8_t bemf_b_pin) {
+    slices_in_use |= 1u << slice;
+    sim_set_output(pwm_a_pin, false);
+    sim_set_output(pwm_b_pin, false);
+}
+
+void hal_hw_init_sense(uint8_t sense_pin) {}
+
+void hal_hw_sync_trigger_phase(uint32_t slice_mask) {
+    slices_in_use |= slice_mask;
+}
+
+void hal_hw_start(volatile uint16_t* ping, volatile uint16_t* pong, uint32_t rrobin_mask, uint8_t first_input,
+                  uint8_t sync_slice) {
+    dma[0] = SimDmaChannel{ping, HAL_BEMF_HALF_SAMPLES};
+    dma[1] = SimDmaChannel{pong, 0};
+    dma_active = 0;
+    adc_ainsel = first_input;
+    adc_rrobin_mask = rrobin_mask;
+    adc_running = true;
+}
+
+void hal_hw_stop(uint8_t sync_slice) {
+    adc_running = false;
+    dma[0].remaining = 0;
+    dma[1].remaining = 0;
+    irq_pending = 0;
+}
+
+void hal_hw_rearm(int half, volatile uint16_t* buffer, uint32_t rrobin_mask, uint8_t input) {
+    dma[half].write_address = buffer;
+    adc_rrobin_mask = rrobin_mask;
+    adc_ainsel = input;
+}
+
+int hal_hw_samples_written(int half) {
+    return HAL_BEMF_HALF_SAMPLES - dma[half].remaining;
+}
+
+volatile uint16_t* hal_hw_write_address(int half) {
+    return dma[half].remaining > 0 ? dma[half].write_address : nullptr;
+}
+
+void hal_hw_set_pwm(uint8_t pin, int duty_cycle) {
+    sim_set_output(pin, duty_cycle > 0);
+}
+
+uint32_t hal_hw_disable_interrupts() {
+    // The fake interrupt only runs inside sim_advance_us(), never during HAL code.
+    return 0;
+}
+
+void hal_hw_restore_interrupts(uint32_t state) {}
+
+void hal_hw_update_irq_rate() {}
+
+uint32_t hal_bemf_get_irq_rate() {
+    return 0;
+}
+
+void hal_get_isr_stats(hal_isr_t isr, hal_isr_stats_t* stats) {
+    // Counts only, the host has no meaningful execution times.
+    stats->count = isr == HAL_ISR_DMA ? dma_irq_count : 0;
+    stats->total_us = 0;
+    stats->max_us = 0;
+}
+
+void hal_reset_isr_stats() {
+    dma_irq_count = 0;
+}
+
+// --- Servos on PWM slices ---
+
+struct hal_servo {
+    bool in_use;
+    uint8_t pin;
+    uint16_t pulse_us;
+    bool playing;
+    int frames;
+    int next_frame;      // Next profile value the "DMA" writes
+    uint64_t start_us;
+};
+
+static hal_servo_t servos[HAL_SERVO_MAX_INSTANCES];
+static uint16_t servo_profiles[HAL_SERVO_MAX_INSTANCES][HAL_SERVO_MAX_FRAMES];
+
+// Writes one profile value per PWM wrap, like the DMA paced by the slice
+class SimServoPwm : public SimDevice {
+public:
+    void step(uint64_t now_us) override {
+        for (int i = 0; i < HAL_SERVO_MAX_INSTANCES; i++) {
+            hal_servo_t* servo = &servos[i];
+            while (servo->playing && now_us >= servo->start_us + (uint64_t)servo->next_frame * HAL_SERVO_FRAME_US) {
+                servo->pulse_us = servo_profiles[i][servo->next_frame++];
+                sim_set_pulse_us(servo->pin, servo->pulse_us);
+                servo->playing = servo->next_frame < servo->frames;
+            }
+        }
+    }
+};
+
+static SimServoPwm servo_pwm;
+
+hal_servo_t* hal_servo_init(uint8_t pin, uint16_t pulse_us) {
+    int slice = pwm_slice_of(pin);
+    if (slices_in_use & (1u << slice) || slice == HAL_BEMF_TRIGGER_PWM_SLICE) {
+        return nullptr;
+    }
+    for (int i = 0; i < HAL_SERVO_MAX_INSTANCES; i++) {
+        if (!servos[i].in_use) {
+            servos[i] = hal_servo_t{true, pin, pulse_us, false, 0, 0, 0};
+            slices_in_use |= 1u << slice;
+            sim_set_pulse_us(pin, pulse_us);
+            return &servos[i];
+        }
+    }
+    return nullptr;
+}
+
+uint16_t* hal_servo_get_profile_buffer(hal_servo_t* servo) {
+    return servo_profiles[servo - servos];
+}
+
+void hal_servo_play(hal_servo_t* servo, int frames) {
+    if (servo == nullptr || frames <= 0) {
+        return;
+    }
+    servo->frames = frames > HAL_SERVO_MAX_FRAMES ? HAL_SERVO_MAX_FRAMES : frames;
+    servo->next_frame = 0;
+    // The first value goes out with the next wrap.
+    servo->start_us = sim_time_us() + SIM_STEP_US;
+    servo->playing = true;
+}
+
+void hal_servo_stop(hal_servo_t* servo) {
+    if (servo != nullptr) {
+        servo->playing = false;
+    }
+}
+
+bool hal_servo_is_playing(hal_servo_t* servo) {
+    return servo != nullptr && servo->playing;
+}
+
+uint16_t hal_servo_get_pulse(hal_servo_t* servo) {
+    return servo->pulse_us;
+}
+
+// --- PIO output engine ---
+
+struct hal_pio_out {
+    uint8_t pin;
+    uint16_t width;
+    bool playing;
+    int frames;
+    uint32_t start_us;
+};
+
+static hal_pio_out_t channels[HAL_PIO_OUT_MAX_CHANNELS];
+static uint16_t pio_profiles[HAL_PIO_OUT_MAX_CHANNELS][HAL_PIO_OUT_MAX_FRAMES];
+static int channel_count = 0;
+static int playing_count = 0;
+
+static void set_width(hal_pio_out_t* channel, uint16_t width_us) {
+    channel->width = width_us;
+    if (width_us == 0 || width_us == HAL_PIO_OUT_ON) {
+        sim_set_pulse_us(channel->pin, 0);
+        sim_set_output(channel->pin, width_us == HAL_PIO_OUT_ON);
+    } else {
+        sim_set_output(channel->pin, false);
+        sim_set_pulse_us(channel->pin, width_us);
+    }
+}
+
+hal_pio_out_t* hal_pio_out_add(uint8_t pin, uint16_t width_us) {
+    if (channel_count >= HAL_PIO_OUT_MAX_CHANNELS) {
+        return nullptr;
+    }
+    for (int i = 0; i < channel_count; i++) {
+        if (channels[i].pin == pin) {
+            return nullptr;
+        }
+    }
+    hal_pio_out_t* channel = &channels[channel_count++];
+    *channel = hal_pio_out_t{pin, 0, false, 0, 0};
+    set_width(channel, width_us);
+    return channel;
+}
+
+void hal_pio_out_set(hal_pio_out_t* channel, uint16_t width_us) {
+    if (channel == nullptr) {
+        return;
+    }
+    hal_pio_out_stop(channel);
+    set_width(channel, width_us);
+}
+
+uint16_t hal_pio_out_get(hal_pio_out_t* channel) {
+    return channel->width;
+}
+
+uint16_t* hal_pio_out_get_profile_buffer(hal_pio_out_t* channel) {
+    return pio_profiles[channel - channels];
+}
+
+void hal_pio_out_play(hal_pio_out_t* channel, int frames) {
+    if (channel == nullptr || frames <= 0) {
+        return;
+    }
+    hal_pio_out_stop(channel);
+    channel->frames = frames > HAL_PIO_OUT_MAX_FRAMES ? HAL_PIO_OUT_MAX_FRAMES : frames;
+    channel->start_us = micros();
+    channel->playing = true;
+    playing_count++;
+    hal_pio_out_service();
+}
+
+void hal_pio_out_stop(hal_pio_out_t* channel) {
+    if (channel != nullptr && channel->playing) {
+        channel->playing = false;
+        playing_count--;
+    }
+}
+
+bool hal_pio_out_is_playing(hal_pio_out_t* channel) {
+    return channel != nullptr && channel->playing;
+}
+
+void hal_pio_out_service() {
+    if (playing_count == 0) {
+        return;
+    }
+    uint32_t now_us = micros();
+    for (int i = 0; i < channel_count && playing_count > 0; i++) {
+        hal_pio_out_t* channel = &channels[i];
+        if (!channel->playing) {
+            continue;
+        }
+        int frame = (now_us - channel->start_us) / HAL_PIO_OUT_FRAME_US;
+        if (frame >= channel->frames - 1) {
+            frame = channel->frames - 1;
+            hal_pio_out_stop(channel);
+        }
+        set_width(channel, pio_profiles[i][frame]);
+    }
+}
+
+// --- Reset, called by sim_reset() ---
+
+void hal_sim_reset() {
+    hal_motor_reset();
+    for (int i = 0; i < HAL_SERVO_MAX_INSTANCES; i++) {
+        servos[i] = hal_servo_t();
+    }
+    slices_in_use = 0;
+    hal_hw_stop(0);
+    irq_latency_us = 0;
+    dma_irq_count = 0;
+    channel_count = 0;
+    playing_count = 0;
+    sim_add_device(adc);
+    sim_add_device(servo_pwm);
+}
@@ -0,0 +1,75 @@
+/**
+ * @file sim.h
+ * @brief Virtual clock and simulated pins of the native simulation.
+ *
+ * Time only advances in `sim_advance_us()` (and in delay()). It moves in
+ * steps of SIM_STEP_US, one ADC conversion at the 25kHz PWM rate of the
+ * motor HAL, and every registered SimDevice is stepped once per step: the
+ * HAL mocks fill their sample buffers and play their profiles, the models
+ * (sim_models.h) move and update the pins they drive.
+ *
+ * A pin has a level the firmware drives (digitalWrite(), the coil and motor
+ * HALs), a servo pulse width (the servo HALs), and the level and analog
+ * value applied from outside by the models. digitalRead() returns the
+ * outside level, or the pull-up/pull-down level of an open input.
+ */
+#ifndef SIM_H
+#define SIM_H
+
+#include <Arduino.h>
+#include <cstdint>
+
+// Length of one simulation step in µs
+#define SIM_STEP_US 40
+
+// Number of simulated GPIOs, the pin numbers of the RP2040
+#define SIM_PINS 30
+
+// Level of a pin nobody drives from outside
+#define SIM_OPEN -1
+
+// Hardware that changes with time: a HAL mock or a physical model
+class SimDevice {
+public:
+    // A device that is destroyed is removed from the simulation.
+    virtual ~SimDevice();
+
+    // Called once per step, after the clock has advanced to `now_us`.
+    virtual void step(uint64_t now_us) = 0;
+};
+
+// Sets the clock to 0, releases all pins, removes all devices and resets the HAL mocks.
+void sim_reset();
+// Registers a device; devices are stepped in the order they were added.
+void sim_add_device(SimDevice& device);
+void sim_remove_device(SimDevice& device);
+
+// Time since sim_reset() in µs
+uint64_t sim_time_us();
+// Advances the clock by `us`, stepping all devices on the way.
+void sim_advance_us(uint64_t us);
+
+// --- Pins as seen from outside ---
+
+// Level the firmware drives, false unless the pin is an output
+bool sim_pin_output(uint8_t pin);
+PinMode sim_pin_mode(uint8_t pin);
+// Servo pulse width in µs, 0 while the pin sends no pulses
+uint16_t sim_pin_pulse_us(uint8_t pin);
+// Number of rising edges the firmware drove since sim_reset()
+uint32_t sim_pin_rising_edges(uint8_t pin);
+// Applies a level from outside, e.g. an end switch to ground; SIM_OPEN releases it.
+void sim_pin_input(uint8_t pin, int level);
+// Sets the voltage at an ADC input in counts (0..4095).
+void sim_pin_analog(uint8_t pin, int counts);
+// Delays the DMA interrupt of the motor HAL after a buffer half is full, 0 after
+// sim_reset(). From one step on, the next conversion still runs on the old inputs.
+void sim_set_dma_irq_latency_us(uint32_t us);
+
+// --- Used by the shims and HAL mocks ---
+
+void sim_set_output(uint8_t pin, bool high);
+void sim_set_pulse_us(uint8_t pin, uint16_t width_us);
+int sim_read_analog(uint8_t pin);
+
+#endif
@@ -0,0 +1,103 @@
+#include "sim_flash.h"
+
+#include <cstring>
+
+static std::vector<uint8_t> flash;
+static std::vector<uint32_t> erase_counts;
+static bool cut_scheduled = false;
+static bool cut = false;
+static uint32_t bytes_to_cut = 0;
+static uint32_t bytes_written = 0;
+
+// Number of bytes of an operation of `length` that run before the power fails
+static size_t powered_bytes(size_t length) {
+    if (cut) {
+        return 0;
+    }
+    if (!cut_scheduled || length < bytes_to_cut) {
+        bytes_to_cut -= cut_scheduled ? length : 0;
+        return length;
+    }
+    size_t done = bytes_to_cut;
+    cut_scheduled = false;
+    cut = true;
+    return done;
+}
+
+void sim_flash_format(uint32_t size) {
+    flash.assign(size, 0xFF);
+    erase_counts.assign(size / SIM_FLASH_SECTOR_SIZE, 0);
+    bytes_written = 0;
+    sim_flash_power_on();
+}
+
+uint32_t sim_flash_size() {
+    return flash.size();
+}
+
+void sim_flash_read(uint32_t offset, void* data, size_t length) {
+    if (offset + length <= flash.size()) {
+        memcpy(data, &flash[offset], length);
+    } else {
+        memset(data, 0xFF, length);
+    }
+}
+
+void sim_flash_erase_sector(uint32_t offset) {
+    offset -= offset % SIM_FLASH_SECTOR_SIZE;
+    if (offset + SIM_FLASH_SECTOR_SIZE > flash.size()) {
+        return;
+    }
+    size_t count = powered_bytes(SIM_FLASH_SECTOR_SIZE);
+    if (count == 0 && cut) {
+        return;
+    }
+    memset(&flash[offset], 0xFF, count);
+    bytes_written += count;
+    erase_counts[offset / SIM_FLASH_SECTOR_SIZE]++;
+}
+
+void sim_flash_program(uint32_t offset, const void* data, size_t length) {
+    if (offset + length > flash.size()) {
+        return;
+    }
+    size_t count = powered_bytes(length);
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < count; i++) {
+        // Programming only clears bits.
+        flash[offset + i] &= bytes[i];
+    }
+    bytes_written += count;
+}
+
+void sim_flash_cut_power_after(uint32_t bytes) {
+    cut_scheduled = true;
+    bytes_to_cut = bytes;
+}
+
+bool sim_flash_power_cut() {
+    return cut;
+}
+
+void sim_flash_power_on() {
+    cut_scheduled = false;
+    cut = false;
+}
+
+std::vector<uint8_t> sim_flash_save() {
+    return flash;
+}
+
+void sim_flash_load(const std::vector<uint8_t>& image) {
+    if (image.size() == flash.size()) {
+        flash = image;
+    }
+}
+
+uint32_t sim_flash_bytes_written() {
+    return bytes_written;
+}
+
+uint32_t sim_flash_erase_count(int sector) {
+    return sector >= 0 && (size_t)sector < erase_counts.size() ? erase_counts[sector] : 0;
+}
@@ -0,0 +1,47 @@
+/**
+ * @file sim_flash.h
+ * @brief Filesystem area of the flash in the native simulation.
+ *
+ * Backs the flash access of TurnoutStateJournal. Like NOR flash, erasing
+ * sets a 4 KB sector to 0xFF and programming can only clear bits. The
+ * content survives sim_reset(), like the flash survives a reset of the board.
+ *
+ * A power cut can be scheduled after a number of bytes: the erase or program
+ * operation that reaches it stops at that byte, later operations have no
+ * effect until sim_flash_power_on(). Erasing and programming run in address
+ * order, so the bytes before the cut are done and the ones after are not.
+ */
+#ifndef SIM_FLASH_H
+#define SIM_FLASH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#define SIM_FLASH_SECTOR_SIZE 4096
+
+// Sets the size of the area (a multiple of the sector size, 0 for none) and erases it.
+void sim_flash_format(uint32_t size);
+uint32_t sim_flash_size();
+
+void sim_flash_read(uint32_t offset, void* data, size_t length);
+void sim_flash_erase_sector(uint32_t offset);
+void sim_flash_program(uint32_t offset, const void* data, size_t length);
+
+// Cuts the power after `bytes` more bytes have been erased or programmed.
+void sim_flash_cut_power_after(uint32_t bytes);
+// True once a scheduled power cut has happened
+bool sim_flash_power_cut();
+// Restores the power; nothing is scheduled any more.
+void sim_flash_power_on();
+
+// Copies the whole area, e.g. to repeat the same write with power cuts at different points
+std::vector<uint8_t> sim_flash_save();
+void sim_flash_load(const std::vector<uint8_t>& image);
+
+// Bytes erased or programmed since sim_flash_format(), counting only operations that ran
+uint32_t sim_flash_bytes_written();
+// Erases of one sector since sim_flash_format()
+uint32_t sim_flash_erase_count(int sector);
+
+#endif
@@ -0,0 +1,170 @@
+#include "sim_models.h"
+
+// Mid-scale of the ADC, the level of both H-bridge terminals at rest
+static const int ADC_MID = 2048;
+
+// --- SimCoilDrive ---
+
+SimCoilDrive::SimCoilDrive(uint8_t coil1Pin, uint8_t coil2Pin, const SimCoilParams& params)
+    : _coil1Pin(coil1Pin), _coil2Pin(coil2Pin), _bemfAPin(-1), _bemfBPin(-1), _shuntPin(-1), _params(params),
+      _x(0), _v(0), _current(0), _coil(0), _jammed(false), _lastUs(sim_time_us()), _pulses(0), _energizedUs(0),
+      _endReachedUs(0), _seed(12345) {
+}
+
+void SimCoilDrive::attachBemf(uint8_t pinA, uint8_t pinB) {
+    _bemfAPin = pinA;
+    _bemfBPin = pinB;
+}
+
+void SimCoilDrive::attachShunt(uint8_t pin) {
+    _shuntPin = pin;
+}
+
+void SimCoilDrive::place(double travel) {
+    _x = travel;
+    _v = 0;
+    _current = 0;
+    _coil = 0;
+    _pulses = 0;
+    _energizedUs = 0;
+}
+
+int SimCoilDrive::pull() const {
+    bool coil1 = sim_pin_output(_coil1Pin);
+    bool coil2 = sim_pin_output(_coil2Pin);
+    return coil1 == coil2 ? 0 : coil1 ? -1 : 1;
+}
+
+// Deterministic, so every run of a test sees the same samples.
+int SimCoilDrive::noise() {
+    if (_params.noise <= 0) {
+        return 0;
+    }
+    _seed = _seed * 1103515245u + 12345u;
+    return (int)((_seed >> 16) % (2 * _params.noise + 1)) - _params.noise;
+}
+
+void SimCoilDrive::step(uint64_t now_us) {
+    double dt = (now_us - _lastUs) / 1000.0; // ms
+    _lastUs = now_us;
+    if (dt <= 0) {
+        return;
+    }
+
+    int direction = pull();
+    int coil = direction < 0 ? 1 : direction > 0 ? 2 : 0;
+    if (coil != 0 && coil != _coil) {
+        _pulses++;
+        _current = 0;
+    }
+    _coil = coil;
+
+    // Travel of the armature into the energized coil, 0..1
+    double closed = direction > 0 ? _x : 1 - _x;
+    double inductance = (_params.open_mh + (_params.closed_mh - _params.open_mh) * closed) / 1000; // H
+    double inductanceRate = 0;                                                                     // H/s
+    if (direction != 0) {
+        _energizedUs += (uint64_t)(dt * 1000);
+        inductanceRate = (_params.closed_mh - _params.open_mh) / 1000 * (_v * direction) * 1000;
+        // L di/dt = V - R i - i dL/dt
+        double di = (_params.supply_v - _params.resistance_ohm * _current - _current * inductanceRate) / inductance;
+        _current += di * dt / 1000;
+        if (_current < 0) {
+            _current = 0;
+        }
+    } else {
+        // The free-wheeling diode takes the current, the shunt sees none of it.
+        _current = 0;
+    }
+
+    double target = 0;
+    double tau = _params.friction_tau_ms;
+    if (direction != 0 && _current > _params.pull_in_a) {
+        double force = (_current - _params.pull_in_a) / (_params.full_a - _params.pull_in_a);
+        target = direction * (force > 1 ? 1 : force) / _params.travel_ms;
+        tau = _params.mech_tau_ms;
+    }
+    if (_jammed) {
+        _v = 0;
+    } else {
+        _v += (target - _v) * (dt < tau ? dt / tau : 1);
+        _x += _v * dt;
+    }
+    if (_x <= 0 || _x >= 1) {
+        if (_v != 0) {
+            _endReachedUs = now_us;
+        }
+        _x = _x <= 0 ? 0 : 1;
+        _v = 0;
+    }
+
+    if (_bemfAPin >= 0) {
+        if (direction != 0) {
+            // The bridge drives the terminals, nothing is measured then.
+            sim_pin_analog(_bemfAPin, direction < 0 ? 4095 : 0);
+            sim_pin_analog(_bemfBPin, direction < 0 ? 0 : 4095);
+        } else {
+            int bemf = (int)(_v * _params.travel_ms * _params.bemf_full);
+            sim_pin_analog(_bemfAPin, ADC_MID + bemf / 2 + noise());
+            sim_pin_analog(_bemfBPin, ADC_MID - bemf / 2 + noise());
+        }
+    }
+    if (_shuntPin >= 0) {
+        sim_pin_analog(_shuntPin, (int)(_current * _params.counts_per_a) + noise());
+    }
+}
+
+// --- SimServo ---
+
+SimServo::SimServo(uint8_t pin, int angleMin, int angleMax, double degreesPerMs)
+    : _pin(pin), _angleMin(angleMin), _angleMax(angleMax), _degreesPerMs(degreesPerMs), _angle(angleMin),
+      _placed(false), _lastUs(sim_time_us()) {
+}
+
+void SimServo::step(uint64_t now_us) {
+    double dt = (now_us - _lastUs) / 1000.0;
+    _lastUs = now_us;
+    uint16_t pulse = sim_pin_pulse_us(_pin);
+    if (pulse == 0) {
+        return; // No pulses, the servo does not hold or move
+    }
+    // Inverse of servoPulse(): 544µs is 0°, 2400µs is 180°
+    double commanded = (pulse - 544) * 180.0 / (2400 - 544);
+    if (!_placed) {
+        // The servo starts where the first pulses put it, as after power-up.
+        _angle = commanded;
+        _placed = true;
+        return;
+    }
+    double limit = _degreesPerMs * dt;
+    double delta = commanded - _angle;
+    _angle += delta > limit ? limit : delta < -limit ? -limit : delta;
+}
+
+// --- SimEndSwitches ---
+
+SimEndSwitches::SimEndSwitches(uint8_t pin1, uint8_t pin2, const SimActuator& actuator, double tolerance,
+                               uint32_t bounceUs)
+    : _pin1(pin1), _pin2(pin2), _actuator(actuator), _tolerance(tolerance), _bounceUs(bounceUs),
+      _closed1(false), _closed2(false), _closedAt1(0), _closedAt2(0) {
+}
+
+void SimEndSwitches::apply(uint8_t pin, bool closed, bool& wasClosed, uint64_t& closedAt, uint64_t now_us) {
+    if (closed && !wasClosed) {
+        closedAt = now_us;
+    }
+    wasClosed = closed;
+    if (!closed) {
+        sim_pin_input(pin, SIM_OPEN);
+        return;
+    }
+    // Bounces as a contact that opens and closes every 200µs until it settles.
+    bool bouncing = now_us - closedAt < _bounceUs && (now_us - closedAt) / 200 % 2 == 1;
+    sim_pin_input(pin, bouncing ? SIM_OPEN : LOW);
+}
+
+void SimEndSwitches::step(uint64_t now_us) {
+    double travel = _actuator.travel();
+    apply(_pin1, travel <= _tolerance, _closed1, _closedAt1, now_us);
+    apply(_pin2, travel >= 1 - _tolerance, _closed2, _closedAt2, now_us);
+}
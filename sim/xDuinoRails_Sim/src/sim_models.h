@@ -0,0 +1,143 @@
+/**
+ * @file sim_models.h
+ * @brief Physical models of turnout drives for the native simulation.
+ *
+ * The models read the pins the firmware drives and write the pins the
+ * firmware reads, once per simulation step (see sim.h). Add them with
+ * sim_add_device() after sim_reset().
+ *
+ * Positions are fractions of the travel: 0 is position 1, 1 is position 2.
+ */
+#ifndef SIM_MODELS_H
+#define SIM_MODELS_H
+
+#include "sim.h"
+
+// Anything that end switches can sense
+class SimActuator {
+public:
+    virtual ~SimActuator() {}
+    // Travel from position 1 (0) to position 2 (1)
+    virtual double travel() const = 0;
+};
+
+// Parameters of SimCoilDrive, typical for a twin-coil point motor at 12V
+struct SimCoilParams {
+    double travel_ms = 20;      // Time to cross the travel at full speed
+    double mech_tau_ms = 3;     // Time constant of the speed while the coil pulls
+    double friction_tau_ms = 4; // Time constant of the speed once the coil is off
+    double pull_in_a = 0.3;     // Current at which the armature starts to move
+    double full_a = 0.8;        // Current at which it reaches full speed
+    double supply_v = 12;
+    double resistance_ohm = 12;
+    double open_mh = 10;        // Inductance of a coil with the armature far from it
+    double closed_mh = 60;      // Inductance with the armature pulled in
+    int bemf_full = 400;        // Differential BEMF at full speed in ADC counts
+    int counts_per_a = 1000;    // Shunt reading in ADC counts per A
+    int noise = 2;              // Peak ADC noise in counts
+};
+
+// Twin-coil point motor. Coil 1 pulls the armature to position 1, coil 2 to
+// position 2; both are switched by pins (GPIO, PIO or the two sides of an
+// H-bridge). The armature moves while a coil carries enough current and
+// coasts to a stop after it; at an end stop its speed, and with it the BEMF,
+// drops to zero.
+//
+// attachBemf() shows the BEMF on two ADC inputs while both coils are off, like
+// the terminals of the H-bridge in BemfCoilMotor's measurement window.
+// attachShunt() shows the coil current on an ADC input: the armature moving
+// into the coil raises its inductance, which dips the current; at the end stop
+// the current rises again, the signature CoilCurrentDetector looks for.
+class SimCoilDrive : public SimDevice, public SimActuator {
+public:
+    SimCoilDrive(uint8_t coil1Pin, uint8_t coil2Pin, const SimCoilParams& params = SimCoilParams());
+
+    void attachBemf(uint8_t pinA, uint8_t pinB);
+    void attachShunt(uint8_t pin);
+    // Puts the armature at rest at `travel`.
+    void place(double travel);
+    // A jammed armature does not move at all.
+    void jam(bool jammed) { _jammed = jammed; }
+
+    double travel() const override { return _x; }
+    // Speed in travels per ms, positive towards position 2
+    double speed() const { return _v; }
+    double current() const { return _current; }
+
+    // Coil switch-ons since place() or the start
+    uint32_t pulses() const { return _pulses; }
+    // Time both coils were on, in µs
+    uint64_t energizedUs() const { return _energizedUs; }
+    // Time the armature last arrived at an end stop
+    uint64_t endReachedUs() const { return _endReachedUs; }
+
+    void step(uint64_t now_us) override;
+
+private:
+    // -1 towards position 1, +1 towards position 2, 0 if no coil or both are on
+    int pull() const;
+    int noise();
+
+    uint8_t _coil1Pin;
+    uint8_t _coil2Pin;
+    int _bemfAPin;
+    int _bemfBPin;
+    int _shuntPin;
+    SimCoilParams _params;
+    double _x;
+    double _v;
+    double _current;       // Current of the coil that is on, A
+    int _coil;             // Coil that carries `_current`: 1, 2 or 0
+    bool _jammed;
+    uint64_t _lastUs;
+    uint32_t _pulses;
+    uint64_t _energizedUs;
+    uint64_t _endReachedUs;
+    uint32_t _seed;
+};
+
+// Hobby servo. It turns towards the angle of its pulse width at a limited speed.
+class SimServo : public SimDevice, public SimActuator {
+public:
+    // `angleMin`/`angleMax` are the angles of position 1 and 2 (ServoMotor's defaults).
+    SimServo(uint8_t pin, int angleMin = 30, int angleMax = 150, double degreesPerMs = 0.6);
+
+    double angle() const { return _angle; }
+    double travel() const override { return (_angle - _angleMin) / (_angleMax - _angleMin); }
+
+    void step(uint64_t now_us) override;
+
+private:
+    uint8_t _pin;
+    double _angleMin;
+    double _angleMax;
+    double _degreesPerMs;
+    double _angle;
+    bool _placed;          // The angle has been taken from the first pulse
+    uint64_t _lastUs;
+};
+
+// Two end switches to ground, closed while the actuator is within `tolerance`
+// of position 1 or 2. A switch that closes bounces for `bounceUs`.
+class SimEndSwitches : public SimDevice {
+public:
+    SimEndSwitches(uint8_t pin1, uint8_t pin2, const SimActuator& actuator, double tolerance = 0.02,
+                   uint32_t bounceUs = 0);
+
+    void step(uint64_t now_us) override;
+
+private:
+    void apply(uint8_t pin, bool closed, bool& wasClosed, uint64_t& closedAt, uint64_t now_us);
+
+    uint8_t _pin1;
+    uint8_t _pin2;
+    const SimActuator& _actuator;
+    double _tolerance;
+    uint32_t _bounceUs;
+    bool _closed1;
+    bool _closed2;
+    uint64_t _closedAt1;
+    uint64_t _closedAt2;
+};
+
+#endif
@@ -0,0 +1,92 @@
+/**
+ * @file turnout_sim.h
+ * @brief Runs the turnouts of a TurnoutManager against the simulated hardware.
+ *
+ * Every loop advances the virtual clock by the loop period, which steps the
+ * HAL mocks and models, then calls TurnoutManager::update() with the new
+ * time, like loop() on the board. The wall-clock time spent in update() is
+ * summed for the benchmarks.
+ */
+#ifndef TURNOUT_SIM_H
+#define TURNOUT_SIM_H
+
+#include <chrono>
+#include <new>
+#include "sim.h"
+#include "turnout_manager.h"
+#include "switch_inputs.h"
+#include "io_pins.h"
+#include "event_log.h"
+#include "bemf_capture.h"
+
+class TurnoutSim {
+public:
+    explicit TurnoutSim(TurnoutManager& manager, uint32_t loopUs = 100)
+        : _manager(manager), _loopUs(loopUs), _loops(0), _updateNs(0) {}
+
+    // Resets the simulation (sim_reset()) and the global state of the library,
+    // as after a reset of the board. Call it before the turnouts are created.
+    static void reset() {
+        sim_reset();
+        renew(switchInputs);
+        renew(ioPins);
+        renew(eventLog);
+        renew(bemfCapture);
+    }
+
+    // Lets the models apply their levels, then starts the turnouts.
+    void begin() {
+        sim_advance_us(SIM_STEP_US);
+        _manager.begin();
+    }
+
+    void loop() {
+        sim_advance_us(_loopUs);
+        auto start = std::chrono::steady_clock::now();
+        _manager.update(millis());
+        _updateNs += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+        _loops++;
+    }
+
+    // Runs the loop for `ms`.
+    void run(unsigned long ms) {
+        uint64_t end = sim_time_us() + (uint64_t)ms * 1000;
+        while (sim_time_us() < end) {
+            loop();
+        }
+    }
+
+    // Runs the loop until no turnout moves, at most `maxMs`. Returns false on the limit.
+    bool runUntilIdle(unsigned long maxMs = 10000) {
+        uint64_t end = sim_time_us() + (uint64_t)maxMs * 1000;
+        while (_manager.isBusy()) {
+            if (sim_time_us() >= end) {
+                return false;
+            }
+            loop();
+        }
+        return true;
+    }
+
+    uint32_t loops() const { return _loops; }
+    // Wall-clock time spent in TurnoutManager::update() in ns
+    uint64_t updateNs() const { return _updateNs; }
+    void resetCounters() {
+        _loops = 0;
+        _updateNs = 0;
+    }
+
+private:
+    template<typename T>
+    static void renew(T& object) {
+        object.~T();
+        new (&object) T();
+    }
+
+    TurnoutManager& _manager;
+    uint32_t _loopUs;
+    uint32_t _loops;
+    uint64_t _updateNs;
+};
+
+#endif
@@ -0,0 +1,33 @@
+#include <Wire.h>
+#include <EEPROM.h>
+
+#include <algorithm>
+
+TwoWire Wire;
+EEPROMClass EEPROM;
+
+void EEPROMClass::begin(size_t size) {
+    if (size > FLASH_SIZE) {
+        size = FLASH_SIZE;
+    }
+    _data.assign(_flash.begin(), _flash.begin() + size);
+}
+
+bool EEPROMClass::commit() {
+    if (_data.empty()) {
+        return false;
+    }
+    // Like the core, an unchanged buffer does not wear the flash.
+    if (std::equal(_data.begin(), _data.end(), _flash.begin())) {
+        return true;
+    }
+    std::copy(_data.begin(), _data.end(), _flash.begin());
+    _commits++;
+    return true;
+}
+
+void EEPROMClass::erase() {
+    _flash.assign(FLASH_SIZE, 0xFF);
+    _data.clear();
+    _commits = 0;
+}
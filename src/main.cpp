@@ -1,6 +1,19 @@
 #include <Arduino.h>
 #include <xDuinoRails_Turnouts.h>
+#include <turnout_manager.h>
+#include <dcc_command_queue.h>
+#include <dcc_turnout_registry.h>
+#include <event_log.h>
+#include <bemf_capture.h>
+#include <perf_counters.h>
+#include <pulse_timing_store.h>
+#include <turnout_state_journal.h>
+#include <host_link.h>
 #include <NmraDcc.h>
+#if defined(XDUINORAILS_PIO_DCC)
+#include <dcc_rx_hal.h>
+#include <dcc_packet_decoder.h>
+#endif
 
 // DCC Pin Definition
 #define DCC_PIN D0
@@ -8,6 +21,34 @@
 // Initialize the DCC object
 NmraDcc Dcc;
 
+#if defined(XDUINORAILS_PIO_DCC)
+// With the PIO receiver, NmraDcc only keeps the CVs; the packets are decoded here
+DccPacketDecoder dccDecoder;
+// The PIO receiver runs; false if it found no free hardware and NmraDcc's interrupt decodes
+bool pioDccActive = false;
+#endif
+
+// Schedules all turnouts, only turnouts that have something to do are updated
+TurnoutManager turnouts;
+
+// Decouples DCC reception from the turnouts and coalesces repeated packets
+DccCommandQueue dccCommands;
+
+// Maps the decoder's accessory addresses (base address from CV1/CV9) to the turnouts
+DccTurnoutRegistry<16> dccAddresses;
+
+// Period of the loop that runs the turnouts
+LoopMonitor loopMonitor;
+
+// Keeps the pulse timing learned by adaptive BEMF turnouts across resets
+PulseTimingStore pulseTimings;
+
+// Records the confirmed turnout positions in the flash, so they are known after a power cycle
+TurnoutStateJournal stateJournal;
+
+// Binary commands of a PC on the USB serial port (tools/turnout_link.py)
+HostLink hostLink;
+
 // Define the two-way turnout with sensors
 // Note: Pin definitions are for the Seeed XIAO RP2040
 // Using D1, D2 for Coils, D3, D4 for Sensors
@@ -46,39 +87,74 @@ xDuinoRails_Turnout turnout3(
 */
 
 // Callback for DCC Accessory Packet
+// Called from within receive_dcc() for every received packet, including all repetitions,
+// so it only queues the command.
 void notifyDccAccTurnoutOutput(uint16_t Addr, uint8_t Direction, uint8_t OutputPower) {
-    Serial.print("DCC Command - Addr: ");
-    Serial.print(Addr);
-    Serial.print(", Dir: ");
-    Serial.print(Direction);
-    Serial.print(", Power: ");
-    Serial.println(OutputPower);
-
-    // Only act on "Output On" commands (OutputPower = 1) if using momentary switches,
-    // but for turnouts, usually the command comes with OutputPower=1.
-    if (OutputPower == 1) {
-        if (Addr == 1) {
-            Serial.print("Switching Turnout 1 to ");
-            Serial.println(Direction ? "Straight (0)" : "Turn (1)");
-            // Note: NMRA direction 0/1 mapping to setPosition 0/1 depends on wiring
-            // Usually 1=Thrown (Turn), 0=Closed (Straight)
-            // But let's assume Direction 1 corresponds to Position 1, Direction 0 to Position 0.
-            // Check library spec: Direction 1 is "Activate", 0 is "Deactivate"?
-            // Actually, for Basic Accessory Decoder Packet:
-            // The least significant bit of the address + the CD bit determines the output.
-            // NmraDcc library abstracts this.
-            // Direction: 1 = "On/Closed/Green", 0 = "Off/Thrown/Red" (standard varies).
-
-            // Let's just map Direction 0 -> Position 0, Direction 1 -> Position 1.
-            turnout1.setPosition(Direction ? 1 : 0);
+    dccCommands.push(Addr, Direction, OutputPower, millis());
+}
+
+#if defined(XDUINORAILS_PIO_DCC)
+// Accessory packets of the PIO receiver take the same path as the ones of NmraDcc
+void on_dcc_accessory(void*, uint16_t address, uint8_t direction, uint8_t outputPower) {
+    notifyDccAccTurnoutOutput(address, direction, outputPower);
+}
+
+// POM writes to this decoder go to NmraDcc's CVs, which calls notifyCVChange() as for its own packets.
+void on_dcc_cv_write(void*, uint16_t address, uint16_t cv, uint8_t value, uint8_t mask) {
+    if (address != Dcc.getAddr()) {
+        return;
+    }
+    uint8_t current = Dcc.getCV(cv);
+    uint8_t updated = (current & ~mask) | (value & mask);
+    if (updated != current) {
+        Dcc.setCV(cv, updated);
+    }
+}
+#endif
+
+// Decodes the received DCC packets
+void receive_dcc() {
+#if defined(XDUINORAILS_PIO_DCC)
+    // The PIO receiver has collected the bits without an interrupt, assemble the packets.
+    uint8_t bits[32];
+    int count;
+    while (pioDccActive && (count = hal_dcc_rx_read(bits, sizeof(bits))) > 0) {
+        for (int i = 0; i < count; i++) {
+            dccDecoder.feed(bits[i]);
         }
     }
+#endif
+    Dcc.process();
 }
 
-void setup() {
-    Serial.begin(115200);
-    Serial.println("xDuinoRails Turnout Example: RP2040 with DCC");
+// Executes one command taken from the queue
+void handle_dcc_command(const DccCommand& command) {
+    eventLog.log(EVENT_DCC_COMMAND, 0, command.address, command.direction | (command.outputPower << 8));
+
+    // Direction 1 (closed) selects position 1, direction 0 (thrown) position 2.
+    dccAddresses.dispatch(command.address, command.direction, command.outputPower, command.timestamp);
+}
+
+#if defined(XDUINORAILS_DUAL_CORE)
+// Inter-core FIFO message from core 0: the base address in the low 16 bits has changed
+const uint32_t FIFO_BASE_ADDRESS = 0x80000000;
+#endif
+
+// Callback for CV changes, e.g. when the decoder address is programmed
+void notifyCVChange(uint16_t CV, uint8_t Value) {
+    if (CV == CV_ACCESSORY_DECODER_ADDRESS_LSB || CV == CV_ACCESSORY_DECODER_ADDRESS_MSB) {
+#if defined(XDUINORAILS_DUAL_CORE)
+        // Runs on core 0, the registry belongs to core 1. A CV write is rare, the FIFO
+        // (8 entries) only fills if core 1 stalls.
+        rp2040.fifo.push(FIFO_BASE_ADDRESS | Dcc.getAddr());
+#else
+        dccAddresses.setBaseAddress(Dcc.getAddr());
+#endif
+    }
+}
 
+// Sets up DCC reception and reads the base address from the CVs
+void setup_dcc() {
     // Configure DCC
     // Setup the DCC Pin with pullup enabled
     Dcc.pin(0, DCC_PIN, 1);
@@ -86,20 +162,192 @@ void setup() {
     // Initialize DCC with Manufacturer ID, Version, Flags, and OpsMode Address
     Dcc.init(MAN_ID_DIY, 10, CV29_ACCESSORY_DECODER | CV29_OUTPUT_ADDRESS_MODE, 0);
 
+#if defined(XDUINORAILS_PIO_DCC)
+    // NmraDcc has attached its edge interrupt in init(), the PIO receiver replaces it.
+    // Without free PIO or DMA hardware the interrupt keeps decoding.
+    dccDecoder.setAccessoryCallback(on_dcc_accessory, nullptr);
+    dccDecoder.setCvWriteCallback(on_dcc_cv_write, nullptr);
+    pioDccActive = hal_dcc_rx_init(DCC_PIN);
+    if (pioDccActive) {
+        detachInterrupt(DCC_PIN);
+    } else {
+        Serial.println("No PIO state machine or DMA channel for the DCC receiver, using the interrupt");
+    }
+#endif
+
     Serial.print("DCC Initialized on Pin ");
     Serial.println(DCC_PIN);
 
-    turnout1.begin();
-    //turnout2.begin();
-    //turnout3.begin();
+    // The turnouts occupy consecutive addresses starting at the decoder address.
+    dccAddresses.setBaseAddress(Dcc.getAddr());
+    Serial.print("DCC Base Address: ");
+    Serial.println(dccAddresses.baseAddress());
+}
+
+// Assigns the turnouts to their addresses and initializes their hardware
+void setup_turnouts() {
+    dccAddresses.assign(0, turnout1);
+    //dccAddresses.assign(1, turnout2); // Claims addresses base+1 and base+2
+    //dccAddresses.assign(3, turnout3);
+
+    // Coil pulses of simultaneously thrown turnouts share the supply current
+    turnouts.setPowerBudget(2000);
+
+    turnouts.add(turnout1);
+    //turnouts.add(turnout2);
+    //turnouts.add(turnout3);
+
+    // Start every turnout at its last confirmed position instead of an unknown one
+    if (!stateJournal.begin(turnouts)) {
+        Serial.println("No flash area for the turnout journal (board_build.filesystem_size)");
+    }
+    turnouts.begin();
+
+    // Restore the pulse timing learned by adaptive BEMF turnouts
+    pulseTimings.begin(turnouts);
+
+    if (!hostLink.begin(turnouts)) {
+        Serial.println("Host link disabled, a turnout id does not fit into 16 bits");
+    }
+}
+
+// Executes all queued DCC commands
+void process_dcc_commands() {
+    DccCommand command;
+    while (dccCommands.pop(command)) {
+        handle_dcc_command(command);
+    }
+}
+
+// Statistics query over USB: 's' prints the counters and histograms, 'r' resets them.
+// 'c' switches the BEMF capture of all BEMF turnouts on and off (tools/bemf_capture.py).
+// Frames of the binary protocol (tools/turnout_link.py) are taken by hostLink.
+void process_serial_commands() {
+    while (Serial.available() > 0) {
+        int command = Serial.read();
+        if (hostLink.feed(command)) {
+            continue;
+        }
+        if (command == 's') {
+            turnouts.printStats(Serial);
+            loopMonitor.print(Serial);
+            Serial.print("log dropped=");
+            Serial.println(eventLog.droppedCount());
+            Serial.print("host frames=");
+            Serial.print(hostLink.frameCount());
+            Serial.print(" errors=");
+            Serial.print(hostLink.errorCount());
+            Serial.print(" dropped=");
+            Serial.println(hostLink.droppedCount());
+#if defined(XDUINORAILS_PIO_DCC)
+            Serial.print("dcc packets=");
+            Serial.print(dccDecoder.packetCount());
+            Serial.print(" checksum_errors=");
+            Serial.print(dccDecoder.checksumErrorCount());
+            Serial.print(" framing_errors=");
+            Serial.print(dccDecoder.framingErrorCount());
+            Serial.print(" overruns=");
+            Serial.println(hal_dcc_rx_get_overrun_count());
+#endif
+        } else if (command == 'r') {
+            turnouts.resetStats();
+            loopMonitor.reset();
+#if defined(XDUINORAILS_PIO_DCC)
+            dccDecoder.resetCounters();
+#endif
+        } else if (command == 'c') {
+            if (bemfCapture.isEnabled()) {
+                bemfCapture.disable();
+                Serial.println("BEMF capture off");
+            } else {
+                bemfCapture.enable();
+                Serial.println("BEMF capture on");
+            }
+        }
+    }
+}
+
+#if defined(XDUINORAILS_DUAL_CORE)
+// Dual-core mode: core 0 only decodes DCC and queues the commands, core 1 runs the
+// turnout state machines and owns the BEMF interrupts (they are attached on the core
+// that calls begin()). The commands cross over through the lock-free DccCommandQueue,
+// so a slow serial write or a burst of BEMF interrupts cannot delay DCC decoding.
+
+// Sent through the inter-core FIFO once core 0 has read the CVs
+const uint32_t CORE0_READY = 1;
+
+void setup() {
+    Serial.begin(115200);
+    Serial.println("xDuinoRails Turnout Example: RP2040 with DCC (Dual-Core)");
+
+    setup_dcc();
+    rp2040.fifo.push(CORE0_READY);
 }
 
 void loop() {
+    // Core 0: DCC reception only
+    receive_dcc();
+}
+
+void setup1() {
+    // Wait until core 0 has set up DCC and the base address.
+    rp2040.fifo.pop();
+    setup_turnouts();
+}
+
+void loop1() {
+    loopMonitor.tick();
+
+    // Base address changes programmed while core 0 received DCC
+    uint32_t message;
+    while (rp2040.fifo.pop_nb(&message)) {
+        if (message & FIFO_BASE_ADDRESS) {
+            dccAddresses.setBaseAddress(message & 0xFFFF);
+        }
+    }
+
+    // Core 1: execute the commands and update the turnouts that are due
+    process_dcc_commands();
+    turnouts.update();
+    pulseTimings.update(turnouts);
+    stateJournal.update(turnouts);
+    hostLink.update(millis());
+
+    // Send the status records when the USB link has room, never waits
+    eventLog.drain(Serial);
+    bemfCapture.drain(Serial);
+    hostLink.drain(Serial);
+    process_serial_commands();
+}
+
+#else
+
+void setup() {
+    Serial.begin(115200);
+    Serial.println("xDuinoRails Turnout Example: RP2040 with DCC");
+
+    setup_dcc();
+    setup_turnouts();
+}
+
+void loop() {
+    loopMonitor.tick();
+
     // Process DCC commands
-    Dcc.process();
+    receive_dcc();
+    process_dcc_commands();
 
-    // Update the state of all turnouts
-    turnout1.update();
-    //turnout2.update();
-    //turnout3.update();
+    // Update the turnouts that are due
+    turnouts.update();
+    pulseTimings.update(turnouts);
+    stateJournal.update(turnouts);
+    hostLink.update(millis());
+
+    // Send the status records when the USB link has room, never waits
+    eventLog.drain(Serial);
+    bemfCapture.drain(Serial);
+    hostLink.drain(Serial);
+    process_serial_commands();
 }
+
+#endif
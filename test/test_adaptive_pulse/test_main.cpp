@@ -0,0 +1,149 @@
+// Adaptive against fixed coil pulse timing on the simulated drive: a light
+// drive settles on shorter pulses and off windows than the fixed 50/150ms,
+// a sluggish drive on one longer pulse instead of two per throw. Every throw
+// reaches its position either way.
+#include <unity.h>
+#include <cstdio>
+#include "turnout_sim.h"
+#include "sim_models.h"
+
+static const int THROWS = 30;
+
+struct Series {
+    uint32_t pulses;            // All throws
+    uint64_t energizedUs;       // All throws
+    unsigned long latencyMs;    // Last throw
+    uint32_t lastPulses;        // Last throw
+    uint64_t lastEnergizedUs;   // Last throw
+    int failed;
+    uint16_t onMs;
+    uint16_t offMs;
+};
+
+static Series throw_series(bool adaptive, const SimCoilParams& params) {
+    TurnoutSim::reset();
+    SimCoilDrive drive(0, 1, params);
+    drive.attachBemf(26, 27);
+    sim_add_device(drive);
+    BEMF_Config config = {0, 1, 26, 27};
+    config.adaptive_pulse = adaptive;
+    BemfTurnout turnout(1, "bemf", BemfCoilMotor(config));
+    TurnoutManager manager;
+    manager.add(turnout);
+    TurnoutSim sim(manager);
+    sim.begin();
+
+    Series series = {};
+    for (int n = 0; n < THROWS; n++) {
+        int position = n % 2 == 0 ? 2 : 1;
+        uint32_t pulses = drive.pulses();
+        uint64_t energized = drive.energizedUs();
+        unsigned long command = millis();
+        turnout.setPosition(position, command);
+        TEST_ASSERT_TRUE(sim.runUntilIdle());
+        series.latencyMs = millis() - command;
+        series.lastPulses = drive.pulses() - pulses;
+        series.lastEnergizedUs = drive.energizedUs() - energized;
+        if (turnout.getPosition() != position || drive.travel() != position - 1) {
+            series.failed++;
+        }
+        sim.run(300);
+    }
+    series.pulses = drive.pulses();
+    series.energizedUs = drive.energizedUs();
+    series.onMs = turnout.getPulseOnMs();
+    series.offMs = turnout.getPulseOffMs();
+    return series;
+}
+
+static void print(const char* name, const Series& s) {
+    printf("%-18s on %3ums off %3ums, last throw: %u pulses %5.1fms on %4lums; total %u pulses %6.1fms on\n", name,
+           s.onMs, s.offMs, (unsigned)s.lastPulses, s.lastEnergizedUs / 1000.0, s.latencyMs, (unsigned)s.pulses,
+           s.energizedUs / 1000.0);
+}
+
+void setUp() {}
+void tearDown() {}
+
+static void test_light_drive_gets_shorter_pulses() {
+    SimCoilParams params; // Crosses in about 20ms, well within the fixed 50ms pulse
+    Series fixed = throw_series(false, params);
+    Series adaptive = throw_series(true, params);
+    print("light, fixed", fixed);
+    print("light, adaptive", adaptive);
+
+    TEST_ASSERT_EQUAL_INT(0, fixed.failed);
+    TEST_ASSERT_EQUAL_INT(0, adaptive.failed);
+    TEST_ASSERT_EQUAL_UINT32(THROWS, fixed.pulses);
+    TEST_ASSERT_EQUAL_UINT32(1, adaptive.lastPulses);
+    TEST_ASSERT_EQUAL_INT(50, fixed.onMs);
+    // The on time has walked down towards the travel time, the off window towards the detection time.
+    TEST_ASSERT_LESS_THAN(50, adaptive.onMs);
+    TEST_ASSERT_LESS_THAN(150, adaptive.offMs);
+    TEST_ASSERT_LESS_THAN(fixed.lastEnergizedUs, adaptive.lastEnergizedUs);
+    TEST_ASSERT_LESS_OR_EQUAL(fixed.latencyMs, adaptive.latencyMs);
+}
+
+static void test_sluggish_drive_gets_longer_pulses() {
+    SimCoilParams params;
+    // Half the travel in a 50ms pulse, the armature is still coasting when the fixed off window ends.
+    params.travel_ms = 150;
+    params.friction_tau_ms = 100;
+    Series fixed = throw_series(false, params);
+    Series adaptive = throw_series(true, params);
+    print("sluggish, fixed", fixed);
+    print("sluggish, adaptive", adaptive);
+
+    TEST_ASSERT_EQUAL_INT(0, fixed.failed);
+    TEST_ASSERT_EQUAL_INT(0, adaptive.failed);
+    TEST_ASSERT_EQUAL_UINT32(2, fixed.lastPulses);
+    // One longer pulse per throw instead of two, with less coil energy and an earlier end
+    TEST_ASSERT_EQUAL_UINT32(1, adaptive.lastPulses);
+    TEST_ASSERT_GREATER_THAN(50, adaptive.onMs);
+    TEST_ASSERT_LESS_THAN(fixed.lastEnergizedUs, adaptive.lastEnergizedUs);
+    TEST_ASSERT_LESS_THAN(fixed.energizedUs, adaptive.energizedUs);
+    TEST_ASSERT_LESS_THAN(fixed.latencyMs, adaptive.latencyMs);
+}
+
+static void test_learned_timing_stays_within_bounds() {
+    SimCoilParams params;
+    params.travel_ms = 3; // Much faster than the shortest pulse
+    Series adaptive = throw_series(true, params);
+    print("fast, adaptive", adaptive);
+    TEST_ASSERT_EQUAL_INT(0, adaptive.failed);
+    TEST_ASSERT_GREATER_OR_EQUAL(10, adaptive.onMs);
+    TEST_ASSERT_GREATER_OR_EQUAL(30, adaptive.offMs);
+}
+
+// A copy takes the configuration only: it has no HAL instance of its own before
+// begin(), so stopping it leaves the pulse of the original alone.
+static void test_copy_does_not_share_the_hal_instance() {
+    TurnoutSim::reset();
+    SimCoilDrive drive(0, 1);
+    drive.attachBemf(26, 27);
+    sim_add_device(drive);
+    BEMF_Config config = {0, 1, 26, 27};
+    BemfTurnout turnout(1, "bemf", BemfCoilMotor(config));
+    TurnoutManager manager;
+    manager.add(turnout);
+    TurnoutSim sim(manager);
+    sim.begin();
+
+    turnout.setPosition(2, millis());
+    sim.run(10);
+    TEST_ASSERT_TRUE(sim_pin_output(1));
+    BemfCoilMotor copy(turnout.motor());
+    copy.stop(turnout);
+    TEST_ASSERT_TRUE(sim_pin_output(1));
+    TEST_ASSERT_TRUE(sim.runUntilIdle());
+    TEST_ASSERT_EQUAL_INT(2, turnout.getPosition());
+}
+
+int main(int, char**) {
+    UNITY_BEGIN();
+    RUN_TEST(test_light_drive_gets_shorter_pulses);
+    RUN_TEST(test_sluggish_drive_gets_longer_pulses);
+    RUN_TEST(test_learned_timing_stays_within_bounds);
+    RUN_TEST(test_copy_does_not_share_the_hal_instance);
+    return UNITY_END();
+}
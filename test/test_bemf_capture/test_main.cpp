@@ -0,0 +1,315 @@
+// BemfCapture on the simulated BEMF drive: the frames of a move decode back
+// to the measurements, replaying them through BemfStallDetector finds the end
+// where the turnout found it, and capturing does not change the move.
+#include <unity.h>
+#include <string>
+#include <vector>
+#include "turnout_sim.h"
+#include "sim_models.h"
+
+// One move decoded from its frames, like Move in tools/bemf_capture.py
+struct Trace {
+    int turnout = -1;
+    int position = 0;
+    int decimation = 0;
+    StallDetectorParams params;
+    std::vector<int> a;
+    std::vector<int> b;
+    std::vector<int> pulseAt;   // Index of the first sample after each pulse
+    int ends = 0;
+    bool reached = false;
+    int samples = 0;            // As counted by the END frame
+    int dropped = 0;
+};
+
+static int u16(const uint8_t* p) {
+    return p[0] | p[1] << 8;
+}
+
+static int i16(const uint8_t* p) {
+    return (int16_t)u16(p);
+}
+
+// Splits `stream` into frames and decodes them; returns the number of bytes that were not frames.
+static int decode(const std::string& stream, std::vector<Trace>& traces) {
+    const uint8_t* data = reinterpret_cast<const uint8_t*>(stream.data());
+    size_t size = stream.size();
+    int other = 0;
+    size_t i = 0;
+    while (i < size) {
+        if (data[i] != BemfCapture::SYNC || i + 5 > size || i + 6 + data[i + 4] > size) {
+            other++;
+            i++;
+            continue;
+        }
+        const uint8_t* frame = data + i;
+        int length = frame[4];
+        uint8_t checksum = 0;
+        for (int k = 1; k < 5 + length; k++) {
+            checksum ^= frame[k];
+        }
+        if (checksum != frame[5 + length]) {
+            other++;
+            i++;
+            continue;
+        }
+        i += 6 + length;
+
+        const uint8_t* payload = frame + 5;
+        if (frame[1] == BEMF_CAPTURE_START) {
+            traces.emplace_back();
+            Trace& trace = traces.back();
+            trace.turnout = u16(frame + 2);
+            trace.position = payload[4];
+            trace.decimation = payload[5];
+            trace.params.type = (StallDetectorType)payload[6];
+            trace.params.threshold = i16(payload + 7);
+            trace.params.stall_count = i16(payload + 9);
+            trace.params.ema_shift = payload[11];
+            trace.params.slope_limit = i16(payload + 12);
+            trace.params.cusum_drift = i16(payload + 14);
+            trace.params.cusum_limit = i16(payload + 16);
+            continue;
+        }
+        TEST_ASSERT_FALSE_MESSAGE(traces.empty(), "frame before the start of a move");
+        Trace& trace = traces.back();
+        TEST_ASSERT_EQUAL_INT(trace.turnout, u16(frame + 2));
+        if (frame[1] == BEMF_CAPTURE_PULSE) {
+            trace.pulseAt.push_back(trace.a.size());
+        } else if (frame[1] == BEMF_CAPTURE_SAMPLES) {
+            TEST_ASSERT_EQUAL_INT((int)trace.a.size(), u16(payload));
+            int a = u16(payload + 2);
+            int b = u16(payload + 4);
+            trace.a.push_back(a);
+            trace.b.push_back(b);
+            for (int k = 6; k < length; k += 2) {
+                a += (int8_t)payload[k];
+                b += (int8_t)payload[k + 1];
+                trace.a.push_back(a);
+                trace.b.push_back(b);
+            }
+        } else if (frame[1] == BEMF_CAPTURE_END) {
+            trace.ends++;
+            trace.reached = payload[4] != 0;
+            trace.samples = u16(payload + 5);
+            trace.dropped = u16(payload + 7);
+        }
+    }
+    return other;
+}
+
+// The value the detector received for sample `i`
+static int differential(const Trace& trace, size_t i) {
+    return trace.a[i] > trace.b[i] ? trace.a[i] - trace.b[i] : trace.b[i] - trace.a[i];
+}
+
+// Index of the first sample at which the detector reports the end, -1 if none
+static int replay(const Trace& trace, const StallDetectorParams& params) {
+    BemfStallDetector detector(params);
+    for (size_t i = 0; i < trace.a.size(); i++) {
+        if (detector.update(differential(trace, i))) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+struct Move {
+    bool reached;
+    uint32_t pulses;
+    unsigned long latencyMs;
+    uint64_t endReachedUs;
+};
+
+// Throws a simulated BEMF turnout to position 2 and back, returns the second move.
+static Move throw_turnout(const SimCoilParams& params, const StallDetectorParams& detector, bool capture,
+                          uint8_t decimation = 1) {
+    TurnoutSim::reset();
+    SimCoilDrive drive(0, 1, params);
+    drive.attachBemf(26, 27);
+    sim_add_device(drive);
+    BEMF_Config config = {0, 1, 26, 27};
+    config.stall_detector = detector.type;
+    config.bemf_threshold = detector.threshold;
+    config.bemf_stall_count = detector.stall_count;
+    BemfTurnout turnout(263, "bemf", BemfCoilMotor(config));  // An id beyond 8 bits
+    TurnoutManager manager;
+    manager.add(turnout);
+    TurnoutSim sim(manager);
+    sim.begin();
+
+    turnout.setPosition(2, millis());
+    TEST_ASSERT_TRUE(sim.runUntilIdle());
+    sim.run(300);
+    if (capture) {
+        bemfCapture.enable(263, decimation);
+    }
+    Serial.output().clear();
+    uint32_t pulses = drive.pulses();
+    unsigned long command = millis();
+    turnout.setPosition(1, command);
+    TEST_ASSERT_TRUE(sim.runUntilIdle());
+    Move move = {turnout.getPosition() == 1, drive.pulses() - pulses, millis() - command, drive.endReachedUs()};
+    bemfCapture.drain(Serial);
+    return move;
+}
+
+void setUp() {}
+void tearDown() {}
+
+static void test_replay_finds_the_recorded_end() {
+    StallDetectorParams detector;
+    Move move = throw_turnout(SimCoilParams(), detector, true);
+    TEST_ASSERT_TRUE(move.reached);
+
+    std::vector<Trace> traces;
+    TEST_ASSERT_EQUAL_INT(0, decode(Serial.output(), traces));
+    TEST_ASSERT_EQUAL_INT(1, (int)traces.size());
+    const Trace& trace = traces[0];
+    TEST_ASSERT_EQUAL_INT(263, trace.turnout);
+    TEST_ASSERT_EQUAL_INT(1, trace.position);
+    TEST_ASSERT_EQUAL_INT(1, trace.ends);
+    TEST_ASSERT_TRUE(trace.reached);
+    TEST_ASSERT_EQUAL_INT(0, trace.dropped);
+    TEST_ASSERT_EQUAL_INT(trace.samples, (int)trace.a.size());
+    TEST_ASSERT_EQUAL_INT((int)move.pulses, (int)trace.pulseAt.size());
+    TEST_ASSERT_EQUAL_INT(detector.threshold, trace.params.threshold);
+    TEST_ASSERT_EQUAL_INT(detector.stall_count, trace.params.stall_count);
+
+    // This drive is at the end before its pulse is over: the detector fires on the first
+    // stall_count + 1 measurements, the last ones the turnout handled. A half that was
+    // already reduced may follow.
+    int end = replay(trace, trace.params);
+    TEST_ASSERT_EQUAL_INT(detector.stall_count, end);
+    TEST_ASSERT_LESS_OR_EQUAL(2, trace.samples - 1 - end);
+}
+
+// Tuning offline: other parameters on the same trace end the move elsewhere.
+static void test_replay_with_other_parameters() {
+    StallDetectorParams detector;
+    throw_turnout(SimCoilParams(), detector, true);
+    std::vector<Trace> traces;
+    decode(Serial.output(), traces);
+    TEST_ASSERT_EQUAL_INT(1, (int)traces.size());
+    int end = replay(traces[0], traces[0].params);
+
+    StallDetectorParams longer = traces[0].params;
+    longer.stall_count += 3;
+    TEST_ASSERT_TRUE(replay(traces[0], longer) < 0 || replay(traces[0], longer) > end);
+    StallDetectorParams shorter = traces[0].params;
+    shorter.stall_count = 1;
+    TEST_ASSERT_LESS_THAN(end, replay(traces[0], shorter));
+    StallDetectorParams ema = traces[0].params;
+    ema.type = STALL_DETECTOR_EMA;
+    TEST_ASSERT_GREATER_OR_EQUAL(0, replay(traces[0], ema));
+}
+
+// A sluggish drive takes two pulses; the markers split the trace into off windows.
+static void test_pulses_mark_the_off_windows() {
+    SimCoilParams params;
+    params.travel_ms = 150;
+    params.friction_tau_ms = 100;
+    StallDetectorParams detector;
+    Move move = throw_turnout(params, detector, true);
+    TEST_ASSERT_TRUE(move.reached);
+    std::vector<Trace> traces;
+    decode(Serial.output(), traces);
+    TEST_ASSERT_EQUAL_INT(1, (int)traces.size());
+    const Trace& trace = traces[0];
+    TEST_ASSERT_EQUAL_INT(2, (int)trace.pulseAt.size());
+    TEST_ASSERT_EQUAL_INT(0, trace.pulseAt[0]);
+    TEST_ASSERT_GREATER_THAN(0, trace.pulseAt[1]);
+    TEST_ASSERT_LESS_THAN((int)trace.a.size(), trace.pulseAt[1]);
+    // The armature coasts through the first off window, the end is found in the second.
+    int end = replay(trace, trace.params);
+    TEST_ASSERT_GREATER_OR_EQUAL(trace.pulseAt[1], end);
+    TEST_ASSERT_LESS_OR_EQUAL(2, trace.samples - 1 - end);
+    int peak = 0;
+    for (int i = 0; i < trace.pulseAt[1]; i++) {
+        peak = differential(trace, i) > peak ? differential(trace, i) : peak;
+    }
+    TEST_ASSERT_GREATER_THAN(10 * detector.threshold, peak);
+}
+
+static void test_decimation_keeps_every_nth_measurement() {
+    StallDetectorParams detector;
+    throw_turnout(SimCoilParams(), detector, true);
+    std::vector<Trace> full;
+    decode(Serial.output(), full);
+    throw_turnout(SimCoilParams(), detector, true, 3);
+    std::vector<Trace> decimated;
+    decode(Serial.output(), decimated);
+    TEST_ASSERT_EQUAL_INT(1, (int)decimated.size());
+    TEST_ASSERT_EQUAL_INT(3, decimated[0].decimation);
+    // The simulation is deterministic, so the moves are the same.
+    TEST_ASSERT_EQUAL_INT(((int)full[0].a.size() + 2) / 3, (int)decimated[0].a.size());
+    for (size_t i = 0; i < decimated[0].a.size(); i++) {
+        TEST_ASSERT_EQUAL_INT(full[0].a[3 * i], decimated[0].a[i]);
+        TEST_ASSERT_EQUAL_INT(full[0].b[3 * i], decimated[0].b[i]);
+    }
+}
+
+static void test_capture_does_not_change_the_move() {
+    StallDetectorParams detector;
+    for (int stallCount : {2, 5, 8}) {
+        detector.stall_count = stallCount;
+        Move plain = throw_turnout(SimCoilParams(), detector, false);
+        TEST_ASSERT_EQUAL_INT(0, (int)Serial.output().size());
+        Move captured = throw_turnout(SimCoilParams(), detector, true);
+        TEST_ASSERT_TRUE(captured.reached);
+        TEST_ASSERT_EQUAL_UINT32(plain.pulses, captured.pulses);
+        TEST_ASSERT_EQUAL_INT((int)plain.latencyMs, (int)captured.latencyMs);
+        TEST_ASSERT_EQUAL_INT((long long)plain.endReachedUs, (long long)captured.endReachedUs);
+    }
+}
+
+// A link that takes nothing: the ring fills, further frames are dropped whole, and
+// what fitted still decodes.
+static void test_congested_link_drops_whole_frames() {
+    TurnoutSim::reset();
+    SimCoilDrive drive(0, 1);
+    drive.attachBemf(26, 27);
+    sim_add_device(drive);
+    BEMF_Config config = {0, 1, 26, 27};
+    BemfTurnout turnout(7, "bemf", BemfCoilMotor(config));
+    TurnoutManager manager;
+    manager.add(turnout);
+    TurnoutSim sim(manager);
+    sim.begin();
+    bemfCapture.enable();
+    Serial.setRoom(0);
+    Serial.output().clear();
+
+    int moves = 0;
+    while (bemfCapture.droppedCount() == 0 && moves < 200) {
+        turnout.setPosition(moves % 2 == 0 ? 2 : 1, millis());
+        TEST_ASSERT_TRUE(sim.runUntilIdle());
+        bemfCapture.drain(Serial);
+        sim.run(300);
+        moves++;
+    }
+    TEST_ASSERT_GREATER_THAN(0, (int)bemfCapture.droppedCount());
+    TEST_ASSERT_EQUAL_INT(0, (int)Serial.output().size());
+
+    Serial.setRoom(4096);
+    bemfCapture.drain(Serial);
+    std::vector<Trace> traces;
+    TEST_ASSERT_EQUAL_INT(0, decode(Serial.output(), traces));
+    TEST_ASSERT_LESS_OR_EQUAL(BEMF_CAPTURE_BUFFER_SIZE, (int)Serial.output().size());
+    TEST_ASSERT_GREATER_THAN(0, (int)traces.size());
+    for (size_t i = 0; i + 1 < traces.size(); i++) {
+        TEST_ASSERT_EQUAL_INT(1, traces[i].ends);
+        TEST_ASSERT_EQUAL_INT(traces[i].samples, (int)traces[i].a.size());
+    }
+}
+
+int main(int, char**) {
+    UNITY_BEGIN();
+    RUN_TEST(test_replay_finds_the_recorded_end);
+    RUN_TEST(test_replay_with_other_parameters);
+    RUN_TEST(test_pulses_mark_the_off_windows);
+    RUN_TEST(test_decimation_keeps_every_nth_measurement);
+    RUN_TEST(test_capture_does_not_change_the_move);
+    RUN_TEST(test_congested_link_drops_whole_frames);
+    return UNITY_END();
+}
@@ -0,0 +1,150 @@
+// hal_bemf_reduce() gives exactly the values of the summation that ran in the
+// DMA interrupt before the reduction moved to hal_motor_service(), and
+// hal_current_reduce() averages its blocks without the first sample.
+// hal_motor_service() delivers the reduction of a half without its first
+// sample, which is not the value of the former reduction of the whole half.
+#include <unity.h>
+#include <cstdlib>
+#include "sim.h"
+#include "motor_control_hal.h"
+
+static const int BEMF_RING_BUFFER_SIZE = 64;
+
+// The arithmetic of the former dma_irq_handler(), unchanged
+static int isr_reduce(const volatile uint16_t* bemf_ring_buffer) {
+    uint32_t sum_A = 0, sum_B = 0;
+    for (unsigned i = 0; i < BEMF_RING_BUFFER_SIZE; i += 2) {
+        sum_B += bemf_ring_buffer[i];
+        sum_A += bemf_ring_buffer[i + 1];
+    }
+    return abs((int)(sum_A / (BEMF_RING_BUFFER_SIZE / 2)) - (int)(sum_B / (BEMF_RING_BUFFER_SIZE / 2)));
+}
+
+static uint32_t seed = 1;
+
+static uint16_t random_sample(uint16_t range) {
+    seed = seed * 1103515245u + 12345u;
+    return (seed >> 16) % range;
+}
+
+void setUp() {
+    sim_reset();
+}
+
+void tearDown() {}
+
+static void test_reduce_matches_isr_on_random_halves() {
+    volatile uint16_t half[BEMF_RING_BUFFER_SIZE];
+    for (int n = 0; n < 10000; n++) {
+        // Full scale, and narrow ranges around mid-scale where the truncation decides
+        uint16_t range = n % 2 == 0 ? 4096 : 8;
+        uint16_t offset = n % 2 == 0 ? 0 : 2044;
+        for (int i = 0; i < BEMF_RING_BUFFER_SIZE; i++) {
+            half[i] = offset + random_sample(range);
+        }
+        TEST_ASSERT_EQUAL_INT(isr_reduce(half), hal_bemf_reduce(half, BEMF_RING_BUFFER_SIZE));
+    }
+}
+
+static void test_reduce_matches_isr_on_edge_cases() {
+    volatile uint16_t half[BEMF_RING_BUFFER_SIZE];
+    const uint16_t a_values[] = {0, 4095, 0, 4095, 2048, 1};
+    const uint16_t b_values[] = {0, 4095, 4095, 0, 2047, 0};
+    for (unsigned n = 0; n < sizeof(a_values) / sizeof(a_values[0]); n++) {
+        for (int i = 0; i < BEMF_RING_BUFFER_SIZE; i += 2) {
+            half[i] = b_values[n];
+            half[i + 1] = a_values[n];
+        }
+        TEST_ASSERT_EQUAL_INT(isr_reduce(half), hal_bemf_reduce(half, BEMF_RING_BUFFER_SIZE));
+    }
+}
+
+static void test_terminals_give_the_difference() {
+    volatile uint16_t half[BEMF_RING_BUFFER_SIZE];
+    for (int n = 0; n < 1000; n++) {
+        for (int i = 0; i < BEMF_RING_BUFFER_SIZE; i++) {
+            half[i] = random_sample(4096);
+        }
+        int avg_a, avg_b;
+        int bemf = hal_bemf_reduce_terminals(half, BEMF_RING_BUFFER_SIZE, &avg_a, &avg_b);
+        TEST_ASSERT_EQUAL_INT(abs(avg_a - avg_b), bemf);
+        // hal_motor_service() leaves out the first sample, the rest reduces like a full half.
+        int inner = hal_bemf_reduce_terminals(half + 1, BEMF_RING_BUFFER_SIZE - 2, &avg_a, &avg_b);
+        TEST_ASSERT_EQUAL_INT(abs(avg_a - avg_b), inner);
+    }
+}
+
+static void test_current_reduce_drops_first_sample() {
+    volatile uint16_t half[BEMF_RING_BUFFER_SIZE];
+    for (int i = 0; i < BEMF_RING_BUFFER_SIZE; i++) {
+        half[i] = 100 + i / 8 * 10;
+    }
+    // Converted on the inputs of the previous instance
+    half[0] = 4095;
+    int values[BEMF_RING_BUFFER_SIZE / 8];
+    TEST_ASSERT_EQUAL_INT(8, hal_current_reduce(half, BEMF_RING_BUFFER_SIZE, 8, values));
+    for (int i = 0; i < 8; i++) {
+        TEST_ASSERT_EQUAL_INT(100 + i * 10, values[i]);
+    }
+}
+
+// Noise on both BEMF inputs, new values for every conversion
+class NoisyInputs : public SimDevice {
+public:
+    void step(uint64_t) override {
+        sim_pin_analog(26, 2000 + random_sample(200));
+        sim_pin_analog(27, 1700 + random_sample(200));
+    }
+};
+
+struct Delivered {
+    hal_motor_t* motor;
+    int count;
+    int differs_from_isr;
+};
+
+static void check_delivered(void* context, int value) {
+    Delivered* delivered = static_cast<Delivered*>(context);
+    volatile uint16_t* buffer;
+    int position;
+    hal_motor_get_bemf_buffer(delivered->motor, &buffer, &position);
+    // The channel that is not writing has just completed this half.
+    volatile uint16_t* half = position >= BEMF_RING_BUFFER_SIZE ? buffer : buffer + BEMF_RING_BUFFER_SIZE;
+    int avg_a, avg_b;
+    TEST_ASSERT_EQUAL_INT(hal_bemf_reduce_terminals(half + 1, BEMF_RING_BUFFER_SIZE - 2, &avg_a, &avg_b), value);
+    int last_a, last_b;
+    hal_motor_get_last_terminals(delivered->motor, &last_a, &last_b);
+    TEST_ASSERT_EQUAL_INT(avg_a, last_a);
+    TEST_ASSERT_EQUAL_INT(avg_b, last_b);
+    // The samples alternate A, B from the start of the half.
+    TEST_ASSERT_TRUE(half[0] >= 2000 && half[2] >= 2000 && half[62] >= 2000);
+    delivered->count++;
+    delivered->differs_from_isr += value != isr_reduce(half);
+}
+
+static void test_service_reduces_the_half_without_its_first_sample() {
+    NoisyInputs inputs;
+    inputs.step(0);
+    sim_add_device(inputs);
+    Delivered delivered = {};
+    delivered.motor = hal_motor_init(0, 1, 26, 27, check_delivered, &delivered);
+    hal_motor_arm_bemf(delivered.motor);
+    for (int ms = 0; ms < 500; ms++) {
+        sim_advance_us(1000);
+        hal_motor_service();
+    }
+    TEST_ASSERT_GREATER_OR_EQUAL(190, delivered.count);
+    // 31 instead of 32 samples per terminal: a different value for most halves
+    TEST_ASSERT_GREATER_THAN(delivered.count / 2, delivered.differs_from_isr);
+    TEST_ASSERT_EQUAL_INT(0, (int)hal_motor_get_overrun_count());
+}
+
+int main(int, char**) {
+    UNITY_BEGIN();
+    RUN_TEST(test_reduce_matches_isr_on_random_halves);
+    RUN_TEST(test_reduce_matches_isr_on_edge_cases);
+    RUN_TEST(test_terminals_give_the_difference);
+    RUN_TEST(test_current_reduce_drops_first_sample);
+    RUN_TEST(test_service_reduces_the_half_without_its_first_sample);
+    return UNITY_END();
+}
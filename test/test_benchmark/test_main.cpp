@@ -0,0 +1,334 @@
+// Benchmarks of the turnouts on the native simulation: the cost of
+// TurnoutManager::update() per turnout, the latency from a command to the
+// detected end of travel and the coil pulses per throw, for every motor type
+// and several turnout counts. All turnouts of a row are thrown at once, like
+// a route. A second table compares the loop cost of calling update() on every
+// turnout, as the sketch did before the TurnoutManager, with the manager for
+// 1 to 128 turnouts. Run with `pio test -e native_benchmark -v` to see the
+// tables; the native environment keeps TURNOUT_MANAGER_CAPACITY at 32 and
+// leaves the larger counts of the manager column empty.
+#include <unity.h>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <vector>
+#include "turnout_sim.h"
+#include "sim_models.h"
+
+static const int THROWS = 4;      // Per turnout, alternating between the positions
+static const int COUNTS[] = {1, 2, 4, 6};
+static const int MAX_TURNOUTS = 6;
+// Turnout counts of the loop cost sweep
+static const int SWEEP[] = {1, 2, 4, 8, 16, 32, 64, 128};
+static const unsigned long SWEEP_THROW_MS = 500;  // Loop time per throw, moving and idle
+static const uint32_t SWEEP_LOOP_US = 100;
+
+// Pins of turnout i: coils (or servo) on 2i/2i+1, end switches on 12+2i/13+2i,
+// ADC inputs 26..29. Every motor and servo has a PWM slice of its own.
+static uint8_t coilPin(int i, int coil) { return 2 * i + coil - 1; }
+static uint8_t switchPin(int i, int position) { return 12 + 2 * i + position - 1; }
+
+// One turnout with the models of its hardware
+struct Rig {
+    std::shared_ptr<TurnoutBase> turnout;
+    std::vector<std::shared_ptr<SimDevice>> models;
+    const SimActuator* actuator = nullptr;
+    const SimCoilDrive* coil = nullptr;     // nullptr for servos
+    unsigned long settledMs = 0;
+};
+
+struct MotorKind {
+    const char* name;
+    int capacity;                           // Turnouts the board's pins allow
+    bool coil;                              // Coil drive, pulses and end stop are measured
+    void (*build)(Rig& rig, int i);
+};
+
+static void on_settled(void* context) {
+    static_cast<Rig*>(context)->settledMs = millis();
+}
+
+static std::shared_ptr<SimCoilDrive> coilModel(Rig& rig, int i) {
+    auto drive = std::make_shared<SimCoilDrive>(coilPin(i, 1), coilPin(i, 2));
+    rig.models.push_back(drive);
+    rig.actuator = drive.get();
+    rig.coil = drive.get();
+    return drive;
+}
+
+static void endSwitchModel(Rig& rig, int i) {
+    rig.models.push_back(std::make_shared<SimEndSwitches>(switchPin(i, 1), switchPin(i, 2), *rig.actuator));
+}
+
+static std::shared_ptr<SimServo> servoModel(Rig& rig, int i) {
+    auto servo = std::make_shared<SimServo>(coilPin(i, 1));
+    rig.models.push_back(servo);
+    rig.actuator = servo.get();
+    return servo;
+}
+
+static const MotorKind KINDS[] = {
+    {"coil", MAX_TURNOUTS, true, [](Rig& rig, int i) {
+        coilModel(rig, i);
+        endSwitchModel(rig, i);
+        rig.turnout = std::make_shared<CoilTurnout>(i + 1, "coil", CoilMotor(coilPin(i, 1), coilPin(i, 2)),
+                                                    EndSwitches(switchPin(i, 1), switchPin(i, 2)));
+    }},
+    {"pio coil", MAX_TURNOUTS, true, [](Rig& rig, int i) {
+        coilModel(rig, i);
+        endSwitchModel(rig, i);
+        rig.turnout = std::make_shared<PioCoilTurnout>(i + 1, "pio coil", PioCoilMotor(coilPin(i, 1), coilPin(i, 2)),
+                                                       EndSwitches(switchPin(i, 1), switchPin(i, 2)));
+    }},
+    // Two BEMF inputs per drive, the four ADC inputs allow two
+    {"bemf coil", 2, true, [](Rig& rig, int i) {
+        coilModel(rig, i)->attachBemf(26 + 2 * i, 27 + 2 * i);
+        BEMF_Config config = {coilPin(i, 1), coilPin(i, 2), 26 + 2 * i, 27 + 2 * i};
+        rig.turnout = std::make_shared<BemfTurnout>(i + 1, "bemf coil", BemfCoilMotor(config));
+    }},
+    // One shunt input per drive
+    {"current coil", 4, true, [](Rig& rig, int i) {
+        coilModel(rig, i)->attachShunt(26 + i);
+        rig.turnout = std::make_shared<CurrentSenseCoilTurnout>(
+            i + 1, "current coil", CurrentSenseCoilMotor(coilPin(i, 1), coilPin(i, 2), 26 + i));
+    }},
+    {"servo", MAX_TURNOUTS, false, [](Rig& rig, int i) {
+        servoModel(rig, i);
+        endSwitchModel(rig, i);
+        rig.turnout = std::make_shared<ServoTurnout>(i + 1, "servo", ServoMotor(coilPin(i, 1)),
+                                                     EndSwitches(switchPin(i, 1), switchPin(i, 2)));
+    }},
+    {"pio servo", MAX_TURNOUTS, false, [](Rig& rig, int i) {
+        servoModel(rig, i);
+        endSwitchModel(rig, i);
+        rig.turnout = std::make_shared<PioServoTurnout>(i + 1, "pio servo", PioServoMotor(coilPin(i, 1)),
+                                                        EndSwitches(switchPin(i, 1), switchPin(i, 2)));
+    }},
+};
+
+struct Result {
+    double updateNsPerTurnout;  // While the turnouts move
+    double idleNs;              // Per update() with all turnouts idle
+    double latencyMs;           // Command to detected end of travel, average
+    unsigned long maxLatencyMs;
+    double detectDelayMs;       // Armature at the end stop to detection, negative for end switches
+                                // that close just before it
+    double pulsesPerThrow;
+    int timeouts;
+};
+
+static Result run(const MotorKind& kind, int count) {
+    TurnoutSim::reset();
+    std::vector<Rig> rigs(count);
+    TurnoutManager manager;
+    TurnoutSim sim(manager);
+    for (int i = 0; i < count; i++) {
+        kind.build(rigs[i], i);
+        for (auto& model : rigs[i].models) {
+            sim_add_device(*model);
+        }
+        rigs[i].turnout->setSettledCallback(on_settled, &rigs[i]);
+        manager.add(*rigs[i].turnout);
+    }
+    sim.begin();
+
+    Result result = {};
+    uint64_t movingNs = 0;
+    uint32_t movingLoops = 0;
+    double latencySum = 0;
+    double detectSum = 0;
+    int detectCount = 0;
+    uint32_t pulses = 0;
+    for (int n = 0; n < THROWS; n++) {
+        int position = n % 2 == 0 ? 2 : 1;
+        unsigned long command = millis();
+        for (Rig& rig : rigs) {
+            rig.settledMs = 0;
+            rig.turnout->setPosition(position, command);
+        }
+        uint32_t pulsesBefore = 0;
+        for (Rig& rig : rigs) {
+            pulsesBefore += rig.coil ? rig.coil->pulses() : 0;
+        }
+        sim.resetCounters();
+        TEST_ASSERT_TRUE_MESSAGE(sim.runUntilIdle(), kind.name);
+        movingNs += sim.updateNs();
+        movingLoops += sim.loops();
+
+        for (Rig& rig : rigs) {
+            unsigned long latency = rig.settledMs - command;
+            latencySum += latency;
+            if (latency > result.maxLatencyMs) {
+                result.maxLatencyMs = latency;
+            }
+            if (rig.turnout->hasTimedOut() || rig.turnout->getPosition() != position) {
+                result.timeouts++;
+            }
+            if (rig.coil) {
+                pulses += rig.coil->pulses();
+                detectSum += rig.settledMs - rig.coil->endReachedUs() / 1000.0;
+                detectCount++;
+            }
+        }
+        pulses -= pulsesBefore;
+        // Lets the armatures come to rest before the next throw.
+        sim.run(100);
+    }
+
+    sim.resetCounters();
+    sim.run(100);
+    result.idleNs = (double)sim.updateNs() / sim.loops();
+    result.updateNsPerTurnout = (double)movingNs / movingLoops / count;
+    result.latencyMs = latencySum / (THROWS * count);
+    result.detectDelayMs = detectCount ? detectSum / detectCount : 0;
+    result.pulsesPerThrow = (double)pulses / (THROWS * count);
+    return result;
+}
+
+// Loop cost of one board of the sweep in ns per loop
+struct LoopCost {
+    double ns;
+    int failed;                 // Throws that did not reach their position
+};
+
+// Turnout 0 is a coil turnout with its models that is thrown back and forth, the
+// others are idle coil turnouts at a restored position. They share their pins,
+// never pulse, and their end switches stay open.
+struct SweepBoard {
+    Rig rig;
+    std::vector<std::shared_ptr<TurnoutBase>> idle;
+
+    explicit SweepBoard(int count) {
+        TurnoutSim::reset();
+        KINDS[0].build(rig, 0);
+        for (auto& model : rig.models) {
+            sim_add_device(*model);
+        }
+        for (int i = 1; i < count; i++) {
+            idle.push_back(std::make_shared<CoilTurnout>(i + 1, "idle", CoilMotor(24, 25), EndSwitches(26, 27)));
+            idle.back()->restorePosition(1);
+        }
+    }
+
+    TurnoutBase& turnout(int i) { return i == 0 ? *rig.turnout : *idle[i - 1]; }
+};
+
+// The loop of the sketch before the TurnoutManager: update() on every turnout.
+static LoopCost run_polled(int count) {
+    SweepBoard board(count);
+    sim_advance_us(SIM_STEP_US);
+    for (int i = 0; i < count; i++) {
+        board.turnout(i).begin();
+    }
+    LoopCost cost = {};
+    uint64_t ns = 0;
+    uint32_t loops = 0;
+    for (int n = 0; n < THROWS; n++) {
+        int position = n % 2 == 0 ? 2 : 1;
+        board.turnout(0).setPosition(position, millis());
+        uint64_t end = sim_time_us() + SWEEP_THROW_MS * 1000;
+        while (sim_time_us() < end) {
+            sim_advance_us(SWEEP_LOOP_US);
+            auto start = std::chrono::steady_clock::now();
+            for (int i = 0; i < count; i++) {
+                board.turnout(i).update();
+            }
+            ns += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+            loops++;
+        }
+        if (board.turnout(0).getPosition() != position || board.turnout(0).hasTimedOut()) {
+            cost.failed++;
+        }
+    }
+    cost.ns = (double)ns / loops;
+    return cost;
+}
+
+// The same board and throws behind TurnoutManager::update().
+static LoopCost run_managed(int count) {
+    SweepBoard board(count);
+    TurnoutManager manager;
+    for (int i = 0; i < count; i++) {
+        manager.add(board.turnout(i));
+    }
+    TurnoutSim sim(manager, SWEEP_LOOP_US);
+    sim.begin();
+    LoopCost cost = {};
+    for (int n = 0; n < THROWS; n++) {
+        int position = n % 2 == 0 ? 2 : 1;
+        board.turnout(0).setPosition(position, millis());
+        sim.run(SWEEP_THROW_MS);
+        if (board.turnout(0).getPosition() != position || board.turnout(0).hasTimedOut()) {
+            cost.failed++;
+        }
+    }
+    cost.ns = (double)sim.updateNs() / sim.loops();
+    return cost;
+}
+
+void setUp() {}
+void tearDown() {}
+
+static void test_benchmark_all_motor_types() {
+    printf("\n%-13s %2s %12s %9s %12s %11s %12s %8s\n", "motor", "n", "update_ns/t", "idle_ns", "latency_ms",
+           "max_lat_ms", "detect_ms", "pulses");
+    for (const MotorKind& kind : KINDS) {
+        for (int count : COUNTS) {
+            if (count > kind.capacity) {
+                continue;
+            }
+            Result r = run(kind, count);
+            printf("%-13s %2d %12.0f %9.0f %12.1f %11lu", kind.name, count, r.updateNsPerTurnout, r.idleNs,
+                   r.latencyMs, r.maxLatencyMs);
+            if (kind.coil) {
+                printf(" %12.1f %8.2f\n", r.detectDelayMs, r.pulsesPerThrow);
+            } else {
+                printf(" %12s %8s\n", "-", "-");
+            }
+            TEST_ASSERT_EQUAL_INT_MESSAGE(0, r.timeouts, kind.name);
+        }
+    }
+}
+
+// Every coil throw takes at least one pulse, a turnout that moves freely needs exactly one.
+static void test_coil_throw_takes_one_pulse() {
+    for (const MotorKind& kind : KINDS) {
+        if (!kind.coil) {
+            continue;
+        }
+        Result r = run(kind, 1);
+        TEST_ASSERT_EQUAL_INT_MESSAGE(0, r.timeouts, kind.name);
+        TEST_ASSERT_TRUE_MESSAGE(r.pulsesPerThrow >= 1.0 && r.pulsesPerThrow < 1.01, kind.name);
+    }
+}
+
+// One turnout moves, the others idle: the polled loop grows with every turnout,
+// the manager only pays for the one that moves.
+static void test_loop_cost_versus_turnout_count() {
+    printf("\n%4s %16s %17s\n", "n", "polled_ns/loop", "manager_ns/loop");
+    LoopCost largest[2] = {};
+    for (int count : SWEEP) {
+        LoopCost polled = run_polled(count);
+        TEST_ASSERT_EQUAL_INT_MESSAGE(0, polled.failed, "polled");
+        printf("%4d %16.0f", count, polled.ns);
+        if (count > TURNOUT_MANAGER_CAPACITY) {
+            printf(" %17s\n", "-");
+            continue;
+        }
+        LoopCost managed = run_managed(count);
+        TEST_ASSERT_EQUAL_INT_MESSAGE(0, managed.failed, "managed");
+        printf(" %17.0f\n", managed.ns);
+        largest[0] = polled;
+        largest[1] = managed;
+    }
+    // At the largest count the manager takes, the idle turnouts dominate the polled loop.
+    TEST_ASSERT_TRUE(largest[1].ns < largest[0].ns);
+}
+
+int main(int, char**) {
+    UNITY_BEGIN();
+    RUN_TEST(test_coil_throw_takes_one_pulse);
+    RUN_TEST(test_benchmark_all_motor_types);
+    RUN_TEST(test_loop_cost_versus_turnout_count);
+    return UNITY_END();
+}
@@ -0,0 +1,198 @@
+// Current-sense end detection: CoilCurrentDetector on synthetic pulse currents,
+// and CurrentSenseCoilTurnout on the simulated drive, where the pulse is cut
+// shortly after the armature hits its end stop instead of after the full
+// fixed on time.
+#include <unity.h>
+#include <cmath>
+#include <memory>
+#include <vector>
+#include "turnout_sim.h"
+#include "sim_models.h"
+
+// Current of a pulse in ADC counts per value: L/R rise towards `full`, a dip of
+// `dip` counts while the armature moves from `moveStart` to `moveEnd`, then the
+// rise towards `full` again. Values every 8 samples at 25kHz, 320µs apart.
+static std::vector<int> pulse_current(int full, int moveStart, int moveEnd, int dip, int noise, uint32_t seed) {
+    std::vector<int> values;
+    for (int i = 0; i < 150; i++) {
+        double rise = full * (1 - exp(-i / 8.0));
+        double sag = 0;
+        if (moveStart >= 0 && i >= moveStart) {
+            int t = i < moveEnd ? i - moveStart : moveEnd - moveStart;
+            sag = dip * (1 - exp(-t / 4.0));
+            if (i >= moveEnd) {
+                sag *= exp(-(i - moveEnd) / 5.0);
+            }
+        }
+        seed = seed * 1103515245u + 12345u;
+        int jitter = noise > 0 ? (int)((seed >> 16) % (2 * noise + 1)) - noise : 0;
+        values.push_back((int)(rise - sag) + jitter);
+    }
+    return values;
+}
+
+// Index of the value at which the detector reports the end, -1 if none
+static int detect(CoilCurrentDetector& detector, const std::vector<int>& values) {
+    detector.reset();
+    for (size_t i = 0; i < values.size(); i++) {
+        if (detector.update(values[i])) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void setUp() {}
+void tearDown() {}
+
+static void test_end_is_the_rise_after_the_dip() {
+    CoilCurrentDetector detector;
+    for (int moveEnd = 40; moveEnd <= 100; moveEnd += 10) {
+        for (uint32_t seed = 1; seed <= 20; seed++) {
+            int end = detect(detector, pulse_current(800, 20, moveEnd, 250, 4, seed));
+            TEST_ASSERT_TRUE(detector.moved());
+            // Not before the end stop, and within a few values after it
+            TEST_ASSERT_GREATER_OR_EQUAL(moveEnd, end);
+            TEST_ASSERT_LESS_OR_EQUAL(moveEnd + 8, end);
+        }
+    }
+}
+
+static void test_resting_armature_gives_a_plateau() {
+    CoilCurrentDetector detector;
+    for (uint32_t seed = 1; seed <= 20; seed++) {
+        std::vector<int> values = pulse_current(800, -1, -1, 0, 1, seed);
+        int end = detect(detector, values);
+        TEST_ASSERT_FALSE(detector.moved());
+        // Reported once the current has settled, not on the way up
+        TEST_ASSERT_GREATER_THAN(0, end);
+        TEST_ASSERT_TRUE(values[end] > 780);
+    }
+}
+
+static void test_inrush_is_blanked() {
+    CoilCurrentDetector detector;
+    std::vector<int> values = pulse_current(800, 20, 60, 250, 0, 1);
+    // Driver turn-on and the ADC hand-over: a spike, then nothing
+    values[0] = 4095;
+    values[1] = 0;
+    values[2] = 4095;
+    TEST_ASSERT_EQUAL_INT(detect(detector, pulse_current(800, 20, 60, 250, 0, 1)), detect(detector, values));
+}
+
+// A slow armature pulls the current down by less than `flat` per value; that is motion,
+// not a plateau, and the end is its rise.
+static void test_slow_decline_is_no_plateau() {
+    CoilCurrentDetector detector;
+    std::vector<int> values = pulse_current(800, 10, 80, 80, 0, 1);
+    for (size_t i = 10; i < 80; i++) {
+        values[i] = values[i - 1] + (i < 15 ? 1 : -1);
+    }
+    int end = detect(detector, values);
+    TEST_ASSERT_TRUE(detector.moved());
+    TEST_ASSERT_GREATER_OR_EQUAL(80, end);
+}
+
+static void test_small_dip_is_not_motion() {
+    CoilCurrentDetector detector;
+    // A wobble of less than `dip` counts on the way up does not count as motion.
+    int end = detect(detector, pulse_current(800, 10, 20, detector.params().dip / 2, 0, 1));
+    TEST_ASSERT_FALSE(detector.moved());
+    TEST_ASSERT_GREATER_THAN(20, end);
+}
+
+struct Throw {
+    bool reached;
+    uint32_t pulses;
+    uint64_t energizedUs;
+    int64_t cutAfterEndUs;    // Coil off after the armature hit the end stop
+};
+
+// Throws the first of `count` current-sense turnouts, the others move at the same time.
+// `resting`: the armatures already rest at position 2.
+static Throw throw_turnouts(const SimCoilParams& params, int count, bool resting = false) {
+    TurnoutSim::reset();
+    std::vector<std::unique_ptr<SimCoilDrive>> drives;
+    std::vector<std::unique_ptr<CurrentSenseCoilTurnout>> turnouts;
+    TurnoutManager manager;
+    for (int i = 0; i < count; i++) {
+        drives.emplace_back(new SimCoilDrive(2 * i, 2 * i + 1, params));
+        drives.back()->attachShunt(26 + i);
+        drives.back()->place(resting ? 1 : 0);
+        sim_add_device(*drives.back());
+        turnouts.emplace_back(
+            new CurrentSenseCoilTurnout(i + 1, "current", CurrentSenseCoilMotor(2 * i, 2 * i + 1, 26 + i)));
+        manager.add(*turnouts.back());
+    }
+    TurnoutSim sim(manager);
+    sim.begin();
+
+    for (auto& turnout : turnouts) {
+        turnout->setPosition(2, millis());
+    }
+    while (drives[0]->pulses() == 0) {
+        sim.loop();
+    }
+    uint64_t pulseStart = sim_time_us();
+    TEST_ASSERT_TRUE(sim.runUntilIdle());
+    Throw result = {true, drives[0]->pulses(), drives[0]->energizedUs(), 0};
+    for (int i = 0; i < count; i++) {
+        result.reached = result.reached && turnouts[i]->getPosition() == 2 && drives[i]->travel() == 1;
+    }
+    // Within a loop period of the pulse start and end
+    result.cutAfterEndUs = (int64_t)(pulseStart + drives[0]->energizedUs()) - (int64_t)drives[0]->endReachedUs();
+    return result;
+}
+
+static void test_pulse_is_cut_at_the_end_stop() {
+    SimCoilParams params;
+    Throw result = throw_turnouts(params, 1);
+    TEST_ASSERT_TRUE(result.reached);
+    TEST_ASSERT_EQUAL_UINT32(1, result.pulses);
+    // A fixed pulse is on for 50ms; this one ends a few ms after the end stop.
+    TEST_ASSERT_GREATER_THAN(0, (long long)result.cutAfterEndUs);
+    TEST_ASSERT_LESS_THAN(5000, (long long)result.cutAfterEndUs);
+}
+
+static void test_drives_of_different_speed() {
+    // Up to a travel of nearly the whole fixed pulse
+    for (double travelMs : {5.0, 10.0, 20.0, 30.0, 40.0}) {
+        SimCoilParams params;
+        params.travel_ms = travelMs;
+        Throw result = throw_turnouts(params, 1);
+        TEST_ASSERT_TRUE(result.reached);
+        TEST_ASSERT_EQUAL_UINT32(1, result.pulses);
+        TEST_ASSERT_GREATER_THAN(0, (long long)result.cutAfterEndUs);
+        TEST_ASSERT_LESS_THAN(5000, (long long)result.cutAfterEndUs);
+    }
+}
+
+// Without a dip the pulse is cut once the current settles, long before the fixed on time.
+static void test_resting_armature_is_not_pulsed_for_long() {
+    Throw result = throw_turnouts(SimCoilParams(), 1, true);
+    TEST_ASSERT_TRUE(result.reached);
+    TEST_ASSERT_EQUAL_UINT32(1, result.pulses);
+    TEST_ASSERT_LESS_THAN(25000, (long long)result.energizedUs);
+}
+
+// Four turnouts share the ADC round robin, each detector still sees its own pulse.
+static void test_four_turnouts_at_once() {
+    Throw result = throw_turnouts(SimCoilParams(), 4);
+    TEST_ASSERT_TRUE(result.reached);
+    TEST_ASSERT_GREATER_THAN(0, (long long)result.cutAfterEndUs);
+    TEST_ASSERT_LESS_THAN(5000, (long long)result.cutAfterEndUs);
+}
+
+int main(int, char**) {
+    UNITY_BEGIN();
+    RUN_TEST(test_end_is_the_rise_after_the_dip);
+    RUN_TEST(test_resting_armature_gives_a_plateau);
+    RUN_TEST(test_inrush_is_blanked);
+    RUN_TEST(test_slow_decline_is_no_plateau);
+    RUN_TEST(test_small_dip_is_not_motion);
+    RUN_TEST(test_pulse_is_cut_at_the_end_stop);
+    RUN_TEST(test_drives_of_different_speed);
+    RUN_TEST(test_resting_armature_is_not_pulsed_for_long);
+    RUN_TEST(test_four_turnouts_at_once);
+    return UNITY_END();
+}
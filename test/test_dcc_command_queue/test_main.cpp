@@ -0,0 +1,159 @@
+// DccCommandQueue on streams of accessory packets as a command station sends
+// them: repeats are coalesced, conflicting commands are superseded, a full
+// queue drops, and a producer and a consumer thread lose nothing.
+#include <unity.h>
+#include <thread>
+#include "dcc_command_queue.h"
+
+// A command station sends every accessory packet a few times in a row.
+static const int REPEATS = 4;
+static const unsigned long REPEAT_MS = 10;
+
+static void send(DccCommandQueue& queue, uint16_t address, uint8_t direction, unsigned long& now) {
+    for (int i = 0; i < REPEATS; i++) {
+        queue.push(address, direction, 1, now);
+        now += REPEAT_MS;
+    }
+}
+
+void setUp() {}
+void tearDown() {}
+
+static void test_repeats_are_coalesced() {
+    DccCommandQueue queue;
+    unsigned long now = 1000;
+    send(queue, 5, 1, now);
+    send(queue, 6, 0, now);
+
+    DccCommand command;
+    TEST_ASSERT_TRUE(queue.pop(command));
+    TEST_ASSERT_EQUAL_INT(5, command.address);
+    TEST_ASSERT_EQUAL_INT(1, command.direction);
+    TEST_ASSERT_EQUAL_INT(1000, (int)command.timestamp);
+    TEST_ASSERT_TRUE(queue.pop(command));
+    TEST_ASSERT_EQUAL_INT(6, command.address);
+    TEST_ASSERT_FALSE(queue.pop(command));
+    TEST_ASSERT_EQUAL_UINT32(2, queue.enqueuedCount());
+    TEST_ASSERT_EQUAL_UINT32(2 * (REPEATS - 1), queue.coalescedCount());
+}
+
+static void test_steady_repetition_stays_coalesced() {
+    // Some command stations refresh accessory packets forever.
+    DccCommandQueue queue(250);
+    for (unsigned long now = 0; now < 5000; now += 100) {
+        queue.push(7, 1, 1, now);
+    }
+    TEST_ASSERT_EQUAL_UINT32(1, queue.enqueuedCount());
+}
+
+static void test_same_command_after_window_is_new() {
+    DccCommandQueue queue(250);
+    unsigned long now = 0;
+    send(queue, 5, 1, now);
+    now += 300;
+    send(queue, 5, 1, now);
+    TEST_ASSERT_EQUAL_UINT32(2, queue.enqueuedCount());
+}
+
+static void test_new_direction_is_not_coalesced() {
+    DccCommandQueue queue;
+    unsigned long now = 0;
+    send(queue, 5, 1, now);
+    send(queue, 5, 0, now);
+    send(queue, 5, 1, now);
+    TEST_ASSERT_EQUAL_UINT32(3, queue.enqueuedCount());
+
+    // Queued unconsumed, only the last target of the turnout counts.
+    DccCommand command;
+    TEST_ASSERT_TRUE(queue.pop(command));
+    TEST_ASSERT_EQUAL_INT(5, command.address);
+    TEST_ASSERT_EQUAL_INT(1, command.direction);
+    TEST_ASSERT_FALSE(queue.pop(command));
+    TEST_ASSERT_EQUAL_UINT32(2 * (REPEATS - 1) + REPEATS - 1 + 2, queue.coalescedCount());
+}
+
+static void test_activate_and_deactivate_are_kept() {
+    DccCommandQueue queue;
+    queue.push(5, 1, 1, 0);
+    queue.push(5, 1, 0, 10);
+    DccCommand command;
+    TEST_ASSERT_TRUE(queue.pop(command));
+    TEST_ASSERT_EQUAL_INT(1, command.outputPower);
+    TEST_ASSERT_TRUE(queue.pop(command));
+    TEST_ASSERT_EQUAL_INT(0, command.outputPower);
+}
+
+static void test_full_queue_drops() {
+    DccCommandQueue queue;
+    for (int address = 1; address <= DCC_COMMAND_QUEUE_SIZE + 3; address++) {
+        queue.push(address, 1, 1, address);
+    }
+    TEST_ASSERT_EQUAL_UINT32(DCC_COMMAND_QUEUE_SIZE, queue.enqueuedCount());
+    TEST_ASSERT_EQUAL_UINT32(3, queue.droppedCount());
+    DccCommand command;
+    for (int address = 1; address <= DCC_COMMAND_QUEUE_SIZE; address++) {
+        TEST_ASSERT_TRUE(queue.pop(command));
+        TEST_ASSERT_EQUAL_INT(address, command.address);
+    }
+    TEST_ASSERT_FALSE(queue.pop(command));
+}
+
+static void test_route_longer_than_history() {
+    // A route interleaves the repeats of more turnouts than the history holds.
+    DccCommandQueue queue;
+    const int TURNOUTS = DCC_COMMAND_HISTORY_SIZE + 2;
+    DccCommand command;
+    int popped = 0;
+    unsigned long now = 0;
+    for (int repeat = 0; repeat < REPEATS; repeat++) {
+        for (int address = 1; address <= TURNOUTS; address++) {
+            queue.push(address, 1, 1, now++);
+        }
+        while (queue.pop(command)) {
+            popped++;
+        }
+    }
+    // Evicted addresses come back as new commands, but each turnout is commanded at least once.
+    TEST_ASSERT_GREATER_OR_EQUAL(TURNOUTS, popped);
+    TEST_ASSERT_EQUAL_UINT32(0, queue.droppedCount());
+}
+
+static void test_producer_and_consumer_threads() {
+    DccCommandQueue queue(0); // No coalescing, every command must arrive
+    const int COMMANDS = 200000;
+    std::thread producer([&queue]() {
+        for (int i = 0; i < COMMANDS; i++) {
+            // Distinct addresses in a row, so no command supersedes another
+            while (!queue.push(i % 1000 + 1, i & 1, 1, i)) {
+                std::this_thread::yield();
+            }
+        }
+    });
+    int received = 0;
+    unsigned long last = 0;
+    bool ordered = true;
+    DccCommand command;
+    while (received < COMMANDS) {
+        if (queue.pop(command)) {
+            ordered = ordered && (received == 0 || command.timestamp > last);
+            last = command.timestamp;
+            received++;
+        }
+    }
+    producer.join();
+    TEST_ASSERT_TRUE(ordered);
+    TEST_ASSERT_EQUAL_INT(COMMANDS, received);
+}
+
+int main(int, char**) {
+    UNITY_BEGIN();
+    RUN_TEST(test_repeats_are_coalesced);
+    RUN_TEST(test_steady_repetition_stays_coalesced);
+    RUN_TEST(test_same_command_after_window_is_new);
+    RUN_TEST(test_new_direction_is_not_coalesced);
+    RUN_TEST(test_activate_and_deactivate_are_kept);
+    RUN_TEST(test_full_queue_drops);
+    RUN_TEST(test_route_longer_than_history);
+    RUN_TEST(test_producer_and_consumer_threads);
+    return UNITY_END();
+}
@@ -0,0 +1,298 @@
+// DccPacketDecoder on synthetic bit streams: accessory packets over the whole
+// address range, operations mode CV writes, back-to-back packets, and
+// malformed streams (short preambles, bit errors, too long and too short
+// packets, noise) that must be dropped without losing the next packet.
+#include <unity.h>
+#include <vector>
+#include "dcc_packet_decoder.h"
+
+struct Accessory {
+    uint16_t address;
+    uint8_t direction;
+    uint8_t outputPower;
+};
+
+struct CvWrite {
+    uint16_t address;
+    uint16_t cv;
+    uint8_t value;
+    uint8_t mask;
+};
+
+static std::vector<Accessory> accessories;
+static std::vector<CvWrite> cvWrites;
+
+static void on_accessory(void*, uint16_t address, uint8_t direction, uint8_t outputPower) {
+    accessories.push_back({address, direction, outputPower});
+}
+
+static void on_cv_write(void*, uint16_t address, uint16_t cv, uint8_t value, uint8_t mask) {
+    cvWrites.push_back({address, cv, value, mask});
+}
+
+// The bits of a packet with its error detection byte: start bits, bytes, end bit.
+// No preamble, see preamble().
+static std::vector<bool> packet_bits(std::vector<uint8_t> bytes) {
+    uint8_t check = 0;
+    for (uint8_t byte : bytes) {
+        check ^= byte;
+    }
+    bytes.push_back(check);
+    std::vector<bool> bits;
+    for (uint8_t byte : bytes) {
+        bits.push_back(false);
+        for (int i = 7; i >= 0; i--) {
+            bits.push_back((byte >> i) & 1);
+        }
+    }
+    bits.push_back(true);
+    return bits;
+}
+
+static void preamble(DccPacketDecoder& decoder, int ones = 14) {
+    for (int i = 0; i < ones; i++) {
+        decoder.feedBit(true);
+    }
+}
+
+static void feed(DccPacketDecoder& decoder, const std::vector<bool>& bits) {
+    for (bool bit : bits) {
+        decoder.feedBit(bit);
+    }
+}
+
+// Basic accessory packet in output addressing, as NmraDcc counts the outputs
+static std::vector<uint8_t> accessory(int address, int direction, int power = 1) {
+    int board = (address - 1) / 4 + 1;
+    int pair = (address - 1) % 4;
+    return {(uint8_t)(0x80 | (board & 0x3F)),
+            (uint8_t)(0x80 | ((~board >> 6) & 0x07) << 4 | power << 3 | pair << 1 | direction)};
+}
+
+// Operations mode CV access to the accessory output `address`: 1110CCVV VVVVVVVV DDDDDDDD
+static std::vector<uint8_t> cv_access(int address, int command, int cv, uint8_t data) {
+    std::vector<uint8_t> bytes = accessory(address, 0);
+    bytes.push_back(0xE0 | command << 2 | ((cv - 1) >> 8));
+    bytes.push_back((cv - 1) & 0xFF);
+    bytes.push_back(data);
+    return bytes;
+}
+
+static void send(DccPacketDecoder& decoder, const std::vector<uint8_t>& bytes) {
+    preamble(decoder);
+    feed(decoder, packet_bits(bytes));
+}
+
+static DccPacketDecoder make_decoder() {
+    DccPacketDecoder decoder;
+    decoder.setAccessoryCallback(on_accessory, nullptr);
+    decoder.setCvWriteCallback(on_cv_write, nullptr);
+    return decoder;
+}
+
+void setUp() {
+    accessories.clear();
+    cvWrites.clear();
+}
+
+void tearDown() {}
+
+static void test_every_accessory_address() {
+    DccPacketDecoder decoder = make_decoder();
+    for (int address = 1; address <= 2044; address++) {
+        send(decoder, accessory(address, address & 1, (address >> 1) & 1));
+        TEST_ASSERT_EQUAL_INT(address, (int)accessories.size());
+        TEST_ASSERT_EQUAL_INT(address, accessories.back().address);
+        TEST_ASSERT_EQUAL_INT(address & 1, accessories.back().direction);
+        TEST_ASSERT_EQUAL_INT((address >> 1) & 1, accessories.back().outputPower);
+    }
+    TEST_ASSERT_EQUAL_UINT32(2044, decoder.packetCount());
+    TEST_ASSERT_EQUAL_UINT32(0, decoder.checksumErrorCount());
+    TEST_ASSERT_EQUAL_UINT32(0, decoder.framingErrorCount());
+}
+
+static void test_other_packets_are_ignored() {
+    DccPacketDecoder decoder = make_decoder();
+    send(decoder, {0xFF, 0x00});             // Idle
+    send(decoder, {0x03, 0x3F, 0x95});       // Speed to multi-function decoder 3
+    send(decoder, {0xC1, 0x23, 0x3F, 0x10}); // Long address 0x123
+    send(decoder, {0x81, 0x71, 0x05});       // Extended accessory, aspect 5
+    std::vector<uint8_t> board0 = accessory(1, 1);
+    board0[0] &= ~0x3F;                      // Board address 0 has no outputs
+    board0[1] |= 0x70;
+    send(decoder, board0);
+    TEST_ASSERT_EQUAL_UINT32(5, decoder.packetCount());
+    TEST_ASSERT_EQUAL_INT(0, (int)accessories.size());
+    TEST_ASSERT_EQUAL_INT(0, (int)cvWrites.size());
+}
+
+// The end bit of a packet is the first preamble bit of the next one; 10 "1" bits are enough.
+static void test_back_to_back_packets() {
+    DccPacketDecoder decoder = make_decoder();
+    preamble(decoder, 10);
+    for (int address = 1; address <= 20; address++) {
+        feed(decoder, packet_bits(accessory(address, 1)));
+        preamble(decoder, 9);
+    }
+    TEST_ASSERT_EQUAL_INT(20, (int)accessories.size());
+
+    // One "1" bit short, the next packet is not recognized.
+    preamble(decoder, 9);
+    feed(decoder, packet_bits(accessory(30, 1)));
+    preamble(decoder, 8);
+    feed(decoder, packet_bits(accessory(31, 1)));
+    TEST_ASSERT_EQUAL_INT(21, (int)accessories.size());
+    TEST_ASSERT_EQUAL_INT(30, accessories.back().address);
+}
+
+static void test_feed_takes_bits_msb_first() {
+    DccPacketDecoder decoder = make_decoder();
+    std::vector<bool> bits(14, true);
+    std::vector<bool> packet = packet_bits(accessory(77, 1));
+    bits.insert(bits.end(), packet.begin(), packet.end());
+    while (bits.size() % 8 != 0) {
+        bits.push_back(true);
+    }
+    for (size_t i = 0; i < bits.size(); i += 8) {
+        uint8_t byte = 0;
+        for (int k = 0; k < 8; k++) {
+            byte = byte << 1 | bits[i + k];
+        }
+        // Uneven chunks, like the PIO FIFO words and the rest of them
+        decoder.feed(byte >> 3, 5);
+        decoder.feed(byte & 0x07, 3);
+    }
+    TEST_ASSERT_EQUAL_INT(1, (int)accessories.size());
+    TEST_ASSERT_EQUAL_INT(77, accessories[0].address);
+}
+
+// Every single bit error is dropped, and the packet after it gets through. If the
+// error hides the end bit, the following preamble is taken as data and the next
+// packet is only recognized on its repetition, as after noise.
+static void test_single_bit_errors() {
+    std::vector<bool> good = packet_bits(accessory(123, 1));
+    for (size_t flip = 0; flip < good.size(); flip++) {
+        DccPacketDecoder decoder = make_decoder();
+        std::vector<bool> bad = good;
+        bad[flip] = !bad[flip];
+        preamble(decoder);
+        feed(decoder, bad);
+        send(decoder, accessory(124, 0));
+        send(decoder, accessory(124, 0));
+        TEST_ASSERT_EQUAL_UINT32(1, decoder.checksumErrorCount() + decoder.framingErrorCount());
+        TEST_ASSERT_GREATER_OR_EQUAL(1, (int)accessories.size());
+        for (const Accessory& received : accessories) {
+            TEST_ASSERT_EQUAL_INT(124, received.address);
+            TEST_ASSERT_EQUAL_INT(0, received.direction);
+        }
+        accessories.clear();
+    }
+}
+
+static void test_too_long_and_too_short_packets() {
+    DccPacketDecoder decoder = make_decoder();
+    send(decoder, {0x81, 0xF9, 0x00, 0x00, 0x00, 0x00, 0x00}); // 8 bytes with the check
+    TEST_ASSERT_EQUAL_UINT32(1, decoder.framingErrorCount());
+    send(decoder, {0x81});                                     // 2 bytes with the check
+    TEST_ASSERT_EQUAL_UINT32(2, decoder.framingErrorCount());
+    TEST_ASSERT_EQUAL_UINT32(0, decoder.packetCount());
+    send(decoder, accessory(5, 1));
+    TEST_ASSERT_EQUAL_INT(1, (int)accessories.size());
+    TEST_ASSERT_EQUAL_INT(5, accessories[0].address);
+}
+
+// After any noise a packet gets through by its next repetition at the latest.
+static void test_noise_then_packets() {
+    uint32_t seed = 12345;
+    for (int round = 0; round < 200; round++) {
+        DccPacketDecoder decoder = make_decoder();
+        for (int i = 0; i < 1000; i++) {
+            seed = seed * 1103515245u + 12345u;
+            decoder.feedBit((seed >> 16) & 1);
+        }
+        accessories.clear();
+        send(decoder, accessory(500, 1));
+        send(decoder, accessory(500, 1));
+        TEST_ASSERT_GREATER_OR_EQUAL(1, (int)accessories.size());
+        TEST_ASSERT_EQUAL_INT(500, accessories.back().address);
+    }
+}
+
+static void test_pom_write_byte() {
+    DccPacketDecoder decoder = make_decoder();
+    send(decoder, cv_access(1, 0x03, 1, 5));
+    send(decoder, cv_access(2044, 0x03, 1024, 0xA5));
+    TEST_ASSERT_EQUAL_INT(2, (int)cvWrites.size());
+    TEST_ASSERT_EQUAL_INT(1, cvWrites[0].address);
+    TEST_ASSERT_EQUAL_INT(1, cvWrites[0].cv);
+    TEST_ASSERT_EQUAL_INT(5, cvWrites[0].value);
+    TEST_ASSERT_EQUAL_INT(0xFF, cvWrites[0].mask);
+    TEST_ASSERT_EQUAL_INT(2044, cvWrites[1].address);
+    TEST_ASSERT_EQUAL_INT(1024, cvWrites[1].cv);
+    TEST_ASSERT_EQUAL_INT(0xA5, cvWrites[1].value);
+    // Not an accessory command
+    TEST_ASSERT_EQUAL_INT(0, (int)accessories.size());
+}
+
+static void test_pom_bit_write() {
+    DccPacketDecoder decoder = make_decoder();
+    send(decoder, cv_access(9, 0x02, 29, 0xFB)); // Set bit 3
+    send(decoder, cv_access(9, 0x02, 29, 0xF5)); // Clear bit 5
+    send(decoder, cv_access(9, 0x02, 29, 0xEB)); // K = 0: verify bit 3, ignored
+    TEST_ASSERT_EQUAL_INT(2, (int)cvWrites.size());
+    TEST_ASSERT_EQUAL_INT(9, cvWrites[0].address);
+    TEST_ASSERT_EQUAL_INT(29, cvWrites[0].cv);
+    TEST_ASSERT_EQUAL_INT(0x08, cvWrites[0].value);
+    TEST_ASSERT_EQUAL_INT(0x08, cvWrites[0].mask);
+    TEST_ASSERT_EQUAL_INT(0x00, cvWrites[1].value);
+    TEST_ASSERT_EQUAL_INT(0x20, cvWrites[1].mask);
+}
+
+static void test_pom_board_address_and_ignored_forms() {
+    DccPacketDecoder decoder = make_decoder();
+    // C = 0, DDD = 000: the board of outputs 9..12, reported as its first output
+    std::vector<uint8_t> board = cv_access(10, 0x03, 3, 7);
+    board[1] &= ~0x0F;
+    send(decoder, board);
+    TEST_ASSERT_EQUAL_INT(1, (int)cvWrites.size());
+    TEST_ASSERT_EQUAL_INT(9, cvWrites[0].address);
+    TEST_ASSERT_EQUAL_INT(3, cvWrites[0].cv);
+
+    // C = 0 with DDD != 000, verify byte, reserved command, not a CV access
+    std::vector<uint8_t> reserved = board;
+    reserved[1] |= 0x02;
+    send(decoder, reserved);
+    send(decoder, cv_access(10, 0x01, 3, 7));
+    send(decoder, cv_access(10, 0x00, 3, 7));
+    std::vector<uint8_t> other = cv_access(10, 0x03, 3, 7);
+    other[2] |= 0x10; // 1111CCVV
+    send(decoder, other);
+    TEST_ASSERT_EQUAL_INT(1, (int)cvWrites.size());
+    TEST_ASSERT_EQUAL_UINT32(5, decoder.packetCount());
+    TEST_ASSERT_EQUAL_INT(0, (int)accessories.size());
+}
+
+static void test_no_callbacks() {
+    DccPacketDecoder decoder;
+    send(decoder, accessory(5, 1));
+    send(decoder, cv_access(5, 0x03, 1, 5));
+    TEST_ASSERT_EQUAL_UINT32(2, decoder.packetCount());
+    decoder.resetCounters();
+    TEST_ASSERT_EQUAL_UINT32(0, decoder.packetCount());
+}
+
+int main(int, char**) {
+    UNITY_BEGIN();
+    RUN_TEST(test_every_accessory_address);
+    RUN_TEST(test_other_packets_are_ignored);
+    RUN_TEST(test_back_to_back_packets);
+    RUN_TEST(test_feed_takes_bits_msb_first);
+    RUN_TEST(test_single_bit_errors);
+    RUN_TEST(test_too_long_and_too_short_packets);
+    RUN_TEST(test_noise_then_packets);
+    RUN_TEST(test_pom_write_byte);
+    RUN_TEST(test_pom_bit_write);
+    RUN_TEST(test_pom_board_address_and_ignored_forms);
+    RUN_TEST(test_no_callbacks);
+    return UNITY_END();
+}
@@ -0,0 +1,211 @@
+// Debouncing of the end switches: GpioDebouncer's vertical counters against a
+// plain counter per input, glitches and bounces that never make an edge, and
+// SwitchInputs on the simulated pins, alone and with bouncing end switches
+// of moving turnouts.
+#include <unity.h>
+#include <memory>
+#include <vector>
+#include "turnout_sim.h"
+#include "sim_models.h"
+
+static uint32_t seed = 1;
+
+static uint32_t random_bits() {
+    seed = seed * 1103515245u + 12345u;
+    uint32_t high = seed >> 16;
+    seed = seed * 1103515245u + 12345u;
+    return high << 16 | seed >> 16;
+}
+
+void setUp() {}
+void tearDown() {}
+
+// The same debouncing with one counter per input
+static void test_matches_a_counter_per_input() {
+    GpioDebouncer debouncer;
+    uint32_t state = 0;
+    int counts[32] = {};
+    uint32_t raw = 0;
+    for (int sample = 0; sample < 200000; sample++) {
+        // Every input flips with a probability of 1/8, so runs of all lengths occur.
+        uint32_t flips = random_bits() & random_bits() & random_bits();
+        raw ^= flips;
+        uint32_t expected = 0;
+        for (int bit = 0; bit < 32; bit++) {
+            if (((raw ^ state) >> bit) & 1) {
+                if (++counts[bit] == GPIO_DEBOUNCE_SAMPLES) {
+                    state ^= 1u << bit;
+                    expected |= 1u << bit;
+                    counts[bit] = 0;
+                }
+            } else {
+                counts[bit] = 0;
+            }
+        }
+        TEST_ASSERT_EQUAL_HEX32(expected, debouncer.update(raw));
+        TEST_ASSERT_EQUAL_HEX32(state, debouncer.state());
+    }
+}
+
+static void test_glitches_are_ignored() {
+    for (int length = 1; length < GPIO_DEBOUNCE_SAMPLES; length++) {
+        GpioDebouncer debouncer;
+        for (int repeat = 0; repeat < 10; repeat++) {
+            for (int i = 0; i < length; i++) {
+                TEST_ASSERT_EQUAL_HEX32(0, debouncer.update(0xFFFFFFFF));
+            }
+            TEST_ASSERT_EQUAL_HEX32(0, debouncer.update(0));
+        }
+        TEST_ASSERT_EQUAL_HEX32(0, debouncer.state());
+    }
+    // The 4th sample in a row is taken.
+    GpioDebouncer debouncer;
+    for (int i = 0; i < GPIO_DEBOUNCE_SAMPLES - 1; i++) {
+        TEST_ASSERT_EQUAL_HEX32(0, debouncer.update(0x5));
+    }
+    TEST_ASSERT_EQUAL_HEX32(0x5, debouncer.update(0x5));
+    TEST_ASSERT_EQUAL_HEX32(0, debouncer.update(0x5));
+}
+
+static void test_preset_takes_a_level_without_edge() {
+    GpioDebouncer debouncer;
+    debouncer.update(0x3);
+    debouncer.update(0x3);
+    // Counting inputs start over at the preset level.
+    debouncer.preset(0x1, 0x1);
+    TEST_ASSERT_EQUAL_HEX32(0x1, debouncer.state());
+    TEST_ASSERT_EQUAL_HEX32(0x2, debouncer.update(0x3) | debouncer.update(0x3));
+    TEST_ASSERT_EQUAL_HEX32(0x3, debouncer.state());
+    debouncer.preset(0x3, 0x0);
+    for (int i = 0; i < GPIO_DEBOUNCE_SAMPLES - 1; i++) {
+        TEST_ASSERT_EQUAL_HEX32(0, debouncer.update(0x3));
+    }
+}
+
+// A turnout that is only the owner of switch pins
+struct Owner {
+    CoilTurnout turnout;
+    Owner() : turnout(1, "owner", CoilMotor(0, 1), EndSwitches(12, 13)) {}
+};
+
+// Runs the scans up to `ms` from now, one call per 100µs like a busy loop.
+static void scan(unsigned long ms) {
+    for (unsigned long i = 0; i < ms * 10; i++) {
+        sim_advance_us(100);
+        switchInputs.update(millis());
+    }
+}
+
+static void test_level_is_taken_after_four_scans() {
+    TurnoutSim::reset();
+    Owner owner;
+    TEST_ASSERT_TRUE(switchInputs.watch(12, owner.turnout));
+    TEST_ASSERT_FALSE(switchInputs.isLow(12));
+    scan(5);
+
+    sim_pin_input(12, LOW);
+    int scans = 0;
+    while (!switchInputs.isLow(12)) {
+        sim_advance_us(SWITCH_INPUTS_SCAN_MS * 1000);
+        switchInputs.update(millis());
+        scans++;
+    }
+    TEST_ASSERT_EQUAL_INT(GPIO_DEBOUNCE_SAMPLES, scans);
+    TEST_ASSERT_EQUAL_UINT32(1, switchInputs.edgeCount());
+
+    // Calls within the scan interval take no samples.
+    sim_pin_input(12, SIM_OPEN);
+    for (int i = 0; i < 100; i++) {
+        switchInputs.update(millis());
+    }
+    TEST_ASSERT_TRUE(switchInputs.isLow(12));
+    scan(GPIO_DEBOUNCE_SAMPLES + 1);
+    TEST_ASSERT_FALSE(switchInputs.isLow(12));
+    TEST_ASSERT_EQUAL_UINT32(2, switchInputs.edgeCount());
+}
+
+static void test_watch_takes_the_current_level() {
+    TurnoutSim::reset();
+    Owner owner;
+    Owner other;
+    sim_pin_input(13, LOW);
+    TEST_ASSERT_TRUE(switchInputs.watch(13, owner.turnout));
+    TEST_ASSERT_TRUE(switchInputs.isLow(13));
+    scan(10);
+    TEST_ASSERT_EQUAL_UINT32(0, switchInputs.edgeCount());
+    // One owner per pin, no pins beyond the GPIOs
+    TEST_ASSERT_TRUE(switchInputs.watch(13, owner.turnout));
+    TEST_ASSERT_FALSE(switchInputs.watch(13, other.turnout));
+    TEST_ASSERT_FALSE(switchInputs.watch(SwitchInputs::MAX_PINS, owner.turnout));
+    TEST_ASSERT_FALSE(switchInputs.isLow(SwitchInputs::MAX_PINS));
+}
+
+// A contact that bounces for a while gives one edge, after it has settled.
+static void test_bouncing_contact_gives_one_edge() {
+    TurnoutSim::reset();
+    Owner owner;
+    switchInputs.watch(12, owner.turnout);
+    scan(5);
+    for (int bounce = 0; bounce < 200; bounce++) {
+        // Closed for 1..3 scans, open for one
+        sim_pin_input(12, LOW);
+        scan(1 + random_bits() % (GPIO_DEBOUNCE_SAMPLES - 1));
+        sim_pin_input(12, SIM_OPEN);
+        scan(1);
+    }
+    TEST_ASSERT_EQUAL_UINT32(0, switchInputs.edgeCount());
+    sim_pin_input(12, LOW);
+    scan(GPIO_DEBOUNCE_SAMPLES + 1);
+    TEST_ASSERT_TRUE(switchInputs.isLow(12));
+    TEST_ASSERT_EQUAL_UINT32(1, switchInputs.edgeCount());
+}
+
+// Turnouts with bouncing end switches: every throw reaches its position with one edge
+// for the switch that opens and one for the switch that closes.
+static void test_turnouts_with_bouncing_switches() {
+    const int TURNOUTS = 4;
+    const int THROWS = 20;
+    TurnoutSim::reset();
+    std::vector<std::unique_ptr<SimCoilDrive>> drives;
+    std::vector<std::unique_ptr<SimEndSwitches>> switches;
+    std::vector<std::unique_ptr<CoilTurnout>> turnouts;
+    TurnoutManager manager;
+    for (int i = 0; i < TURNOUTS; i++) {
+        drives.emplace_back(new SimCoilDrive(2 * i, 2 * i + 1));
+        switches.emplace_back(new SimEndSwitches(12 + 2 * i, 13 + 2 * i, *drives.back(), 0.02, 3000));
+        sim_add_device(*drives.back());
+        sim_add_device(*switches.back());
+        turnouts.emplace_back(new CoilTurnout(i + 1, "coil", CoilMotor(2 * i, 2 * i + 1),
+                                              EndSwitches(12 + 2 * i, 13 + 2 * i)));
+        manager.add(*turnouts.back());
+    }
+    TurnoutSim sim(manager);
+    sim.begin();
+    uint32_t edges = switchInputs.edgeCount();
+    for (int n = 0; n < THROWS; n++) {
+        int position = n % 2 == 0 ? 2 : 1;
+        for (auto& turnout : turnouts) {
+            turnout->setPosition(position, millis());
+        }
+        TEST_ASSERT_TRUE(sim.runUntilIdle());
+        for (int i = 0; i < TURNOUTS; i++) {
+            TEST_ASSERT_EQUAL_INT(position, turnouts[i]->getPosition());
+            TEST_ASSERT_FALSE(turnouts[i]->hasTimedOut());
+        }
+        sim.run(100);
+    }
+    // The armatures start at the end of position 1, so the first throw opens a switch too.
+    TEST_ASSERT_EQUAL_UINT32(TURNOUTS * 2 * THROWS, switchInputs.edgeCount() - edges);
+}
+
+int main(int, char**) {
+    UNITY_BEGIN();
+    RUN_TEST(test_matches_a_counter_per_input);
+    RUN_TEST(test_glitches_are_ignored);
+    RUN_TEST(test_preset_takes_a_level_without_edge);
+    RUN_TEST(test_level_is_taken_after_four_scans);
+    RUN_TEST(test_watch_takes_the_current_level);
+    RUN_TEST(test_bouncing_contact_gives_one_edge);
+    RUN_TEST(test_turnouts_with_bouncing_switches);
+    return UNITY_END();
+}
@@ -0,0 +1,367 @@
+// Turnouts on GPIO expanders: the Mcp23017 driver and IoPins against fake
+// MCP23017 chips on the simulated I2C bus. A turnout switching any number of
+// coils costs one write per chip and loop, inputs are read once per read
+// interval, and the end switches on the chips are debounced from those reads.
+#include <unity.h>
+#include <memory>
+#include <vector>
+#include "turnout_sim.h"
+#include "io_expander.h"
+
+// MCP23017 registers, IOCON.BANK = 0
+static const uint8_t IODIRA = 0x00;
+static const uint8_t GPPUA = 0x0C;
+static const uint8_t GPIOA = 0x12;
+static const uint8_t OLATA = 0x14;
+static const uint8_t REGISTERS = 0x16;
+
+// An MCP23017 on the bus. Its input pins read the level applied from outside,
+// `external` (open pins: high).
+struct FakeChip {
+    uint8_t address;
+    uint8_t registers[REGISTERS];
+    uint8_t pointer;
+    uint16_t external;
+    uint32_t writes;              // Transactions that wrote registers
+    uint32_t reads;
+    uint32_t outputWrites;        // Writes of the output latches
+    std::vector<uint8_t> written; // First register of every write
+
+    explicit FakeChip(uint8_t address) : address(address), registers(), pointer(0), external(0xFFFF),
+                                         writes(0), reads(0), outputWrites(0) {
+        // Power-on: all pins are inputs.
+        registers[IODIRA] = 0xFF;
+        registers[IODIRA + 1] = 0xFF;
+    }
+
+    uint16_t get(uint8_t reg) const { return registers[reg] | registers[reg + 1] << 8; }
+
+    uint16_t pins() const {
+        uint16_t inputs = get(IODIRA);
+        return (get(OLATA) & ~inputs) | (external & inputs);
+    }
+};
+
+// The bus with its chips. Sequential addressing: the register pointer
+// increments after every byte.
+class FakeBus : public TwoWire {
+public:
+    void attach(FakeChip& chip) { _chips.push_back(&chip); }
+
+    void beginTransmission(uint8_t address) override {
+        _address = address;
+        _tx.clear();
+    }
+
+    uint8_t endTransmission(bool stopBit = true) override {
+        (void)stopBit;
+        FakeChip* chip = find(_address);
+        if (chip == nullptr) {
+            return 2;
+        }
+        if (_tx.empty()) {
+            return 0;
+        }
+        chip->pointer = _tx[0];
+        if (_tx.size() > 1) {
+            chip->writes++;
+            chip->written.push_back(chip->pointer);
+            chip->outputWrites += chip->pointer == OLATA ? 1 : 0;
+        }
+        for (size_t i = 1; i < _tx.size(); i++) {
+            chip->registers[chip->pointer] = _tx[i];
+            chip->pointer = (chip->pointer + 1) % REGISTERS;
+        }
+        return 0;
+    }
+
+    size_t requestFrom(uint8_t address, size_t quantity, bool stopBit = true) override {
+        (void)stopBit;
+        FakeChip* chip = find(address);
+        _rx.clear();
+        _next = 0;
+        if (chip == nullptr) {
+            return 0;
+        }
+        chip->reads++;
+        for (size_t i = 0; i < quantity; i++) {
+            uint8_t reg = chip->pointer;
+            if (reg == GPIOA || reg == GPIOA + 1) {
+                _rx.push_back(chip->pins() >> (reg == GPIOA ? 0 : 8));
+            } else {
+                _rx.push_back(chip->registers[reg]);
+            }
+            chip->pointer = (chip->pointer + 1) % REGISTERS;
+        }
+        return quantity;
+    }
+
+    size_t write(uint8_t value) override {
+        _tx.push_back(value);
+        return 1;
+    }
+    int available() override { return _rx.size() - _next; }
+    int read() override { return _next < _rx.size() ? _rx[_next++] : -1; }
+    int peek() override { return _next < _rx.size() ? _rx[_next] : -1; }
+
+private:
+    FakeChip* find(uint8_t address) {
+        for (FakeChip* chip : _chips) {
+            if (chip->address == address) {
+                return chip;
+            }
+        }
+        return nullptr;
+    }
+
+    std::vector<FakeChip*> _chips;
+    uint8_t _address = 0;
+    std::vector<uint8_t> _tx;
+    std::vector<uint8_t> _rx;
+    size_t _next = 0;
+};
+
+// Armature of a twin-coil drive on chip pins: crosses the travel in 10ms while
+// a coil is on, and closes the end switch of its end, which bounces every ms
+// for the first 3ms.
+class FakeArmature : public SimDevice {
+public:
+    FakeArmature(FakeChip& chip, int coil1, int coil2, int switch1, int switch2)
+        : _chip(chip), _coil1(coil1), _coil2(coil2), _switch1(switch1), _switch2(switch2), _x(0), _closedAt(0),
+          _last(0), _end(1) {
+        apply(0);
+    }
+
+    void step(uint64_t now_us) override {
+        uint16_t pins = _chip.pins() & ~_chip.get(IODIRA);
+        bool on1 = (pins >> _coil1) & 1;
+        bool on2 = (pins >> _coil2) & 1;
+        double dx = (now_us - _last) / 10000.0;
+        _last = now_us;
+        if (on1 != on2) {
+            _x = on2 ? std::min(1.0, _x + dx) : std::max(0.0, _x - dx);
+        }
+        int end = _x <= 0 ? 1 : _x >= 1 ? 2 : 0;
+        if (end != _end) {
+            _end = end;
+            _closedAt = now_us;
+        }
+        apply(now_us);
+    }
+
+    double travel() const { return _x; }
+
+private:
+    void apply(uint64_t now_us) {
+        bool bouncing = now_us - _closedAt < 3000 && (now_us - _closedAt) / 1000 % 2 == 1;
+        uint16_t closed = 0;
+        if (_end != 0 && !bouncing) {
+            closed = 1u << (_end == 1 ? _switch1 : _switch2);
+        }
+        uint16_t both = 1u << _switch1 | 1u << _switch2;
+        _chip.external = (_chip.external & ~both) | (both & ~closed);
+    }
+
+    FakeChip& _chip;
+    int _coil1;
+    int _coil2;
+    int _switch1;
+    int _switch2;
+    double _x;
+    uint64_t _closedAt;
+    uint64_t _last;
+    int _end;  // End stop the armature rests at, 0 while it moves
+};
+
+// Four chips with four turnouts each: coils on port A, end switches on port B.
+struct Board {
+    static const int CHIPS = 4;
+    static const int PER_CHIP = 4;
+
+    FakeBus bus;
+    std::vector<std::unique_ptr<FakeChip>> chips;
+    std::vector<std::unique_ptr<Mcp23017>> drivers;
+    std::vector<std::unique_ptr<FakeArmature>> armatures;
+    std::vector<std::unique_ptr<CoilTurnout>> turnouts;
+    TurnoutManager manager;
+    TurnoutSim sim;
+
+    explicit Board(int chipCount = CHIPS, uint8_t missingAddress = 0) : sim(manager) {
+        TurnoutSim::reset();
+        for (int c = 0; c < chipCount; c++) {
+            uint8_t address = 0x20 + c;
+            chips.emplace_back(new FakeChip(address));
+            if (address != missingAddress) {
+                bus.attach(*chips.back());
+            }
+            drivers.emplace_back(new Mcp23017(address, bus));
+            TEST_ASSERT_EQUAL_INT(c, ioPins.addExpander(*drivers.back()));
+            for (int t = 0; t < PER_CHIP; t++) {
+                armatures.emplace_back(new FakeArmature(*chips.back(), 2 * t, 2 * t + 1, 8 + 2 * t, 9 + 2 * t));
+                sim_add_device(*armatures.back());
+                turnouts.emplace_back(new CoilTurnout(
+                    turnouts.size() + 1, "coil", CoilMotor(expanderPin(c, 2 * t), expanderPin(c, 2 * t + 1)),
+                    EndSwitches(expanderPin(c, 8 + 2 * t), expanderPin(c, 9 + 2 * t))));
+                manager.add(*turnouts.back());
+            }
+        }
+        sim.begin();
+    }
+
+    uint32_t busTransactions() const {
+        uint32_t sum = 0;
+        for (auto& chip : chips) {
+            sum += chip->writes + chip->reads;
+        }
+        return sum;
+    }
+};
+
+void setUp() {}
+void tearDown() {}
+
+static void test_configuration() {
+    Board board;
+    for (auto& chip : board.chips) {
+        // Latches before directions, so an output starts low
+        TEST_ASSERT_EQUAL_INT(3, chip->written.size());
+        TEST_ASSERT_EQUAL_HEX8(OLATA, chip->written[0]);
+        TEST_ASSERT_EQUAL_HEX8(GPPUA, chip->written[1]);
+        TEST_ASSERT_EQUAL_HEX8(IODIRA, chip->written[2]);
+        TEST_ASSERT_EQUAL_HEX16(0xFF00, chip->get(IODIRA));
+        TEST_ASSERT_EQUAL_HEX16(0xFF00, chip->get(GPPUA));
+        TEST_ASSERT_EQUAL_HEX16(0x0000, chip->get(OLATA));
+    }
+    TEST_ASSERT_EQUAL_UINT32(3 * Board::CHIPS, ioPins.transactionCount());
+    TEST_ASSERT_EQUAL_UINT32(0, ioPins.failedCount());
+    // The armatures rest at position 1, the first reads take that over.
+    board.sim.run(50);
+    for (auto& turnout : board.turnouts) {
+        TEST_ASSERT_FALSE(turnout->isMoving());
+    }
+    TEST_ASSERT_EQUAL_UINT32(board.busTransactions(), ioPins.transactionCount());
+}
+
+// All 16 turnouts thrown at once: every loop writes each chip at most once, the
+// coils of a chip switch on together in one write.
+static void test_one_write_per_chip_and_loop() {
+    Board board;
+    board.sim.run(50);
+    for (int n = 0; n < 4; n++) {
+        int position = n % 2 == 0 ? 2 : 1;
+        std::vector<uint32_t> outputWrites;
+        for (auto& chip : board.chips) {
+            outputWrites.push_back(chip->outputWrites);
+        }
+        for (auto& turnout : board.turnouts) {
+            turnout->setPosition(position, millis());
+        }
+        while (board.manager.isBusy()) {
+            std::vector<uint32_t> before;
+            for (auto& chip : board.chips) {
+                before.push_back(chip->writes);
+            }
+            board.sim.loop();
+            for (int c = 0; c < Board::CHIPS; c++) {
+                TEST_ASSERT_LESS_OR_EQUAL(1, board.chips[c]->writes - before[c]);
+                if (board.chips[c]->outputWrites == outputWrites[c] + 1 && board.chips[c]->writes != before[c]) {
+                    // Every turnout of the chip switched its coil on with the first write.
+                    uint16_t coils = position == 1 ? 0x55 : 0xAA;
+                    TEST_ASSERT_EQUAL_HEX16(coils, board.chips[c]->get(OLATA));
+                }
+            }
+            TEST_ASSERT_TRUE(millis() < 10000);
+        }
+        for (int c = 0; c < Board::CHIPS; c++) {
+            // One write for all pulses on and one or a few for them off
+            uint32_t writes = board.chips[c]->outputWrites - outputWrites[c];
+            TEST_ASSERT_GREATER_OR_EQUAL(2, writes);
+            TEST_ASSERT_LESS_OR_EQUAL(1 + Board::PER_CHIP, writes);
+            TEST_ASSERT_EQUAL_HEX16(0, board.chips[c]->get(OLATA));
+        }
+        for (size_t i = 0; i < board.turnouts.size(); i++) {
+            TEST_ASSERT_EQUAL_INT(position, board.turnouts[i]->getPosition());
+            TEST_ASSERT_FALSE(board.turnouts[i]->hasTimedOut());
+            TEST_ASSERT_TRUE(board.armatures[i]->travel() == position - 1);
+        }
+        board.sim.run(50);
+    }
+    TEST_ASSERT_EQUAL_UINT32(board.busTransactions(), ioPins.transactionCount());
+}
+
+// Reads every MCP23017_READ_MS, the chips in different loops
+static void test_reads_on_their_interval() {
+    Board board;
+    board.sim.run(20);
+    std::vector<uint32_t> reads;
+    std::vector<unsigned long> lastRead(Board::CHIPS, 0);
+    for (auto& chip : board.chips) {
+        reads.push_back(chip->reads);
+    }
+    std::vector<uint32_t> start = reads;
+    for (int loop = 0; loop < 10000; loop++) {
+        board.sim.loop();
+        int readers = 0;
+        for (int c = 0; c < Board::CHIPS; c++) {
+            if (board.chips[c]->reads != reads[c]) {
+                TEST_ASSERT_EQUAL_UINT32(reads[c] + 1, board.chips[c]->reads);
+                reads[c] = board.chips[c]->reads;
+                if (lastRead[c] != 0) {
+                    TEST_ASSERT_GREATER_OR_EQUAL(MCP23017_READ_MS, millis() - lastRead[c]);
+                }
+                lastRead[c] = millis();
+                readers++;
+            }
+        }
+        TEST_ASSERT_LESS_OR_EQUAL(1, readers);
+    }
+    // One second: a read per chip every 5ms
+    for (int c = 0; c < Board::CHIPS; c++) {
+        TEST_ASSERT_GREATER_OR_EQUAL(1000 / MCP23017_READ_MS - 1, reads[c] - start[c]);
+    }
+}
+
+// A switch that is open for fewer reads than the debouncing needs gives no edge.
+static void test_switch_glitch_between_reads() {
+    Board board;
+    board.sim.run(50);
+    FakeChip& chip = *board.chips[0];
+    uint32_t edges = switchInputs.edgeCount();
+    for (int glitch = 0; glitch < 20; glitch++) {
+        // The armature applies the closed switch again in its next step.
+        uint32_t reads = chip.reads;
+        while (chip.reads < reads + GPIO_DEBOUNCE_SAMPLES - 1) {
+            board.sim.loop();
+            chip.external |= 1u << 8;
+        }
+        board.sim.run(30);
+    }
+    TEST_ASSERT_EQUAL_UINT32(edges, switchInputs.edgeCount());
+    TEST_ASSERT_TRUE(switchInputs.isLow(expanderPin(0, 8)));
+    TEST_ASSERT_FALSE(board.turnouts[0]->isMoving());
+}
+
+// A chip that does not answer is counted, the turnouts on the other chips still move.
+static void test_missing_chip() {
+    Board board(2, 0x21);
+    TEST_ASSERT_EQUAL_UINT32(1, ioPins.failedCount());
+    board.sim.run(50);
+    for (int t = 0; t < Board::PER_CHIP; t++) {
+        board.turnouts[t]->setPosition(2, millis());
+    }
+    TEST_ASSERT_TRUE(board.sim.runUntilIdle());
+    for (int t = 0; t < Board::PER_CHIP; t++) {
+        TEST_ASSERT_EQUAL_INT(2, board.turnouts[t]->getPosition());
+    }
+    TEST_ASSERT_EQUAL_UINT32(0, board.chips[1]->writes + board.chips[1]->reads);
+}
+
+int main(int, char**) {
+    UNITY_BEGIN();
+    RUN_TEST(test_configuration);
+    RUN_TEST(test_one_write_per_chip_and_loop);
+    RUN_TEST(test_reads_on_their_interval);
+    RUN_TEST(test_switch_glitch_between_reads);
+    RUN_TEST(test_missing_chip);
+    return UNITY_END();
+}
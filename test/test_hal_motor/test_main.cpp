@@ -0,0 +1,228 @@
+// Several motor instances measured at the same time by the motor HAL on the
+// fake ADC and DMA of the simulation: every callback gets the values of its own
+// inputs with its own context, a late DMA interrupt or a late loop never mixes
+// samples of two instances, and the pin checks reject what the board would reject.
+#include <unity.h>
+#include "sim.h"
+#include "motor_control_hal.h"
+#include "servo_pwm_hal.h"
+
+struct Received {
+    int count;
+    int last;
+    int min;
+    int max;
+};
+
+static void on_value(void* context, int value) {
+    Received* received = static_cast<Received*>(context);
+    if (received->count == 0) {
+        received->min = value;
+        received->max = value;
+    }
+    received->last = value;
+    received->min = value < received->min ? value : received->min;
+    received->max = value > received->max ? value : received->max;
+    received->count++;
+}
+
+static void run_ms(unsigned long ms) {
+    for (unsigned long i = 0; i < ms; i++) {
+        sim_advance_us(1000);
+        hal_motor_service();
+    }
+}
+
+void setUp() {
+    sim_reset();
+}
+
+void tearDown() {}
+
+static void test_two_motors_get_their_own_bemf() {
+    Received first = {};
+    Received second = {};
+    hal_motor_t* a = hal_motor_init(0, 1, 26, 27, on_value, &first);
+    hal_motor_t* b = hal_motor_init(2, 3, 28, 29, on_value, &second);
+    TEST_ASSERT_NOT_NULL(a);
+    TEST_ASSERT_NOT_NULL(b);
+    sim_pin_analog(26, 2300);
+    sim_pin_analog(27, 1800);
+    sim_pin_analog(28, 2100);
+    sim_pin_analog(29, 2000);
+
+    hal_motor_arm_bemf(a);
+    hal_motor_arm_bemf(b);
+    run_ms(100);
+
+    // 100ms are about 39 halves, shared by the two instances.
+    TEST_ASSERT_GREATER_OR_EQUAL(15, first.count);
+    TEST_ASSERT_GREATER_OR_EQUAL(15, second.count);
+    TEST_ASSERT_INT_WITHIN(1, first.count, second.count);
+    // The first sample of a half after the hand-over is left out, no value mixes the inputs.
+    TEST_ASSERT_EQUAL_INT(500, first.min);
+    TEST_ASSERT_EQUAL_INT(500, first.max);
+    TEST_ASSERT_EQUAL_INT(100, second.min);
+    TEST_ASSERT_EQUAL_INT(100, second.max);
+
+    int avg_a, avg_b;
+    hal_motor_get_last_terminals(a, &avg_a, &avg_b);
+    TEST_ASSERT_EQUAL_INT(2300, avg_a);
+    TEST_ASSERT_EQUAL_INT(1800, avg_b);
+    hal_motor_get_last_terminals(b, &avg_a, &avg_b);
+    TEST_ASSERT_EQUAL_INT(2100, avg_a);
+    TEST_ASSERT_EQUAL_INT(2000, avg_b);
+}
+
+static void test_disarmed_motor_gets_no_values() {
+    Received first = {};
+    Received second = {};
+    hal_motor_t* a = hal_motor_init(0, 1, 26, 27, on_value, &first);
+    hal_motor_t* b = hal_motor_init(2, 3, 28, 29, on_value, &second);
+    sim_pin_analog(26, 2200);
+    sim_pin_analog(27, 2000);
+    sim_pin_analog(28, 2000);
+    sim_pin_analog(29, 2050);
+
+    hal_motor_arm_bemf(a);
+    hal_motor_arm_bemf(b);
+    run_ms(20);
+    hal_motor_disarm_bemf(b);
+    int secondCount = second.count;
+    run_ms(50);
+
+    // The other instance keeps the ADC to itself: 19 more halves in 50ms.
+    TEST_ASSERT_EQUAL_INT(secondCount, second.count);
+    TEST_ASSERT_GREATER_OR_EQUAL(3 + 19, first.count);
+    TEST_ASSERT_EQUAL_INT(200, first.last);
+
+    // Re-armed, only halves sampled completely after arming are delivered.
+    sim_pin_analog(29, 2300);
+    hal_motor_arm_bemf(b);
+    run_ms(20);
+    TEST_ASSERT_GREATER_THAN(secondCount, second.count);
+    TEST_ASSERT_EQUAL_INT(300, second.last);
+    TEST_ASSERT_EQUAL_INT(0, (int)hal_motor_get_overrun_count());
+}
+
+static void test_motor_and_current_sense_share_the_adc() {
+    Received bemf = {};
+    Received current = {};
+    hal_motor_t* motor = hal_motor_init(0, 1, 26, 27, on_value, &bemf);
+    hal_motor_t* sense = hal_current_sense_init(28, on_value, &current);
+    TEST_ASSERT_NOT_NULL(sense);
+    sim_pin_analog(26, 2400);
+    sim_pin_analog(27, 2000);
+    sim_pin_analog(28, 700);
+
+    hal_motor_arm_bemf(motor);
+    hal_motor_arm_bemf(sense);
+    run_ms(50);
+
+    TEST_ASSERT_EQUAL_INT(400, bemf.min);
+    TEST_ASSERT_EQUAL_INT(400, bemf.max);
+    // Eight values per half of the sense instance, all of the shunt.
+    TEST_ASSERT_GREATER_OR_EQUAL(8 * 8, current.count);
+    TEST_ASSERT_EQUAL_INT(700, current.min);
+    TEST_ASSERT_EQUAL_INT(700, current.max);
+}
+
+// With the DMA interrupt one conversion late, the first sample of a half is still converted on the
+// inputs of the previous instance; the reduction leaves it out.
+static void test_late_interrupt_leaks_into_the_dropped_sample() {
+    Received first = {};
+    Received second = {};
+    hal_motor_t* a = hal_motor_init(0, 1, 26, 27, on_value, &first);
+    hal_motor_t* b = hal_motor_init(2, 3, 28, 29, on_value, &second);
+    sim_pin_analog(26, 2300);
+    sim_pin_analog(27, 1800);
+    sim_pin_analog(28, 2100);
+    sim_pin_analog(29, 2000);
+    sim_set_dma_irq_latency_us(SIM_STEP_US);
+
+    hal_motor_arm_bemf(a);
+    hal_motor_arm_bemf(b);
+    run_ms(100);
+
+    // After the start, instance a always gets the pong half, after a half of b. The round
+    // robin of b has moved on to its input A when the half is complete.
+    volatile uint16_t* buffer;
+    int position;
+    hal_motor_get_bemf_buffer(a, &buffer, &position);
+    TEST_ASSERT_EQUAL_INT(2100, buffer[64]);
+    TEST_ASSERT_EQUAL_INT(1800, buffer[65]);
+    TEST_ASSERT_EQUAL_INT(2300, buffer[66]);
+    TEST_ASSERT_GREATER_OR_EQUAL(15, first.count);
+    TEST_ASSERT_EQUAL_INT(500, first.min);
+    TEST_ASSERT_EQUAL_INT(500, first.max);
+    TEST_ASSERT_EQUAL_INT(100, second.min);
+    TEST_ASSERT_EQUAL_INT(100, second.max);
+    // The round robin went on in phase, A and B are not swapped.
+    int avg_a, avg_b;
+    hal_motor_get_last_terminals(a, &avg_a, &avg_b);
+    TEST_ASSERT_EQUAL_INT(2300, avg_a);
+    TEST_ASSERT_EQUAL_INT(1800, avg_b);
+}
+
+// A loop that is too slow loses the halves the DMA has overwritten and counts them.
+static void test_late_service_counts_overruns() {
+    Received received = {};
+    hal_motor_t* motor = hal_motor_init(0, 1, 26, 27, on_value, &received);
+    sim_pin_analog(26, 2200);
+    sim_pin_analog(27, 2000);
+    hal_motor_arm_bemf(motor);
+
+    // About four halves: the older pending one is being written again.
+    sim_advance_us(4 * 64 * SIM_STEP_US + 100);
+    hal_motor_service();
+    TEST_ASSERT_EQUAL_INT(1, received.count);
+    TEST_ASSERT_EQUAL_INT(1, (int)hal_motor_get_overrun_count());
+    TEST_ASSERT_EQUAL_INT(200, received.last);
+
+    run_ms(50);
+    TEST_ASSERT_EQUAL_INT(1, (int)hal_motor_get_overrun_count());
+    hal_isr_stats_t stats;
+    hal_get_isr_stats(HAL_ISR_DMA, &stats);
+    TEST_ASSERT_GREATER_OR_EQUAL(20, (int)stats.count);
+}
+
+static void test_pin_checks() {
+    Received received = {};
+    // Pins on two slices
+    TEST_ASSERT_NULL(hal_motor_init(1, 2, 26, 27, on_value, &received));
+    // No ADC input
+    TEST_ASSERT_NULL(hal_motor_init(0, 1, 25, 27, on_value, &received));
+    TEST_ASSERT_NULL(hal_current_sense_init(12, on_value, &received));
+    // A slice running for a servo
+    TEST_ASSERT_NOT_NULL(hal_servo_init(4, 1500));
+    TEST_ASSERT_NULL(hal_motor_init(4, 5, 26, 27, on_value, &received));
+
+    TEST_ASSERT_NOT_NULL(hal_motor_init(0, 1, 26, 27, on_value, &received));
+    // The slice is taken
+    TEST_ASSERT_NULL(hal_motor_init(16, 17, 26, 27, on_value, &received));
+    // Slice 7 paces the ADC
+    TEST_ASSERT_NULL(hal_motor_init(14, 15, 26, 27, on_value, &received));
+    TEST_ASSERT_NULL(hal_servo_init(14, 1500));
+    TEST_ASSERT_EQUAL_INT(HAL_BEMF_TRIGGER_HARDWARE, hal_bemf_get_trigger_mode());
+}
+
+// The first motor may take the trigger slice, the ADC start falls back to the alarm then.
+static void test_trigger_slice_falls_back_to_alarm() {
+    Received received = {};
+    TEST_ASSERT_NOT_NULL(hal_motor_init(14, 15, 26, 27, on_value, &received));
+    TEST_ASSERT_EQUAL_INT(HAL_BEMF_TRIGGER_ALARM, hal_bemf_get_trigger_mode());
+    // The alarm mode is paced by a motor slice, a current sense instance has none.
+    TEST_ASSERT_NULL(hal_current_sense_init(28, on_value, &received));
+}
+
+int main(int, char**) {
+    UNITY_BEGIN();
+    RUN_TEST(test_two_motors_get_their_own_bemf);
+    RUN_TEST(test_disarmed_motor_gets_no_values);
+    RUN_TEST(test_motor_and_current_sense_share_the_adc);
+    RUN_TEST(test_late_interrupt_leaks_into_the_dropped_sample);
+    RUN_TEST(test_late_service_counts_overruns);
+    RUN_TEST(test_pin_checks);
+    RUN_TEST(test_trigger_slice_falls_back_to_alarm);
+    return UNITY_END();
+}
@@ -0,0 +1,545 @@
+// The binary host protocol over a pseudo-terminal: HostLink serves simulated
+// coil turnouts on the device side of a pty, the test is the PC on the other
+// side with its own COBS and CRC code. Frames go through the kernel's tty in
+// both directions, in pieces, mixed with text and broken on purpose.
+#include <unity.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+#include "turnout_sim.h"
+#include "sim_models.h"
+#include "host_link.h"
+
+typedef std::vector<uint8_t> Bytes;
+
+// --- The PC side ---
+
+static uint16_t crc16(const Bytes& data) {
+    uint16_t crc = 0xFFFF;
+    for (uint8_t byte : data) {
+        for (int bit = 7; bit >= 0; bit--) {
+            bool top = ((crc >> 15) ^ (byte >> bit)) & 1;
+            crc = top ? (crc << 1) ^ 0x1021 : crc << 1;
+        }
+    }
+    return crc;
+}
+
+static Bytes cobs_encode(const Bytes& data) {
+    Bytes out(1, 0);
+    size_t code = 0;
+    for (uint8_t byte : data) {
+        if (byte != 0) {
+            out.push_back(byte);
+        }
+        if (byte == 0 || out.size() - code == 0xFF) {
+            out[code] = out.size() - code;
+            code = out.size();
+            out.push_back(0);
+        }
+    }
+    out[code] = out.size() - code;
+    return out;
+}
+
+static bool cobs_decode(const Bytes& data, Bytes& out) {
+    out.clear();
+    for (size_t i = 0; i < data.size();) {
+        uint8_t code = data[i++];
+        if (code == 0 || i + code - 1 > data.size()) {
+            return false;
+        }
+        out.insert(out.end(), data.begin() + i, data.begin() + i + code - 1);
+        i += code - 1;
+        if (code != 0xFF && i < data.size()) {
+            out.push_back(0);
+        }
+    }
+    return true;
+}
+
+// A frame on the wire: 0x00, COBS(type, sequence, payload, CRC), 0x00
+static Bytes frame(uint8_t type, uint8_t sequence, const Bytes& payload) {
+    Bytes body = {type, sequence};
+    body.insert(body.end(), payload.begin(), payload.end());
+    uint16_t crc = crc16(body);
+    body.push_back(crc & 0xFF);
+    body.push_back(crc >> 8);
+    Bytes out(1, 0);
+    Bytes encoded = cobs_encode(body);
+    out.insert(out.end(), encoded.begin(), encoded.end());
+    out.push_back(0);
+    return out;
+}
+
+// Appends a turnout id, u16 little endian
+static void put_id(Bytes& payload, int id) {
+    payload.push_back(id & 0xFF);
+    payload.push_back(id >> 8);
+}
+
+static Bytes ids_of(std::initializer_list<int> ids) {
+    Bytes payload;
+    for (int id : ids) {
+        put_id(payload, id);
+    }
+    return payload;
+}
+
+// Id of the status record at `offset`
+static int record_id(const Bytes& payload, size_t offset) {
+    return payload[offset] | payload[offset + 1] << 8;
+}
+
+struct Frame {
+    uint8_t type;
+    uint8_t sequence;
+    Bytes payload;
+};
+
+// --- The link ---
+
+// Device side of the pty as the USB serial port
+class PtyPort : public Print {
+public:
+    explicit PtyPort(int fd) : _fd(fd), room(256) {}
+
+    size_t write(uint8_t byte) override { return write(&byte, 1); }
+    size_t write(const uint8_t* data, size_t size) override {
+        size_t done = 0;
+        while (done < size) {
+            ssize_t n = ::write(_fd, data + done, size - done);
+            TEST_ASSERT_TRUE_MESSAGE(n > 0, "pty write failed");
+            done += n;
+        }
+        return done;
+    }
+    int availableForWrite() override { return room; }
+
+private:
+    int _fd;
+
+public:
+    int room;  // What the port reports as free, like the CDC buffer of the board
+};
+
+// Six coil turnouts with ids `firstId`, `firstId` + 2, .. on the simulated drives,
+// HostLink on one end of a pty and the PC on the other.
+struct Link {
+    static const int TURNOUTS = 6;
+
+    int pc;      // PC side
+    int device;  // Device side, raw like a USB CDC port
+    std::unique_ptr<PtyPort> port;
+    std::vector<std::unique_ptr<SimCoilDrive>> drives;
+    std::vector<std::unique_ptr<SimEndSwitches>> switches;
+    std::vector<std::unique_ptr<CoilTurnout>> turnouts;
+    TurnoutManager manager;
+    TurnoutSim sim;
+    HostLink hostLink;
+    bool served;     // HostLink::begin() has accepted the ids
+    Bytes text;      // Bytes the device got outside of frames
+    Bytes received;  // Bytes the PC has read and not yet split into frames
+
+    explicit Link(int firstId = 3) : pc(-1), device(-1), sim(manager), served(false) {
+        pc = posix_openpt(O_RDWR | O_NOCTTY);
+        TEST_ASSERT_TRUE_MESSAGE(pc >= 0 && grantpt(pc) == 0 && unlockpt(pc) == 0, "no pty");
+        device = open(ptsname(pc), O_RDWR | O_NOCTTY);
+        TEST_ASSERT_TRUE_MESSAGE(device >= 0, "pty device side");
+        struct termios raw;
+        tcgetattr(device, &raw);
+        cfmakeraw(&raw);
+        tcsetattr(device, TCSANOW, &raw);
+        fcntl(pc, F_SETFL, O_NONBLOCK);
+        fcntl(device, F_SETFL, O_NONBLOCK);
+        port.reset(new PtyPort(device));
+
+        TurnoutSim::reset();
+        for (int i = 0; i < TURNOUTS; i++) {
+            drives.emplace_back(new SimCoilDrive(2 * i, 2 * i + 1));
+            switches.emplace_back(new SimEndSwitches(12 + 2 * i, 13 + 2 * i, *drives.back()));
+            sim_add_device(*drives.back());
+            sim_add_device(*switches.back());
+            turnouts.emplace_back(new CoilTurnout(firstId + 2 * i, "coil", CoilMotor(2 * i, 2 * i + 1),
+                                                  EndSwitches(12 + 2 * i, 13 + 2 * i)));
+            manager.add(*turnouts.back());
+        }
+        sim.begin();
+        served = hostLink.begin(manager);
+    }
+
+    ~Link() {
+        close(device);
+        close(pc);
+    }
+
+    void send(const Bytes& bytes) {
+        TEST_ASSERT_EQUAL_INT(bytes.size(), ::write(pc, bytes.data(), bytes.size()));
+    }
+
+    // One loop of the sketch: the received bytes, the turnouts, the replies.
+    void loop() {
+        uint8_t buffer[64];
+        ssize_t n = ::read(device, buffer, sizeof(buffer));
+        for (ssize_t i = 0; i < n; i++) {
+            if (!hostLink.feed(buffer[i])) {
+                text.push_back(buffer[i]);
+            }
+        }
+        sim.loop();
+        hostLink.update(millis());
+        hostLink.drain(*port);
+    }
+
+    // Runs the loop until `count` frames have arrived at the PC, at most `maxLoops`.
+    std::vector<Frame> receive(size_t count, int maxLoops = 2000) {
+        std::vector<Frame> frames;
+        for (int i = 0; i < maxLoops && frames.size() < count; i++) {
+            loop();
+            take(frames);
+        }
+        return frames;
+    }
+
+    // Splits what the PC has read into frames; every frame must be intact.
+    void take(std::vector<Frame>& frames) {
+        uint8_t buffer[256];
+        ssize_t n;
+        while ((n = ::read(pc, buffer, sizeof(buffer))) > 0) {
+            received.insert(received.end(), buffer, buffer + n);
+        }
+        // Frames are 0x00, data, 0x00; the device writes them whole.
+        while (received.size() >= 2 && received[0] == 0) {
+            auto end = std::find(received.begin() + 1, received.end(), 0);
+            if (end == received.end()) {
+                return;
+            }
+            Bytes body;
+            TEST_ASSERT_TRUE_MESSAGE(cobs_decode(Bytes(received.begin() + 1, end), body), "broken COBS");
+            TEST_ASSERT_GREATER_OR_EQUAL(4, body.size());
+            uint16_t crc = body[body.size() - 2] | body[body.size() - 1] << 8;
+            body.resize(body.size() - 2);
+            TEST_ASSERT_EQUAL_HEX16(crc16(body), crc);
+            frames.push_back({body[0], body[1], Bytes(body.begin() + 2, body.end())});
+            received.erase(received.begin(), end + 1);
+        }
+        TEST_ASSERT_TRUE_MESSAGE(received.empty() || received[0] == 0, "bytes outside of a frame");
+    }
+
+    // Sends a command and returns its reply.
+    Frame command(uint8_t type, uint8_t sequence, const Bytes& payload) {
+        send(frame(type, sequence, payload));
+        std::vector<Frame> frames = receive(1);
+        TEST_ASSERT_EQUAL_INT(1, frames.size());
+        return frames[0];
+    }
+};
+
+static uint32_t seed = 1;
+
+static uint32_t random_below(uint32_t range) {
+    seed = seed * 1103515245u + 12345u;
+    return (seed >> 8) % range;
+}
+
+void setUp() {}
+void tearDown() {}
+
+// The encoders of both sides agree, including runs of zeros and 254 bytes without one.
+static void test_cobs_of_the_pc_side() {
+    for (int trial = 0; trial < 2000; trial++) {
+        Bytes data(random_below(600));
+        for (auto& byte : data) {
+            byte = random_below(3) == 0 ? 0 : 1 + random_below(255);
+        }
+        if (trial % 4 == 0) {
+            std::fill(data.begin(), data.end(), 0x55);
+        }
+        Bytes encoded = cobs_encode(data);
+        TEST_ASSERT_TRUE(std::find(encoded.begin(), encoded.end(), 0) == encoded.end());
+        TEST_ASSERT_LESS_OR_EQUAL(data.size() + data.size() / 254 + 1, encoded.size());
+        Bytes decoded;
+        TEST_ASSERT_TRUE(cobs_decode(encoded, decoded));
+        TEST_ASSERT_TRUE(decoded == data);
+    }
+    // CRC-16/CCITT-FALSE check value
+    TEST_ASSERT_EQUAL_HEX16(0x29B1, crc16(Bytes{'1', '2', '3', '4', '5', '6', '7', '8', '9'}));
+}
+
+// Status queries with random ids, zeros included, round-trip with the records of the known ones.
+static void test_status_round_trip() {
+    Link link;
+    for (int trial = 0; trial < 300; trial++) {
+        std::vector<int> ids(random_below(TURNOUT_MANAGER_CAPACITY + 1));
+        Bytes payload;
+        for (auto& id : ids) {
+            // Zeros in both bytes, and ids whose low byte is that of a known one
+            id = random_below(4) == 0 ? 0 : random_below(16) | (random_below(4) == 0 ? 0x100 : 0);
+            put_id(payload, id);
+        }
+        Frame reply = link.command(HOST_LINK_GET_STATUS, trial, payload);
+        TEST_ASSERT_EQUAL_HEX8(HOST_LINK_GET_STATUS | 0x80, reply.type);
+        TEST_ASSERT_EQUAL_UINT8(trial & 0xFF, reply.sequence);
+        size_t records = 0;
+        for (size_t i = 0; i < ids.size(); i++) {
+            bool known = ids[i] >= 3 && ids[i] <= 13 && ids[i] % 2 == 1;
+            if (!known) {
+                continue;
+            }
+            TEST_ASSERT_GREATER_THAN(records * HostLink::STATUS_SIZE, reply.payload.size());
+            TEST_ASSERT_EQUAL_INT(ids[i], record_id(reply.payload, records * HostLink::STATUS_SIZE));
+            records++;
+        }
+        if (ids.empty()) {
+            records = Link::TURNOUTS;
+        }
+        TEST_ASSERT_EQUAL_INT(records * HostLink::STATUS_SIZE, reply.payload.size());
+    }
+    TEST_ASSERT_EQUAL_UINT32(300, link.hostLink.frameCount());
+    TEST_ASSERT_EQUAL_UINT32(0, link.hostLink.errorCount());
+}
+
+// All turnouts in one frame, then their packed state and move time in one query.
+static void test_batch_set_and_status() {
+    Link link;
+    Bytes set;
+    for (int i = 0; i < Link::TURNOUTS; i++) {
+        put_id(set, 3 + 2 * i);
+        set.push_back(2);
+    }
+    // An unknown id and a position that does not exist
+    put_id(set, 4);
+    set.push_back(2);
+    put_id(set, 5);
+    set.push_back(3);
+    Frame reply = link.command(HOST_LINK_SET_POSITIONS, 7, set);
+    TEST_ASSERT_EQUAL_HEX8(HOST_LINK_SET_POSITIONS | 0x80, reply.type);
+    TEST_ASSERT_EQUAL_UINT8(7, reply.sequence);
+    TEST_ASSERT_EQUAL_INT(2, reply.payload.size());
+    TEST_ASSERT_EQUAL_UINT8(Link::TURNOUTS, reply.payload[0]);
+    TEST_ASSERT_EQUAL_UINT8(2, reply.payload[1]);
+
+    // Moving: no confirmed position, target 2
+    reply = link.command(HOST_LINK_GET_STATUS, 8, ids_of({3}));
+    TEST_ASSERT_EQUAL_INT(HostLink::STATUS_SIZE, reply.payload.size());
+    TEST_ASSERT_EQUAL_HEX8(0x10 | 2 << 2, reply.payload[2]);
+
+    TEST_ASSERT_TRUE(link.sim.runUntilIdle());
+    reply = link.command(HOST_LINK_GET_STATUS, 9, Bytes());
+    TEST_ASSERT_EQUAL_INT(Link::TURNOUTS * HostLink::STATUS_SIZE, reply.payload.size());
+    for (int i = 0; i < Link::TURNOUTS; i++) {
+        const uint8_t* record = reply.payload.data() + i * HostLink::STATUS_SIZE;
+        TEST_ASSERT_EQUAL_INT(3 + 2 * i, record_id(reply.payload, i * HostLink::STATUS_SIZE));
+        TEST_ASSERT_EQUAL_HEX8(2 | 2 << 2, record[2]);
+        uint16_t moveMs = record[3] | record[4] << 8;
+        TEST_ASSERT_EQUAL_UINT16(link.turnouts[i]->getLastMoveMs(), moveMs);
+        TEST_ASSERT_GREATER_THAN(0, moveMs);
+        TEST_ASSERT_TRUE(link.drives[i]->travel() == 1);
+    }
+}
+
+// Events carry the changed turnouts only, with consecutive sequence numbers, at
+// most every HOST_LINK_EVENT_MS.
+static void test_subscribed_events() {
+    Link link;
+    // The reply, then the first event with all turnouts
+    link.send(frame(HOST_LINK_SUBSCRIBE, 1, Bytes{1}));
+    std::vector<Frame> events = link.receive(2);
+    TEST_ASSERT_EQUAL_INT(2, events.size());
+    TEST_ASSERT_EQUAL_HEX8(HOST_LINK_SUBSCRIBE | 0x80, events[0].type);
+    TEST_ASSERT_EQUAL_UINT8(1, events[0].payload[0]);
+    TEST_ASSERT_EQUAL_HEX8(HOST_LINK_EVENT, events[1].type);
+    TEST_ASSERT_EQUAL_INT(Link::TURNOUTS * HostLink::STATUS_SIZE, events[1].payload.size());
+    // Nothing changes, nothing is sent.
+    TEST_ASSERT_EQUAL_INT(0, link.receive(1, 500).size());
+
+    link.send(frame(HOST_LINK_SET_POSITIONS, 2, Bytes{5, 0, 1, 9, 0, 2}));
+    std::vector<Frame> frames;
+    std::vector<unsigned long> times;
+    uint8_t state5 = 0;
+    uint8_t state9 = 0;
+    for (int i = 0; i < 10000 && !(state5 == (1 | 1 << 2) && state9 == (2 | 2 << 2)); i++) {
+        size_t before = frames.size();
+        link.loop();
+        link.take(frames);
+        for (size_t f = before; f < frames.size(); f++) {
+            if (frames[f].type != HOST_LINK_EVENT) {
+                continue;
+            }
+            times.push_back(millis());
+            const Bytes& payload = frames[f].payload;
+            TEST_ASSERT_EQUAL_INT(0, payload.size() % HostLink::STATUS_SIZE);
+            for (size_t r = 0; r < payload.size(); r += HostLink::STATUS_SIZE) {
+                int id = record_id(payload, r);
+                TEST_ASSERT_TRUE(id == 5 || id == 9);
+                (id == 5 ? state5 : state9) = payload[r + 2];
+            }
+        }
+    }
+    TEST_ASSERT_EQUAL_HEX8(1 | 1 << 2, state5);
+    TEST_ASSERT_EQUAL_HEX8(2 | 2 << 2, state9);
+    uint8_t sequence = events[1].sequence;
+    for (size_t i = 1; i < times.size(); i++) {
+        TEST_ASSERT_GREATER_OR_EQUAL(HOST_LINK_EVENT_MS, times[i] - times[i - 1]);
+    }
+    for (const Frame& f : frames) {
+        if (f.type == HOST_LINK_EVENT) {
+            TEST_ASSERT_EQUAL_UINT8(++sequence, f.sequence);
+        }
+    }
+
+    Frame reply = link.command(HOST_LINK_SUBSCRIBE, 3, Bytes{0});
+    TEST_ASSERT_EQUAL_UINT8(0, reply.payload[0]);
+    link.send(frame(HOST_LINK_SET_POSITIONS, 4, Bytes{5, 0, 2}));
+    std::vector<Frame> after = link.receive(5, 2000);
+    TEST_ASSERT_EQUAL_INT(1, after.size());
+    TEST_ASSERT_EQUAL_HEX8(HOST_LINK_SET_POSITIONS | 0x80, after[0].type);
+}
+
+// Broken frames are dropped or answered with an error, and the next frame works.
+static void test_broken_frames() {
+    Link link;
+    Bytes bad = frame(HOST_LINK_GET_STATUS, 1, ids_of({3}));
+    // A flipped bit of the payload, not a 0x00 that would end the frame
+    bad[4] ^= 0x10;
+    link.send(bad);
+    // Empty frame, a code byte beyond the frame end, a frame longer than any command
+    link.send(Bytes{0, 0});
+    link.send(Bytes{0, 0x09, 0x01, 0x02, 0});
+    Bytes huge(1, 0);
+    huge.insert(huge.end(), 400, 0x42);
+    huge.push_back(0);
+    link.send(huge);
+    // Too short for a CRC
+    link.send(Bytes{0, 0x03, 0x02, 0x01, 0});
+    TEST_ASSERT_EQUAL_INT(0, link.receive(1, 200).size());
+    TEST_ASSERT_EQUAL_UINT32(4, link.hostLink.errorCount());
+    TEST_ASSERT_EQUAL_UINT32(0, link.hostLink.frameCount());
+
+    Frame reply = link.command(0x42, 5, Bytes{1, 2});
+    TEST_ASSERT_EQUAL_HEX8(HOST_LINK_ERROR, reply.type);
+    TEST_ASSERT_EQUAL_UINT8(5, reply.sequence);
+    TEST_ASSERT_EQUAL_HEX8(0x42, reply.payload[0]);
+    TEST_ASSERT_EQUAL_HEX8(HOST_LINK_UNKNOWN_COMMAND, reply.payload[1]);
+    // An id and position pair of 8-bit ids
+    reply = link.command(HOST_LINK_SET_POSITIONS, 6, Bytes{3, 2});
+    TEST_ASSERT_EQUAL_HEX8(HOST_LINK_ERROR, reply.type);
+    TEST_ASSERT_EQUAL_HEX8(HOST_LINK_BAD_LENGTH, reply.payload[1]);
+    reply = link.command(HOST_LINK_GET_STATUS, 7, Bytes{3});
+    TEST_ASSERT_EQUAL_HEX8(HOST_LINK_BAD_LENGTH, reply.payload[1]);
+    Bytes tooMany;
+    for (int i = 0; i <= TURNOUT_MANAGER_CAPACITY; i++) {
+        put_id(tooMany, 3);
+    }
+    reply = link.command(HOST_LINK_GET_STATUS, 7, tooMany);
+    TEST_ASSERT_EQUAL_HEX8(HOST_LINK_BAD_LENGTH, reply.payload[1]);
+    reply = link.command(HOST_LINK_SUBSCRIBE, 8, Bytes());
+    TEST_ASSERT_EQUAL_HEX8(HOST_LINK_BAD_LENGTH, reply.payload[1]);
+
+    reply = link.command(HOST_LINK_GET_STATUS, 9, ids_of({3}));
+    TEST_ASSERT_EQUAL_HEX8(HOST_LINK_GET_STATUS | 0x80, reply.type);
+    TEST_ASSERT_EQUAL_INT(3, record_id(reply.payload, 0));
+    TEST_ASSERT_TRUE(link.text.empty());
+}
+
+// Frames in pieces over many loops, with text commands in between.
+static void test_frames_in_pieces_with_text() {
+    Link link;
+    Bytes stream;
+    std::string expectedText;
+    const int COMMANDS = 200;
+    for (int i = 0; i < COMMANDS; i++) {
+        Bytes f = frame(HOST_LINK_GET_STATUS, i, ids_of({3 + 2 * (int)random_below(Link::TURNOUTS)}));
+        stream.insert(stream.end(), f.begin(), f.end());
+        if (i % 10 == 0) {
+            stream.push_back('s');
+            expectedText += 's';
+        }
+    }
+    std::vector<Frame> frames;
+    size_t sent = 0;
+    for (int i = 0; i < 100000 && frames.size() < COMMANDS; i++) {
+        if (sent < stream.size()) {
+            size_t n = std::min<size_t>(1 + random_below(7), stream.size() - sent);
+            link.send(Bytes(stream.begin() + sent, stream.begin() + sent + n));
+            sent += n;
+        }
+        link.loop();
+        link.take(frames);
+    }
+    TEST_ASSERT_EQUAL_INT(COMMANDS, frames.size());
+    for (int i = 0; i < COMMANDS; i++) {
+        TEST_ASSERT_EQUAL_UINT8(i & 0xFF, frames[i].sequence);
+        TEST_ASSERT_EQUAL_INT(HostLink::STATUS_SIZE, frames[i].payload.size());
+    }
+    TEST_ASSERT_EQUAL_STRING(expectedText.c_str(), std::string(link.text.begin(), link.text.end()).c_str());
+    TEST_ASSERT_EQUAL_UINT32(0, link.hostLink.errorCount());
+}
+
+// A port without room gets no partial frame; the replies wait in the ring.
+static void test_full_port_keeps_frames_whole() {
+    Link link;
+    link.port->room = 10;
+    for (int i = 0; i < 20; i++) {
+        link.send(frame(HOST_LINK_GET_STATUS, i, Bytes()));
+    }
+    TEST_ASSERT_EQUAL_INT(0, link.receive(1, 200).size());
+    TEST_ASSERT_EQUAL_UINT32(20, link.hostLink.frameCount());
+    link.port->room = 64;
+    std::vector<Frame> frames = link.receive(20);
+    TEST_ASSERT_EQUAL_INT(20, frames.size());
+    for (int i = 0; i < 20; i++) {
+        TEST_ASSERT_EQUAL_UINT8(i, frames[i].sequence);
+        TEST_ASSERT_EQUAL_INT(Link::TURNOUTS * HostLink::STATUS_SIZE, frames[i].payload.size());
+    }
+    TEST_ASSERT_EQUAL_UINT32(0, link.hostLink.droppedCount());
+}
+
+// Ids beyond 255 are set and reported in full, their low byte alone matches no turnout.
+static void test_ids_beyond_8_bits() {
+    Link link(0x103);
+    TEST_ASSERT_TRUE(link.served);
+    Frame reply = link.command(HOST_LINK_SET_POSITIONS, 1, Bytes{0x05, 0x01, 2, 0x05, 0x00, 2});
+    TEST_ASSERT_EQUAL_UINT8(1, reply.payload[0]);
+    TEST_ASSERT_EQUAL_UINT8(1, reply.payload[1]);
+    TEST_ASSERT_EQUAL_INT(2, link.turnouts[1]->getTargetPosition());
+    TEST_ASSERT_TRUE(link.turnouts[0]->getTargetPosition() != 2);
+
+    reply = link.command(HOST_LINK_GET_STATUS, 2, ids_of({0x105, 0x05, 0x10D}));
+    TEST_ASSERT_EQUAL_INT(2 * HostLink::STATUS_SIZE, reply.payload.size());
+    TEST_ASSERT_EQUAL_INT(0x105, record_id(reply.payload, 0));
+    TEST_ASSERT_EQUAL_INT(0x10D, record_id(reply.payload, HostLink::STATUS_SIZE));
+    TEST_ASSERT_EQUAL_HEX8(0x10 | 2 << 2, reply.payload[2]);
+}
+
+// Turnouts with an id a record cannot carry are not served at all.
+static void test_begin_rejects_ids_beyond_16_bits() {
+    Link link(0xFFFD);
+    TEST_ASSERT_FALSE(link.served);
+    link.send(frame(HOST_LINK_GET_STATUS, 1, Bytes()));
+    TEST_ASSERT_EQUAL_INT(0, link.receive(1, 200).size());
+
+    Link fits(0xFFF3);
+    TEST_ASSERT_TRUE(fits.served);
+    Frame reply = fits.command(HOST_LINK_GET_STATUS, 1, ids_of({0xFFFD}));
+    TEST_ASSERT_EQUAL_INT(0xFFFD, record_id(reply.payload, 0));
+}
+
+int main(int, char**) {
+    UNITY_BEGIN();
+    RUN_TEST(test_cobs_of_the_pc_side);
+    RUN_TEST(test_status_round_trip);
+    RUN_TEST(test_batch_set_and_status);
+    RUN_TEST(test_subscribed_events);
+    RUN_TEST(test_broken_frames);
+    RUN_TEST(test_frames_in_pieces_with_text);
+    RUN_TEST(test_full_port_keeps_frames_whole);
+    RUN_TEST(test_ids_beyond_8_bits);
+    RUN_TEST(test_begin_rejects_ids_beyond_16_bits);
+    return UNITY_END();
+}
@@ -0,0 +1,213 @@
+// hal_pio_out_build_table() on random and edge-case channel widths: the table
+// always fills exactly one frame, every channel's waveform is its width within
+// the documented edge delay, the slices after the pulses stay short, and a
+// switch between constantly low and high only changes that channel's bit.
+#include <unity.h>
+#include <algorithm>
+#include "pio_output_hal.h"
+
+static const uint32_t MAX_PULSE_US = HAL_PIO_OUT_FRAME_US - HAL_PIO_OUT_SEGMENTS * HAL_PIO_OUT_MIN_SEGMENT_US;
+
+static uint32_t seed = 1;
+
+static uint32_t random_below(uint32_t range) {
+    seed = seed * 1103515245u + 12345u;
+    return (seed >> 8) % range;
+}
+
+static uint32_t duration(const hal_pio_out_segment_t& segment) {
+    return segment.delay + HAL_PIO_OUT_MIN_SEGMENT_US;
+}
+
+static bool is_pulse(uint16_t width) {
+    return width != 0 && width <= MAX_PULSE_US;
+}
+
+// Checks the table built for `widths` on channels with the level bits `masks`.
+static void check_table(const uint32_t* masks, const uint16_t* widths, int count) {
+    hal_pio_out_segment_t table[HAL_PIO_OUT_SEGMENTS];
+    hal_pio_out_build_table(masks, widths, count, table);
+
+    uint32_t all = 0;
+    for (int i = 0; i < count; i++) {
+        all |= masks[i];
+    }
+    uint32_t lastEnd = 0;
+    for (int i = 0; i < count; i++) {
+        if (is_pulse(widths[i])) {
+            lastEnd = std::max(lastEnd, (uint32_t)widths[i]);
+        }
+    }
+
+    uint32_t t = 0;
+    uint32_t ends[HAL_PIO_OUT_MAX_CHANNELS] = {};
+    for (int s = 0; s < HAL_PIO_OUT_SEGMENTS; s++) {
+        // No underflow of the delay, and no level bits of pins that are not channels
+        TEST_ASSERT_TRUE_MESSAGE(table[s].delay < HAL_PIO_OUT_FRAME_US, "segment shorter than the minimum");
+        TEST_ASSERT_EQUAL_UINT32(0, table[s].levels & ~all);
+        for (int i = 0; i < count; i++) {
+            bool high = (table[s].levels & masks[i]) != 0;
+            if (widths[i] == 0) {
+                TEST_ASSERT_FALSE_MESSAGE(high, "channel at 0 is high");
+            } else if (!is_pulse(widths[i])) {
+                TEST_ASSERT_TRUE_MESSAGE(high, "constantly high channel is low");
+            } else if (high) {
+                TEST_ASSERT_EQUAL_UINT32_MESSAGE(t, ends[i], "pulse is not one piece");
+                ends[i] = t + duration(table[s]);
+            }
+        }
+        // After the last pulse the rest of the frame is split into slices of about 1ms.
+        if (t >= lastEnd) {
+            TEST_ASSERT_TRUE_MESSAGE(duration(table[s]) <= 1000 + HAL_PIO_OUT_SEGMENTS, "slice too long");
+        }
+        t += duration(table[s]);
+    }
+    TEST_ASSERT_EQUAL_UINT32(HAL_PIO_OUT_FRAME_US, t);
+
+    // Every pulse ends at its width, or later by at most the minimum segment per
+    // distinct width that ends before or with it.
+    for (int i = 0; i < count; i++) {
+        if (!is_pulse(widths[i])) {
+            continue;
+        }
+        uint32_t earlier = 0;
+        for (int k = 0; k < count; k++) {
+            bool distinct = std::find(widths, widths + k, widths[k]) == widths + k;
+            earlier += distinct && is_pulse(widths[k]) && widths[k] <= widths[i] ? 1 : 0;
+        }
+        TEST_ASSERT_GREATER_OR_EQUAL(widths[i], ends[i]);
+        TEST_ASSERT_LESS_OR_EQUAL(widths[i] + earlier * HAL_PIO_OUT_MIN_SEGMENT_US, ends[i]);
+        // Channels of the same width end together.
+        for (int k = 0; k < count; k++) {
+            if (widths[k] == widths[i]) {
+                TEST_ASSERT_EQUAL_UINT32(ends[i], ends[k]);
+            }
+        }
+    }
+}
+
+static uint16_t random_width() {
+    switch (random_below(5)) {
+        case 0: return 0;
+        case 1: return HAL_PIO_OUT_ON;
+        case 2: return 1 + random_below(10);                    // Shorter than a segment
+        case 3: return MAX_PULSE_US - 5 + random_below(10);     // Around the longest pulse
+        default: return 500 + random_below(2000);               // Servo range
+    }
+}
+
+void setUp() {}
+void tearDown() {}
+
+static void test_random_widths() {
+    uint32_t masks[HAL_PIO_OUT_MAX_CHANNELS];
+    uint16_t widths[HAL_PIO_OUT_MAX_CHANNELS];
+    for (int trial = 0; trial < 20000; trial++) {
+        int count = random_below(HAL_PIO_OUT_MAX_CHANNELS + 1);
+        for (int i = 0; i < count; i++) {
+            // Level bits as the pins of the channels relative to the lowest one
+            masks[i] = 1u << (i * 2 + trial % 2);
+            widths[i] = random_width();
+            if (trial % 5 == 0 && i > 0) {
+                // Edges closer together than a segment
+                widths[i] = widths[i - 1] + random_below(3);
+            }
+        }
+        check_table(masks, widths, count);
+    }
+}
+
+static void test_edge_cases() {
+    uint32_t masks[HAL_PIO_OUT_MAX_CHANNELS];
+    uint16_t widths[HAL_PIO_OUT_MAX_CHANNELS];
+    for (int i = 0; i < HAL_PIO_OUT_MAX_CHANNELS; i++) {
+        masks[i] = 1u << i;
+    }
+    check_table(masks, widths, 0);
+
+    const uint16_t single[] = {0, 1, 2, 3, 4, 544, 1500, 2400, MAX_PULSE_US - 1, MAX_PULSE_US, MAX_PULSE_US + 1,
+                               HAL_PIO_OUT_FRAME_US, HAL_PIO_OUT_ON - 1, HAL_PIO_OUT_ON};
+    for (uint16_t width : single) {
+        widths[0] = width;
+        check_table(masks, widths, 1);
+    }
+
+    // All channels with distinct pulses one µs apart: the most edges, all too close
+    for (int i = 0; i < HAL_PIO_OUT_MAX_CHANNELS; i++) {
+        widths[i] = 1000 + i;
+    }
+    check_table(masks, widths, HAL_PIO_OUT_MAX_CHANNELS);
+    // ... and at the longest pulse
+    for (int i = 0; i < HAL_PIO_OUT_MAX_CHANNELS; i++) {
+        widths[i] = MAX_PULSE_US - i;
+    }
+    check_table(masks, widths, HAL_PIO_OUT_MAX_CHANNELS);
+    // All the same
+    std::fill(widths, widths + HAL_PIO_OUT_MAX_CHANNELS, 1500);
+    check_table(masks, widths, HAL_PIO_OUT_MAX_CHANNELS);
+}
+
+// The HAL switches coils by patching one level bit in the tables it already has.
+static void test_switching_only_changes_the_level_bit() {
+    uint32_t masks[HAL_PIO_OUT_MAX_CHANNELS];
+    uint16_t widths[HAL_PIO_OUT_MAX_CHANNELS];
+    for (int trial = 0; trial < 2000; trial++) {
+        int count = 1 + random_below(HAL_PIO_OUT_MAX_CHANNELS);
+        for (int i = 0; i < count; i++) {
+            masks[i] = 1u << i;
+            widths[i] = random_width();
+        }
+        int coil = random_below(count);
+        hal_pio_out_segment_t off[HAL_PIO_OUT_SEGMENTS];
+        hal_pio_out_segment_t on[HAL_PIO_OUT_SEGMENTS];
+        widths[coil] = 0;
+        hal_pio_out_build_table(masks, widths, count, off);
+        widths[coil] = HAL_PIO_OUT_ON;
+        hal_pio_out_build_table(masks, widths, count, on);
+        for (int s = 0; s < HAL_PIO_OUT_SEGMENTS; s++) {
+            TEST_ASSERT_EQUAL_UINT32(off[s].delay, on[s].delay);
+            TEST_ASSERT_EQUAL_UINT32(off[s].levels | masks[coil], on[s].levels);
+            TEST_ASSERT_EQUAL_UINT32(0, off[s].levels & masks[coil]);
+        }
+    }
+}
+
+static void test_channel_order_does_not_matter() {
+    uint32_t masks[HAL_PIO_OUT_MAX_CHANNELS];
+    uint16_t widths[HAL_PIO_OUT_MAX_CHANNELS];
+    int order[HAL_PIO_OUT_MAX_CHANNELS];
+    for (int trial = 0; trial < 2000; trial++) {
+        int count = 1 + random_below(HAL_PIO_OUT_MAX_CHANNELS);
+        for (int i = 0; i < count; i++) {
+            masks[i] = 1u << i;
+            widths[i] = random_width();
+            order[i] = i;
+        }
+        for (int i = count - 1; i > 0; i--) {
+            std::swap(order[i], order[random_below(i + 1)]);
+        }
+        uint32_t shuffledMasks[HAL_PIO_OUT_MAX_CHANNELS];
+        uint16_t shuffledWidths[HAL_PIO_OUT_MAX_CHANNELS];
+        for (int i = 0; i < count; i++) {
+            shuffledMasks[i] = masks[order[i]];
+            shuffledWidths[i] = widths[order[i]];
+        }
+        hal_pio_out_segment_t table[HAL_PIO_OUT_SEGMENTS];
+        hal_pio_out_segment_t shuffled[HAL_PIO_OUT_SEGMENTS];
+        hal_pio_out_build_table(masks, widths, count, table);
+        hal_pio_out_build_table(shuffledMasks, shuffledWidths, count, shuffled);
+        for (int s = 0; s < HAL_PIO_OUT_SEGMENTS; s++) {
+            TEST_ASSERT_EQUAL_UINT32(table[s].levels, shuffled[s].levels);
+            TEST_ASSERT_EQUAL_UINT32(table[s].delay, shuffled[s].delay);
+        }
+    }
+}
+
+int main(int, char**) {
+    UNITY_BEGIN();
+    RUN_TEST(test_random_widths);
+    RUN_TEST(test_edge_cases);
+    RUN_TEST(test_switching_only_changes_the_level_bit);
+    RUN_TEST(test_channel_order_does_not_matter);
+    return UNITY_END();
+}
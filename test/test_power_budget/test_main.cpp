@@ -0,0 +1,127 @@
+// Turnouts of every coil motor type behind a power budget for a single pulse:
+// the manager never grants more than the budget, only one coil is on at a time,
+// a turnout that waits for the budget neither drives nor ends a pulse, and all
+// turnouts reach their position with one pulse per throw.
+#include <unity.h>
+#include <memory>
+#include <vector>
+#include "turnout_sim.h"
+#include "sim_models.h"
+
+static const unsigned int COIL_CURRENT = 1000;
+static const int THROWS = 4;
+
+struct Board {
+    std::vector<std::unique_ptr<SimCoilDrive>> drives;
+    std::vector<std::unique_ptr<SimEndSwitches>> switches;
+    std::vector<std::shared_ptr<void>> owned;   // The turnouts, of different types
+    std::vector<TurnoutBase*> turnouts;
+    TurnoutManager manager;
+
+    template<typename T>
+    void addTurnout(T* turnout) {
+        owned.emplace_back(turnout);
+        turnouts.push_back(turnout);
+    }
+
+    SimCoilDrive& addDrive(int i) {
+        drives.emplace_back(new SimCoilDrive(2 * i, 2 * i + 1));
+        sim_add_device(*drives.back());
+        return *drives.back();
+    }
+};
+
+static void add_coil(Board& board, int i) {
+    SimCoilDrive& drive = board.addDrive(i);
+    board.switches.emplace_back(new SimEndSwitches(12 + 2 * i, 13 + 2 * i, drive));
+    sim_add_device(*board.switches.back());
+    board.addTurnout(
+        new CoilTurnout(i + 1, "coil", CoilMotor(2 * i, 2 * i + 1), EndSwitches(12 + 2 * i, 13 + 2 * i)));
+}
+
+static void add_bemf(Board& board, int i) {
+    board.addDrive(i).attachBemf(26 + 2 * i, 27 + 2 * i);
+    BEMF_Config config = {(uint8_t)(2 * i), (uint8_t)(2 * i + 1), (uint8_t)(26 + 2 * i), (uint8_t)(27 + 2 * i)};
+    board.addTurnout(new BemfTurnout(i + 1, "bemf", BemfCoilMotor(config)));
+}
+
+static void add_current_sense(Board& board, int i) {
+    board.addDrive(i).attachShunt(26 + i);
+    board.addTurnout(
+        new CurrentSenseCoilTurnout(i + 1, "current", CurrentSenseCoilMotor(2 * i, 2 * i + 1, 26 + i)));
+}
+
+// Coils that are switched on right now
+static int coils_on(const Board& board) {
+    int on = 0;
+    for (size_t i = 0; i < board.drives.size(); i++) {
+        on += sim_pin_output(2 * i) + sim_pin_output(2 * i + 1);
+    }
+    return on;
+}
+
+// Throws all turnouts at once, back and forth, and checks the budget on every loop.
+static void throw_behind_budget(void (*add)(Board&, int), int count) {
+    TurnoutSim::reset();
+    Board board;
+    for (int i = 0; i < count; i++) {
+        add(board, i);
+        board.manager.add(*board.turnouts.back());
+    }
+    for (int type = TurnoutBase::MOTOR_COIL; type <= TurnoutBase::MOTOR_COIL_CURRENT; type++) {
+        board.manager.setMotorCurrent((TurnoutBase::MotorType)type, COIL_CURRENT);
+    }
+    board.manager.setPowerBudget(COIL_CURRENT);
+    TurnoutSim sim(board.manager);
+    sim.begin();
+
+    for (int n = 0; n < THROWS; n++) {
+        int position = n % 2 == 0 ? 2 : 1;
+        std::vector<uint32_t> pulses;
+        for (auto& drive : board.drives) {
+            pulses.push_back(drive->pulses());
+        }
+        for (auto& turnout : board.turnouts) {
+            turnout->setPosition(position, millis());
+        }
+        unsigned long start = millis();
+        while (board.manager.isBusy() && millis() - start < 5000) {
+            sim.loop();
+            TEST_ASSERT_LESS_OR_EQUAL(COIL_CURRENT, board.manager.powerInUse());
+            TEST_ASSERT_LESS_OR_EQUAL(1, coils_on(board));
+        }
+        TEST_ASSERT_FALSE(board.manager.isBusy());
+        TEST_ASSERT_EQUAL_INT(0, (int)board.manager.powerInUse());
+        for (int i = 0; i < count; i++) {
+            TEST_ASSERT_EQUAL_INT(position, board.turnouts[i]->getPosition());
+            TEST_ASSERT_FALSE(board.turnouts[i]->hasTimedOut());
+            TEST_ASSERT_TRUE(board.drives[i]->travel() == position - 1);
+            // Waiting for the budget is no pulse.
+            TEST_ASSERT_EQUAL_UINT32(pulses[i] + 1, board.drives[i]->pulses());
+        }
+        sim.run(200);
+    }
+}
+
+void setUp() {}
+void tearDown() {}
+
+static void test_coil_turnouts_take_turns() {
+    throw_behind_budget(add_coil, 4);
+}
+
+static void test_bemf_turnouts_take_turns() {
+    throw_behind_budget(add_bemf, 2);
+}
+
+static void test_current_sense_turnouts_take_turns() {
+    throw_behind_budget(add_current_sense, 4);
+}
+
+int main(int, char**) {
+    UNITY_BEGIN();
+    RUN_TEST(test_coil_turnouts_take_turns);
+    RUN_TEST(test_bemf_turnouts_take_turns);
+    RUN_TEST(test_current_sense_turnouts_take_turns);
+    return UNITY_END();
+}
@@ -0,0 +1,196 @@
+// Servo motion profiles: the table spans the move's duration and ends exactly
+// on the target, the speed and acceleration stay within the limits of the
+// profile, and the S-curve has no jerk steps. On the simulation a servo
+// turnout plays the table frame by frame.
+#include <unity.h>
+#include <cmath>
+#include "servo_profile.h"
+#include "turnout_sim.h"
+#include "sim_models.h"
+
+static const uint32_t FRAME_US = 20000;
+static const float FRAME_MS = FRAME_US / 1000.0f;
+static const int CAPACITY = 256;
+// Rounding to whole µs moves every entry by up to 0.5µs.
+static const float ROUNDING = 0.5f;
+
+static uint16_t table[CAPACITY];
+
+static ServoProfileParams profile(ServoProfileType type, uint16_t durationMs, uint16_t accelMs) {
+    ServoProfileParams params;
+    params.type = type;
+    params.duration_ms = durationMs;
+    params.accel_ms = accelMs;
+    return params;
+}
+
+// n-th difference of the table at `i` with a stride of `k` frames
+static float difference(const uint16_t* pulses, int i, int k, int n) {
+    if (n == 0) {
+        return pulses[i];
+    }
+    return difference(pulses, i + k, k, n - 1) - difference(pulses, i, k, n - 1);
+}
+
+// Bounds the first three differences over windows of `k` frames by the limits of the
+// profile: top speed v = 1 / (duration - accel); for the S-curve a peak acceleration of
+// v pi / (2 accel) and a jerk of v pi^2 / (2 accel^2), for the trapezoid v / accel.
+static void check_limits(ServoProfileType type, float duration, float accel, const uint16_t* pulses, int frames,
+                         int delta, int k) {
+    float v = 1 / (duration - accel);
+    float window = k * FRAME_MS;
+    float a = type == SERVO_PROFILE_SCURVE ? v * (float)M_PI / (2 * accel) : v / accel;
+    float speedLimit = fabsf(delta) * v * window + 2 * ROUNDING;
+    float accelLimit = fabsf(delta) * a * window * window + 4 * ROUNDING;
+    for (int i = 0; i + k < frames; i++) {
+        TEST_ASSERT_TRUE_MESSAGE(fabsf(difference(pulses, i, k, 1)) <= speedLimit, "speed");
+    }
+    for (int i = 0; i + 2 * k < frames; i++) {
+        TEST_ASSERT_TRUE_MESSAGE(fabsf(difference(pulses, i, k, 2)) <= accelLimit, "acceleration");
+    }
+    if (type == SERVO_PROFILE_SCURVE) {
+        float jerk = v * (float)(M_PI * M_PI) / (2 * accel * accel);
+        float jerkLimit = fabsf(delta) * jerk * window * window * window + 8 * ROUNDING;
+        for (int i = 0; i + 3 * k < frames; i++) {
+            TEST_ASSERT_TRUE_MESSAGE(fabsf(difference(pulses, i, k, 3)) <= jerkLimit, "jerk");
+        }
+    }
+}
+
+void setUp() {}
+void tearDown() {}
+
+static void test_table_spans_duration_and_ends_on_target() {
+    const uint16_t durations[] = {20, 100, 500, 1000, 2500};
+    for (ServoProfileType type : {SERVO_PROFILE_TRAPEZOID, SERVO_PROFILE_SCURVE}) {
+        for (uint16_t duration : durations) {
+            int frames = servo_profile_generate(profile(type, duration, duration / 4), 853, 2090, FRAME_US, table,
+                                                CAPACITY);
+            TEST_ASSERT_EQUAL_INT((int)ceilf(duration / FRAME_MS), frames);
+            TEST_ASSERT_EQUAL_UINT16(2090, table[frames - 1]);
+            for (int i = 1; i < frames; i++) {
+                TEST_ASSERT_GREATER_OR_EQUAL(table[i - 1], table[i]);
+            }
+        }
+    }
+}
+
+static void test_move_backwards_mirrors_forward() {
+    uint16_t forward[CAPACITY];
+    int frames = servo_profile_generate(profile(SERVO_PROFILE_SCURVE, 1000, 250), 853, 2090, FRAME_US, forward,
+                                        CAPACITY);
+    TEST_ASSERT_EQUAL_INT(frames, servo_profile_generate(profile(SERVO_PROFILE_SCURVE, 1000, 250), 2090, 853,
+                                                         FRAME_US, table, CAPACITY));
+    for (int i = 0; i < frames; i++) {
+        // Both are rounded to whole µs, so the mirror can differ by one.
+        TEST_ASSERT_INT_WITHIN(1, 853 + 2090 - forward[i], table[i]);
+    }
+}
+
+static void test_speed_acceleration_and_jerk_limits() {
+    struct {
+        ServoProfileType type;
+        uint16_t duration;
+        uint16_t accel;
+    } const cases[] = {
+        {SERVO_PROFILE_TRAPEZOID, 1000, 250}, {SERVO_PROFILE_SCURVE, 1000, 250},  {SERVO_PROFILE_SCURVE, 2000, 1000},
+        {SERVO_PROFILE_SCURVE, 600, 100},     {SERVO_PROFILE_TRAPEZOID, 600, 300}, {SERVO_PROFILE_SCURVE, 5000, 800},
+    };
+    for (const auto& c : cases) {
+        int frames = servo_profile_generate(profile(c.type, c.duration, c.accel), 544, 2400, FRAME_US, table,
+                                            CAPACITY);
+        for (int k = 1; k <= 5; k++) {
+            check_limits(c.type, c.duration, c.accel, table, frames, 2400 - 544, k);
+        }
+    }
+}
+
+static void test_scurve_starts_and_stops_softly() {
+    uint16_t trapezoid[CAPACITY];
+    int frames = servo_profile_generate(profile(SERVO_PROFILE_TRAPEZOID, 2000, 500), 544, 2400, FRAME_US, trapezoid,
+                                        CAPACITY);
+    servo_profile_generate(profile(SERVO_PROFILE_SCURVE, 2000, 500), 544, 2400, FRAME_US, table, CAPACITY);
+    // Zero acceleration at both ends: the servo leaves and approaches the ends more slowly
+    // than with constant acceleration.
+    TEST_ASSERT_LESS_THAN(trapezoid[4] - 544, table[4] - 544);
+    TEST_ASSERT_LESS_THAN(2400 - trapezoid[frames - 6], 2400 - table[frames - 6]);
+    // Halfway both are at the middle.
+    TEST_ASSERT_INT_WITHIN(1, (544 + 2400) / 2, table[frames / 2 - 1]);
+    TEST_ASSERT_INT_WITHIN(1, (544 + 2400) / 2, trapezoid[frames / 2 - 1]);
+}
+
+static void test_accel_is_capped_at_half_the_duration() {
+    uint16_t capped[CAPACITY];
+    int frames = servo_profile_generate(profile(SERVO_PROFILE_SCURVE, 1000, 900), 853, 2090, FRAME_US, capped,
+                                        CAPACITY);
+    servo_profile_generate(profile(SERVO_PROFILE_SCURVE, 1000, 500), 853, 2090, FRAME_US, table, CAPACITY);
+    for (int i = 0; i < frames; i++) {
+        TEST_ASSERT_EQUAL_UINT16(table[i], capped[i]);
+    }
+}
+
+static void test_long_move_is_sped_up_to_fit() {
+    int frames = servo_profile_generate(profile(SERVO_PROFILE_SCURVE, 10000, 2000), 853, 2090, FRAME_US, table, 128);
+    TEST_ASSERT_EQUAL_INT(128, frames);
+    TEST_ASSERT_EQUAL_UINT16(2090, table[frames - 1]);
+    // Same shape on the shorter time: 2560ms with 512ms of acceleration
+    check_limits(SERVO_PROFILE_SCURVE, 128 * FRAME_MS, 2000 * 128 * FRAME_MS / 10000, table, frames, 2090 - 853, 1);
+}
+
+static void test_no_move() {
+    TEST_ASSERT_EQUAL_INT(1, servo_profile_generate(profile(SERVO_PROFILE_SCURVE, 0, 0), 1500, 1500, FRAME_US, table,
+                                                    CAPACITY));
+    TEST_ASSERT_EQUAL_UINT16(1500, table[0]);
+    int frames = servo_profile_generate(profile(SERVO_PROFILE_SCURVE, 400, 100), 1500, 1500, FRAME_US, table, CAPACITY);
+    for (int i = 0; i < frames; i++) {
+        TEST_ASSERT_EQUAL_UINT16(1500, table[i]);
+    }
+}
+
+// The servo turnout hands the table to the HAL, which outputs one entry per frame.
+static void test_turnout_plays_the_profile() {
+    TurnoutSim::reset();
+    SimServo servo(0);
+    // The switch only closes at the very end, so the whole table is played.
+    SimEndSwitches switches(12, 13, servo, 0.001);
+    sim_add_device(servo);
+    sim_add_device(switches);
+    ServoTurnout turnout(1, "servo", ServoMotor(0), EndSwitches(12, 13));
+    turnout.motor().setProfile(SERVO_PROFILE_SCURVE, 600, 150);
+    TurnoutManager manager;
+    manager.add(turnout);
+    TurnoutSim sim(manager, 1000);
+    sim.begin();
+
+    int frames = servo_profile_generate(profile(SERVO_PROFILE_SCURVE, 600, 150), servoPulse(30), servoPulse(150),
+                                        FRAME_US, table, CAPACITY);
+    turnout.setPosition(2, millis());
+    sim.loop();
+    uint64_t start = sim_time_us();
+    int frame = 0;
+    while (frame < frames) {
+        sim.loop();
+        // Every pulse width on the pin is an entry of the table, in order
+        if (sim_pin_pulse_us(0) != (frame == 0 ? servoPulse(30) : table[frame - 1])) {
+            TEST_ASSERT_EQUAL_UINT16(table[frame], sim_pin_pulse_us(0));
+            frame++;
+        }
+        TEST_ASSERT_LESS_THAN(start + 700000, sim_time_us());
+    }
+    TEST_ASSERT_INT_WITHIN(FRAME_US + 1000, 600000, (long long)(sim_time_us() - start));
+    TEST_ASSERT_TRUE(sim.runUntilIdle(1000));
+    TEST_ASSERT_EQUAL_INT(2, turnout.getPosition());
+}
+
+int main(int, char**) {
+    UNITY_BEGIN();
+    RUN_TEST(test_table_spans_duration_and_ends_on_target);
+    RUN_TEST(test_move_backwards_mirrors_forward);
+    RUN_TEST(test_speed_acceleration_and_jerk_limits);
+    RUN_TEST(test_scurve_starts_and_stops_softly);
+    RUN_TEST(test_accel_is_capped_at_half_the_duration);
+    RUN_TEST(test_long_move_is_sped_up_to_fit);
+    RUN_TEST(test_no_move);
+    RUN_TEST(test_turnout_plays_the_profile);
+    return UNITY_END();
+}
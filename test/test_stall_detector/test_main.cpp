@@ -0,0 +1,450 @@
+// Replay harness of BemfStallDetector: traces with a known end of travel run
+// through all four detector types, which report the detection latency in
+// measurements after the end, the detections before it (false positives) and
+// the traces without a detection. The synthetic traces model the noise seen on
+// layouts, the recorded ones are moves of the simulated drive captured through
+// BemfCapture and decoded from its frames. Every row of the table is checked
+// against bounds. Run with `pio test -e native -f test_stall_detector -v` to
+// see the table.
+//
+// Moves recorded on a layout with tools/bemf_capture.py are replayed too when
+// BEMF_TRACES names their directory; BEMF_PARAMS overrides the detector
+// parameters of the recordings, e.g. BEMF_PARAMS="threshold=12 stall_count=3".
+#include <unity.h>
+#include <dirent.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "turnout_sim.h"
+#include "sim_models.h"
+
+static const StallDetectorType TYPES[] = {STALL_DETECTOR_THRESHOLD, STALL_DETECTOR_EMA, STALL_DETECTOR_SLOPE,
+                                          STALL_DETECTOR_CUSUM};
+static const char* const TYPE_NAMES[] = {"threshold", "ema", "slope", "cusum"};
+
+// Measurements of one move and the first one taken after the armature stopped
+// at the end, -1 if that is not known
+struct Trace {
+    std::vector<int> values;
+    int end = -1;
+};
+
+// --- Synthetic traces ---
+
+static uint32_t seed;
+
+// Uniform in -peak..peak
+static int noise(int peak) {
+    seed = seed * 1103515245 + 12345;
+    return (int)((seed >> 8) % (2 * peak + 1)) - peak;
+}
+
+static int uniform(int low, int high) {
+    return low + noise((high - low) / 2) + (high - low) / 2;
+}
+
+// The moving armature gives 180-260 counts, the stopped one 0-2.
+static Trace clean_move() {
+    Trace trace;
+    int level = uniform(180, 260);
+    for (int i = uniform(20, 60); i > 0; i--) {
+        trace.values.push_back(level + noise(5));
+    }
+    trace.end = trace.values.size();
+    for (int i = 0; i < 60; i++) {
+        trace.values.push_back(abs(noise(2)));
+    }
+    return trace;
+}
+
+// Noisy measurements on both sides of the end, most of the stopped ones still below the threshold.
+static Trace noisy_move() {
+    Trace trace;
+    int level = uniform(150, 250);
+    for (int i = uniform(20, 60); i > 0; i--) {
+        trace.values.push_back(abs(level + noise(60)));
+    }
+    trace.end = trace.values.size();
+    for (int i = 0; i < 60; i++) {
+        trace.values.push_back(abs(4 + noise(8)));
+    }
+    return trace;
+}
+
+// Single spikes after the end, e.g. from a coil of a neighbouring turnout.
+static Trace spiky_move() {
+    Trace trace = clean_move();
+    for (size_t i = trace.end + uniform(1, 4); i < trace.values.size(); i += uniform(3, 6)) {
+        trace.values[i] = uniform(12, 25);
+    }
+    return trace;
+}
+
+// Single measurements that drop out while the armature moves.
+static Trace dropout_move() {
+    Trace trace = clean_move();
+    for (int i = uniform(2, 8); i < trace.end; i += uniform(5, 12)) {
+        trace.values[i] = uniform(0, 4);
+    }
+    return trace;
+}
+
+// The armature slows down towards the end and stops at 40 counts.
+static Trace slowing_move() {
+    Trace trace;
+    int steps = uniform(20, 60);
+    for (int i = 0; i < steps; i++) {
+        trace.values.push_back(200 - 160 * i / steps + noise(4));
+    }
+    trace.end = trace.values.size();
+    for (int i = 0; i < 60; i++) {
+        trace.values.push_back(abs(noise(3)));
+    }
+    return trace;
+}
+
+// --- Traces recorded from the simulated drive ---
+
+static const int RECORDED_ID = 3;
+static const int AFTER_END = 60;            // Measurements recorded after the end
+static const unsigned long OFF_MS = 150;    // Off window after a pulse, as TurnoutBase
+
+struct Recorder {
+    hal_motor_t* hal = nullptr;
+    const SimCoilDrive* drive = nullptr;
+    uint64_t startUs = 0;
+    int samples = 0;
+    int end = -1;
+};
+
+// The HAL callback: records the terminals and notes the first measurement after the end stop.
+static void on_measurement(void* context, int) {
+    Recorder* recorder = static_cast<Recorder*>(context);
+    if (recorder->end < 0 && recorder->drive->endReachedUs() > recorder->startUs) {
+        recorder->end = recorder->samples;
+    }
+    int a, b;
+    hal_motor_get_last_terminals(recorder->hal, &a, &b);
+    bemfCapture.sample(RECORDED_ID, a, b);
+    recorder->samples++;
+}
+
+// Runs the HAL like TurnoutManager::update() does, every 100µs.
+static void run_hal(Recorder& recorder, unsigned long ms, bool measuring) {
+    uint64_t end = sim_time_us() + (uint64_t)ms * 1000;
+    while (sim_time_us() < end && !(measuring && recorder.end >= 0 && recorder.samples >= recorder.end + AFTER_END)) {
+        sim_advance_us(100);
+        hal_motor_service();
+        bemfCapture.drain(Serial);
+    }
+}
+
+// Throws the simulated drive from position 1 to 2 with pulses of `pulseMs`, measures in
+// the off windows like BemfCoilMotor, and returns the capture stream of the move.
+static std::string record_move(const SimCoilParams& params, unsigned long pulseMs, int& end) {
+    TurnoutSim::reset();
+    SimCoilDrive drive(0, 1, params);
+    drive.attachBemf(26, 27);
+    sim_add_device(drive);
+    Recorder recorder;
+    recorder.drive = &drive;
+    recorder.hal = hal_motor_init(0, 1, 26, 27, on_measurement, &recorder);
+    TEST_ASSERT_NOT_NULL(recorder.hal);
+    sim_advance_us(SIM_STEP_US);
+    recorder.startUs = sim_time_us();
+
+    Serial.output().clear();
+    bemfCapture.enable(RECORDED_ID);
+    bemfCapture.moveStarted(RECORDED_ID, 2, StallDetectorParams());
+    for (int pulse = 0; pulse < 4 && !(recorder.end >= 0 && recorder.samples >= recorder.end + AFTER_END); pulse++) {
+        hal_motor_set_pwm(recorder.hal, 255, false);
+        bemfCapture.pulseStarted(RECORDED_ID, pulseMs);
+        run_hal(recorder, pulseMs, false);
+        hal_motor_set_pwm(recorder.hal, 0, false);
+        hal_motor_arm_bemf(recorder.hal);
+        run_hal(recorder, OFF_MS, true);
+        hal_motor_disarm_bemf(recorder.hal);
+    }
+    bemfCapture.moveEnded(RECORDED_ID, recorder.end >= 0);
+    bemfCapture.drain(Serial);
+    end = recorder.end;
+    return Serial.output();
+}
+
+// --- Capture frames ---
+
+// One move decoded from its frames, like Move in tools/bemf_capture.py
+struct Recording {
+    int turnout = -1;
+    StallDetectorParams params;
+    std::vector<int> values;    // |A - B| of every measurement
+    bool ended = false;
+    bool reached = false;
+    int decimation = 1;
+};
+
+static int u16(const uint8_t* p) {
+    return p[0] | p[1] << 8;
+}
+
+static int i16(const uint8_t* p) {
+    return (int16_t)u16(p);
+}
+
+// Decodes the capture frames in `stream`, the bytes around them are skipped.
+static std::vector<Recording> decode(const std::string& stream) {
+    const uint8_t* data = reinterpret_cast<const uint8_t*>(stream.data());
+    size_t size = stream.size();
+    std::vector<Recording> recordings;
+    size_t i = 0;
+    while (i < size) {
+        if (data[i] != BemfCapture::SYNC || i + 5 > size || i + 6 + data[i + 4] > size) {
+            i++;
+            continue;
+        }
+        const uint8_t* frame = data + i;
+        int length = frame[4];
+        uint8_t checksum = 0;
+        for (int k = 1; k < 5 + length; k++) {
+            checksum ^= frame[k];
+        }
+        if (checksum != frame[5 + length]) {
+            i++;
+            continue;
+        }
+        i += 6 + length;
+
+        const uint8_t* payload = frame + 5;
+        if (frame[1] == BEMF_CAPTURE_START) {
+            recordings.emplace_back();
+            Recording& recording = recordings.back();
+            recording.turnout = u16(frame + 2);
+            recording.decimation = payload[5];
+            recording.params.type = (StallDetectorType)payload[6];
+            recording.params.threshold = i16(payload + 7);
+            recording.params.stall_count = i16(payload + 9);
+            recording.params.ema_shift = payload[11];
+            recording.params.slope_limit = i16(payload + 12);
+            recording.params.cusum_drift = i16(payload + 14);
+            recording.params.cusum_limit = i16(payload + 16);
+        } else if (recordings.empty() || recordings.back().ended) {
+            continue;
+        } else if (frame[1] == BEMF_CAPTURE_SAMPLES) {
+            int a = u16(payload + 2);
+            int b = u16(payload + 4);
+            recordings.back().values.push_back(abs(a - b));
+            for (int k = 6; k + 1 < length; k += 2) {
+                a += (int8_t)payload[k];
+                b += (int8_t)payload[k + 1];
+                recordings.back().values.push_back(abs(a - b));
+            }
+        } else if (frame[1] == BEMF_CAPTURE_END) {
+            recordings.back().ended = true;
+            recordings.back().reached = payload[4] != 0;
+        }
+    }
+    return recordings;
+}
+
+// --- Replay ---
+
+// Index of the first measurement at which the detector reports the end, -1 if none
+static int replay(const std::vector<int>& values, const StallDetectorParams& params) {
+    BemfStallDetector detector(params);
+    for (size_t i = 0; i < values.size(); i++) {
+        if (detector.update(values[i])) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+struct Score {
+    int traces = 0;
+    int falsePositives = 0;     // Detected before the end
+    int missed = 0;             // Not detected at all
+    int latencySum = 0;         // Measurements from the end to the detection
+    int maxLatency = 0;
+
+    double meanLatency() const {
+        int detected = traces - falsePositives - missed;
+        return detected > 0 ? (double)latencySum / detected : 0;
+    }
+};
+
+static Score score(const std::vector<Trace>& traces, const StallDetectorParams& params) {
+    Score result;
+    for (const Trace& trace : traces) {
+        result.traces++;
+        int found = replay(trace.values, params);
+        if (found < 0) {
+            result.missed++;
+        } else if (found < trace.end) {
+            result.falsePositives++;
+        } else {
+            result.latencySum += found - trace.end;
+            result.maxLatency = found - trace.end > result.maxLatency ? found - trace.end : result.maxLatency;
+        }
+    }
+    return result;
+}
+
+// Upper bounds of a row, per detector type in the order of TYPES
+struct Bounds {
+    int falsePositives[4];
+    int missed[4];
+    int maxLatency[4];
+};
+
+static void print_header() {
+    printf("\n%-18s %-10s %6s %9s %6s %8s %7s\n", "traces", "detector", "count", "false_pos", "missed", "mean_lat",
+           "max_lat");
+}
+
+static void check(const char* name, const std::vector<Trace>& traces, const Bounds& bounds) {
+    for (int t = 0; t < 4; t++) {
+        StallDetectorParams params;
+        params.type = TYPES[t];
+        Score s = score(traces, params);
+        printf("%-18s %-10s %6d %9d %6d %8.1f %7d\n", name, TYPE_NAMES[t], s.traces, s.falsePositives, s.missed,
+               s.meanLatency(), s.maxLatency);
+        std::string message = std::string(name) + " " + TYPE_NAMES[t];
+        TEST_ASSERT_LESS_OR_EQUAL_MESSAGE(bounds.falsePositives[t], s.falsePositives, message.c_str());
+        TEST_ASSERT_LESS_OR_EQUAL_MESSAGE(bounds.missed[t], s.missed, message.c_str());
+        TEST_ASSERT_LESS_OR_EQUAL_MESSAGE(bounds.maxLatency[t], s.maxLatency, message.c_str());
+    }
+}
+
+static std::vector<Trace> synthetic(Trace (*generate)(), int count) {
+    seed = 1;
+    std::vector<Trace> traces;
+    for (int i = 0; i < count; i++) {
+        traces.push_back(generate());
+    }
+    return traces;
+}
+
+// Moves of one drive with pulses of 14, 16, .. ms, decoded from their capture frames
+static std::vector<Trace> recorded(const SimCoilParams& params, int count) {
+    std::vector<Trace> traces;
+    for (int i = 0; i < count; i++) {
+        Trace trace;
+        std::vector<Recording> recordings = decode(record_move(params, 14 + 2 * i, trace.end));
+        TEST_ASSERT_EQUAL_INT(1, (int)recordings.size());
+        TEST_ASSERT_TRUE(recordings[0].ended);
+        TEST_ASSERT_EQUAL_INT(RECORDED_ID, recordings[0].turnout);
+        trace.values = recordings[0].values;
+        TEST_ASSERT_GREATER_OR_EQUAL(0, trace.end);
+        traces.push_back(trace);
+    }
+    return traces;
+}
+
+void setUp() {}
+void tearDown() {}
+
+static void test_synthetic_traces() {
+    print_header();
+    check("clean", synthetic(clean_move, 50), {{0, 0, 0, 0}, {0, 0, 0, 0}, {6, 18, 20, 8}});
+    check("noisy", synthetic(noisy_move, 50), {{0, 0, 0, 0}, {0, 0, 0, 0}, {32, 25, 28, 32}});
+    // Every spike restarts the count of the threshold detector, it never sees the end.
+    check("spikes", synthetic(spiky_move, 50), {{0, 0, 0, 0}, {50, 0, 2, 0}, {60, 32, 60, 24}});
+    check("dropouts", synthetic(dropout_move, 50), {{0, 0, 0, 0}, {0, 0, 0, 0}, {6, 18, 20, 8}});
+    check("slowing", synthetic(slowing_move, 50), {{0, 0, 0, 0}, {0, 0, 0, 0}, {6, 14, 16, 8}});
+}
+
+static void test_recorded_traces() {
+    print_header();
+    // Pulses of 14-18 ms leave the drive short of the end stop, every detector takes
+    // the armature at rest for the end.
+    check("recorded", recorded(SimCoilParams(), 8), {{3, 3, 3, 3}, {0, 0, 0, 0}, {8, 20, 22, 8}});
+    SimCoilParams noisy;
+    noisy.noise = 60;
+    check("recorded noisy", recorded(noisy, 8), {{3, 3, 3, 3}, {0, 0, 0, 0}, {26, 28, 30, 40}});
+    // After its first pulse the sluggish drive coasts to a stop short of the end. The
+    // filtered detectors take that stop for the end, the noise keeps the raw ones
+    // counting until the second pulse.
+    SimCoilParams sluggish;
+    sluggish.travel_ms = 60;
+    sluggish.friction_tau_ms = 30;
+    sluggish.noise = 40;
+    check("recorded sluggish", recorded(sluggish, 8), {{0, 8, 8, 0}, {0, 0, 0, 0}, {10, 60, 60, 20}});
+}
+
+// Applies "name=value" pairs of BEMF_PARAMS to `params`.
+static void override_params(StallDetectorParams& params) {
+    const char* text = getenv("BEMF_PARAMS");
+    std::istringstream in(text ? text : "");
+    std::string pair;
+    while (in >> pair) {
+        size_t equals = pair.find('=');
+        TEST_ASSERT_TRUE_MESSAGE(equals != std::string::npos, "BEMF_PARAMS: name=value expected");
+        std::string name = pair.substr(0, equals);
+        int value = atoi(pair.c_str() + equals + 1);
+        if (name == "threshold") {
+            params.threshold = value;
+        } else if (name == "stall_count") {
+            params.stall_count = value;
+        } else if (name == "ema_shift") {
+            params.ema_shift = value;
+        } else if (name == "slope_limit") {
+            params.slope_limit = value;
+        } else if (name == "cusum_drift") {
+            params.cusum_drift = value;
+        } else if (name == "cusum_limit") {
+            params.cusum_limit = value;
+        } else {
+            TEST_FAIL_MESSAGE("BEMF_PARAMS: unknown parameter");
+        }
+    }
+}
+
+// Recordings from a layout: the end is not known, the table shows where each detector finds it.
+static void test_recordings_of_bemf_traces() {
+    const char* path = getenv("BEMF_TRACES");
+    if (path == nullptr) {
+        TEST_IGNORE_MESSAGE("BEMF_TRACES not set");
+    }
+    DIR* dir = opendir(path);
+    TEST_ASSERT_NOT_NULL_MESSAGE(dir, "BEMF_TRACES is no directory");
+    std::vector<std::string> names;
+    while (dirent* entry = readdir(dir)) {
+        std::string name = entry->d_name;
+        if (name.size() > 5 && name.compare(name.size() - 5, 5, ".bemf") == 0) {
+            names.push_back(name);
+        }
+    }
+    closedir(dir);
+    std::sort(names.begin(), names.end());
+
+    printf("\n%-24s %8s %8s %10s %6s %6s %6s\n", "file", "samples", "device", "threshold", "ema", "slope", "cusum");
+    for (const std::string& name : names) {
+        std::ifstream file(std::string(path) + "/" + name, std::ios::binary);
+        std::string stream((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        for (const Recording& recording : decode(stream)) {
+            printf("%-24s %8d %8s", name.c_str(), (int)recording.values.size(),
+                   !recording.ended ? "-" : recording.reached ? "reached" : "timeout");
+            for (StallDetectorType type : TYPES) {
+                StallDetectorParams params = recording.params;
+                override_params(params);
+                params.type = type;
+                printf(" %*d", type == STALL_DETECTOR_THRESHOLD ? 10 : 6, replay(recording.values, params));
+            }
+            printf(recording.decimation > 1 ? "  (decimated)\n" : "\n");
+        }
+    }
+}
+
+int main(int, char**) {
+    UNITY_BEGIN();
+    RUN_TEST(test_synthetic_traces);
+    RUN_TEST(test_recorded_traces);
+    RUN_TEST(test_recordings_of_bemf_traces);
+    return UNITY_END();
+}
@@ -0,0 +1,311 @@
+// TurnoutStateJournal on the flash mock: positions survive a reset, writes
+// are batched, the sectors wear evenly, and a power cut at any byte of a
+// write leaves a journal that replays either the old or the new positions.
+#include <unity.h>
+#include <memory>
+#include <vector>
+#include "sim_flash.h"
+#include "turnout_state_journal.h"
+#include "turnout_sim.h"
+#include "sim_models.h"
+
+// The journal only reads the confirmed positions; these turnouts are never thrown
+// and share one drive.
+static const BEMF_Config DRIVE = {0, 1, 26, 27};
+
+static const int TURNOUTS = 16;
+static const int SECTORS = 4;
+static const uint32_t HEADER_BYTES = 12;
+static const uint32_t RECORD_BYTES = 4;
+
+// The board after a reset: turnouts registered, journal replayed, turnouts started.
+struct Board {
+    TurnoutManager manager;
+    TurnoutStateJournal journal;
+    std::vector<std::unique_ptr<BemfTurnout>> turnouts;
+    bool journalStarted;
+
+    Board() {
+        TurnoutSim::reset();
+        for (int i = 0; i < TURNOUTS; i++) {
+            turnouts.emplace_back(new BemfTurnout(100 + i, "W", BemfCoilMotor(DRIVE)));
+            manager.add(*turnouts.back());
+        }
+        journalStarted = journal.begin(manager);
+        manager.begin();
+    }
+
+    void set(const std::vector<int>& positions) {
+        for (int i = 0; i < TURNOUTS; i++) {
+            turnouts[i]->restorePosition(positions[i]);
+        }
+    }
+
+    std::vector<int> positions() const {
+        std::vector<int> result;
+        for (const auto& turnout : turnouts) {
+            result.push_back(turnout->getPosition());
+        }
+        return result;
+    }
+
+    // Lets the write interval pass, then gives the journal a chance to write.
+    void write() {
+        sim_advance_us((TURNOUT_JOURNAL_WRITE_INTERVAL_MS + 1) * 1000ull);
+        journal.update(manager);
+    }
+};
+
+static std::vector<int> pattern(int n) {
+    std::vector<int> positions;
+    for (int i = 0; i < TURNOUTS; i++) {
+        positions.push_back((i * 7 + n * 3) % 5 < 2 ? 1 : 2);
+    }
+    return positions;
+}
+
+// Positions after a reset
+static std::vector<int> replayed() {
+    Board board;
+    TEST_ASSERT_TRUE(board.journalStarted);
+    return board.positions();
+}
+
+static uint32_t total_erases() {
+    uint32_t erases = 0;
+    for (int sector = 0; sector < SECTORS; sector++) {
+        erases += sim_flash_erase_count(sector);
+    }
+    return erases;
+}
+
+void setUp() {
+    sim_flash_format(SECTORS * SIM_FLASH_SECTOR_SIZE);
+}
+
+void tearDown() {}
+
+static void test_positions_survive_reset() {
+    TEST_ASSERT_TRUE(replayed() == std::vector<int>(TURNOUTS, 0));
+    {
+        Board board;
+        board.set(pattern(1));
+        board.write();
+    }
+    TEST_ASSERT_TRUE(replayed() == pattern(1));
+    {
+        Board board;
+        board.set(pattern(2));
+        board.write();
+        board.set(pattern(3));
+        board.write();
+    }
+    TEST_ASSERT_TRUE(replayed() == pattern(3));
+}
+
+static void test_no_area_no_journal() {
+    sim_flash_format(SIM_FLASH_SECTOR_SIZE); // Needs at least two sectors
+    Board board;
+    TEST_ASSERT_FALSE(board.journalStarted);
+    board.set(pattern(1));
+    board.write();
+    TEST_ASSERT_EQUAL_UINT32(0, sim_flash_bytes_written());
+}
+
+static void test_changes_are_batched() {
+    Board board;
+    board.set(pattern(1));
+    board.write();
+    uint32_t written = sim_flash_bytes_written();
+
+    // Two changes within the interval go into one write of their two records.
+    std::vector<int> positions = pattern(1);
+    positions[3] = 3 - positions[3];
+    board.set(positions);
+    sim_advance_us(100000);
+    board.journal.update(board.manager);
+    positions[9] = 3 - positions[9];
+    board.set(positions);
+    sim_advance_us(500000);
+    board.journal.update(board.manager);
+    TEST_ASSERT_EQUAL_UINT32(written, sim_flash_bytes_written());
+
+    board.write();
+    TEST_ASSERT_EQUAL_UINT32(written + 2 * RECORD_BYTES, sim_flash_bytes_written());
+    // Nothing changed, nothing is written.
+    board.write();
+    TEST_ASSERT_EQUAL_UINT32(written + 2 * RECORD_BYTES, sim_flash_bytes_written());
+}
+
+static void test_sectors_wear_evenly() {
+    Board board;
+    // Every write changes all turnouts; three times round the ring.
+    int writes = 3 * SECTORS * (SIM_FLASH_SECTOR_SIZE / (TURNOUTS * RECORD_BYTES));
+    for (int n = 0; n < writes; n++) {
+        board.set(pattern(n % 2));
+        board.write();
+    }
+    uint32_t least = sim_flash_erase_count(0);
+    uint32_t most = least;
+    for (int sector = 1; sector < SECTORS; sector++) {
+        least = sim_flash_erase_count(sector) < least ? sim_flash_erase_count(sector) : least;
+        most = sim_flash_erase_count(sector) > most ? sim_flash_erase_count(sector) : most;
+    }
+    TEST_ASSERT_GREATER_OR_EQUAL(2, least);
+    TEST_ASSERT_LESS_OR_EQUAL(least + 1, most);
+    TEST_ASSERT_TRUE(replayed() == pattern((writes - 1) % 2));
+}
+
+// A power cut after every single byte of a write of records
+static void test_power_cut_while_appending() {
+    std::vector<int> before = pattern(1);
+    {
+        Board board;
+        board.set(before);
+        board.write();
+    }
+    std::vector<uint8_t> image = sim_flash_save();
+    std::vector<int> after = pattern(2);
+    std::vector<int> changed;
+    for (int i = 0; i < TURNOUTS; i++) {
+        if (after[i] != before[i]) {
+            changed.push_back(i);
+        }
+    }
+    TEST_ASSERT_GREATER_OR_EQUAL(3, (int)changed.size());
+
+    for (uint32_t cut = 0; cut <= changed.size() * RECORD_BYTES; cut++) {
+        sim_flash_load(image);
+        {
+            Board board;
+            board.set(after);
+            sim_flash_cut_power_after(cut);
+            board.write();
+        }
+        sim_flash_power_on();
+
+        // The records are written in slot order: complete ones count, a torn one is skipped.
+        std::vector<int> expected = before;
+        for (uint32_t record = 0; record < cut / RECORD_BYTES; record++) {
+            expected[changed[record]] = after[changed[record]];
+        }
+        TEST_ASSERT_TRUE_MESSAGE(replayed() == expected, "replay after a cut");
+
+        // The journal goes on behind the torn record.
+        {
+            Board board;
+            board.set(pattern(3));
+            board.write();
+        }
+        TEST_ASSERT_TRUE_MESSAGE(replayed() == pattern(3), "write after a cut");
+    }
+}
+
+// A power cut at many points of starting a new sector: erase, snapshot, header
+static void test_power_cut_while_starting_a_sector() {
+    std::vector<uint8_t> image;
+    int n = 0;
+    {
+        // Fill the first sector until the next write starts a new one.
+        Board board;
+        uint32_t erases = 0;
+        while (true) {
+            image = sim_flash_save();
+            erases = total_erases();
+            board.set(pattern(n % 2));
+            board.write();
+            if (n > 0 && total_erases() > erases) {
+                break;
+            }
+            n++;
+        }
+    }
+    std::vector<int> before = pattern((n + 1) % 2);
+    std::vector<int> after = pattern(n % 2);
+    uint32_t snapshot = SIM_FLASH_SECTOR_SIZE + TURNOUTS * RECORD_BYTES;
+    uint32_t total = snapshot + HEADER_BYTES;
+
+    for (uint32_t cut = 0; cut <= total; cut += cut < 64 || cut > total - 64 ? 1 : 61) {
+        sim_flash_load(image);
+        {
+            Board board;
+            TEST_ASSERT_TRUE(board.positions() == before);
+            board.set(after);
+            sim_flash_cut_power_after(cut);
+            board.write();
+        }
+        sim_flash_power_on();
+
+        // Never a mix. The new sector counts once its header checks, which the trailing
+        // 0xFF bytes of the check word may do a little early, but never before the snapshot
+        // and the sequence number are complete.
+        std::vector<int> positions = replayed();
+        TEST_ASSERT_TRUE_MESSAGE(positions == before || positions == after, "replay after a cut");
+        if (cut < snapshot + 8) {
+            TEST_ASSERT_TRUE_MESSAGE(positions == before, "new sector before its header");
+        }
+        if (cut >= total) {
+            TEST_ASSERT_TRUE_MESSAGE(positions == after, "new sector after its header");
+        }
+
+        {
+            Board board;
+            board.set(pattern(3));
+            board.write();
+        }
+        TEST_ASSERT_TRUE_MESSAGE(replayed() == pattern(3), "write after a cut");
+    }
+}
+
+// A BEMF turnout knows its position only from the journal: after a reset it is
+// at its position right away, and a command to it does not pulse the coil.
+static void test_boot_does_not_rethrow() {
+    SimCoilDrive drive(0, 1);
+    drive.attachBemf(26, 27);
+    BEMF_Config config = {0, 1, 26, 27};
+    {
+        TurnoutSim::reset();
+        sim_add_device(drive);
+        BemfTurnout turnout(1, "bemf", BemfCoilMotor(config));
+        TurnoutManager manager;
+        manager.add(turnout);
+        TurnoutStateJournal journal;
+        journal.begin(manager);
+        TurnoutSim sim(manager);
+        sim.begin();
+        turnout.setPosition(2, millis());
+        TEST_ASSERT_TRUE(sim.runUntilIdle());
+        TEST_ASSERT_EQUAL_INT(2, turnout.getPosition());
+        sim.run(TURNOUT_JOURNAL_WRITE_INTERVAL_MS + 1);
+        journal.update(manager);
+    }
+
+    TurnoutSim::reset();
+    sim_add_device(drive);
+    drive.place(drive.travel());
+    BemfTurnout turnout(1, "bemf", BemfCoilMotor(config));
+    TurnoutManager manager;
+    manager.add(turnout);
+    TurnoutStateJournal journal;
+    journal.begin(manager);
+    TurnoutSim sim(manager);
+    sim.begin();
+    TEST_ASSERT_EQUAL_INT(2, turnout.getPosition());
+    turnout.setPosition(2, millis());
+    TEST_ASSERT_TRUE(sim.runUntilIdle());
+    sim.run(100);
+    TEST_ASSERT_EQUAL_UINT32(0, drive.pulses());
+    TEST_ASSERT_EQUAL_INT(2, turnout.getPosition());
+}
+
+int main(int, char**) {
+    UNITY_BEGIN();
+    RUN_TEST(test_positions_survive_reset);
+    RUN_TEST(test_no_area_no_journal);
+    RUN_TEST(test_changes_are_batched);
+    RUN_TEST(test_sectors_wear_evenly);
+    RUN_TEST(test_power_cut_while_appending);
+    RUN_TEST(test_power_cut_while_starting_a_sector);
+    RUN_TEST(test_boot_does_not_rethrow);
+    return UNITY_END();
+}
@@ -0,0 +1,241 @@
+#!/usr/bin/env python3
+"""Records and shows the BEMF capture of xDuinoRails_Turnouts (see bemf_capture.h).
+
+Usage:
+    bemf_capture.py record /dev/ttyACM0 [-o DIR]    # live, requires pyserial
+    bemf_capture.py record capture.bin [-o DIR]     # recorded serial output
+    bemf_capture.py show DIR/*.bemf [--csv]
+
+Send 'c' to the decoder to switch the capture on. `record` writes every captured
+move into a file of its own and decodes the event log and the text that share
+the serial link. `show` summarizes recorded moves, or prints every measurement
+as CSV for plotting.
+
+The recordings are replayed through BemfStallDetector itself, compiled for the
+host, by the native test test/test_stall_detector:
+    BEMF_TRACES=DIR BEMF_PARAMS="threshold=12" pio test -e native -f test_stall_detector -v
+"""
+
+import argparse
+import csv
+import os
+import sys
+
+from decode_event_log import Decoder as EventDecoder
+
+SYNC = 0xB5
+HEADER_SIZE = 5
+
+# Keep in sync with BemfCaptureFrame in bemf_capture.h
+FRAME_START = 1
+FRAME_SAMPLES = 2
+FRAME_PULSE = 3
+FRAME_END = 4
+
+# Keep in sync with StallDetectorType in bemf_stall_detector.h
+DETECTORS = ["threshold", "ema", "slope", "cusum"]
+
+
+def s8(value):
+    return value - 256 if value > 127 else value
+
+
+def u16(data, offset):
+    return int.from_bytes(data[offset:offset + 2], "little")
+
+
+def i16(data, offset):
+    return int.from_bytes(data[offset:offset + 2], "little", signed=True)
+
+
+def u32(data, offset):
+    return int.from_bytes(data[offset:offset + 4], "little")
+
+
+class FrameParser:
+    """Splits a byte stream into capture frames and everything else."""
+
+    def __init__(self, on_frame, on_other):
+        self.on_frame = on_frame
+        self.on_other = on_other
+        self.buffer = bytearray()
+
+    def feed(self, data):
+        self.buffer += data
+        while self.buffer:
+            if self.buffer[0] != SYNC:
+                self.pass_through()
+                continue
+            if len(self.buffer) < HEADER_SIZE:
+                return
+            size = HEADER_SIZE + self.buffer[HEADER_SIZE - 1] + 1
+            if len(self.buffer) < size:
+                return
+            frame = bytes(self.buffer[:size])
+            checksum = 0
+            for b in frame[1:size - 1]:
+                checksum ^= b
+            if checksum != frame[size - 1]:
+                # Not a frame, resynchronize on the next byte.
+                self.pass_through()
+                continue
+            del self.buffer[:size]
+            self.on_frame(frame)
+
+    def pass_through(self):
+        self.on_other(bytes(self.buffer[:1]))
+        del self.buffer[:1]
+
+
+class Move:
+    """One captured move, decoded from its frames."""
+
+    def __init__(self):
+        self.turnout = None
+        self.position = 0
+        self.decimation = 1
+        self.params = None
+        self.samples = []    # (index, pulse, a, b)
+        self.pulses = []     # (first sample index, on time in ms)
+        self.reached = None
+        self.missing = 0     # Samples lost in dropped frames
+        self.dropped = 0
+        self.start_us = 0
+        self.end_us = 0
+
+    def add(self, frame):
+        kind, turnout, payload = frame[1], int.from_bytes(frame[2:4], "little"), frame[HEADER_SIZE:-1]
+        if kind == FRAME_START:
+            self.turnout = turnout
+            self.start_us = u32(payload, 0)
+            self.position = payload[4]
+            self.decimation = payload[5]
+            self.params = {
+                "type": DETECTORS[payload[6]] if payload[6] < len(DETECTORS) else "threshold",
+                "threshold": i16(payload, 7),
+                "stall_count": i16(payload, 9),
+                "ema_shift": payload[11],
+                "slope_limit": i16(payload, 12),
+                "cusum_drift": i16(payload, 14),
+                "cusum_limit": i16(payload, 16),
+            }
+        elif kind == FRAME_PULSE:
+            self.pulses.append((len(self.samples) + self.missing, u16(payload, 5)))
+        elif kind == FRAME_SAMPLES:
+            index = u16(payload, 0)
+            self.missing = index - len(self.samples)
+            a, b = u16(payload, 2), u16(payload, 4)
+            pulse = len(self.pulses)
+            self.samples.append((index, pulse, a, b))
+            for offset in range(6, len(payload), 2):
+                index += 1
+                a += s8(payload[offset])
+                b += s8(payload[offset + 1])
+                self.samples.append((index, pulse, a, b))
+        elif kind == FRAME_END:
+            self.end_us = u32(payload, 0)
+            self.reached = bool(payload[4])
+            self.missing = u16(payload, 5) - len(self.samples)
+            self.dropped = u16(payload, 7)
+
+
+def record(args):
+    os.makedirs(args.output, exist_ok=True)
+    events = EventDecoder({})
+    state = {"count": 0, "frames": None}
+
+    def on_frame(frame):
+        if frame[1] == FRAME_START:
+            state["frames"] = [frame]
+        elif state["frames"] is not None:
+            state["frames"].append(frame)
+            if frame[1] == FRAME_END:
+                state["count"] += 1
+                name = os.path.join(args.output, "move_%03d_t%d.bemf" % (state["count"], int.from_bytes(frame[2:4], "little")))
+                with open(name, "wb") as f:
+                    f.write(b"".join(state["frames"]))
+                state["frames"] = None
+                events.flush_text()
+                print("Aufzeichnung gespeichert: %s" % name)
+                sys.stdout.flush()
+
+    parser = FrameParser(on_frame, events.feed)
+    stream = open_source(args.source, args.baud)
+    try:
+        while True:
+            data = stream.read(256)
+            if data is None:
+                continue
+            if not data:
+                if hasattr(stream, "in_waiting"):
+                    continue  # Serial read timeout
+                break
+            parser.feed(data)
+    except KeyboardInterrupt:
+        pass
+    events.flush_text()
+
+
+def show(args):
+    writer = csv.writer(sys.stdout) if args.csv else None
+    if writer:
+        writer.writerow(["file", "index", "pulse", "a", "b", "diff"])
+    for name in args.files:
+        move = Move()
+        with open(name, "rb") as f:
+            FrameParser(move.add, lambda data: None).feed(f.read())
+        if move.params is None:
+            print("%s: keine Aufzeichnung" % name, file=sys.stderr)
+            continue
+        if writer:
+            for index, pulse, a, b in move.samples:
+                writer.writerow([name, index, pulse, a, b, abs(a - b)])
+            continue
+
+        print("%s: Weiche %d -> Position %d, %d Pulse, %d Messwerte, %.1f ms" % (
+            name, move.turnout, move.position, len(move.pulses), len(move.samples),
+            ((move.end_us - move.start_us) & 0xFFFFFFFF) / 1000.0))
+        print("  Geraet: %s, Detektor %s" % ("Endlage erkannt" if move.reached else "Timeout",
+                                            format_params(move.params)))
+        if move.decimation > 1:
+            print("  Hinweis: nur jeder %d. Messwert aufgezeichnet" % move.decimation)
+        if move.dropped or move.missing:
+            print("  Hinweis: %d Frames verloren, %d Messwerte fehlen" % (move.dropped, move.missing))
+
+
+def format_params(params):
+    return "%s threshold=%d stall_count=%d ema_shift=%d slope_limit=%d cusum_drift=%d cusum_limit=%d" % (
+        params["type"], params["threshold"], params["stall_count"], params["ema_shift"],
+        params["slope_limit"], params["cusum_drift"], params["cusum_limit"])
+
+
+def open_source(source, baud):
+    if source == "-":
+        return sys.stdin.buffer
+    if os.path.isfile(source):
+        return open(source, "rb")
+    import serial
+    return serial.Serial(source, baud, timeout=0.1)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    commands = parser.add_subparsers(dest="command", required=True)
+
+    rec = commands.add_parser("record", help="write every captured move to a file")
+    rec.add_argument("source", help="serial port, file, or - for stdin")
+    rec.add_argument("--baud", type=int, default=115200)
+    rec.add_argument("-o", "--output", default=".", help="directory of the recordings")
+    rec.set_defaults(run=record)
+
+    show_cmd = commands.add_parser("show", help="summarize recorded moves or print their measurements")
+    show_cmd.add_argument("files", nargs="+")
+    show_cmd.add_argument("--csv", action="store_true", help="print every measurement as CSV")
+    show_cmd.set_defaults(run=show)
+
+    args = parser.parse_args()
+    args.run(args)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,143 @@
+#!/usr/bin/env python3
+"""Decodes the binary event log of xDuinoRails_Turnouts (see event_log.h).
+
+Usage:
+    decode_event_log.py /dev/ttyACM0 [--baud 115200]   # live, requires pyserial
+    decode_event_log.py capture.bin                     # recorded output
+    decode_event_log.py - < capture.bin                 # stdin
+
+Bytes outside of valid records (e.g. the startup banner) are printed as text.
+Frames of the BEMF capture (see bemf_capture.py) are skipped.
+"""
+
+import argparse
+import os
+import sys
+
+SYNC = 0xA5
+RECORD_SIZE = 13
+CAPTURE_SYNC = 0xB5  # BemfCapture::SYNC, frames of variable length
+
+# Keep in sync with EventLogId in event_log.h
+EVENTS = {
+    1: lambda t, a0, a1: "Log-Puffer voll, verlorene Eintraege: %d" % (a0 | (a1 << 16)),
+    2: lambda t, a0, a1: "Bewegung gestartet: %s -> Position %d" % (t, a0),
+    3: lambda t, a0, a1: "Position %d erreicht: %s (%d ms)" % (a0, t, a1),
+    4: lambda t, a0, a1: "Timeout: %s (Position %d)" % (t, a0),
+    5: lambda t, a0, a1: "BEMF-Initialisierung fehlgeschlagen: %s" % t,
+    6: lambda t, a0, a1: "DCC Command - Addr: %d, Dir: %d, Power: %d" % (a0, a1 & 0xFF, a1 >> 8),
+    7: lambda t, a0, a1: "Fahrstrasse gestellt: %d Weichen, %d Timeouts" % (a0, a1),
+    8: lambda t, a0, a1: "Servo-Initialisierung fehlgeschlagen: %s" % t,
+    9: lambda t, a0, a1: "Strommessung-Initialisierung fehlgeschlagen: %s" % t,
+}
+
+
+class Decoder:
+    def __init__(self, names):
+        self.names = names
+        self.buffer = bytearray()
+        self.text = bytearray()
+        self.last_timestamp = None
+        self.epoch = 0  # Accumulated micros() wrap-arounds
+
+    def feed(self, data):
+        self.buffer += data
+        while self.buffer:
+            if self.buffer[0] == CAPTURE_SYNC:
+                if len(self.buffer) < 5 or len(self.buffer) < self.buffer[4] + 6:
+                    return
+                size = self.buffer[4] + 6
+                checksum = 0
+                for b in self.buffer[1:size - 1]:
+                    checksum ^= b
+                if checksum == self.buffer[size - 1]:
+                    del self.buffer[:size]
+                    continue
+            if self.buffer[0] != SYNC:
+                self.text.append(self.buffer.pop(0))
+                if self.text.endswith(b"\n"):
+                    self.flush_text()
+                continue
+            if len(self.buffer) < RECORD_SIZE:
+                return
+            record = self.buffer[:RECORD_SIZE]
+            checksum = 0
+            for b in record[1:RECORD_SIZE - 1]:
+                checksum ^= b
+            if checksum != record[RECORD_SIZE - 1]:
+                # Not a record, resynchronize on the next byte.
+                self.text.append(self.buffer.pop(0))
+                continue
+            del self.buffer[:RECORD_SIZE]
+            self.flush_text()
+            self.print_record(record)
+
+    def flush_text(self):
+        if self.text:
+            sys.stdout.write(self.text.decode("utf-8", "replace"))
+            if not self.text.endswith(b"\n"):
+                sys.stdout.write("\n")
+            self.text.clear()
+
+    def print_record(self, record):
+        event = record[1]
+        turnout_id = int.from_bytes(record[2:4], "little")
+        timestamp = int.from_bytes(record[4:8], "little")
+        arg0 = int.from_bytes(record[8:10], "little")
+        arg1 = int.from_bytes(record[10:12], "little")
+
+        if self.last_timestamp is not None and timestamp < self.last_timestamp:
+            self.epoch += 1 << 32
+        self.last_timestamp = timestamp
+        seconds = (self.epoch + timestamp) / 1e6
+
+        turnout = self.names.get(turnout_id, "Weiche %d" % turnout_id)
+        formatter = EVENTS.get(event)
+        if formatter:
+            message = formatter(turnout, arg0, arg1)
+        else:
+            message = "Unbekanntes Ereignis %d: %s, %d, %d" % (event, turnout, arg0, arg1)
+        print("[%12.6f] %s" % (seconds, message))
+        sys.stdout.flush()
+
+
+def parse_name(value):
+    turnout_id, _, name = value.partition("=")
+    return int(turnout_id), name
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("source", help="serial port, file, or - for stdin")
+    parser.add_argument("--baud", type=int, default=115200)
+    parser.add_argument("--name", type=parse_name, action="append", default=[],
+                        metavar="ID=NAME", help="show NAME instead of the turnout id")
+    args = parser.parse_args()
+
+    decoder = Decoder(dict(args.name))
+
+    if args.source == "-":
+        stream = sys.stdin.buffer
+    elif os.path.isfile(args.source):
+        stream = open(args.source, "rb")
+    else:
+        import serial
+        stream = serial.Serial(args.source, args.baud, timeout=0.1)
+
+    try:
+        while True:
+            data = stream.read(256)
+            if data is None:
+                continue
+            if not data:
+                if hasattr(stream, "in_waiting"):
+                    continue  # Serial read timeout
+                break
+            decoder.feed(data)
+    except KeyboardInterrupt:
+        pass
+    decoder.flush_text()
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,297 @@
+#!/usr/bin/env python3
+"""Sets and queries the turnouts of xDuinoRails_Turnouts over the binary protocol (see host_link.h).
+
+Usage:
+    turnout_link.py /dev/ttyACM0 set 1=2 2=1 7=2    # turnout id=position, requires pyserial
+    turnout_link.py /dev/ttyACM0 status [ID ...]
+    turnout_link.py /dev/ttyACM0 monitor
+
+`set` and `status` repeat a command whose reply does not arrive in time.
+`monitor` subscribes to the change events and prints every change until
+Ctrl-C. The event log and the text that share the serial link are decoded
+and printed in between.
+"""
+
+import argparse
+import binascii
+import sys
+import time
+
+from decode_event_log import Decoder as EventDecoder
+from decode_event_log import RECORD_SIZE, SYNC as EVENT_SYNC, CAPTURE_SYNC
+
+# Keep in sync with HostLinkFrame in host_link.h
+SET_POSITIONS = 0x01
+GET_STATUS = 0x02
+SUBSCRIBE = 0x03
+EVENT = 0x84
+ERROR = 0xFF
+REPLY = 0x80
+
+# Keep in sync with HostLinkError in host_link.h
+ERRORS = {1: "unbekannter Befehl", 2: "falsche Laenge"}
+
+STATUS_SIZE = 5
+MAX_ENCODED = 2048  # Longer frames are garbage, resynchronize
+
+
+def crc16(data):
+    """CRC-16/CCITT-FALSE"""
+    return binascii.crc_hqx(data, 0xFFFF)
+
+
+def cobs_encode(data):
+    out = bytearray()
+    block = bytearray()
+    for b in data:
+        if b == 0:
+            out.append(len(block) + 1)
+            out += block
+            block.clear()
+            continue
+        block.append(b)
+        if len(block) == 254:
+            out.append(255)
+            out += block
+            block.clear()
+    out.append(len(block) + 1)
+    out += block
+    return bytes(out)
+
+
+def cobs_decode(data):
+    out = bytearray()
+    i = 0
+    while i < len(data):
+        code = data[i]
+        if code == 0 or i + code > len(data):
+            return None
+        out += data[i + 1:i + code]
+        i += code
+        if code != 255 and i < len(data):
+            out.append(0)
+    return bytes(out)
+
+
+def make_frame(kind, sequence, payload):
+    body = bytes([kind, sequence]) + bytes(payload)
+    body += crc16(body).to_bytes(2, "little")
+    return b"\x00" + cobs_encode(body) + b"\x00"
+
+
+class FrameParser:
+    """Splits a byte stream into protocol frames and everything else.
+
+    Event log records and BEMF capture frames may contain 0x00 bytes, so they
+    are recognized and passed on as a whole before a 0x00 is taken as the
+    start of a frame."""
+
+    def __init__(self, on_frame, on_other):
+        self.on_frame = on_frame
+        self.on_other = on_other
+        self.buffer = bytearray()
+        self.in_frame = False
+        self.errors = 0
+
+    def feed(self, data):
+        self.buffer += data
+        while self.buffer:
+            if self.in_frame:
+                end = self.buffer.find(0)
+                if end < 0:
+                    if len(self.buffer) > MAX_ENCODED:
+                        self.in_frame = False
+                        self.errors += 1
+                        continue
+                    return
+                encoded = bytes(self.buffer[:end])
+                del self.buffer[:end + 1]
+                if not encoded:
+                    continue  # Leading delimiter of the next frame
+                self.in_frame = False
+                self.decode(encoded)
+                continue
+            first = self.buffer[0]
+            if first == 0:
+                del self.buffer[:1]
+                self.in_frame = True
+                continue
+            size = self.record_size()
+            if size is None:
+                return  # Wait for the rest of the record
+            self.on_other(bytes(self.buffer[:size]))
+            del self.buffer[:size]
+
+    def record_size(self):
+        """Size of the event log record or capture frame at the start of the buffer, 1 otherwise"""
+        first = self.buffer[0]
+        if first == EVENT_SYNC:
+            size = RECORD_SIZE
+        elif first == CAPTURE_SYNC:
+            if len(self.buffer) < 5:
+                return None
+            size = self.buffer[4] + 6
+        else:
+            return 1
+        if len(self.buffer) < size:
+            return None
+        checksum = 0
+        for b in self.buffer[1:size - 1]:
+            checksum ^= b
+        return size if checksum == self.buffer[size - 1] else 1
+
+    def decode(self, encoded):
+        body = cobs_decode(encoded)
+        if body is None or len(body) < 4 or crc16(body[:-2]) != int.from_bytes(body[-2:], "little"):
+            self.errors += 1
+            return
+        self.on_frame(body[0], body[1], body[2:-2])
+
+
+class Link:
+    def __init__(self, stream, timeout, retries):
+        self.stream = stream
+        self.timeout = timeout
+        self.retries = retries
+        self.sequence = 0
+        self.events = EventDecoder({})
+        self.frames = []
+        self.on_event = None  # Called with sequence and payload of EVENT frames
+        self.parser = FrameParser(lambda *frame: self.frames.append(frame), self.events.feed)
+
+    def poll(self):
+        data = self.stream.read(256)
+        if data:
+            self.parser.feed(data)
+
+    def request(self, kind, payload):
+        """Sends a command and returns the payload of its reply."""
+        self.sequence = (self.sequence + 1) & 0xFF
+        frame = make_frame(kind, self.sequence, payload)
+        for _ in range(self.retries + 1):
+            self.stream.write(frame)
+            deadline = time.monotonic() + self.timeout
+            while time.monotonic() < deadline:
+                self.poll()
+                while self.frames:
+                    reply_kind, sequence, reply = self.frames.pop(0)
+                    if reply_kind == EVENT:
+                        if self.on_event:
+                            self.on_event(sequence, reply)
+                    elif sequence != self.sequence:
+                        continue  # Late reply to an earlier attempt
+                    elif reply_kind == ERROR:
+                        raise RuntimeError("Befehl 0x%02x abgelehnt: %s" % (
+                            reply[0], ERRORS.get(reply[1], "Fehler %d" % reply[1])))
+                    elif reply_kind == kind | REPLY:
+                        return reply
+        raise RuntimeError("Keine Antwort auf Befehl 0x%02x" % kind)
+
+
+def status_records(payload):
+    for offset in range(0, len(payload) - STATUS_SIZE + 1, STATUS_SIZE):
+        turnout = int.from_bytes(payload[offset:offset + 2], "little")
+        state = payload[offset + 2]
+        move_ms = int.from_bytes(payload[offset + 3:offset + 5], "little")
+        yield turnout, state, move_ms
+
+
+def format_status(turnout, state, move_ms):
+    position = state & 0x03
+    target = (state >> 2) & 0x03
+    text = "Weiche %d: Position %s, Ziel %s" % (
+        turnout, position if position else "unbekannt", target if target else "-")
+    if state & 0x10:
+        text += ", faehrt"
+    if state & 0x20:
+        text += ", Timeout"
+    if move_ms:
+        text += ", letzte Bewegung %d ms" % move_ms
+    return text
+
+
+def parse_setting(value):
+    turnout_id, _, position = value.partition("=")
+    return int(turnout_id), int(position)
+
+
+def set_positions(link, args):
+    payload = bytearray()
+    for turnout, position in args.settings:
+        payload += turnout.to_bytes(2, "little") + bytes([position])
+    reply = link.request(SET_POSITIONS, payload)
+    link.events.flush_text()
+    print("Angenommen: %d, abgelehnt: %d" % (reply[0], reply[1]))
+
+
+def status(link, args):
+    reply = link.request(GET_STATUS, b"".join(turnout.to_bytes(2, "little") for turnout in args.ids))
+    link.events.flush_text()
+    for record in status_records(reply):
+        print(format_status(*record))
+    if args.ids and len(reply) // STATUS_SIZE < len(args.ids):
+        print("Hinweis: %d Weichen unbekannt" % (len(args.ids) - len(reply) // STATUS_SIZE))
+
+
+def monitor(link, args):
+    expected = [None]
+
+    def on_event(sequence, payload):
+        link.events.flush_text()
+        if expected[0] is not None and sequence != expected[0]:
+            print("Hinweis: %d Ereignisse verloren" % ((sequence - expected[0]) & 0xFF))
+        expected[0] = (sequence + 1) & 0xFF
+        stamp = time.strftime("%H:%M:%S")
+        for record in status_records(payload):
+            print("[%s] %s" % (stamp, format_status(*record)))
+        sys.stdout.flush()
+
+    link.on_event = on_event
+    link.request(SUBSCRIBE, b"\x01")
+    try:
+        while True:
+            link.poll()
+            while link.frames:
+                kind, sequence, payload = link.frames.pop(0)
+                if kind == EVENT:
+                    on_event(sequence, payload)
+    except KeyboardInterrupt:
+        pass
+    link.request(SUBSCRIBE, b"\x00")
+    link.events.flush_text()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("port", help="serial port of the decoder")
+    parser.add_argument("--baud", type=int, default=115200)
+    parser.add_argument("--timeout", type=float, default=0.5, help="seconds to wait for a reply")
+    parser.add_argument("--retries", type=int, default=3)
+    commands = parser.add_subparsers(dest="command", required=True)
+
+    cmd = commands.add_parser("set", help="set the positions of several turnouts at once")
+    cmd.add_argument("settings", nargs="+", type=parse_setting, metavar="ID=POSITION")
+    cmd.set_defaults(run=set_positions)
+
+    cmd = commands.add_parser("status", help="show the state of all or some turnouts")
+    cmd.add_argument("ids", nargs="*", type=int)
+    cmd.set_defaults(run=status)
+
+    cmd = commands.add_parser("monitor", help="show every change until Ctrl-C")
+    cmd.set_defaults(run=monitor)
+
+    args = parser.parse_args()
+
+    import serial
+    stream = serial.Serial(args.port, args.baud, timeout=0.05)
+    link = Link(stream, args.timeout, args.retries)
+    try:
+        args.run(link, args)
+    except RuntimeError as error:
+        link.events.flush_text()
+        print(error, file=sys.stderr)
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()